@@ -0,0 +1,299 @@
+﻿#include "bit_packing.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#if !defined(SEARCH_SERVER_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define BIT_PACKING_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace bit_packing {
+
+namespace {
+
+constexpr size_t VALUES_PER_LANE = BLOCK_SIZE / LANE_COUNT;
+
+uint32_t Mask(uint32_t bit_width) {
+  return bit_width >= 32 ? ~0u : (1u << bit_width) - 1;
+}
+
+void UnpackScalar(const uint32_t* in, uint32_t bit_width, uint32_t* out) {
+  if (bit_width == 0) {
+    std::fill(out, out + BLOCK_SIZE, 0u);
+    return;
+  }
+  const uint32_t mask = Mask(bit_width);
+  for (size_t j = 0; j < VALUES_PER_LANE; ++j) {
+    const size_t bit = j * bit_width;
+    const size_t word = bit / 32;
+    const uint32_t shift = bit % 32;
+    for (size_t lane = 0; lane < LANE_COUNT; ++lane) {
+      uint32_t value = in[word * LANE_COUNT + lane] >> shift;
+      if (shift + bit_width > 32) {
+        value |= in[(word + 1) * LANE_COUNT + lane] << (32 - shift);
+      }
+      out[j * LANE_COUNT + lane] = value & mask;
+    }
+  }
+}
+
+void UnpackGapsScalar(const uint32_t* in, uint32_t bit_width, uint32_t base, uint32_t* out) {
+  UnpackScalar(in, bit_width, out);
+  uint32_t previous = base;
+  for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+    previous += out[i] + 1;
+    out[i] = previous;
+  }
+}
+
+size_t LowerBoundScalar(const uint32_t* values, size_t count, uint32_t value) {
+  return std::lower_bound(values, values + count, value) - values;
+}
+
+#ifdef BIT_PACKING_X86_KERNELS
+
+__attribute__((target("sse2"))) __m128i UnpackLaneSse2(const uint32_t* in,
+                                                        size_t j,
+                                                        size_t half,
+                                                        uint32_t bit_width,
+                                                        __m128i mask) {
+  const size_t bit = j * bit_width;
+  const size_t word = bit / 32;
+  const int shift = bit % 32;
+  const auto* src = reinterpret_cast<const __m128i*>(in + word * LANE_COUNT + half * 4);
+  __m128i value = _mm_srl_epi32(_mm_loadu_si128(src), _mm_cvtsi32_si128(shift));
+  if (shift + bit_width > 32) {
+    const __m128i high = _mm_loadu_si128(src + LANE_COUNT / 4);
+    value = _mm_or_si128(value, _mm_sll_epi32(high, _mm_cvtsi32_si128(32 - shift)));
+  }
+  return _mm_and_si128(value, mask);
+}
+
+__attribute__((target("sse2"))) void UnpackSse2(const uint32_t* in,
+                                                uint32_t bit_width,
+                                                uint32_t* out) {
+  if (bit_width == 0) {
+    std::fill(out, out + BLOCK_SIZE, 0u);
+    return;
+  }
+  const __m128i mask = _mm_set1_epi32(static_cast<int>(Mask(bit_width)));
+  for (size_t j = 0; j < VALUES_PER_LANE; ++j) {
+    for (size_t half = 0; half < 2; ++half) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j * LANE_COUNT + half * 4),
+                       UnpackLaneSse2(in, j, half, bit_width, mask));
+    }
+  }
+}
+
+__attribute__((target("sse2"))) void UnpackGapsSse2(const uint32_t* in,
+                                                    uint32_t bit_width,
+                                                    uint32_t base,
+                                                    uint32_t* out) {
+  const __m128i mask = _mm_set1_epi32(static_cast<int>(Mask(bit_width)));
+  const __m128i one = _mm_set1_epi32(1);
+  __m128i carry = _mm_set1_epi32(static_cast<int>(base));
+  for (size_t j = 0; j < VALUES_PER_LANE; ++j) {
+    for (size_t half = 0; half < 2; ++half) {
+      __m128i value = bit_width == 0 ? _mm_setzero_si128()
+                                     : UnpackLaneSse2(in, j, half, bit_width, mask);
+      value = _mm_add_epi32(value, one);
+      value = _mm_add_epi32(value, _mm_slli_si128(value, 4));
+      value = _mm_add_epi32(value, _mm_slli_si128(value, 8));
+      value = _mm_add_epi32(value, carry);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j * LANE_COUNT + half * 4), value);
+      carry = _mm_shuffle_epi32(value, 0xFF);
+    }
+  }
+}
+
+__attribute__((target("avx2"))) __m256i UnpackLanesAvx2(const uint32_t* in,
+                                                        size_t j,
+                                                        uint32_t bit_width,
+                                                        __m256i mask) {
+  const size_t bit = j * bit_width;
+  const size_t word = bit / 32;
+  const int shift = bit % 32;
+  const auto* src = reinterpret_cast<const __m256i*>(in + word * LANE_COUNT);
+  __m256i value = _mm256_srl_epi32(_mm256_loadu_si256(src), _mm_cvtsi32_si128(shift));
+  if (shift + bit_width > 32) {
+    const __m256i high = _mm256_loadu_si256(src + 1);
+    value = _mm256_or_si256(value, _mm256_sll_epi32(high, _mm_cvtsi32_si128(32 - shift)));
+  }
+  return _mm256_and_si256(value, mask);
+}
+
+__attribute__((target("avx2"))) void UnpackAvx2(const uint32_t* in,
+                                                uint32_t bit_width,
+                                                uint32_t* out) {
+  if (bit_width == 0) {
+    std::fill(out, out + BLOCK_SIZE, 0u);
+    return;
+  }
+  const __m256i mask = _mm256_set1_epi32(static_cast<int>(Mask(bit_width)));
+  for (size_t j = 0; j < VALUES_PER_LANE; ++j) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j * LANE_COUNT),
+                        UnpackLanesAvx2(in, j, bit_width, mask));
+  }
+}
+
+__attribute__((target("avx2"))) void UnpackGapsAvx2(const uint32_t* in,
+                                                    uint32_t bit_width,
+                                                    uint32_t base,
+                                                    uint32_t* out) {
+  const __m256i mask = _mm256_set1_epi32(static_cast<int>(Mask(bit_width)));
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i last = _mm256_set1_epi32(7);
+  __m256i carry = _mm256_set1_epi32(static_cast<int>(base));
+  for (size_t j = 0; j < VALUES_PER_LANE; ++j) {
+    __m256i value = bit_width == 0 ? _mm256_setzero_si256()
+                                   : UnpackLanesAvx2(in, j, bit_width, mask);
+    value = _mm256_add_epi32(value, one);
+    // Prefix sums inside each 128-bit half, then the low half total goes to the high half
+    value = _mm256_add_epi32(value, _mm256_slli_si256(value, 4));
+    value = _mm256_add_epi32(value, _mm256_slli_si256(value, 8));
+    const __m256i low_total = _mm256_shuffle_epi32(value, 0xFF);
+    value = _mm256_add_epi32(value, _mm256_permute2x128_si256(low_total, low_total, 0x08));
+    value = _mm256_add_epi32(value, carry);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j * LANE_COUNT), value);
+    carry = _mm256_permutevar8x32_epi32(value, last);
+  }
+}
+
+// Sorted values are below the key up to the first lane which is not, so the answer is
+// the first zero bit of the comparison mask
+__attribute__((target("sse2"))) size_t LowerBoundSse2(const uint32_t* values,
+                                                      size_t count,
+                                                      uint32_t value) {
+  const __m128i key = _mm_set1_epi32(static_cast<int>(value));
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+    const auto less = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(
+        _mm_cmpgt_epi32(key, chunk))));
+    if (less != 0xF) {
+      return i + __builtin_ctz(~less);
+    }
+  }
+  return i + LowerBoundScalar(values + i, count - i, value);
+}
+
+__attribute__((target("avx2"))) size_t LowerBoundAvx2(const uint32_t* values,
+                                                      size_t count,
+                                                      uint32_t value) {
+  const __m256i key = _mm256_set1_epi32(static_cast<int>(value));
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+    const auto less = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_cmpgt_epi32(key, chunk))));
+    if (less != 0xFF) {
+      return i + __builtin_ctz(~less);
+    }
+  }
+  return i + LowerBoundScalar(values + i, count - i, value);
+}
+
+#endif
+
+struct Kernels {
+  const char* name;
+  void (*unpack)(const uint32_t*, uint32_t, uint32_t*);
+  void (*unpack_gaps)(const uint32_t*, uint32_t, uint32_t, uint32_t*);
+  size_t (*lower_bound)(const uint32_t*, size_t, uint32_t);
+};
+
+std::vector<Kernels> GetSupportedKernels() {
+  std::vector<Kernels> kernels;
+#ifdef BIT_PACKING_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back({"avx2", UnpackAvx2, UnpackGapsAvx2, LowerBoundAvx2});
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    kernels.push_back({"sse2", UnpackSse2, UnpackGapsSse2, LowerBoundSse2});
+  }
+#endif
+  kernels.push_back({"scalar", UnpackScalar, UnpackGapsScalar, LowerBoundScalar});
+  return kernels;
+}
+
+Kernels& GetKernels() {
+  static Kernels kernels = GetSupportedKernels().front();
+  return kernels;
+}
+
+}  // namespace
+
+size_t PackedWordCount(uint32_t bit_width) {
+  return LANE_COUNT * ((VALUES_PER_LANE * bit_width + 31) / 32);
+}
+
+uint32_t RequiredBitWidth(const uint32_t* values, size_t count) {
+  uint32_t all_bits = 0;
+  for (size_t i = 0; i < count; ++i) {
+    all_bits |= values[i];
+  }
+  uint32_t bit_width = 0;
+  while (bit_width < 32 && (all_bits >> bit_width) != 0) {
+    ++bit_width;
+  }
+  return bit_width;
+}
+
+void Pack(const uint32_t* values, uint32_t bit_width, uint32_t* out) {
+  std::fill(out, out + PackedWordCount(bit_width), 0u);
+  if (bit_width == 0) {
+    return;
+  }
+  const uint32_t mask = Mask(bit_width);
+  for (size_t j = 0; j < VALUES_PER_LANE; ++j) {
+    const size_t bit = j * bit_width;
+    const size_t word = bit / 32;
+    const uint32_t shift = bit % 32;
+    for (size_t lane = 0; lane < LANE_COUNT; ++lane) {
+      const uint32_t value = values[j * LANE_COUNT + lane] & mask;
+      out[word * LANE_COUNT + lane] |= value << shift;
+      if (shift + bit_width > 32) {
+        out[(word + 1) * LANE_COUNT + lane] |= value >> (32 - shift);
+      }
+    }
+  }
+}
+
+void Unpack(const uint32_t* in, uint32_t bit_width, uint32_t* out) {
+  GetKernels().unpack(in, bit_width, out);
+}
+
+void UnpackGaps(const uint32_t* in, uint32_t bit_width, uint32_t base, uint32_t* out) {
+  GetKernels().unpack_gaps(in, bit_width, base, out);
+}
+
+size_t LowerBound(const uint32_t* values, size_t count, uint32_t value) {
+  return GetKernels().lower_bound(values, count, value);
+}
+
+const char* GetKernelName() {
+  return GetKernels().name;
+}
+
+std::vector<std::string_view> GetSupportedKernelNames() {
+  std::vector<std::string_view> names;
+  for (const auto& kernels : GetSupportedKernels()) {
+    names.push_back(kernels.name);
+  }
+  return names;
+}
+
+void SelectKernel(std::string_view name) {
+  for (const auto& kernels : GetSupportedKernels()) {
+    if (kernels.name == name) {
+      GetKernels() = kernels;
+      return;
+    }
+  }
+  throw std::invalid_argument("Unsupported bit packing kernel " + std::string(name));
+}
+
+}  // namespace bit_packing
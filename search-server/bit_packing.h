@@ -0,0 +1,42 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Bit packing of fixed-size blocks of unsigned integers.
+// A block is stored as LANE_COUNT interleaved 32-bit lanes: value i belongs to lane
+// i % LANE_COUNT, so one SIMD register decodes LANE_COUNT consecutive values at once.
+namespace bit_packing {
+
+constexpr size_t BLOCK_SIZE = 128;
+constexpr size_t LANE_COUNT = 8;
+
+// Number of 32-bit words taken by a packed block of the given bit width
+size_t PackedWordCount(uint32_t bit_width);
+
+uint32_t RequiredBitWidth(const uint32_t* values, size_t count);
+
+void Pack(const uint32_t* values, uint32_t bit_width, uint32_t* out);
+
+// The decoders are chosen once at startup: AVX2, SSE2 or scalar
+void Unpack(const uint32_t* in, uint32_t bit_width, uint32_t* out);
+
+// Decodes gaps stored as (value - previous - 1), starting from previous = base
+void UnpackGaps(const uint32_t* in, uint32_t bit_width, uint32_t base, uint32_t* out);
+
+// Index of the first value not less than value in sorted values, count if there is none.
+// Values must be below 2^31, compared in SIMD registers several at a time
+size_t LowerBound(const uint32_t* values, size_t count, uint32_t value);
+
+const char* GetKernelName();
+
+// Names of the kernels this CPU can run, the one chosen at startup first
+std::vector<std::string_view> GetSupportedKernelNames();
+
+// Makes the decoders use the named kernel. For tests comparing the kernels, not safe
+// while other threads decode. Throws std::invalid_argument for unsupported kernels
+void SelectKernel(std::string_view name);
+
+}  // namespace bit_packing
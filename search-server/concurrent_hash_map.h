@@ -0,0 +1,441 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <execution>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Open addressing hash map for concurrent updates. Each shard sits on its own cache line
+// and owns a linear probing table. Keys are claimed with CAS, values are atomics, so
+// inserts, additive updates and lookups take no locks. A shard that runs out of room
+// rebuilds its table; operations on that shard wait only while the table is rebuilt.
+// Erased keys keep their slot until the next rebuild and come back on a new insert.
+// The rebuilt table is sized by the live keys, so add/erase churn doesn't grow it.
+// A standalone container: queries accumulate relevance in ScoreAccumulator, which needs
+// no synchronization since every thread scores into its own one.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class ConcurrentHashMap {
+ public:
+  static_assert(std::is_trivially_copyable_v<Key>, "Keys must be trivially copyable");
+  static_assert(std::atomic<Value>::is_always_lock_free, "Values must be lock-free atomics");
+
+  explicit ConcurrentHashMap(size_t shard_count = 64, size_t initial_shard_capacity = 64);
+
+  ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+  ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+  ~ConcurrentHashMap();
+
+  // Adds delta to the value of the key, a missing key starts from Value{}
+  void Add(const Key& key, Value delta);
+
+  void Assign(const Key& key, Value value);
+
+  std::optional<Value> Find(const Key& key) const;
+
+  bool Erase(const Key& key);
+
+  size_t size() const;
+
+  // Bytes taken by the tables of the shards
+  size_t GetMemoryUsage() const;
+
+  // Visits the shards in parallel, concurrent writers may or may not be seen
+  template <typename ExecutionPolicy, typename Callback>
+  void ForEach(const ExecutionPolicy& policy, Callback callback) const;
+
+  template <typename ExecutionPolicy>
+  std::vector<std::pair<Key, Value>> BuildFlatContainer(const ExecutionPolicy& policy) const;
+
+ private:
+  static constexpr size_t CACHE_LINE_SIZE = 64;
+  static constexpr uint32_t RESIZING = 1u << 31;
+
+  enum SlotState : uint8_t { EMPTY, BUSY, LIVE, ERASED };
+
+  struct Slot {
+    std::atomic<uint8_t> state{EMPTY};
+    Key key;
+    std::atomic<Value> value{Value{}};
+  };
+
+  struct Table {
+    explicit Table(size_t capacity) : slots(capacity), mask(capacity - 1) {}
+
+    std::vector<Slot> slots;
+    size_t mask;
+  };
+
+  struct alignas(CACHE_LINE_SIZE) Shard {
+    // Number of operations inside the shard, RESIZING is set while the table is rebuilt
+    std::atomic<uint32_t> guard{0};
+    std::atomic<size_t> used{0};
+    std::atomic<size_t> live{0};
+    std::atomic<Table*> table{nullptr};
+  };
+
+  // Holds a shard open for ordinary operations
+  class ShardAccess {
+   public:
+    explicit ShardAccess(Shard& shard);
+    ~ShardAccess();
+
+    Table& GetTable() const;
+
+   private:
+    Shard& shard_;
+  };
+
+  enum class Claim { FOUND, INSERTED, FULL };
+
+  static size_t Mix(size_t hash);
+
+  static bool KeyEquals(const Key& lhs, const Key& rhs);
+
+  static void WaitForSlot(const Slot& slot);
+
+  Shard& GetShard(size_t hash) const;
+
+  // Finds the slot of the key or claims an empty one and stores initial there
+  std::pair<Slot*, Claim> FindOrInsert(Shard& shard, size_t hash, const Key& key, Value initial);
+
+  // Replaces the full table by one sized for the live keys
+  void Rebuild(Shard& shard, const Table* full_table);
+
+  template <typename Update>
+  void Upsert(const Key& key, Value initial, Update update);
+
+  std::unique_ptr<Shard[]> shards_;
+  size_t shard_count_;
+  // Tables never shrink below it
+  size_t min_capacity_ = 8;
+  Hash hasher_;
+};
+
+template <typename Key, typename Value, typename Hash>
+ConcurrentHashMap<Key, Value, Hash>::ShardAccess::ShardAccess(Shard& shard) : shard_(shard) {
+  uint32_t guard = shard_.guard.load(std::memory_order_relaxed);
+  while (true) {
+    if (guard & RESIZING) {
+      std::this_thread::yield();
+      guard = shard_.guard.load(std::memory_order_relaxed);
+    } else if (shard_.guard.compare_exchange_weak(guard, guard + 1, std::memory_order_acquire)) {
+      return;
+    }
+  }
+}
+
+template <typename Key, typename Value, typename Hash>
+ConcurrentHashMap<Key, Value, Hash>::ShardAccess::~ShardAccess() {
+  shard_.guard.fetch_sub(1, std::memory_order_release);
+}
+
+template <typename Key, typename Value, typename Hash>
+typename ConcurrentHashMap<Key, Value, Hash>::Table&
+ConcurrentHashMap<Key, Value, Hash>::ShardAccess::GetTable() const {
+  return *shard_.table.load(std::memory_order_acquire);
+}
+
+template <typename Key, typename Value, typename Hash>
+ConcurrentHashMap<Key, Value, Hash>::ConcurrentHashMap(size_t shard_count,
+                                                       size_t initial_shard_capacity)
+    : shards_(std::make_unique<Shard[]>(std::max<size_t>(shard_count, 1))),
+      shard_count_(std::max<size_t>(shard_count, 1)) {
+  while (min_capacity_ < initial_shard_capacity) {
+    min_capacity_ *= 2;
+  }
+  for (size_t i = 0; i < shard_count_; ++i) {
+    shards_[i].table.store(new Table(min_capacity_), std::memory_order_relaxed);
+  }
+}
+
+template <typename Key, typename Value, typename Hash>
+ConcurrentHashMap<Key, Value, Hash>::~ConcurrentHashMap() {
+  for (size_t i = 0; i < shard_count_; ++i) {
+    delete shards_[i].table.load(std::memory_order_relaxed);
+  }
+}
+
+template <typename Key, typename Value, typename Hash>
+void ConcurrentHashMap<Key, Value, Hash>::Add(const Key& key, Value delta) {
+  Upsert(key, delta, [delta](std::atomic<Value>& value) {
+    if constexpr (std::is_integral_v<Value>) {
+      value.fetch_add(delta, std::memory_order_relaxed);
+    } else {
+      Value expected = value.load(std::memory_order_relaxed);
+      while (!value.compare_exchange_weak(expected, expected + delta,
+                                          std::memory_order_relaxed)) {
+      }
+    }
+  });
+}
+
+template <typename Key, typename Value, typename Hash>
+void ConcurrentHashMap<Key, Value, Hash>::Assign(const Key& key, Value value) {
+  Upsert(key, value, [value](std::atomic<Value>& slot_value) {
+    slot_value.store(value, std::memory_order_relaxed);
+  });
+}
+
+template <typename Key, typename Value, typename Hash>
+std::optional<Value> ConcurrentHashMap<Key, Value, Hash>::Find(const Key& key) const {
+  const size_t hash = Mix(hasher_(key));
+  Shard& shard = GetShard(hash);
+  const ShardAccess access(shard);
+  const Table& table = access.GetTable();
+  for (size_t i = hash & table.mask;; i = (i + 1) & table.mask) {
+    const Slot& slot = table.slots[i];
+    WaitForSlot(slot);
+    const uint8_t state = slot.state.load(std::memory_order_acquire);
+    if (state == EMPTY) {
+      return std::nullopt;
+    }
+    if (KeyEquals(slot.key, key)) {
+      if (state == ERASED) {
+        return std::nullopt;
+      }
+      return slot.value.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template <typename Key, typename Value, typename Hash>
+bool ConcurrentHashMap<Key, Value, Hash>::Erase(const Key& key) {
+  const size_t hash = Mix(hasher_(key));
+  Shard& shard = GetShard(hash);
+  const ShardAccess access(shard);
+  Table& table = access.GetTable();
+  for (size_t i = hash & table.mask;; i = (i + 1) & table.mask) {
+    Slot& slot = table.slots[i];
+    WaitForSlot(slot);
+    uint8_t state = slot.state.load(std::memory_order_acquire);
+    if (state == EMPTY) {
+      return false;
+    }
+    if (KeyEquals(slot.key, key)) {
+      while (state == LIVE) {
+        if (slot.state.compare_exchange_weak(state, ERASED, std::memory_order_acq_rel)) {
+          shard.live.fetch_sub(1, std::memory_order_relaxed);
+          return true;
+        }
+      }
+      return false;
+    }
+  }
+}
+
+template <typename Key, typename Value, typename Hash>
+size_t ConcurrentHashMap<Key, Value, Hash>::size() const {
+  size_t result = 0;
+  for (size_t i = 0; i < shard_count_; ++i) {
+    result += shards_[i].live.load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+template <typename Key, typename Value, typename Hash>
+size_t ConcurrentHashMap<Key, Value, Hash>::GetMemoryUsage() const {
+  size_t result = shard_count_ * sizeof(Shard);
+  for (size_t i = 0; i < shard_count_; ++i) {
+    const ShardAccess access(shards_[i]);
+    result += sizeof(Table) + access.GetTable().slots.size() * sizeof(Slot);
+  }
+  return result;
+}
+
+template <typename Key, typename Value, typename Hash>
+template <typename ExecutionPolicy, typename Callback>
+void ConcurrentHashMap<Key, Value, Hash>::ForEach(const ExecutionPolicy& policy,
+                                                  Callback callback) const {
+  std::vector<size_t> shard_indexes(shard_count_);
+  std::iota(shard_indexes.begin(), shard_indexes.end(), 0);
+  std::for_each(policy, shard_indexes.begin(), shard_indexes.end(), [&](size_t index) {
+    const ShardAccess access(shards_[index]);
+    for (const Slot& slot : access.GetTable().slots) {
+      if (slot.state.load(std::memory_order_acquire) == LIVE) {
+        callback(slot.key, slot.value.load(std::memory_order_relaxed));
+      }
+    }
+  });
+}
+
+template <typename Key, typename Value, typename Hash>
+template <typename ExecutionPolicy>
+std::vector<std::pair<Key, Value>> ConcurrentHashMap<Key, Value, Hash>::BuildFlatContainer(
+    const ExecutionPolicy& policy) const {
+  std::vector<std::vector<std::pair<Key, Value>>> parts(shard_count_);
+  std::vector<size_t> shard_indexes(shard_count_);
+  std::iota(shard_indexes.begin(), shard_indexes.end(), 0);
+  std::for_each(policy, shard_indexes.begin(), shard_indexes.end(), [&](size_t index) {
+    const ShardAccess access(shards_[index]);
+    auto& part = parts[index];
+    part.reserve(shards_[index].live.load(std::memory_order_relaxed));
+    for (const Slot& slot : access.GetTable().slots) {
+      if (slot.state.load(std::memory_order_acquire) == LIVE) {
+        part.emplace_back(slot.key, slot.value.load(std::memory_order_relaxed));
+      }
+    }
+  });
+
+  std::vector<size_t> offsets(shard_count_ + 1, 0);
+  for (size_t i = 0; i < shard_count_; ++i) {
+    offsets[i + 1] = offsets[i] + parts[i].size();
+  }
+  std::vector<std::pair<Key, Value>> result(offsets.back());
+  std::for_each(policy, shard_indexes.begin(), shard_indexes.end(), [&](size_t index) {
+    std::copy(parts[index].begin(), parts[index].end(), result.begin() + offsets[index]);
+  });
+  return result;
+}
+
+template <typename Key, typename Value, typename Hash>
+size_t ConcurrentHashMap<Key, Value, Hash>::Mix(size_t hash) {
+  // Finalizer of MurmurHash3, std::hash of integers is often the identity
+  uint64_t x = hash;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return static_cast<size_t>(x);
+}
+
+template <typename Key, typename Value, typename Hash>
+bool ConcurrentHashMap<Key, Value, Hash>::KeyEquals(const Key& lhs, const Key& rhs) {
+  return std::equal_to<Key>{}(lhs, rhs);
+}
+
+template <typename Key, typename Value, typename Hash>
+void ConcurrentHashMap<Key, Value, Hash>::WaitForSlot(const Slot& slot) {
+  while (slot.state.load(std::memory_order_acquire) == BUSY) {
+    std::this_thread::yield();
+  }
+}
+
+template <typename Key, typename Value, typename Hash>
+typename ConcurrentHashMap<Key, Value, Hash>::Shard& ConcurrentHashMap<Key, Value, Hash>::GetShard(
+    size_t hash) const {
+  // High bits pick the shard, low bits pick the slot inside it
+  return shards_[(hash >> 40) % shard_count_];
+}
+
+template <typename Key, typename Value, typename Hash>
+std::pair<typename ConcurrentHashMap<Key, Value, Hash>::Slot*,
+          typename ConcurrentHashMap<Key, Value, Hash>::Claim>
+ConcurrentHashMap<Key, Value, Hash>::FindOrInsert(Shard& shard,
+                                                  size_t hash,
+                                                  const Key& key,
+                                                  Value initial) {
+  Table& table = *shard.table.load(std::memory_order_acquire);
+  for (size_t i = hash & table.mask;; i = (i + 1) & table.mask) {
+    Slot& slot = table.slots[i];
+    uint8_t state = slot.state.load(std::memory_order_acquire);
+    if (state == EMPTY) {
+      // A quarter of the table always stays free, so probe sequences stay short and end
+      if ((shard.used.fetch_add(1, std::memory_order_relaxed) + 1) * 4 > table.slots.size() * 3) {
+        shard.used.fetch_sub(1, std::memory_order_relaxed);
+        return {nullptr, Claim::FULL};
+      }
+      if (!slot.state.compare_exchange_strong(state, BUSY, std::memory_order_acquire)) {
+        shard.used.fetch_sub(1, std::memory_order_relaxed);
+      } else {
+        shard.live.fetch_add(1, std::memory_order_relaxed);
+        slot.key = key;
+        slot.value.store(initial, std::memory_order_relaxed);
+        slot.state.store(LIVE, std::memory_order_release);
+        return {&slot, Claim::INSERTED};
+      }
+    }
+    WaitForSlot(slot);
+    state = slot.state.load(std::memory_order_acquire);
+    if (state != EMPTY && KeyEquals(slot.key, key)) {
+      if (state == ERASED &&
+          slot.state.compare_exchange_strong(state, BUSY, std::memory_order_acquire)) {
+        shard.live.fetch_add(1, std::memory_order_relaxed);
+        slot.value.store(initial, std::memory_order_relaxed);
+        slot.state.store(LIVE, std::memory_order_release);
+        return {&slot, Claim::INSERTED};
+      }
+      WaitForSlot(slot);
+      return {&slot, Claim::FOUND};
+    }
+  }
+}
+
+template <typename Key, typename Value, typename Hash>
+void ConcurrentHashMap<Key, Value, Hash>::Rebuild(Shard& shard, const Table* full_table) {
+  uint32_t guard = 0;
+  while (!shard.guard.compare_exchange_weak(guard, guard | RESIZING, std::memory_order_acquire)) {
+    if (guard & RESIZING) {
+      return;
+    }
+  }
+  while ((shard.guard.load(std::memory_order_acquire) & ~RESIZING) != 0) {
+    std::this_thread::yield();
+  }
+
+  Table* old_table = shard.table.load(std::memory_order_relaxed);
+  if (old_table == full_table) {
+    // Erased slots count as used until the rebuild drops them, so a table full of them
+    // is rebuilt at the same or a smaller capacity. Live keys take at most half of the
+    // new table, leaving a quarter of it for inserts before the next rebuild
+    const size_t live = shard.live.load(std::memory_order_relaxed);
+    size_t capacity = min_capacity_;
+    while (capacity < (live + 1) * 2) {
+      capacity *= 2;
+    }
+    auto* new_table = new Table(capacity);
+    size_t used = 0;
+    for (const Slot& slot : old_table->slots) {
+      if (slot.state.load(std::memory_order_relaxed) != LIVE) {
+        continue;
+      }
+      size_t i = Mix(hasher_(slot.key)) & new_table->mask;
+      while (new_table->slots[i].state.load(std::memory_order_relaxed) != EMPTY) {
+        i = (i + 1) & new_table->mask;
+      }
+      Slot& target = new_table->slots[i];
+      target.key = slot.key;
+      target.value.store(slot.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      target.state.store(LIVE, std::memory_order_relaxed);
+      ++used;
+    }
+    shard.used.store(used, std::memory_order_relaxed);
+    shard.live.store(used, std::memory_order_relaxed);
+    shard.table.store(new_table, std::memory_order_release);
+    delete old_table;
+  }
+  shard.guard.fetch_and(~RESIZING, std::memory_order_release);
+}
+
+template <typename Key, typename Value, typename Hash>
+template <typename Update>
+void ConcurrentHashMap<Key, Value, Hash>::Upsert(const Key& key, Value initial, Update update) {
+  const size_t hash = Mix(hasher_(key));
+  Shard& shard = GetShard(hash);
+  while (true) {
+    const Table* full_table = nullptr;
+    {
+      const ShardAccess access(shard);
+      const auto [slot, claim] = FindOrInsert(shard, hash, key, initial);
+      if (claim == Claim::FOUND) {
+        update(slot->value);
+        return;
+      }
+      if (claim == Claim::INSERTED) {
+        return;
+      }
+      full_table = &access.GetTable();
+    }
+    Rebuild(shard, full_table);
+  }
+}
@@ -1,4 +1,6 @@
-﻿#include <algorithm>
+﻿#pragma once
+
+#include <algorithm>
 #include <cstdlib>
 #include <execution>
 #include <future>
@@ -58,7 +60,7 @@ class ConcurrentMap {
   }
   std::vector<std::pair<Key, Value>> BuildFlatContainer() {
     std::vector<std::pair<Key, Value>> result;
-    result.reserve(bucket_count_);
+    result.reserve(size());
     for (size_t i = 0; i < bucket_count_; ++i) {
       std::lock_guard<std::mutex> lock(mut_[i]);
       for (const auto& [key, value] : buckets_[i]) {
@@ -0,0 +1,125 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// Append-only array for one writer and readers on other threads. Elements never move:
+// chunk k holds FIRST_CHUNK_SIZE << k of them, so readers index it without locks.
+// A reader may only touch elements whose addition was published to it
+template <typename T>
+class ConcurrentVector {
+ public:
+  ConcurrentVector() = default;
+
+  ConcurrentVector(const ConcurrentVector&) = delete;
+
+  ConcurrentVector& operator=(const ConcurrentVector&) = delete;
+
+  ~ConcurrentVector();
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args);
+
+  T& operator[](size_t index);
+
+  const T& operator[](size_t index) const;
+
+  size_t size() const;
+
+  bool empty() const;
+
+  // Calls callback(data, count) for the filled part of every chunk in order
+  template <typename Callback>
+  void ForEachChunk(Callback callback) const;
+
+ private:
+  static constexpr size_t FIRST_CHUNK_BITS = 6;
+  static constexpr size_t FIRST_CHUNK_SIZE = size_t{1} << FIRST_CHUNK_BITS;
+  static constexpr size_t CHUNK_COUNT = 48;
+
+  static size_t GetChunk(size_t index);
+
+  static size_t GetChunkBegin(size_t chunk);
+
+  std::array<std::atomic<T*>, CHUNK_COUNT> chunks_{};
+  std::atomic<size_t> size_ = 0;
+};
+
+template <typename T>
+ConcurrentVector<T>::~ConcurrentVector() {
+  const size_t size = size_.load(std::memory_order_relaxed);
+  for (size_t chunk = 0; chunk < CHUNK_COUNT; ++chunk) {
+    T* data = chunks_[chunk].load(std::memory_order_relaxed);
+    if (data == nullptr) {
+      break;
+    }
+    const size_t begin = GetChunkBegin(chunk);
+    for (size_t i = begin; i < size && i < GetChunkBegin(chunk + 1); ++i) {
+      data[i - begin].~T();
+    }
+    ::operator delete(data);
+  }
+}
+
+template <typename T>
+template <typename... Args>
+T& ConcurrentVector<T>::emplace_back(Args&&... args) {
+  const size_t index = size_.load(std::memory_order_relaxed);
+  const size_t chunk = GetChunk(index);
+  T* data = chunks_[chunk].load(std::memory_order_relaxed);
+  if (data == nullptr) {
+    data = static_cast<T*>(::operator new(sizeof(T) * (FIRST_CHUNK_SIZE << chunk)));
+    chunks_[chunk].store(data, std::memory_order_release);
+  }
+  T* element = new (data + index - GetChunkBegin(chunk)) T(std::forward<Args>(args)...);
+  size_.store(index + 1, std::memory_order_release);
+  return *element;
+}
+
+template <typename T>
+T& ConcurrentVector<T>::operator[](size_t index) {
+  const size_t chunk = GetChunk(index);
+  return chunks_[chunk].load(std::memory_order_acquire)[index - GetChunkBegin(chunk)];
+}
+
+template <typename T>
+const T& ConcurrentVector<T>::operator[](size_t index) const {
+  const size_t chunk = GetChunk(index);
+  return chunks_[chunk].load(std::memory_order_acquire)[index - GetChunkBegin(chunk)];
+}
+
+template <typename T>
+size_t ConcurrentVector<T>::size() const {
+  return size_.load(std::memory_order_acquire);
+}
+
+template <typename T>
+bool ConcurrentVector<T>::empty() const {
+  return size() == 0;
+}
+
+template <typename T>
+template <typename Callback>
+void ConcurrentVector<T>::ForEachChunk(Callback callback) const {
+  const size_t size = this->size();
+  for (size_t chunk = 0; GetChunkBegin(chunk) < size; ++chunk) {
+    const size_t begin = GetChunkBegin(chunk);
+    const size_t end = std::min(GetChunkBegin(chunk + 1), size);
+    callback(static_cast<const T*>(chunks_[chunk].load(std::memory_order_acquire)), end - begin);
+  }
+}
+
+template <typename T>
+size_t ConcurrentVector<T>::GetChunk(size_t index) {
+  // Position of the highest bit of index + FIRST_CHUNK_SIZE gives the chunk
+  return 63 - __builtin_clzll(index + FIRST_CHUNK_SIZE) - FIRST_CHUNK_BITS;
+}
+
+template <typename T>
+size_t ConcurrentVector<T>::GetChunkBegin(size_t chunk) {
+  return (FIRST_CHUNK_SIZE << chunk) - FIRST_CHUNK_SIZE;
+}
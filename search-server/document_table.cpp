@@ -0,0 +1,123 @@
+﻿#include "document_table.h"
+
+namespace {
+
+template <typename T>
+void WriteColumn(IndexFileWriter& writer, IndexSection section, const ConcurrentVector<T>& column) {
+  writer.BeginSection(section);
+  column.ForEachChunk([&writer](const T* data, size_t count) { writer.WriteArray(data, count); });
+  writer.EndSection();
+}
+
+}  // namespace
+
+DocumentTable::DocumentTable(EpochManager& epochs) : internal_ids_(epochs) {}
+
+int DocumentTable::Add(int document_id,
+                       int rating,
+                       DocumentStatus status,
+                       double inv_word_count) {
+  const int internal_id = GetInternalIdLimit();
+  const uint32_t previous_id = internal_ids_.Find(static_cast<uint32_t>(document_id));
+  external_ids_.emplace_back(document_id);
+  ratings_.emplace_back(rating);
+  statuses_.emplace_back(status);
+  inv_word_counts_.emplace_back(inv_word_count);
+  removed_generations_.emplace_back(NOT_REMOVED);
+  previous_ids_.emplace_back(previous_id == EpochHashTable::NO_VALUE
+                                 ? NO_DOCUMENT
+                                 : static_cast<int>(previous_id));
+  internal_ids_.Assign(static_cast<uint32_t>(document_id), static_cast<uint32_t>(internal_id));
+  ++live_count_;
+  return internal_id;
+}
+
+void DocumentTable::Remove(int internal_id, uint64_t generation) {
+  removed_generations_[internal_id].store(generation, std::memory_order_release);
+  --live_count_;
+}
+
+int DocumentTable::FindInternalId(int document_id) const {
+  const uint32_t internal_id = internal_ids_.Find(static_cast<uint32_t>(document_id));
+  if (internal_id == EpochHashTable::NO_VALUE ||
+      removed_generations_[internal_id].load(std::memory_order_relaxed) != NOT_REMOVED) {
+    return NO_DOCUMENT;
+  }
+  return static_cast<int>(internal_id);
+}
+
+int DocumentTable::FindInternalId(int document_id,
+                                  uint64_t generation,
+                                  int internal_id_limit) const {
+  const uint32_t latest_id = internal_ids_.Find(static_cast<uint32_t>(document_id));
+  int internal_id = latest_id == EpochHashTable::NO_VALUE ? NO_DOCUMENT
+                                                          : static_cast<int>(latest_id);
+  // Documents added after the reader's version was published aren't seen
+  while (internal_id >= internal_id_limit) {
+    internal_id = previous_ids_[internal_id];
+  }
+  return internal_id == NO_DOCUMENT || IsRemoved(internal_id, generation) ? NO_DOCUMENT
+                                                                          : internal_id;
+}
+
+size_t DocumentTable::size() const {
+  return live_count_;
+}
+
+int DocumentTable::GetInternalIdLimit() const {
+  return static_cast<int>(external_ids_.size());
+}
+
+void DocumentTable::Save(IndexFileWriter& writer) const {
+  WriteColumn(writer, IndexSection::DOCUMENT_IDS, external_ids_);
+  WriteColumn(writer, IndexSection::DOCUMENT_RATINGS, ratings_);
+  WriteColumn(writer, IndexSection::DOCUMENT_STATUSES, statuses_);
+  WriteColumn(writer, IndexSection::DOCUMENT_INV_WORD_COUNTS, inv_word_counts_);
+
+  // Files keep a bitmap of the live documents of every status
+  const size_t count = external_ids_.size();
+  const size_t word_count = (count + 63) / 64;
+  std::array<std::vector<uint64_t>, STATUS_COUNT> status_bitmaps;
+  for (auto& bitmap : status_bitmaps) {
+    bitmap.assign(word_count, 0);
+  }
+  for (size_t internal_id = 0; internal_id < count; ++internal_id) {
+    if (removed_generations_[internal_id].load(std::memory_order_relaxed) == NOT_REMOVED) {
+      status_bitmaps[static_cast<size_t>(statuses_[internal_id])][internal_id / 64] |=
+          uint64_t{1} << (internal_id % 64);
+    }
+  }
+  writer.BeginSection(IndexSection::DOCUMENT_STATUS_BITMAPS);
+  for (const auto& bitmap : status_bitmaps) {
+    writer.WriteArray(bitmap.data(), bitmap.size());
+  }
+  writer.EndSection();
+}
+
+void DocumentTable::Load(const IndexFile& file) {
+  const auto external_ids = file.GetSection<int>(IndexSection::DOCUMENT_IDS);
+  const auto ratings = file.GetSection<int>(IndexSection::DOCUMENT_RATINGS);
+  const auto statuses = file.GetSection<DocumentStatus>(IndexSection::DOCUMENT_STATUSES);
+  const auto inv_word_counts = file.GetSection<double>(IndexSection::DOCUMENT_INV_WORD_COUNTS);
+  const auto bitmaps = file.GetSection<uint64_t>(IndexSection::DOCUMENT_STATUS_BITMAPS);
+  const size_t count = external_ids.size();
+  const size_t word_count = (count + 63) / 64;
+  if (ratings.size() != count || statuses.size() != count || inv_word_counts.size() != count ||
+      bitmaps.size() != word_count * STATUS_COUNT) {
+    throw std::runtime_error("Index file has invalid documents");
+  }
+
+  for (size_t internal_id = 0; internal_id < count; ++internal_id) {
+    const auto status = static_cast<size_t>(statuses.begin()[internal_id]);
+    if (status >= STATUS_COUNT) {
+      throw std::runtime_error("Index file has invalid documents");
+    }
+    // Documents missing from the bitmap of their status were removed before the save
+    const uint64_t word = bitmaps.begin()[status * word_count + internal_id / 64];
+    Add(external_ids.begin()[internal_id], ratings.begin()[internal_id],
+        statuses.begin()[internal_id], inv_word_counts.begin()[internal_id]);
+    if (((word >> (internal_id % 64)) & 1) == 0) {
+      Remove(static_cast<int>(internal_id), 0);
+    }
+  }
+}
@@ -0,0 +1,99 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "concurrent_vector.h"
+#include "document.h"
+#include "epoch_hash_table.h"
+#include "epoch_manager.h"
+#include "index_file.h"
+
+// Metadata of documents under dense internal ids given in the order of addition.
+// Every field is a separate append-only array. One writer adds and removes documents
+// while queries read the table for their index generation
+class DocumentTable {
+ public:
+  static constexpr int NO_DOCUMENT = -1;
+  static constexpr size_t STATUS_COUNT = 4;
+
+  explicit DocumentTable(EpochManager& epochs);
+
+  // Returns the internal id of the new document
+  int Add(int document_id, int rating, DocumentStatus status, double inv_word_count);
+
+  // Removed in the generation and all later ones. Internal ids are never reused
+  void Remove(int internal_id, uint64_t generation);
+
+  // Live document as the writer sees it
+  int FindInternalId(int document_id) const;
+
+  // Live document as seen in the generation by a reader whose documents end at the limit.
+  // Readers must hold an epoch pin
+  int FindInternalId(int document_id, uint64_t generation, int internal_id_limit) const;
+
+  int GetExternalId(int internal_id) const;
+
+  int GetRating(int internal_id) const;
+
+  DocumentStatus GetStatus(int internal_id) const;
+
+  bool HasStatus(int internal_id, DocumentStatus status, uint64_t generation) const;
+
+  bool IsRemoved(int internal_id, uint64_t generation) const;
+
+  double GetInvWordCount(int internal_id) const;
+
+  // Number of live documents
+  size_t size() const;
+
+  // Upper limit of the internal ids given so far
+  int GetInternalIdLimit() const;
+
+  void Save(IndexFileWriter& writer) const;
+
+  // The table must be empty
+  void Load(const IndexFile& file);
+
+ private:
+  static constexpr uint64_t NOT_REMOVED = UINT64_MAX;
+
+  ConcurrentVector<int> external_ids_;
+  ConcurrentVector<int> ratings_;
+  ConcurrentVector<DocumentStatus> statuses_;
+  ConcurrentVector<double> inv_word_counts_;
+  // Generation of the removal of every document
+  ConcurrentVector<std::atomic<uint64_t>> removed_generations_;
+  // Earlier internal id of the same external one, for readers of older generations
+  ConcurrentVector<int> previous_ids_;
+  // Latest internal id of every external one
+  EpochHashTable internal_ids_;
+  size_t live_count_ = 0;
+};
+
+inline int DocumentTable::GetExternalId(int internal_id) const {
+  return external_ids_[internal_id];
+}
+
+inline int DocumentTable::GetRating(int internal_id) const {
+  return ratings_[internal_id];
+}
+
+inline DocumentStatus DocumentTable::GetStatus(int internal_id) const {
+  return statuses_[internal_id];
+}
+
+inline bool DocumentTable::HasStatus(int internal_id,
+                                     DocumentStatus status,
+                                     uint64_t generation) const {
+  return statuses_[internal_id] == status && !IsRemoved(internal_id, generation);
+}
+
+inline bool DocumentTable::IsRemoved(int internal_id, uint64_t generation) const {
+  return removed_generations_[internal_id].load(std::memory_order_acquire) <= generation;
+}
+
+inline double DocumentTable::GetInvWordCount(int internal_id) const {
+  return inv_word_counts_[internal_id];
+}
@@ -0,0 +1,83 @@
+﻿#include "epoch_hash_table.h"
+#include <utility>
+
+EpochHashTable::Table::Table(size_t capacity)
+    : slots(std::make_unique<std::atomic<uint64_t>[]>(capacity)), mask(capacity - 1) {
+  for (size_t i = 0; i < capacity; ++i) {
+    slots[i].store(EMPTY, std::memory_order_relaxed);
+  }
+}
+
+EpochHashTable::EpochHashTable(EpochManager& epochs, size_t capacity) : epochs_(epochs) {
+  size_t table_capacity = 16;
+  while (table_capacity < capacity * 2) {
+    table_capacity *= 2;
+  }
+  table_ = std::make_shared<Table>(table_capacity);
+  published_table_.store(table_.get(), std::memory_order_release);
+}
+
+uint32_t EpochHashTable::Find(uint32_t key) const {
+  return Find(key, [](uint32_t) { return true; });
+}
+
+void EpochHashTable::Insert(uint32_t key, uint32_t value) {
+  // Half of the table stays free, so probe sequences are short
+  if ((size_ + 1) * 2 > table_->mask + 1) {
+    Grow();
+  }
+  size_t i = GetPosition(key, table_->mask);
+  while (table_->slots[i].load(std::memory_order_relaxed) != EMPTY) {
+    i = (i + 1) & table_->mask;
+  }
+  table_->slots[i].store(MakeSlot(key, value), std::memory_order_release);
+  ++size_;
+}
+
+void EpochHashTable::Assign(uint32_t key, uint32_t value) {
+  for (size_t i = GetPosition(key, table_->mask);; i = (i + 1) & table_->mask) {
+    const uint64_t slot = table_->slots[i].load(std::memory_order_relaxed);
+    if (slot == EMPTY) {
+      Insert(key, value);
+      return;
+    }
+    if (static_cast<uint32_t>(slot >> 32) == key) {
+      table_->slots[i].store(MakeSlot(key, value), std::memory_order_release);
+      return;
+    }
+  }
+}
+
+size_t EpochHashTable::size() const {
+  return size_;
+}
+
+size_t EpochHashTable::GetMemoryUsage() const {
+  return sizeof(*this) + sizeof(Table) + (table_->mask + 1) * sizeof(uint64_t);
+}
+
+size_t EpochHashTable::GetPosition(uint32_t key, size_t mask) {
+  // Fibonacci hashing spreads sequential keys over the table
+  return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+uint64_t EpochHashTable::MakeSlot(uint32_t key, uint32_t value) {
+  return (uint64_t{key} << 32) | value;
+}
+
+void EpochHashTable::Grow() {
+  auto table = std::make_shared<Table>((table_->mask + 1) * 2);
+  for (size_t i = 0; i <= table_->mask; ++i) {
+    const uint64_t slot = table_->slots[i].load(std::memory_order_relaxed);
+    if (slot == EMPTY) {
+      continue;
+    }
+    size_t position = GetPosition(static_cast<uint32_t>(slot >> 32), table->mask);
+    while (table->slots[position].load(std::memory_order_relaxed) != EMPTY) {
+      position = (position + 1) & table->mask;
+    }
+    table->slots[position].store(slot, std::memory_order_relaxed);
+  }
+  published_table_.store(table.get());
+  epochs_.Retire(std::exchange(table_, std::move(table)));
+}
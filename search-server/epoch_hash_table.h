@@ -0,0 +1,74 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "epoch_manager.h"
+
+// Open addressing table of 32-bit keys and values filled by one writer and read without
+// locks. A key and its value share one atomic slot, slots are never cleared. A full table
+// is replaced by a larger one and retired through the epoch manager, so readers must
+// hold a pin while they look up
+class EpochHashTable {
+ public:
+  static constexpr uint32_t NO_VALUE = UINT32_MAX;
+
+  explicit EpochHashTable(EpochManager& epochs, size_t capacity = 16);
+
+  EpochHashTable(const EpochHashTable&) = delete;
+
+  EpochHashTable& operator=(const EpochHashTable&) = delete;
+
+  // First value of the key accepted by match(value), NO_VALUE if there is none.
+  // A key may have several values, e.g. when keys are hashes of longer ones
+  template <typename Match>
+  uint32_t Find(uint32_t key, Match match) const;
+
+  uint32_t Find(uint32_t key) const;
+
+  // Adds one more value of the key
+  void Insert(uint32_t key, uint32_t value);
+
+  // Replaces the first value of the key or inserts it
+  void Assign(uint32_t key, uint32_t value);
+
+  size_t size() const;
+
+  size_t GetMemoryUsage() const;
+
+ private:
+  static constexpr uint64_t EMPTY = UINT64_MAX;
+
+  struct Table {
+    explicit Table(size_t capacity);
+
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+    size_t mask;
+  };
+
+  static size_t GetPosition(uint32_t key, size_t mask);
+
+  static uint64_t MakeSlot(uint32_t key, uint32_t value);
+
+  void Grow();
+
+  EpochManager& epochs_;
+  std::shared_ptr<Table> table_;
+  std::atomic<const Table*> published_table_;
+  size_t size_ = 0;
+};
+
+template <typename Match>
+uint32_t EpochHashTable::Find(uint32_t key, Match match) const {
+  const Table& table = *published_table_.load(std::memory_order_acquire);
+  for (size_t i = GetPosition(key, table.mask);; i = (i + 1) & table.mask) {
+    const uint64_t slot = table.slots[i].load(std::memory_order_acquire);
+    if (slot == EMPTY) {
+      return NO_VALUE;
+    }
+    if (static_cast<uint32_t>(slot >> 32) == key && match(static_cast<uint32_t>(slot))) {
+      return static_cast<uint32_t>(slot);
+    }
+  }
+}
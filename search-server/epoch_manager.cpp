@@ -0,0 +1,71 @@
+﻿#include "epoch_manager.h"
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+EpochManager::EpochManager() : slots_(std::make_unique<Slot[]>(SLOT_COUNT)) {}
+
+EpochManager::Guard EpochManager::Pin() const {
+  // Threads start probing at different slots, so they rarely compete for one
+  thread_local const size_t first_slot = std::hash<std::thread::id>{}(std::this_thread::get_id());
+  for (size_t attempt = 0;; ++attempt) {
+    auto& slot = slots_[(first_slot + attempt) % SLOT_COUNT].epoch;
+    uint64_t expected = FREE_SLOT;
+    // Sequentially consistent, so a writer which misses the slot has already
+    // published the pointers this reader loads after pinning
+    if (slot.load(std::memory_order_relaxed) == FREE_SLOT &&
+        slot.compare_exchange_strong(expected, epoch_.load())) {
+      return Guard(&slot);
+    }
+    if (attempt % SLOT_COUNT == SLOT_COUNT - 1) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void EpochManager::Retire(std::shared_ptr<const void> object) {
+  // Destructors run outside the lock, they may retire objects themselves
+  RetiredList expired;
+  {
+    std::lock_guard guard(retired_mutex_);
+    // Readers which pin a later epoch can only load the replacement
+    retired_.emplace_back(epoch_.fetch_add(1), std::move(object));
+    expired = Collect();
+  }
+}
+
+EpochManager::RetiredList EpochManager::Collect() {
+  uint64_t min_epoch = epoch_.load();
+  for (size_t i = 0; i < SLOT_COUNT; ++i) {
+    const uint64_t epoch = slots_[i].epoch.load();
+    if (epoch != FREE_SLOT) {
+      min_epoch = std::min(min_epoch, epoch);
+    }
+  }
+  const auto it = std::find_if(retired_.begin(), retired_.end(), [min_epoch](const auto& retired) {
+    return retired.first >= min_epoch;
+  });
+  RetiredList expired(std::make_move_iterator(retired_.begin()), std::make_move_iterator(it));
+  retired_.erase(retired_.begin(), it);
+  return expired;
+}
+
+EpochManager::Guard::Guard(std::atomic<uint64_t>* slot) : slot_(slot) {}
+
+EpochManager::Guard::Guard(Guard&& other) noexcept : slot_(std::exchange(other.slot_, nullptr)) {}
+
+EpochManager::Guard& EpochManager::Guard::operator=(Guard&& other) noexcept {
+  if (this != &other) {
+    if (slot_ != nullptr) {
+      slot_->store(FREE_SLOT, std::memory_order_release);
+    }
+    slot_ = std::exchange(other.slot_, nullptr);
+  }
+  return *this;
+}
+
+EpochManager::Guard::~Guard() {
+  if (slot_ != nullptr) {
+    slot_->store(FREE_SLOT, std::memory_order_release);
+  }
+}
@@ -0,0 +1,68 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Epoch based reclamation. A reader pins the current epoch in a slot before it loads
+// published pointers, writers retire the objects they replace, and a retired object
+// is destroyed once every reader which could have loaded it is gone.
+// Readers take no locks, writers serialize on a mutex only while retiring
+class EpochManager {
+ public:
+  class Guard;
+
+  EpochManager();
+
+  EpochManager(const EpochManager&) = delete;
+
+  EpochManager& operator=(const EpochManager&) = delete;
+
+  // Readers with more pins than slots wait for a free slot
+  Guard Pin() const;
+
+  // Must be called after the replacement of the object is published
+  void Retire(std::shared_ptr<const void> object);
+
+ private:
+  static constexpr size_t SLOT_COUNT = 128;
+  static constexpr size_t CACHE_LINE_SIZE = 64;
+  static constexpr uint64_t FREE_SLOT = 0;
+
+  struct alignas(CACHE_LINE_SIZE) Slot {
+    std::atomic<uint64_t> epoch{FREE_SLOT};
+  };
+
+  // Objects with the epochs in which they were retired, oldest first
+  using RetiredList = std::vector<std::pair<uint64_t, std::shared_ptr<const void>>>;
+
+  // Takes the objects no reader can reach anymore out of the list
+  RetiredList Collect();
+
+  mutable std::unique_ptr<Slot[]> slots_;
+  std::atomic<uint64_t> epoch_ = 1;
+
+  std::mutex retired_mutex_;
+  RetiredList retired_;
+};
+
+// Keeps the pinned epoch until destroyed
+class EpochManager::Guard {
+ public:
+  Guard(Guard&& other) noexcept;
+
+  Guard& operator=(Guard&& other) noexcept;
+
+  ~Guard();
+
+ private:
+  friend class EpochManager;
+
+  explicit Guard(std::atomic<uint64_t>* slot);
+
+  std::atomic<uint64_t>* slot_;
+};
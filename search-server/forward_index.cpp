@@ -0,0 +1,56 @@
+﻿#include "forward_index.h"
+#include <algorithm>
+#include <stdexcept>
+
+void ForwardIndex::Add(const std::vector<Entry>& entries) {
+  entries_.insert(entries_.end(), entries.begin(), entries.end());
+  offsets_.push_back(entries_.size());
+}
+
+IteratorRange<const ForwardIndex::Entry*> ForwardIndex::GetEntries(int internal_id) const {
+  if (internal_id < mapped_count_) {
+    return {mapped_entries_ + mapped_offsets_[internal_id],
+            mapped_entries_ + mapped_offsets_[internal_id + 1]};
+  }
+  const size_t index = internal_id - mapped_count_;
+  return {entries_.data() + offsets_[index], entries_.data() + offsets_[index + 1]};
+}
+
+void ForwardIndex::Save(IndexFileWriter& writer) const {
+  const uint64_t mapped_size = mapped_count_ > 0 ? mapped_offsets_[mapped_count_] : 0;
+  writer.BeginSection(IndexSection::FORWARD_OFFSETS);
+  writer.WriteArray(mapped_offsets_, mapped_count_);
+  for (const uint64_t offset : offsets_) {
+    const uint64_t shifted = mapped_size + offset;
+    writer.WriteArray(&shifted, 1);
+  }
+  writer.EndSection();
+
+  writer.BeginSection(IndexSection::FORWARD_ENTRIES);
+  writer.WriteArray(mapped_entries_, mapped_size);
+  writer.WriteArray(entries_.data(), entries_.size());
+  writer.EndSection();
+}
+
+void ForwardIndex::Load(const IndexFile& file, int document_count, size_t term_count) {
+  const auto offsets = file.GetSection<uint64_t>(IndexSection::FORWARD_OFFSETS);
+  const auto entries = file.GetSection<Entry>(IndexSection::FORWARD_ENTRIES);
+  if (offsets.size() != static_cast<size_t>(document_count) + 1 || offsets.begin()[0] != 0 ||
+      !std::is_sorted(offsets.begin(), offsets.end()) ||
+      offsets.begin()[offsets.size() - 1] != entries.size()) {
+    throw std::runtime_error("Index file has invalid forward index");
+  }
+  // Terms of a document increase
+  for (size_t i = 0; !file.IsVerified() && i + 1 < offsets.size(); ++i) {
+    for (uint64_t j = offsets.begin()[i]; j < offsets.begin()[i + 1]; ++j) {
+      const Entry& entry = entries.begin()[j];
+      if (entry.term_id >= term_count ||
+          (j > offsets.begin()[i] && entry.term_id <= entries.begin()[j - 1].term_id)) {
+        throw std::runtime_error("Index file has invalid forward index");
+      }
+    }
+  }
+  mapped_offsets_ = offsets.begin();
+  mapped_entries_ = entries.begin();
+  mapped_count_ = static_cast<int>(offsets.size() - 1);
+}
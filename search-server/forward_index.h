@@ -0,0 +1,34 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "index_file.h"
+#include "index_segment.h"
+#include "paginator.h"
+
+// Terms of every document by internal id. Documents loaded from a file are kept
+// in the mapped sections, the ones added later are stored in memory
+class ForwardIndex {
+ public:
+  // Layout is stored in index files as is
+  using Entry = IndexSegment::TermEntry;
+
+  // Entries of the document with the next internal id
+  void Add(const std::vector<Entry>& entries);
+
+  IteratorRange<const Entry*> GetEntries(int internal_id) const;
+
+  void Save(IndexFileWriter& writer) const;
+
+  // Sections are used in place, the file must outlive the index. The index must be empty.
+  // Throws std::runtime_error unless the file has the entries of document_count documents
+  // with terms below term_count
+  void Load(const IndexFile& file, int document_count, size_t term_count);
+
+ private:
+  const uint64_t* mapped_offsets_ = nullptr;
+  const Entry* mapped_entries_ = nullptr;
+  int mapped_count_ = 0;
+  std::vector<uint64_t> offsets_ = {0};
+  std::vector<Entry> entries_;
+};
@@ -0,0 +1,224 @@
+﻿#include "index_file.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string_literals::operator""s;
+
+namespace {
+
+constexpr char MAGIC[8] = {'S', 'R', 'C', 'H', 'I', 'D', 'X', '\0'};
+constexpr uint32_t VERSION = 3;
+// Records are stored in the native layout, a file from a machine with another byte order is rejected
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+constexpr size_t SECTION_ALIGNMENT = 64;
+constexpr size_t SECTION_COUNT = static_cast<size_t>(IndexSection::COUNT);
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t file_size;
+  uint64_t checksum;
+  uint64_t section_offsets[SECTION_COUNT];
+  uint64_t section_sizes[SECTION_COUNT];
+};
+
+constexpr size_t BODY_OFFSET =
+    (sizeof(FileHeader) + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+
+uint64_t ComputeChecksum(const char* body,
+                         size_t body_size,
+                         const uint64_t* section_offsets,
+                         const uint64_t* section_sizes) {
+  IndexChecksum checksum;
+  checksum.Update(body, body_size);
+  checksum.Update(section_offsets, SECTION_COUNT * sizeof(uint64_t));
+  checksum.Update(section_sizes, SECTION_COUNT * sizeof(uint64_t));
+  return checksum.Finish();
+}
+
+}  // namespace
+
+void IndexChecksum::Update(const void* data, size_t size) {
+  const auto* bytes = static_cast<const char*>(data);
+  total_size_ += size;
+  while (pending_size_ > 0 && pending_size_ < 8 && size > 0) {
+    pending_ |= static_cast<uint64_t>(static_cast<unsigned char>(*bytes)) << (8 * pending_size_);
+    ++pending_size_;
+    ++bytes;
+    --size;
+  }
+  if (pending_size_ == 8) {
+    Mix(pending_);
+    pending_ = 0;
+    pending_size_ = 0;
+  }
+  for (; size >= 8; bytes += 8, size -= 8) {
+    uint64_t word;
+    std::memcpy(&word, bytes, 8);
+    Mix(word);
+  }
+  for (; size > 0; ++bytes, --size) {
+    pending_ |= static_cast<uint64_t>(static_cast<unsigned char>(*bytes)) << (8 * pending_size_);
+    ++pending_size_;
+  }
+}
+
+uint64_t IndexChecksum::Finish() const {
+  uint64_t hash = state_ ^ pending_ ^ (total_size_ * 0xC2B2AE3D27D4EB4Full);
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDull;
+  hash ^= hash >> 33;
+  hash *= 0xC4CEB9FE1A85EC53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+void IndexChecksum::Mix(uint64_t word) {
+  state_ = (state_ ^ word) * 0x9FB21C651E98DF25ull;
+  state_ ^= state_ >> 29;
+}
+
+IndexFileWriter::IndexFileWriter(const std::string& path)
+    : path_(path),
+      temporary_path_(path + ".tmp"s),
+      output_(temporary_path_, std::ios::binary | std::ios::trunc),
+      position_(BODY_OFFSET),
+      section_offsets_(SECTION_COUNT, 0),
+      section_sizes_(SECTION_COUNT, 0) {
+  if (!output_) {
+    throw std::runtime_error("Can't create index file "s + temporary_path_);
+  }
+  const std::vector<char> header(BODY_OFFSET, '\0');
+  output_.write(header.data(), header.size());
+}
+
+void IndexFileWriter::BeginSection(IndexSection section) {
+  WritePadding();
+  current_section_ = section;
+  section_offsets_[static_cast<size_t>(section)] = position_;
+}
+
+void IndexFileWriter::Write(const void* data, size_t size) {
+  output_.write(static_cast<const char*>(data), size);
+  checksum_.Update(data, size);
+  position_ += size;
+}
+
+void IndexFileWriter::EndSection() {
+  const auto section = static_cast<size_t>(current_section_);
+  section_sizes_[section] = position_ - section_offsets_[section];
+  current_section_ = IndexSection::COUNT;
+}
+
+void IndexFileWriter::Commit() {
+  WritePadding();
+  FileHeader header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.byte_order = BYTE_ORDER_MARK;
+  header.file_size = position_;
+  std::copy(section_offsets_.begin(), section_offsets_.end(), header.section_offsets);
+  std::copy(section_sizes_.begin(), section_sizes_.end(), header.section_sizes);
+  checksum_.Update(header.section_offsets, sizeof(header.section_offsets));
+  checksum_.Update(header.section_sizes, sizeof(header.section_sizes));
+  header.checksum = checksum_.Finish();
+
+  output_.seekp(0);
+  output_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  output_.close();
+  if (!output_) {
+    throw std::runtime_error("Can't write index file "s + temporary_path_);
+  }
+  if (std::rename(temporary_path_.c_str(), path_.c_str()) != 0) {
+    throw std::runtime_error("Can't replace index file "s + path_ + ": "s +
+                             std::strerror(errno));
+  }
+}
+
+void IndexFileWriter::WritePadding() {
+  static const char zeros[SECTION_ALIGNMENT] = {};
+  Write(zeros, (SECTION_ALIGNMENT - position_ % SECTION_ALIGNMENT) % SECTION_ALIGNMENT);
+}
+
+IndexFile::IndexFile(const std::string& path, bool verify_checksum) {
+  const int descriptor = open(path.c_str(), O_RDONLY);
+  if (descriptor < 0) {
+    throw std::runtime_error("Can't open index file "s + path + ": "s + std::strerror(errno));
+  }
+  struct stat file_stat;
+  if (fstat(descriptor, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) < BODY_OFFSET) {
+    close(descriptor);
+    throw std::runtime_error("Index file "s + path + " is truncated"s);
+  }
+  size_ = file_stat.st_size;
+  void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, descriptor, 0);
+  close(descriptor);
+  if (mapping == MAP_FAILED) {
+    throw std::runtime_error("Can't map index file "s + path + ": "s + std::strerror(errno));
+  }
+  data_ = static_cast<const char*>(mapping);
+
+  FileHeader header;
+  std::memcpy(&header, data_, sizeof(header));
+  std::string error;
+  if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+    error = "is not an index file"s;
+  } else if (header.version != VERSION || header.byte_order != BYTE_ORDER_MARK) {
+    error = "has unsupported version"s;
+  } else if (header.file_size != size_) {
+    error = "is truncated"s;
+  }
+  for (size_t i = 0; error.empty() && i < SECTION_COUNT; ++i) {
+    const uint64_t offset = header.section_offsets[i];
+    const uint64_t size = header.section_sizes[i];
+    // Sections never overlap the header
+    if (offset % SECTION_ALIGNMENT != 0 || (offset < BODY_OFFSET && size > 0) ||
+        offset > size_ || size > size_ - offset) {
+      error = "has invalid sections"s;
+    }
+  }
+  if (error.empty() && verify_checksum &&
+      ComputeChecksum(data_ + BODY_OFFSET, size_ - BODY_OFFSET, header.section_offsets,
+                      header.section_sizes) != header.checksum) {
+    error = "is damaged"s;
+  }
+  if (!error.empty()) {
+    munmap(const_cast<char*>(data_), size_);
+    throw std::runtime_error("Index file "s + path + " "s + error);
+  }
+  is_verified_ = verify_checksum;
+}
+
+IndexFile::~IndexFile() {
+  munmap(const_cast<char*>(data_), size_);
+}
+
+std::string_view IndexFile::GetText(IndexSection section) const {
+  const auto text = GetSection<char>(section);
+  return {text.begin(), text.size()};
+}
+
+bool IndexFile::IsVerified() const {
+  return is_verified_;
+}
+
+const char* IndexFile::GetSectionData(IndexSection section,
+                                      size_t alignment,
+                                      size_t& size) const {
+  FileHeader header;
+  std::memcpy(&header, data_, sizeof(header));
+  const uint64_t offset = header.section_offsets[static_cast<size_t>(section)];
+  if (offset % alignment != 0) {
+    throw std::runtime_error("Index file section is misaligned");
+  }
+  size = header.section_sizes[static_cast<size_t>(section)];
+  return data_ + offset;
+}
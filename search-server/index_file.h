@@ -0,0 +1,136 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "paginator.h"
+
+// Sections of an index file. Every section is an array of fixed layout records
+enum class IndexSection : uint32_t {
+  STOP_WORDS,
+  TERM_TEXT,
+  TERMS,
+  POSTING_BLOCKS,
+  POSTING_DATA,
+  POSTING_TAILS,
+  DOCUMENT_IDS,
+  DOCUMENT_RATINGS,
+  DOCUMENT_STATUSES,
+  DOCUMENT_INV_WORD_COUNTS,
+  DOCUMENT_STATUS_BITMAPS,
+  FORWARD_OFFSETS,
+  FORWARD_ENTRIES,
+  POSITION_OFFSETS,
+  POSITION_DATA,
+  COUNT,
+};
+
+// Streaming 64-bit checksum of the index file body
+class IndexChecksum {
+ public:
+  void Update(const void* data, size_t size);
+
+  uint64_t Finish() const;
+
+ private:
+  void Mix(uint64_t word);
+
+  uint64_t state_ = 0x9E3779B97F4A7C15ull;
+  uint64_t pending_ = 0;
+  size_t pending_size_ = 0;
+  uint64_t total_size_ = 0;
+};
+
+// Writes sections one after another to a temporary file which replaces the target
+// on Commit, so a file mapped by a running server is never overwritten
+class IndexFileWriter {
+ public:
+  explicit IndexFileWriter(const std::string& path);
+
+  void BeginSection(IndexSection section);
+
+  void Write(const void* data, size_t size);
+
+  template <typename T>
+  void WriteArray(const T* data, size_t count);
+
+  template <typename T>
+  void WriteSection(IndexSection section, const std::vector<T>& values);
+
+  void EndSection();
+
+  void Commit();
+
+ private:
+  void WritePadding();
+
+  std::string path_;
+  std::string temporary_path_;
+  std::ofstream output_;
+  IndexChecksum checksum_;
+  uint64_t position_ = 0;
+  std::vector<uint64_t> section_offsets_;
+  std::vector<uint64_t> section_sizes_;
+  IndexSection current_section_ = IndexSection::COUNT;
+};
+
+// Read-only memory mapping of an index file. Sections are used in place,
+// nothing is read until the pages are touched
+class IndexFile {
+ public:
+  // Throws std::runtime_error if the file can't be mapped or isn't a valid index.
+  // The checksum check reads the whole file
+  explicit IndexFile(const std::string& path, bool verify_checksum = true);
+
+  IndexFile(const IndexFile&) = delete;
+
+  IndexFile& operator=(const IndexFile&) = delete;
+
+  ~IndexFile();
+
+  template <typename T>
+  IteratorRange<const T*> GetSection(IndexSection section) const;
+
+  std::string_view GetText(IndexSection section) const;
+
+  // Whether the checksum was checked. Otherwise the readers of the sections decode and
+  // check their contents, which may be damaged, before using them
+  bool IsVerified() const;
+
+ private:
+  const char* GetSectionData(IndexSection section, size_t alignment, size_t& size) const;
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool is_verified_ = false;
+};
+
+template <typename T>
+void IndexFileWriter::WriteArray(const T* data, size_t count) {
+  static_assert(std::is_trivially_copyable_v<T>, "Only plain records can be written");
+  Write(data, count * sizeof(T));
+}
+
+template <typename T>
+void IndexFileWriter::WriteSection(IndexSection section, const std::vector<T>& values) {
+  BeginSection(section);
+  WriteArray(values.data(), values.size());
+  EndSection();
+}
+
+template <typename T>
+IteratorRange<const T*> IndexFile::GetSection(IndexSection section) const {
+  static_assert(std::is_trivially_copyable_v<T>, "Only plain records can be mapped");
+  size_t size = 0;
+  const char* data = GetSectionData(section, alignof(T), size);
+  if (size % sizeof(T) != 0) {
+    throw std::runtime_error("Index file section has invalid size");
+  }
+  const auto* first = reinterpret_cast<const T*>(data);
+  return {first, first + size / sizeof(T)};
+}
@@ -0,0 +1,91 @@
+﻿#include "index_segment.h"
+#include <algorithm>
+
+IndexSegment::IndexSegment(int first_document_id) : first_document_id_(first_document_id) {}
+
+const PostingList* IndexSegment::FindPostings(TermId term_id) const {
+  const auto it = std::lower_bound(terms_.begin(), terms_.end(), term_id);
+  return it == terms_.end() || *it != term_id ? nullptr : &postings_[it - terms_.begin()];
+}
+
+int IndexSegment::GetFirstDocumentId() const {
+  return first_document_id_;
+}
+
+int IndexSegment::GetDocumentLimit() const {
+  return first_document_id_ + static_cast<int>(inv_word_counts_.size());
+}
+
+size_t IndexSegment::GetDocumentCount() const {
+  return document_count_;
+}
+
+size_t IndexSegment::GetMemoryUsage() const {
+  size_t result = sizeof(*this) + inv_word_counts_.capacity() * sizeof(double) +
+                  terms_.capacity() * sizeof(TermId) +
+                  (postings_.capacity() - postings_.size()) * sizeof(PostingList);
+  for (const auto& postings : postings_) {
+    result += postings.GetMemoryUsage();
+  }
+  return result;
+}
+
+std::shared_ptr<const IndexSegment> IndexSegment::Merge(
+    const std::vector<std::shared_ptr<const IndexSegment>>& segments,
+    const std::vector<bool>& removed,
+    const std::atomic<bool>& is_stopping) {
+  const int first_document_id = segments.front()->first_document_id_;
+  auto merged = std::make_shared<IndexSegment>(first_document_id);
+  for (const auto& segment : segments) {
+    merged->inv_word_counts_.insert(merged->inv_word_counts_.end(),
+                                    segment->inv_word_counts_.begin(),
+                                    segment->inv_word_counts_.end());
+    merged->document_count_ += segment->document_count_;
+  }
+
+  std::vector<TermId> terms;
+  for (const auto& segment : segments) {
+    terms.insert(terms.end(), segment->terms_.begin(), segment->terms_.end());
+  }
+  std::sort(terms.begin(), terms.end());
+  terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+  merged->document_count_ -= std::count(removed.begin(), removed.end(), true);
+  const auto& inv_word_counts = merged->inv_word_counts_;
+  for (const TermId term_id : terms) {
+    if (is_stopping.load(std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    PostingList postings;
+    for (const auto& segment : segments) {
+      const PostingList* source = segment->FindPostings(term_id);
+      if (source == nullptr) {
+        continue;
+      }
+      source->ForEach([&](int document_id, uint32_t term_count) {
+        const size_t index = document_id - first_document_id;
+        if (!removed[index]) {
+          postings.Add(document_id, term_count, term_count * inv_word_counts[index]);
+        }
+      });
+    }
+    if (!postings.empty()) {
+      merged->terms_.push_back(term_id);
+      merged->postings_.push_back(std::move(postings));
+    }
+  }
+  return merged;
+}
+
+std::shared_ptr<const IndexSegment> IndexSegment::FromPostings(
+    int first_document_id,
+    std::vector<double> inv_word_counts,
+    std::vector<TermId> terms,
+    std::vector<PostingList> postings) {
+  auto segment = std::make_shared<IndexSegment>(first_document_id);
+  segment->document_count_ = inv_word_counts.size();
+  segment->inv_word_counts_ = std::move(inv_word_counts);
+  segment->terms_ = std::move(terms);
+  segment->postings_ = std::move(postings);
+  return segment;
+}
@@ -0,0 +1,67 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "posting_list.h"
+
+// Postings of the documents with internal ids in [GetFirstDocumentId(), GetDocumentLimit()).
+// Segments are built by sealing a MutableSegment or by merges and never modified:
+// merges replace them with new ones
+class IndexSegment {
+ public:
+  using TermId = uint32_t;
+
+  struct TermEntry {
+    TermId term_id;
+    uint32_t term_count;
+  };
+
+  explicit IndexSegment(int first_document_id);
+
+  // nullptr if no document of the segment has the term
+  const PostingList* FindPostings(TermId term_id) const;
+
+  int GetFirstDocumentId() const;
+
+  int GetDocumentLimit() const;
+
+  // Documents having postings, removed ones are dropped by merges
+  size_t GetDocumentCount() const;
+
+  size_t GetMemoryUsage() const;
+
+  // Calls callback(term_id, postings) in increasing term_id order
+  template <typename Callback>
+  void ForEachTerm(Callback callback) const;
+
+  // Segment with the postings of consecutive segments except the removed documents.
+  // removed[i] marks the document first_document_id + i. Returns nullptr once is_stopping is set
+  static std::shared_ptr<const IndexSegment> Merge(
+      const std::vector<std::shared_ptr<const IndexSegment>>& segments,
+      const std::vector<bool>& removed,
+      const std::atomic<bool>& is_stopping);
+
+  // Segment over posting lists sorted by term, e.g. lists kept in a mapped index file
+  static std::shared_ptr<const IndexSegment> FromPostings(int first_document_id,
+                                                          std::vector<double> inv_word_counts,
+                                                          std::vector<TermId> terms,
+                                                          std::vector<PostingList> postings);
+
+ private:
+  int first_document_id_;
+  size_t document_count_ = 0;
+  std::vector<double> inv_word_counts_;
+  std::vector<TermId> terms_;
+  std::vector<PostingList> postings_;
+};
+
+using SegmentList = std::vector<std::shared_ptr<const IndexSegment>>;
+
+template <typename Callback>
+void IndexSegment::ForEachTerm(Callback callback) const {
+  for (size_t i = 0; i < terms_.size(); ++i) {
+    callback(terms_[i], postings_[i]);
+  }
+}
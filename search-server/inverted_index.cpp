@@ -0,0 +1,558 @@
+﻿#include "inverted_index.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+namespace {
+
+// Where the parts of a posting list are stored in the posting sections
+// Whether [offset, offset + size) lies inside a section of the given size
+bool IsInside(uint64_t offset, uint64_t size, size_t section_size) {
+  return offset <= section_size && size <= section_size - offset;
+}
+
+struct TermRecord {
+  uint64_t text_offset;
+  uint32_t text_size;
+  uint32_t block_count;
+  uint64_t block_offset;
+  uint64_t data_offset;
+  uint64_t data_size;
+  uint64_t tail_offset;
+  uint32_t tail_size;
+  float max_term_freq;
+  float tail_max_term_freq;
+  uint32_t reserved;
+};
+
+}  // namespace
+
+InvertedIndex::InvertedIndex(EpochManager& epochs)
+    : epochs_(epochs),
+      term_ids_(epochs),
+      mutable_segment_(std::make_shared<MutableSegment>(epochs, 0)) {
+  std::lock_guard guard(mutex_);
+  Publish({generation_, std::make_shared<const SegmentList>(), mutable_segment_, 0, 0, 0,
+           std::make_shared<const SortedTerms>(terms_)});
+}
+
+InvertedIndex::~InvertedIndex() {
+  {
+    std::lock_guard guard(mutex_);
+    is_stopping_ = true;
+  }
+  merge_condition_.notify_all();
+  if (merge_thread_.joinable()) {
+    merge_thread_.join();
+  }
+}
+
+InvertedIndex::TermId InvertedIndex::AddTerm(std::string_view word) {
+  if (const TermId term_id = FindTerm(word); term_id != NO_TERM) {
+    return term_id;
+  }
+  const auto term_id = static_cast<TermId>(terms_.size());
+  terms_.emplace_back(term_storage_.emplace_back(word));
+  document_freqs_.emplace_back(nullptr);
+  // Readers find the term only after its fields are filled
+  term_ids_.Insert(HashTerm(word), term_id);
+  unsorted_terms_.push_back(term_id);
+  return term_id;
+}
+
+std::string_view InvertedIndex::GetTerm(TermId term_id) const {
+  return terms_[term_id];
+}
+
+size_t InvertedIndex::GetTermCount() const {
+  return terms_.size();
+}
+
+uint64_t InvertedIndex::GetNextGeneration() const {
+  return generation_ + 1;
+}
+
+void InvertedIndex::AddDocument(double inv_word_count, const std::vector<TermEntry>& entries) {
+  std::lock_guard guard(mutex_);
+  IndexVersion version = *version_;
+  version.generation = GetNextGeneration();
+  AppendDocument(version, GetMinReaderGeneration(), inv_word_count, entries);
+  SortNewTerms(version);
+  generation_ = version.generation;
+  Publish(std::move(version));
+}
+
+void InvertedIndex::AddDocuments(const std::vector<DocumentEntries>& documents) {
+  std::lock_guard guard(mutex_);
+  IndexVersion version = *version_;
+  version.generation = GetNextGeneration();
+  const uint64_t min_reader_generation = GetMinReaderGeneration();
+  for (const auto& document : documents) {
+    AppendDocument(version, min_reader_generation, document.inv_word_count, document.entries);
+  }
+  SortNewTerms(version);
+  generation_ = version.generation;
+  Publish(std::move(version));
+}
+
+void InvertedIndex::RemoveDocument(int document_id, IteratorRange<const TermEntry*> entries) {
+  RemoveDocuments({{document_id, entries}});
+}
+
+void InvertedIndex::RemoveDocuments(const std::vector<RemovedDocument>& documents) {
+  std::lock_guard guard(mutex_);
+  IndexVersion version = *version_;
+  version.generation = GetNextGeneration();
+  const uint64_t min_reader_generation = GetMinReaderGeneration();
+  for (const auto& document : documents) {
+    for (const auto& entry : document.entries) {
+      UpdateDocumentFreq(entry.term_id, -1, version.generation, min_reader_generation);
+      version.word_count -= entry.term_count;
+    }
+    SetRemoved(document.document_id);
+    --version.document_count;
+  }
+  generation_ = version.generation;
+  Publish(std::move(version));
+
+  // Segments full of removed documents are rewritten, checking them on every removal is too much
+  removals_since_merge_check_ += documents.size();
+  if (removals_since_merge_check_ >= SEGMENT_DOCUMENT_COUNT) {
+    removals_since_merge_check_ = 0;
+    has_merge_work_ = true;
+    merge_condition_.notify_one();
+  }
+}
+
+IndexSnapshot InvertedIndex::GetSnapshot() const {
+  // The pin comes first: a version loaded after it isn't destroyed until the pin is released
+  auto guard = epochs_.Pin();
+  const IndexVersion* version = published_version_.load();
+  return IndexSnapshot(*this, std::move(guard), *version);
+}
+
+size_t InvertedIndex::GetPostingsMemoryUsage() const {
+  std::lock_guard guard(mutex_);
+  size_t result = mutable_segment_->GetMemoryUsage();
+  for (const auto& segment : *version_->segments) {
+    result += segment->GetMemoryUsage();
+  }
+  return result;
+}
+
+size_t InvertedIndex::GetSegmentCount() const {
+  std::lock_guard guard(mutex_);
+  return version_->segments->size();
+}
+
+void InvertedIndex::WaitForMerges() const {
+  std::unique_lock lock(mutex_);
+  // Without sealed segments there is no merge thread and nothing to merge
+  merges_done_condition_.wait(lock, [this] {
+    return !has_merge_work_ || !merge_thread_.joinable() || is_stopping_;
+  });
+}
+
+void InvertedIndex::Save(IndexFileWriter& writer) const {
+  SegmentList segments;
+  std::vector<bool> removed;
+  {
+    std::lock_guard guard(mutex_);
+    segments = *version_->segments;
+    removed = GetRemoved(0, mutable_segment_->GetDocumentLimit());
+  }
+  segments.push_back(mutable_segment_->Seal());
+  const std::atomic<bool> is_stopping = false;
+  const auto merged = IndexSegment::Merge(segments, removed, is_stopping);
+  const PostingList empty_postings;
+  const auto get_storage = [&](TermId term_id) {
+    const PostingList* postings = merged->FindPostings(term_id);
+    return (postings != nullptr ? *postings : empty_postings).GetStorage();
+  };
+
+  writer.BeginSection(IndexSection::TERM_TEXT);
+  for (TermId term_id = 0; term_id < terms_.size(); ++term_id) {
+    writer.Write(terms_[term_id].data(), terms_[term_id].size());
+  }
+  writer.EndSection();
+
+  writer.BeginSection(IndexSection::TERMS);
+  TermRecord record{};
+  for (TermId term_id = 0; term_id < terms_.size(); ++term_id) {
+    const auto storage = get_storage(term_id);
+    record.text_size = static_cast<uint32_t>(terms_[term_id].size());
+    record.block_count = static_cast<uint32_t>(storage.block_count);
+    record.data_size = storage.data_size;
+    record.tail_size = static_cast<uint32_t>(storage.tail_size);
+    record.max_term_freq = storage.max_term_freq;
+    record.tail_max_term_freq = storage.tail_max_term_freq;
+    writer.WriteArray(&record, 1);
+    record.text_offset += record.text_size;
+    record.block_offset += record.block_count;
+    record.data_offset += record.data_size;
+    record.tail_offset += record.tail_size;
+  }
+  writer.EndSection();
+
+  writer.BeginSection(IndexSection::POSTING_BLOCKS);
+  for (TermId term_id = 0; term_id < terms_.size(); ++term_id) {
+    const auto storage = get_storage(term_id);
+    writer.WriteArray(storage.blocks, storage.block_count);
+  }
+  writer.EndSection();
+
+  writer.BeginSection(IndexSection::POSTING_DATA);
+  for (TermId term_id = 0; term_id < terms_.size(); ++term_id) {
+    const auto storage = get_storage(term_id);
+    writer.WriteArray(storage.data, storage.data_size);
+  }
+  writer.EndSection();
+
+  writer.BeginSection(IndexSection::POSTING_TAILS);
+  for (TermId term_id = 0; term_id < terms_.size(); ++term_id) {
+    const auto storage = get_storage(term_id);
+    writer.WriteArray(storage.tail, storage.tail_size);
+  }
+  writer.EndSection();
+}
+
+void InvertedIndex::Load(const IndexFile& file, size_t document_count, uint64_t word_count) {
+  const auto text = file.GetText(IndexSection::TERM_TEXT);
+  const auto records = file.GetSection<TermRecord>(IndexSection::TERMS);
+  const auto blocks = file.GetSection<PostingList::Block>(IndexSection::POSTING_BLOCKS);
+  const auto data = file.GetSection<uint32_t>(IndexSection::POSTING_DATA);
+  const auto tails = file.GetSection<PostingList::Entry>(IndexSection::POSTING_TAILS);
+  const auto inv_word_counts = file.GetSection<double>(IndexSection::DOCUMENT_INV_WORD_COUNTS);
+
+  std::vector<TermId> segment_terms;
+  std::vector<PostingList> segment_postings;
+  for (const auto& record : records) {
+    if (!IsInside(record.text_offset, record.text_size, text.size()) ||
+        !IsInside(record.block_offset, record.block_count, blocks.size()) ||
+        !IsInside(record.data_offset, record.data_size, data.size()) ||
+        !IsInside(record.tail_offset, record.tail_size, tails.size())) {
+      throw std::runtime_error("Index file has invalid terms");
+    }
+    const PostingList::Storage storage{blocks.begin() + record.block_offset, record.block_count,
+                                       data.begin() + record.data_offset, record.data_size,
+                                       tails.begin() + record.tail_offset, record.tail_size,
+                                       record.max_term_freq, record.tail_max_term_freq};
+    if (!PostingList::IsValidStorage(storage, static_cast<int>(inv_word_counts.size()),
+                                     !file.IsVerified())) {
+      throw std::runtime_error("Index file has invalid postings");
+    }
+    const auto term_id = static_cast<TermId>(terms_.size());
+    const auto word = text.substr(record.text_offset, record.text_size);
+    terms_.emplace_back(word);
+    term_ids_.Insert(HashTerm(word), term_id);
+    unsorted_terms_.push_back(term_id);
+    auto postings = PostingList::FromStorage(storage);
+    FreqNode* node = nullptr;
+    if (!postings.empty()) {
+      node = &freq_nodes_.emplace_back(
+          FreqNode{generation_, static_cast<uint32_t>(postings.size()), nullptr});
+    }
+    document_freqs_.emplace_back(node);
+    if (!postings.empty()) {
+      segment_terms.push_back(term_id);
+      segment_postings.push_back(std::move(postings));
+    }
+  }
+
+  const auto segment = IndexSegment::FromPostings(
+      0, {inv_word_counts.begin(), inv_word_counts.end()}, std::move(segment_terms),
+      std::move(segment_postings));
+  mutable_segment_ = std::make_shared<MutableSegment>(epochs_, segment->GetDocumentLimit());
+  std::lock_guard guard(mutex_);
+  IndexVersion version{generation_, std::make_shared<const SegmentList>(SegmentList{segment}),
+                       mutable_segment_, segment->GetDocumentLimit(), document_count, word_count,
+                       version_->sorted_terms};
+  SortNewTerms(version);
+  Publish(std::move(version));
+}
+
+size_t InvertedIndex::GetTermCount(const IndexFile& file) {
+  return file.GetSection<TermRecord>(IndexSection::TERMS).size();
+}
+
+uint32_t InvertedIndex::HashTerm(std::string_view word) {
+  const uint64_t hash = std::hash<std::string_view>{}(word);
+  return static_cast<uint32_t>(hash ^ (hash >> 32));
+}
+
+InvertedIndex::TermId InvertedIndex::FindTerm(std::string_view word) const {
+  const uint32_t term_id =
+      term_ids_.Find(HashTerm(word), [this, word](uint32_t id) { return terms_[id] == word; });
+  return term_id == EpochHashTable::NO_VALUE ? NO_TERM : term_id;
+}
+
+size_t InvertedIndex::GetDocumentFreq(TermId term_id, uint64_t generation) const {
+  const FreqNode* node = document_freqs_[term_id].load(std::memory_order_acquire);
+  while (node != nullptr && node->generation > generation) {
+    node = node->older;
+  }
+  return node != nullptr ? node->document_freq : 0;
+}
+
+void InvertedIndex::UpdateDocumentFreq(TermId term_id,
+                                       int delta,
+                                       uint64_t generation,
+                                       uint64_t min_reader_generation) {
+  auto& head = document_freqs_[term_id];
+  FreqNode* const older = head.load(std::memory_order_relaxed);
+  // Readers skip nodes of generations not published yet without reading the counts,
+  // so a batch changes the node of its generation in place
+  if (older != nullptr && older->generation == generation) {
+    older->document_freq += delta;
+    return;
+  }
+  FreqNode* node = nullptr;
+  if (free_freq_nodes_.empty()) {
+    node = &freq_nodes_.emplace_back();
+  } else {
+    node = free_freq_nodes_.back();
+    free_freq_nodes_.pop_back();
+  }
+  *node = {generation, (older != nullptr ? older->document_freq : 0) + delta, older};
+  head.store(node, std::memory_order_release);
+
+  // Every reader stops at the first node not newer than its generation,
+  // so the nodes after the one of the oldest reader are never visited again
+  for (FreqNode* current = node; current != nullptr; current = current->older) {
+    if (current->generation <= min_reader_generation) {
+      for (FreqNode* unused = current->older; unused != nullptr; unused = unused->older) {
+        free_freq_nodes_.push_back(unused);
+      }
+      current->older = nullptr;
+      break;
+    }
+  }
+}
+
+uint64_t InvertedIndex::GetMinReaderGeneration() {
+  // Versions are destroyed in the order they were retired, so the oldest alive one is first
+  while (!retired_versions_.empty()) {
+    if (const auto version = retired_versions_.front().lock()) {
+      return version->generation;
+    }
+    retired_versions_.pop_front();
+  }
+  return version_->generation;
+}
+
+void InvertedIndex::Publish(IndexVersion version) {
+  auto next = std::make_shared<const IndexVersion>(std::move(version));
+  published_version_.store(next.get());
+  if (version_ != nullptr) {
+    retired_versions_.push_back(version_);
+    epochs_.Retire(std::exchange(version_, std::move(next)));
+  } else {
+    version_ = std::move(next);
+  }
+}
+
+void InvertedIndex::AppendDocument(IndexVersion& version,
+                                   uint64_t min_reader_generation,
+                                   double inv_word_count,
+                                   const std::vector<TermEntry>& entries) {
+  for (const auto& entry : entries) {
+    UpdateDocumentFreq(entry.term_id, 1, version.generation, min_reader_generation);
+    version.word_count += entry.term_count;
+  }
+  // Postings of the new document stay invisible until the version with its id is published
+  mutable_segment_->AddDocument(inv_word_count, entries.data(), entries.size());
+  version.document_limit = mutable_segment_->GetDocumentLimit();
+  ++version.document_count;
+  if (mutable_segment_->GetDocumentCount() >= SEGMENT_DOCUMENT_COUNT) {
+    SealMutableSegment(version);
+  }
+}
+
+void InvertedIndex::SortNewTerms(IndexVersion& version) {
+  if (!unsorted_terms_.empty()) {
+    version.sorted_terms = version.sorted_terms->Add(std::exchange(unsorted_terms_, {}));
+  }
+}
+
+void InvertedIndex::SealMutableSegment(IndexVersion& version) {
+  auto segments = std::make_shared<SegmentList>(*version.segments);
+  segments->push_back(mutable_segment_->Seal());
+  version.segments = std::move(segments);
+  mutable_segment_ = std::make_shared<MutableSegment>(epochs_, version.document_limit);
+  version.mutable_segment = mutable_segment_;
+  has_merge_work_ = true;
+  if (!merge_thread_.joinable()) {
+    merge_thread_ = std::thread([this] { RunMerges(); });
+  }
+  merge_condition_.notify_one();
+}
+
+void InvertedIndex::RunMerges() {
+  std::unique_lock lock(mutex_);
+  while (true) {
+    merge_condition_.wait(lock, [this] { return has_merge_work_ || is_stopping_; });
+    if (is_stopping_) {
+      return;
+    }
+    const auto [first, last] = PlanMerge(*version_->segments);
+    if (first == last) {
+      has_merge_work_ = false;
+      merges_done_condition_.notify_all();
+      continue;
+    }
+
+    const SegmentList picked(version_->segments->begin() + first,
+                             version_->segments->begin() + last);
+    const int first_document_id = picked.front()->GetFirstDocumentId();
+    const int document_limit = picked.back()->GetDocumentLimit();
+    const std::vector<bool> removed = GetRemoved(first_document_id, document_limit);
+
+    lock.unlock();
+    const auto merged = IndexSegment::Merge(picked, removed, is_stopping_);
+    lock.lock();
+    if (merged == nullptr) {
+      return;
+    }
+
+    // Only this thread replaces sealed segments, so they are still in place. Versions
+    // pinned before keep the old segments, which still have the removed documents.
+    // Documents removed during the merge stay marked for the next one
+    for (size_t i = 0; i < removed.size(); ++i) {
+      if (removed[i]) {
+        const int document_id = first_document_id + static_cast<int>(i);
+        removed_bits_[document_id / 64] &= ~(uint64_t{1} << (document_id % 64));
+      }
+    }
+    const auto& current = *version_->segments;
+    const auto position = std::find(current.begin(), current.end(), picked.front()) - current.begin();
+    auto segments = std::make_shared<SegmentList>(current.begin(), current.begin() + position);
+    segments->push_back(merged);
+    segments->insert(segments->end(), current.begin() + position + picked.size(), current.end());
+    IndexVersion version = *version_;
+    version.segments = std::move(segments);
+    Publish(std::move(version));
+  }
+}
+
+std::pair<size_t, size_t> InvertedIndex::PlanMerge(const SegmentList& segments) const {
+  const auto get_tier = [](size_t document_count) {
+    size_t tier = 0;
+    for (size_t size = SEGMENT_DOCUMENT_COUNT * MERGE_FACTOR; document_count >= size;
+         size *= MERGE_FACTOR) {
+      ++tier;
+    }
+    return tier;
+  };
+
+  // Segments with mostly removed documents are rewritten alone
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const size_t removed_count =
+        CountRemoved(segments[i]->GetFirstDocumentId(), segments[i]->GetDocumentLimit());
+    if (removed_count > 0 && removed_count * 2 >= segments[i]->GetDocumentCount()) {
+      return {i, i + 1};
+    }
+  }
+
+  // Otherwise MERGE_FACTOR neighbours of the same tier are merged
+  size_t run_begin = 0;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    if (i > 0 && get_tier(segments[i]->GetDocumentCount()) !=
+                     get_tier(segments[i - 1]->GetDocumentCount())) {
+      run_begin = i;
+    }
+    if (i + 1 - run_begin == MERGE_FACTOR) {
+      return {run_begin, i + 1};
+    }
+  }
+  return {0, 0};
+}
+
+void InvertedIndex::SetRemoved(int document_id) {
+  const size_t word = document_id / 64;
+  if (word >= removed_bits_.size()) {
+    removed_bits_.resize(word + 1, 0);
+  }
+  removed_bits_[word] |= uint64_t{1} << (document_id % 64);
+}
+
+std::vector<bool> InvertedIndex::GetRemoved(int first_document_id, int document_limit) const {
+  std::vector<bool> removed(document_limit - first_document_id, false);
+  for (int document_id = first_document_id; document_id < document_limit; ++document_id) {
+    const size_t word = document_id / 64;
+    if (word >= removed_bits_.size()) {
+      break;
+    }
+    removed[document_id - first_document_id] = (removed_bits_[word] >> (document_id % 64)) & 1;
+  }
+  return removed;
+}
+
+size_t InvertedIndex::CountRemoved(int first_document_id, int document_limit) const {
+  size_t result = 0;
+  for (int document_id = first_document_id; document_id < document_limit;) {
+    const size_t word = document_id / 64;
+    if (word >= removed_bits_.size()) {
+      break;
+    }
+    const int word_end = std::min(document_limit, static_cast<int>(word + 1) * 64);
+    uint64_t bits = removed_bits_[word] >> (document_id % 64);
+    if (word_end - document_id < 64) {
+      bits &= (uint64_t{1} << (word_end - document_id)) - 1;
+    }
+    result += __builtin_popcountll(bits);
+    document_id = word_end;
+  }
+  return result;
+}
+
+IndexSnapshot::IndexSnapshot(const InvertedIndex& index,
+                             EpochManager::Guard guard,
+                             const IndexVersion& version)
+    : SegmentSnapshot(*version.segments, *version.mutable_segment, version.document_limit),
+      index_(&index),
+      guard_(std::move(guard)),
+      version_(&version) {}
+
+InvertedIndex::TermId IndexSnapshot::FindTerm(std::string_view word) const {
+  const auto term_id = index_->FindTerm(word);
+  return term_id != InvertedIndex::NO_TERM && GetDocumentFreq(term_id) > 0
+             ? term_id
+             : InvertedIndex::NO_TERM;
+}
+
+void IndexSnapshot::FindTermsWithPrefix(std::string_view prefix,
+                                        size_t max_count,
+                                        std::vector<InvertedIndex::TermId>& term_ids) const {
+  term_ids.clear();
+  // Every run gives its first max_count terms, the first ones overall are among them
+  version_->sorted_terms->ForEachWithPrefix(prefix, [&](const InvertedIndex::TermId* first,
+                                                        const InvertedIndex::TermId* last) {
+    for (size_t count = 0; first != last && count < max_count; ++first) {
+      if (GetDocumentFreq(*first) > 0) {
+        term_ids.push_back(*first);
+        ++count;
+      }
+    }
+  });
+  std::sort(term_ids.begin(), term_ids.end(), [this](auto lhs, auto rhs) {
+    return index_->terms_[lhs] < index_->terms_[rhs];
+  });
+  term_ids.resize(std::min(term_ids.size(), max_count));
+}
+
+size_t IndexSnapshot::GetDocumentFreq(InvertedIndex::TermId term_id) const {
+  return index_->GetDocumentFreq(term_id, version_->generation);
+}
+
+size_t IndexSnapshot::GetDocumentCount() const {
+  return version_->document_count;
+}
+
+uint64_t IndexSnapshot::GetWordCount() const {
+  return version_->word_count;
+}
+
+uint64_t IndexSnapshot::GetGeneration() const {
+  return version_->generation;
+}
@@ -0,0 +1,239 @@
+﻿#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "concurrent_vector.h"
+#include "epoch_hash_table.h"
+#include "epoch_manager.h"
+#include "index_file.h"
+#include "index_segment.h"
+#include "mutable_segment.h"
+#include "paginator.h"
+#include "segment_snapshot.h"
+#include "sorted_terms.h"
+
+// State of the index seen by queries, never changed once published
+struct IndexVersion {
+  // Advanced by every change of the documents, merges publish the same generation
+  uint64_t generation;
+  // Sealed segments in the order of ids
+  std::shared_ptr<const SegmentList> segments;
+  std::shared_ptr<const MutableSegment> mutable_segment;
+  int document_limit;
+  size_t document_count;
+  // Words of the live documents
+  uint64_t word_count;
+  // Every term added before the version, also the ones without live documents
+  std::shared_ptr<const SortedTerms> sorted_terms;
+};
+
+class IndexSnapshot;
+
+// Term dictionary with postings split into segments: new documents go to a mutable
+// segment, full segments are sealed and merged by a background thread.
+// One writer at a time changes the index and publishes a new IndexVersion after every
+// change, queries on any number of threads read snapshots of versions without locks
+class InvertedIndex {
+ public:
+  using TermId = IndexSegment::TermId;
+  using TermEntry = IndexSegment::TermEntry;
+  static constexpr TermId NO_TERM = UINT32_MAX;
+  // Documents of the mutable segment before it is sealed
+  static constexpr size_t SEGMENT_DOCUMENT_COUNT = 4096;
+  // Sealed segments of a size tier merged together
+  static constexpr size_t MERGE_FACTOR = 4;
+
+  explicit InvertedIndex(EpochManager& epochs);
+
+  InvertedIndex(const InvertedIndex&) = delete;
+
+  InvertedIndex& operator=(const InvertedIndex&) = delete;
+
+  ~InvertedIndex();
+
+  TermId AddTerm(std::string_view word);
+
+  // The returned view stays valid for the whole lifetime of the index
+  std::string_view GetTerm(TermId term_id) const;
+
+  size_t GetTermCount() const;
+
+  // Generation the next change publishes, the writer stamps its own changes with it
+  uint64_t GetNextGeneration() const;
+
+  // Postings of a document, entries have distinct terms
+  struct DocumentEntries {
+    double inv_word_count;
+    std::vector<TermEntry> entries;
+  };
+
+  // Postings of the document with the next internal id, entries have distinct terms
+  void AddDocument(double inv_word_count, const std::vector<TermEntry>& entries);
+
+  // Documents with consecutive internal ids from the next one on, published at once
+  void AddDocuments(const std::vector<DocumentEntries>& documents);
+
+  struct RemovedDocument {
+    int document_id;
+    IteratorRange<const TermEntry*> entries;
+  };
+
+  // The postings stay in their segment until it is merged, queries must skip the document
+  void RemoveDocument(int document_id, IteratorRange<const TermEntry*> entries);
+
+  // Removes live documents at once, segments are compacted by the merge thread later
+  void RemoveDocuments(const std::vector<RemovedDocument>& documents);
+
+  // Pins the current version, may be called on any thread
+  IndexSnapshot GetSnapshot() const;
+
+  size_t GetPostingsMemoryUsage() const;
+
+  // Sealed segments of the current version
+  size_t GetSegmentCount() const;
+
+  // Blocks until the merge thread has nothing left to merge
+  void WaitForMerges() const;
+
+  // Removed documents are left out of the file
+  void Save(IndexFileWriter& writer) const;
+
+  // Terms and postings are used in place, the file must outlive the index.
+  // The index must be empty. Throws std::runtime_error for postings out of their sections
+  // or of the documents
+  void Load(const IndexFile& file, size_t document_count, uint64_t word_count);
+
+  // Number of the terms in the file
+  static size_t GetTermCount(const IndexFile& file);
+
+ private:
+  friend class IndexSnapshot;
+
+  // Document frequency of a term from the generation on. Older values stay in the chain
+  // while readers of older generations may ask for them
+  struct FreqNode {
+    uint64_t generation;
+    uint32_t document_freq;
+    FreqNode* older;
+  };
+
+  static uint32_t HashTerm(std::string_view word);
+
+  TermId FindTerm(std::string_view word) const;
+
+  size_t GetDocumentFreq(TermId term_id, uint64_t generation) const;
+
+  void UpdateDocumentFreq(TermId term_id,
+                          int delta,
+                          uint64_t generation,
+                          uint64_t min_reader_generation);
+
+  // Generation not above the ones of all pinned versions, mutex_ must be held
+  uint64_t GetMinReaderGeneration();
+
+  // Makes the version current, mutex_ must be held
+  void Publish(IndexVersion version);
+
+  // Adds the document to the mutable segment and counts it in the version, mutex_ must be held
+  void AppendDocument(IndexVersion& version,
+                      uint64_t min_reader_generation,
+                      double inv_word_count,
+                      const std::vector<TermEntry>& entries);
+
+  // Moves the terms added since the last change into the sorted terms of the version
+  void SortNewTerms(IndexVersion& version);
+
+  // Moves the mutable segment into the sealed ones of the version
+  void SealMutableSegment(IndexVersion& version);
+
+  void RunMerges();
+
+  // Bounds of the sealed segments to merge next, equal if there is nothing to merge
+  std::pair<size_t, size_t> PlanMerge(const SegmentList& segments) const;
+
+  void SetRemoved(int document_id);
+
+  // removed[i] tells if the document first_document_id + i is marked
+  std::vector<bool> GetRemoved(int first_document_id, int document_limit) const;
+
+  size_t CountRemoved(int first_document_id, int document_limit) const;
+
+  EpochManager& epochs_;
+
+  // Views into term_storage_ or into a mapped file
+  ConcurrentVector<std::string_view> terms_;
+  std::deque<std::string> term_storage_;
+  // Hashes of the terms to their ids
+  EpochHashTable term_ids_;
+  // Terms missing from the sorted terms of the versions. Changed by the writer only
+  std::vector<TermId> unsorted_terms_;
+  ConcurrentVector<std::atomic<FreqNode*>> document_freqs_;
+  std::deque<FreqNode> freq_nodes_;
+  // Nodes no reader can reach anymore
+  std::vector<FreqNode*> free_freq_nodes_;
+
+  std::shared_ptr<MutableSegment> mutable_segment_;
+  // Changed by the writer only
+  uint64_t generation_ = 0;
+  std::atomic<const IndexVersion*> published_version_ = nullptr;
+
+  // Guards the fields below, which are shared with the merge thread.
+  // A writer holds it for the whole change
+  mutable std::mutex mutex_;
+  std::shared_ptr<const IndexVersion> version_;
+  // Replaced versions which may still be pinned, oldest first
+  std::deque<std::weak_ptr<const IndexVersion>> retired_versions_;
+  // Bitmap of the removed documents whose postings are still in segments
+  std::vector<uint64_t> removed_bits_;
+  size_t removals_since_merge_check_ = 0;
+  std::condition_variable merge_condition_;
+  // Notified once the merge thread runs out of work
+  mutable std::condition_variable merges_done_condition_;
+  bool has_merge_work_ = false;
+  std::atomic<bool> is_stopping_ = false;
+  std::thread merge_thread_;
+};
+
+// Point-in-time view of the index for a query. It pins its version, so nothing it refers
+// to is destroyed while it lives, and writers keep publishing new versions meanwhile
+class IndexSnapshot : public SegmentSnapshot {
+ public:
+  // Terms without live documents in the snapshot are not found
+  InvertedIndex::TermId FindTerm(std::string_view word) const;
+
+  // Fills term_ids with the terms which start with prefix and have live documents: the
+  // first max_count of them in lexicographic order. Costs about the number of such terms
+  void FindTermsWithPrefix(std::string_view prefix,
+                           size_t max_count,
+                           std::vector<InvertedIndex::TermId>& term_ids) const;
+
+  // Number of live documents with the term
+  size_t GetDocumentFreq(InvertedIndex::TermId term_id) const;
+
+  // Number of live documents
+  size_t GetDocumentCount() const;
+
+  // Total length of the live documents
+  uint64_t GetWordCount() const;
+
+  uint64_t GetGeneration() const;
+
+ private:
+  friend class InvertedIndex;
+
+  IndexSnapshot(const InvertedIndex& index,
+                EpochManager::Guard guard,
+                const IndexVersion& version);
+
+  const InvertedIndex* index_;
+  EpochManager::Guard guard_;
+  const IndexVersion* version_;
+};
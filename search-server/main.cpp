@@ -3,9 +3,14 @@
 #include <iostream>
 #include <random>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
+#include "concurrent_hash_map.h"
+#include "concurrent_map.h"
 #include "log_duration.h"
 #include "search_server.h"
+#include "tests.h"
 
 using namespace std;
 
@@ -65,6 +70,33 @@ vector<string> GenerateQueries(mt19937& generator,
   return queries;
 }
 
+// Words of natural texts follow Zipf's law: the i-th most frequent one occurs about 1/i as
+// often as the first
+vector<string> GenerateZipfQueries(mt19937& generator,
+                                   const vector<string>& dictionary,
+                                   int query_count,
+                                   int word_count) {
+  vector<double> weights;
+  weights.reserve(dictionary.size());
+  for (size_t i = 0; i < dictionary.size(); ++i) {
+    weights.push_back(1.0 / (i + 1));
+  }
+  discrete_distribution<size_t> word_distribution(weights.begin(), weights.end());
+  vector<string> queries;
+  queries.reserve(query_count);
+  for (int i = 0; i < query_count; ++i) {
+    string query;
+    for (int j = 0; j < word_count; ++j) {
+      if (!query.empty()) {
+        query.push_back(' ');
+      }
+      query += dictionary[word_distribution(generator)];
+    }
+    queries.push_back(move(query));
+  }
+  return queries;
+}
+
 template <typename ExecutionPolicy>
 void Test(string_view mark,
           const SearchServer& search_server,
@@ -82,8 +114,62 @@ void Test(string_view mark,
 
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
 
-int main() {
-  {
+template <typename Scorer>
+void TestScorer(string_view mark,
+                const SearchServer& search_server,
+                const vector<string>& queries,
+                QueryEvaluation evaluation) {
+  LOG_DURATION(mark);
+  double total_relevance = 0;
+  for (const string_view query : queries) {
+    for (const auto& document : search_server.FindTopDocuments<Scorer>(
+             query, DocumentStatus::ACTUAL, {MAX_RESULT_DOCUMENT_COUNT, evaluation})) {
+      total_relevance += document.relevance;
+    }
+  }
+  cout << total_relevance << endl;
+}
+
+#define TEST_SCORER(scorer, evaluation) \
+  TestScorer<scorer>(#scorer " "s #evaluation, search_server, queries, QueryEvaluation::evaluation)
+
+const int CONTENTION_OPERATION_COUNT = 1'000'000;
+const int CONTENTION_KEY_COUNT = 10'000;
+const int CONTENTION_BUCKET_COUNT = 1000;
+
+template <typename AddFunction>
+void TestContention(string_view mark, int thread_count, AddFunction add) {
+  LOG_DURATION(string(mark) + " x"s + to_string(thread_count));
+  vector<thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([t, thread_count, &add] {
+      mt19937 generator(t);
+      for (int i = t; i < CONTENTION_OPERATION_COUNT; i += thread_count) {
+        add(uniform_int_distribution(0, CONTENTION_KEY_COUNT - 1)(generator), 1.0);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+void TestConcurrentMaps() {
+  for (int thread_count = 1; thread_count <= 64; thread_count *= 2) {
+    ConcurrentMap<int, double> concurrent_map(CONTENTION_BUCKET_COUNT);
+    TestContention("ConcurrentMap"sv, thread_count, [&concurrent_map](int key, double value) {
+      concurrent_map[key].ref_to_value += value;
+    });
+    ConcurrentHashMap<int, double> hash_map;
+    TestContention("ConcurrentHashMap"sv, thread_count,
+                   [&hash_map](int key, double value) { hash_map.Add(key, value); });
+  }
+}
+
+int main(int argc, char* argv[]) {
+  TestSearchServer();
+  // Benchmarks take a while, so they run only on request
+  if (argc > 1 && argv[1] == "--benchmark"sv) {
     mt19937 generator;
 
     const auto dictionary = GenerateDictionary(generator, 1000, 10);
@@ -98,6 +184,31 @@ int main() {
 
    // TEST(seq);
     TEST(par);
+
+    TEST_SCORER(TfIdfScorer, EXHAUSTIVE);
+    TEST_SCORER(Bm25Scorer, EXHAUSTIVE);
+    TEST_SCORER(TfIdfScorer, WAND);
+    TEST_SCORER(TfIdfScorer, BLOCK_MAX_WAND);
+    TEST_SCORER(Bm25Scorer, BLOCK_MAX_WAND);
+
+    // Pruned evaluations against exhaustive on queries from short to long: the bounds of
+    // rare words let them skip the documents which only have common ones
+    SearchServer zipf_server(dictionary[0]);
+    const auto zipf_documents = GenerateZipfQueries(generator, dictionary, 10'000, 70);
+    for (size_t i = 0; i < zipf_documents.size(); ++i) {
+      zipf_server.AddDocument(i, zipf_documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
+    }
+    for (const int word_count : {3, 10, 30, 70}) {
+      const auto zipf_queries = GenerateZipfQueries(generator, dictionary, 100, word_count);
+      const string mark = "Zipf x"s + to_string(word_count) + " "s;
+      TestScorer<TfIdfScorer>(mark + "EXHAUSTIVE"s, zipf_server, zipf_queries,
+                              QueryEvaluation::EXHAUSTIVE);
+      TestScorer<TfIdfScorer>(mark + "WAND"s, zipf_server, zipf_queries, QueryEvaluation::WAND);
+      TestScorer<TfIdfScorer>(mark + "BLOCK_MAX_WAND"s, zipf_server, zipf_queries,
+                              QueryEvaluation::BLOCK_MAX_WAND);
+    }
+
+    TestConcurrentMaps();
   }
   {
     SearchServer search_server("and with"s);
@@ -0,0 +1,132 @@
+﻿#include "mutable_segment.h"
+#include <numeric>
+#include <utility>
+
+PostingBuffer::Chunk::Chunk(size_t capacity)
+    : entries(std::make_unique<PostingList::Entry[]>(capacity)), capacity(capacity) {}
+
+PostingBuffer::~PostingBuffer() {
+  for (Chunk* chunk = head_; chunk != nullptr;) {
+    delete std::exchange(chunk, chunk->next.load(std::memory_order_relaxed));
+  }
+}
+
+void PostingBuffer::Add(int document_id, uint32_t term_count, double term_freq) {
+  if (tail_ == nullptr || tail_size_ == tail_->capacity) {
+    auto* chunk = new Chunk(tail_ == nullptr ? FIRST_CHUNK_SIZE : tail_->capacity * 2);
+    if (tail_ == nullptr) {
+      head_ = chunk;
+    } else {
+      tail_->next.store(chunk, std::memory_order_release);
+    }
+    tail_ = chunk;
+    tail_size_ = 0;
+  }
+  const float bound = PostingList::RoundUpTermFreq(term_freq);
+  tail_->entries[tail_size_++] = {document_id, term_count, bound};
+  if (bound > max_term_freq_.load(std::memory_order_relaxed)) {
+    max_term_freq_.store(bound, std::memory_order_relaxed);
+  }
+  size_.store(size_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+bool PostingBuffer::Contains(int document_id) const {
+  size_t remaining = size_.load(std::memory_order_acquire);
+  for (const Chunk* chunk = head_; remaining > 0;
+       chunk = chunk->next.load(std::memory_order_acquire)) {
+    const size_t count = std::min(remaining, chunk->capacity);
+    const PostingList::Entry* begin = chunk->entries.get();
+    const PostingList::Entry* end = begin + count;
+    // Chunks ending before the document are skipped without a search
+    if (end[-1].document_id >= document_id) {
+      const auto* it = std::lower_bound(
+          begin, end, document_id,
+          [](const PostingList::Entry& lhs, int id) { return lhs.document_id < id; });
+      return it->document_id == document_id;
+    }
+    remaining -= count;
+  }
+  return false;
+}
+
+float PostingBuffer::GetMaxTermFreq() const {
+  return max_term_freq_.load(std::memory_order_relaxed);
+}
+
+size_t PostingBuffer::GetMemoryUsage() const {
+  size_t result = 0;
+  for (const Chunk* chunk = head_; chunk != nullptr;
+       chunk = chunk->next.load(std::memory_order_relaxed)) {
+    result += sizeof(Chunk) + chunk->capacity * sizeof(PostingList::Entry);
+  }
+  return result;
+}
+
+MutableSegment::MutableSegment(EpochManager& epochs, int first_document_id)
+    : first_document_id_(first_document_id), term_positions_(epochs) {}
+
+void MutableSegment::AddDocument(double inv_word_count,
+                                 const TermEntry* entries,
+                                 size_t entry_count) {
+  const int document_id = GetDocumentLimit();
+  inv_word_counts_.push_back(inv_word_count);
+  for (size_t i = 0; i < entry_count; ++i) {
+    const TermId term_id = entries[i].term_id;
+    const double term_freq = entries[i].term_count * inv_word_count;
+    const uint32_t position = term_positions_.Find(term_id);
+    if (position != EpochHashTable::NO_VALUE) {
+      postings_[position].Add(document_id, entries[i].term_count, term_freq);
+      continue;
+    }
+    // The buffer is filled before readers can find it
+    auto& postings = postings_.emplace_back();
+    postings.Add(document_id, entries[i].term_count, term_freq);
+    term_positions_.Insert(term_id, static_cast<uint32_t>(terms_.size()));
+    terms_.push_back(term_id);
+  }
+}
+
+const PostingBuffer* MutableSegment::FindPostings(TermId term_id) const {
+  const uint32_t position = term_positions_.Find(term_id);
+  return position == EpochHashTable::NO_VALUE ? nullptr : &postings_[position];
+}
+
+int MutableSegment::GetFirstDocumentId() const {
+  return first_document_id_;
+}
+
+int MutableSegment::GetDocumentLimit() const {
+  return first_document_id_ + static_cast<int>(inv_word_counts_.size());
+}
+
+size_t MutableSegment::GetDocumentCount() const {
+  return inv_word_counts_.size();
+}
+
+size_t MutableSegment::GetMemoryUsage() const {
+  size_t result = sizeof(*this) + inv_word_counts_.capacity() * sizeof(double) +
+                  terms_.capacity() * sizeof(TermId) + term_positions_.GetMemoryUsage();
+  for (size_t i = 0; i < terms_.size(); ++i) {
+    result += sizeof(PostingBuffer) + postings_[i].GetMemoryUsage();
+  }
+  return result;
+}
+
+std::shared_ptr<const IndexSegment> MutableSegment::Seal() const {
+  std::vector<uint32_t> order(terms_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [this](uint32_t lhs, uint32_t rhs) { return terms_[lhs] < terms_[rhs]; });
+  std::vector<TermId> terms;
+  std::vector<PostingList> postings(order.size());
+  terms.reserve(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    terms.push_back(terms_[order[i]]);
+    postings_[order[i]].ForEach(PostingList::END, [&](const PostingList::Entry& entry) {
+      const double inv_word_count = inv_word_counts_[entry.document_id - first_document_id_];
+      postings[i].Add(entry.document_id, entry.term_count, entry.term_count * inv_word_count);
+    });
+  }
+  return IndexSegment::FromPostings(first_document_id_, inv_word_counts_, std::move(terms),
+                                    std::move(postings));
+}
@@ -0,0 +1,111 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "concurrent_vector.h"
+#include "epoch_hash_table.h"
+#include "epoch_manager.h"
+#include "index_segment.h"
+#include "posting_list.h"
+
+// Postings of one term in the mutable segment. The writer appends entries to chunks
+// which never move, readers go over the entries of the documents below their limit
+class PostingBuffer {
+ public:
+  PostingBuffer() = default;
+
+  PostingBuffer(const PostingBuffer&) = delete;
+
+  PostingBuffer& operator=(const PostingBuffer&) = delete;
+
+  ~PostingBuffer();
+
+  // Document ids must increase
+  void Add(int document_id, uint32_t term_count, double term_freq);
+
+  // Calls callback(entry) for the documents below the limit in increasing id order
+  template <typename Callback>
+  void ForEach(int document_limit, Callback callback) const;
+
+  bool Contains(int document_id) const;
+
+  // May also cover documents which are not published yet
+  float GetMaxTermFreq() const;
+
+  size_t GetMemoryUsage() const;
+
+ private:
+  static constexpr size_t FIRST_CHUNK_SIZE = 4;
+
+  struct Chunk {
+    explicit Chunk(size_t capacity);
+
+    std::unique_ptr<PostingList::Entry[]> entries;
+    size_t capacity;
+    std::atomic<Chunk*> next = nullptr;
+  };
+
+  // Written before the first entry is published, readers check size_ first
+  Chunk* head_ = nullptr;
+  Chunk* tail_ = nullptr;
+  size_t tail_size_ = 0;
+  std::atomic<size_t> size_ = 0;
+  std::atomic<float> max_term_freq_ = 0;
+};
+
+// Segment which receives new documents. The writer appends postings while queries read
+// the documents below the limit of their index version. A full segment is sealed:
+// its postings are compressed into an IndexSegment which replaces it
+class MutableSegment {
+ public:
+  using TermId = IndexSegment::TermId;
+  using TermEntry = IndexSegment::TermEntry;
+
+  MutableSegment(EpochManager& epochs, int first_document_id);
+
+  // Documents are added with consecutive internal ids, entries have distinct terms
+  void AddDocument(double inv_word_count, const TermEntry* entries, size_t entry_count);
+
+  // nullptr if no document of the segment has the term. Readers must hold an epoch pin
+  const PostingBuffer* FindPostings(TermId term_id) const;
+
+  int GetFirstDocumentId() const;
+
+  // The writer's view, readers use the document limit of their version
+  int GetDocumentLimit() const;
+
+  size_t GetDocumentCount() const;
+
+  size_t GetMemoryUsage() const;
+
+  // Sealed copy of the postings, the segment itself doesn't change
+  std::shared_ptr<const IndexSegment> Seal() const;
+
+ private:
+  int first_document_id_;
+  std::vector<double> inv_word_counts_;
+  // Terms in the order they appeared, postings_ and term_positions_ follow it
+  std::vector<TermId> terms_;
+  ConcurrentVector<PostingBuffer> postings_;
+  EpochHashTable term_positions_;
+};
+
+template <typename Callback>
+void PostingBuffer::ForEach(int document_limit, Callback callback) const {
+  size_t remaining = size_.load(std::memory_order_acquire);
+  for (const Chunk* chunk = head_; remaining > 0;
+       chunk = chunk->next.load(std::memory_order_acquire)) {
+    const size_t count = std::min(remaining, chunk->capacity);
+    for (size_t i = 0; i < count; ++i) {
+      if (chunk->entries[i].document_id >= document_limit) {
+        return;
+      }
+      callback(chunk->entries[i]);
+    }
+    remaining -= count;
+  }
+}
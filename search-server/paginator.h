@@ -23,7 +23,7 @@ private:
 
 template <typename Iterator>
 IteratorRange<Iterator>::IteratorRange(Iterator begin, Iterator end)
-    : first_(begin), last_(end), size_(distance(first_, last_)) {}
+    : first_(begin), last_(end), size_(std::distance(first_, last_)) {}
 
 template <typename Iterator>
 Iterator IteratorRange<Iterator>::begin() const {
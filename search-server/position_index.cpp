@@ -0,0 +1,231 @@
+﻿#include "position_index.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+
+PositionIndex::Positions::Positions(const uint8_t* begin, const uint8_t* end)
+    : begin_(begin), end_(end) {}
+
+bool PositionIndex::Positions::empty() const {
+  return begin_ == end_;
+}
+
+void PositionIndex::Positions::Decode(std::vector<uint32_t>& positions) const {
+  positions.clear();
+  uint32_t position = 0;
+  for (const uint8_t* it = begin_; it != end_;) {
+    uint32_t gap = 0;
+    for (int shift = 0;; shift += 7) {
+      const uint8_t byte = *it++;
+      gap |= static_cast<uint32_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        break;
+      }
+    }
+    position += gap;
+    positions.push_back(position);
+  }
+}
+
+void PositionIndex::Enable() {
+  is_enabled_.store(true, std::memory_order_relaxed);
+}
+
+bool PositionIndex::IsEnabled() const {
+  return is_enabled_.load(std::memory_order_relaxed);
+}
+
+void PositionIndex::Add(const std::vector<TermId>& words) {
+  if (!IsEnabled()) {
+    return;
+  }
+  // Word positions grouped by term, a stable sort keeps the positions of a term increasing
+  thread_local std::vector<uint32_t> order;
+  thread_local std::vector<uint8_t> bytes;
+  order.resize(words.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&words](uint32_t lhs, uint32_t rhs) { return words[lhs] < words[rhs]; });
+
+  thread_local std::vector<uint32_t> directory;
+  directory.clear();
+  bytes.clear();
+  for (size_t i = 0; i < order.size(); ++i) {
+    const bool is_first = i == 0 || words[order[i]] != words[order[i - 1]];
+    uint32_t gap = is_first ? order[i] : order[i] - order[i - 1];
+    for (; gap >= 0x80; gap >>= 7) {
+      bytes.push_back(static_cast<uint8_t>(gap | 0x80));
+    }
+    bytes.push_back(static_cast<uint8_t>(gap));
+    if (i + 1 == order.size() || words[order[i + 1]] != words[order[i]]) {
+      directory.push_back(words[order[i]]);
+      directory.push_back(static_cast<uint32_t>(bytes.size()));
+    }
+  }
+
+  const size_t size = 1 + directory.size() + (bytes.size() + 3) / 4;
+  uint32_t* record = Allocate(size);
+  record[size - 1] = 0;
+  record[0] = static_cast<uint32_t>(directory.size() / 2);
+  std::copy(directory.begin(), directory.end(), record + 1);
+  std::memcpy(record + 1 + directory.size(), bytes.data(), bytes.size());
+  records_.emplace_back(Record{record, size});
+}
+
+PositionIndex::Positions PositionIndex::Find(int internal_id, TermId term_id) const {
+  const uint32_t* record = GetRecord(internal_id);
+  if (record == nullptr) {
+    return {};
+  }
+  const uint32_t* directory = record + 1;
+  const auto* bytes = reinterpret_cast<const uint8_t*>(directory + 2 * record[0]);
+  size_t first = 0;
+  size_t last = record[0];
+  while (first < last) {
+    const size_t middle = (first + last) / 2;
+    if (directory[2 * middle] < term_id) {
+      first = middle + 1;
+    } else {
+      last = middle;
+    }
+  }
+  if (first == record[0] || directory[2 * first] != term_id) {
+    return {};
+  }
+  const uint32_t begin = first == 0 ? 0 : directory[2 * first - 1];
+  return {bytes + begin, bytes + directory[2 * first + 1]};
+}
+
+bool PositionIndex::HasPhrase(int internal_id, const TermId* terms, size_t term_count) const {
+  thread_local std::vector<std::vector<uint32_t>> positions;
+  thread_local std::vector<size_t> cursors;
+  if (positions.size() < term_count) {
+    positions.resize(term_count);
+  }
+  cursors.assign(term_count, 0);
+  size_t anchor = 0;
+  for (size_t i = 0; i < term_count; ++i) {
+    const Positions term_positions = Find(internal_id, terms[i]);
+    if (term_positions.empty()) {
+      return false;
+    }
+    term_positions.Decode(positions[i]);
+    if (positions[i].size() < positions[anchor].size()) {
+      anchor = i;
+    }
+  }
+
+  // Starts are taken from the rarest term, the other lists are searched forward only
+  for (const uint32_t anchor_position : positions[anchor]) {
+    if (anchor_position < anchor) {
+      continue;
+    }
+    const uint32_t start = anchor_position - static_cast<uint32_t>(anchor);
+    bool is_found = true;
+    for (size_t i = 0; i < term_count && is_found; ++i) {
+      const auto& term_positions = positions[i];
+      const auto it = std::lower_bound(term_positions.begin() + cursors[i], term_positions.end(),
+                                       start + static_cast<uint32_t>(i));
+      cursors[i] = it - term_positions.begin();
+      if (it == term_positions.end()) {
+        return false;
+      }
+      is_found = *it == start + i;
+    }
+    if (is_found) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PositionIndex::Save(IndexFileWriter& writer) const {
+  const uint64_t mapped_size = mapped_count_ > 0 ? mapped_offsets_[mapped_count_] : 0;
+  writer.BeginSection(IndexSection::POSITION_OFFSETS);
+  if (IsEnabled()) {
+    writer.WriteArray(mapped_offsets_, mapped_count_);
+    uint64_t offset = mapped_size;
+    writer.WriteArray(&offset, 1);
+    for (size_t i = 0; i < records_.size(); ++i) {
+      offset += records_[i].size;
+      writer.WriteArray(&offset, 1);
+    }
+  }
+  writer.EndSection();
+
+  writer.BeginSection(IndexSection::POSITION_DATA);
+  writer.WriteArray(mapped_data_, mapped_size);
+  for (size_t i = 0; i < records_.size(); ++i) {
+    writer.WriteArray(records_[i].data, records_[i].size);
+  }
+  writer.EndSection();
+}
+
+void PositionIndex::Load(const IndexFile& file, int document_count, size_t term_count) {
+  const auto offsets = file.GetSection<uint64_t>(IndexSection::POSITION_OFFSETS);
+  const auto data = file.GetSection<uint32_t>(IndexSection::POSITION_DATA);
+  if (offsets.size() == 0) {
+    return;
+  }
+  if (offsets.size() != static_cast<size_t>(document_count) + 1 || offsets.begin()[0] != 0 ||
+      !std::is_sorted(offsets.begin(), offsets.end()) ||
+      offsets.begin()[offsets.size() - 1] != data.size()) {
+    throw std::runtime_error("Index file has invalid positions");
+  }
+  for (size_t i = 0; !file.IsVerified() && i + 1 < offsets.size(); ++i) {
+    const uint64_t offset = offsets.begin()[i];
+    if (!IsValidRecord(data.begin() + offset, offsets.begin()[i + 1] - offset, term_count)) {
+      throw std::runtime_error("Index file has invalid positions");
+    }
+  }
+  mapped_offsets_ = offsets.begin();
+  mapped_data_ = data.begin();
+  mapped_count_ = static_cast<int>(offsets.size() - 1);
+  Enable();
+}
+
+bool PositionIndex::IsValidRecord(const uint32_t* record, size_t size, size_t term_count) {
+  if (size == 0 || record[0] > (size - 1) / 2) {
+    return false;
+  }
+  const uint32_t* directory = record + 1;
+  const auto* bytes = reinterpret_cast<const uint8_t*>(directory + 2 * record[0]);
+  const size_t byte_count = (size - 1 - 2 * record[0]) * 4;
+  uint32_t begin = 0;
+  for (size_t i = 0; i < record[0]; ++i) {
+    const uint32_t term_id = directory[2 * i];
+    const uint32_t end = directory[2 * i + 1];
+    // Terms increase, every one has positions and its last varint ends in its range
+    if (term_id >= term_count || (i > 0 && term_id <= directory[2 * i - 2]) || end <= begin ||
+        end > byte_count || (bytes[end - 1] & 0x80) != 0) {
+      return false;
+    }
+    begin = end;
+  }
+  return true;
+}
+
+const uint32_t* PositionIndex::GetRecord(int internal_id) const {
+  if (internal_id < mapped_count_) {
+    return mapped_data_ + mapped_offsets_[internal_id];
+  }
+  const size_t index = internal_id - mapped_count_;
+  return index < records_.size() ? records_[index].data : nullptr;
+}
+
+uint32_t* PositionIndex::Allocate(size_t size) {
+  if (block_used_ + size > BLOCK_WORD_COUNT) {
+    if (size > BLOCK_WORD_COUNT / 4) {
+      // Large records get blocks of their own, the partly used block stays the last one
+      const auto it = blocks_.empty() ? blocks_.end() : std::prev(blocks_.end());
+      return blocks_.insert(it, std::make_unique<uint32_t[]>(size))->get();
+    }
+    blocks_.push_back(std::make_unique<uint32_t[]>(BLOCK_WORD_COUNT));
+    block_used_ = 0;
+  }
+  uint32_t* result = blocks_.back().get() + block_used_;
+  block_used_ += size;
+  return result;
+}
@@ -0,0 +1,84 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "concurrent_vector.h"
+#include "index_file.h"
+#include "index_segment.h"
+
+// Positions of the words of every document by internal id, kept for phrase queries.
+// Positions count the words left after stop words. A document is one record of 32-bit
+// words: the number of its terms, pairs of a term id and the end of its positions in
+// increasing term order, then the positions of every term as varint gaps. The writer adds
+// a record before the postings of the document are published, queries read the records
+// of the documents they see without locks
+class PositionIndex {
+ public:
+  using TermId = IndexSegment::TermId;
+
+  // Varint gaps of the positions of one term in one document
+  class Positions {
+   public:
+    Positions() = default;
+
+    Positions(const uint8_t* begin, const uint8_t* end);
+
+    bool empty() const;
+
+    // Replaces the contents of the buffer with the positions in increasing order
+    void Decode(std::vector<uint32_t>& positions) const;
+
+   private:
+    const uint8_t* begin_ = nullptr;
+    const uint8_t* end_ = nullptr;
+  };
+
+  // Documents added before are left without positions
+  void Enable();
+
+  bool IsEnabled() const;
+
+  // Words of the document with the next internal id as terms in the order of the text.
+  // Does nothing while the index is disabled
+  void Add(const std::vector<TermId>& words);
+
+  // Empty if the document doesn't have the term or has no record
+  Positions Find(int internal_id, TermId term_id) const;
+
+  // Whether the terms follow one another somewhere in the document
+  bool HasPhrase(int internal_id, const TermId* terms, size_t term_count) const;
+
+  void Save(IndexFileWriter& writer) const;
+
+  // Sections are used in place, the file must outlive the index. The index must be empty.
+  // Throws std::runtime_error unless the file has no positions or the records of
+  // document_count documents with terms below term_count
+  void Load(const IndexFile& file, int document_count, size_t term_count);
+
+ private:
+  static constexpr size_t BLOCK_WORD_COUNT = size_t{1} << 14;
+
+  struct Record {
+    const uint32_t* data;
+    size_t size;
+  };
+
+  // nullptr for documents without a record
+  const uint32_t* GetRecord(int internal_id) const;
+
+  static bool IsValidRecord(const uint32_t* record, size_t size, size_t term_count);
+
+  // Room for a record of the given number of words, which never moves
+  uint32_t* Allocate(size_t size);
+
+  std::atomic<bool> is_enabled_ = false;
+  const uint64_t* mapped_offsets_ = nullptr;
+  const uint32_t* mapped_data_ = nullptr;
+  int mapped_count_ = 0;
+  ConcurrentVector<Record> records_;
+  // Storage of the records, changed by the writer only
+  std::vector<std::unique_ptr<uint32_t[]>> blocks_;
+  size_t block_used_ = BLOCK_WORD_COUNT;
+};
@@ -0,0 +1,393 @@
+﻿#include "posting_list.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Lower bound searched with doubling steps from first, so it costs O(log distance):
+// cursors moving forward in small hops don't pay for the whole range
+template <typename Iterator, typename T, typename Less>
+Iterator GallopLowerBound(Iterator first, Iterator last, const T& value, Less less) {
+  const auto size = last - first;
+  decltype(last - first) bound = 1;
+  while (bound < size && less(first[bound], value)) {
+    bound *= 2;
+  }
+  return std::lower_bound(first + bound / 2, first + std::min(bound + 1, size), value, less);
+}
+
+// Upper 16 bits of a term frequency, the lower ones are zero
+uint32_t GetTermFreqBits(float term_freq) {
+  uint32_t bits;
+  std::memcpy(&bits, &term_freq, sizeof(bits));
+  return bits >> 16;
+}
+
+float MakeTermFreq(uint32_t term_freq_bits) {
+  const uint32_t bits = term_freq_bits << 16;
+  float term_freq;
+  std::memcpy(&term_freq, &bits, sizeof(term_freq));
+  return term_freq;
+}
+
+}  // namespace
+
+float PostingList::RoundUpTermFreq(double term_freq) {
+  float result = static_cast<float>(term_freq);
+  if (result < term_freq) {
+    result = std::nextafter(result, std::numeric_limits<float>::infinity());
+  }
+  // Frequencies are positive, so the next 16 bits are the next larger value
+  const uint32_t bits = GetTermFreqBits(result);
+  return MakeTermFreq(MakeTermFreq(bits) < result ? bits + 1 : bits);
+}
+
+size_t PostingList::size() const {
+  const Storage storage = GetStorage();
+  return storage.block_count * BLOCK_SIZE + storage.tail_size;
+}
+
+bool PostingList::empty() const {
+  return size() == 0;
+}
+
+void PostingList::Add(int document_id, uint32_t term_count, double term_freq) {
+  Detach();
+  const Entry entry{document_id, term_count, RoundUpTermFreq(term_freq)};
+  const bool is_last = tail_.empty()
+                           ? blocks_.empty() || blocks_.back().last_document_id < document_id
+                           : tail_.back().document_id < document_id;
+  if (is_last) {
+    Append(entry);
+    return;
+  }
+  auto entries = ExtractFrom(FindBlock(GetStorage(), document_id));
+  const auto it = std::lower_bound(
+      entries.begin(), entries.end(), document_id,
+      [](const Entry& lhs, int id) { return lhs.document_id < id; });
+  if (it != entries.end() && it->document_id == document_id) {
+    it->term_count += term_count;
+    it->term_freq = std::max(it->term_freq, entry.term_freq);
+  } else {
+    entries.insert(it, entry);
+  }
+  for (const auto& extracted : entries) {
+    Append(extracted);
+  }
+}
+
+bool PostingList::Remove(int document_id) {
+  if (!Contains(document_id)) {
+    return false;
+  }
+  Detach();
+  auto entries = ExtractFrom(FindBlock(GetStorage(), document_id));
+  for (const auto& entry : entries) {
+    if (entry.document_id != document_id) {
+      Append(entry);
+    }
+  }
+  return true;
+}
+
+bool PostingList::Contains(int document_id) const {
+  const Storage storage = GetStorage();
+  const size_t block = FindBlock(storage, document_id);
+  if (block == storage.block_count) {
+    const Entry* tail_end = storage.tail + storage.tail_size;
+    const auto it = std::lower_bound(
+        storage.tail, tail_end, document_id,
+        [](const Entry& lhs, int id) { return lhs.document_id < id; });
+    return it != tail_end && it->document_id == document_id;
+  }
+  uint32_t document_ids[BLOCK_SIZE];
+  uint32_t term_counts[BLOCK_SIZE];
+  DecodeBlock(storage, block, document_ids, term_counts);
+  return std::binary_search(document_ids, document_ids + BLOCK_SIZE,
+                            static_cast<uint32_t>(document_id));
+}
+
+float PostingList::GetMaxTermFreq() const {
+  return max_term_freq_;
+}
+
+size_t PostingList::GetMemoryUsage() const {
+  return sizeof(*this) + blocks_.capacity() * sizeof(Block) +
+         data_.capacity() * sizeof(uint32_t) + tail_.capacity() * sizeof(Entry);
+}
+
+PostingList::Storage PostingList::GetStorage() const {
+  if (is_mapped_) {
+    return mapped_;
+  }
+  return {blocks_.data(), blocks_.size(), data_.data(), data_.size(),
+          tail_.data(), tail_.size(), max_term_freq_, tail_max_term_freq_};
+}
+
+PostingList PostingList::FromStorage(const Storage& storage) {
+  PostingList postings;
+  postings.mapped_ = storage;
+  postings.is_mapped_ = true;
+  postings.max_term_freq_ = storage.max_term_freq;
+  postings.tail_max_term_freq_ = storage.tail_max_term_freq;
+  return postings;
+}
+
+bool PostingList::IsValidStorage(const Storage& storage, int document_limit, bool decode_blocks) {
+  int64_t previous = -1;
+  uint32_t document_ids[BLOCK_SIZE];
+  uint32_t term_counts[BLOCK_SIZE];
+  uint32_t term_freq_gaps[BLOCK_SIZE];
+  for (size_t block = 0; block < storage.block_count; ++block) {
+    const Block& header = storage.blocks[block];
+    // A block holds BLOCK_SIZE increasing ids
+    if (header.document_bits > 32 || header.count_bits > 32 || header.term_freq_bits > 16 ||
+        header.offset > storage.data_size ||
+        bit_packing::PackedWordCount(header.document_bits) +
+                bit_packing::PackedWordCount(header.count_bits) +
+                bit_packing::PackedWordCount(header.term_freq_bits) >
+            storage.data_size - header.offset ||
+        header.last_document_id < previous + static_cast<int64_t>(BLOCK_SIZE) ||
+        header.last_document_id >= document_limit) {
+      return false;
+    }
+    if (decode_blocks) {
+      DecodeBlock(storage, block, document_ids, term_counts);
+      for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+        // Gaps adding up past 2^32 wrap around and make the ids decrease
+        if (document_ids[i] <= previous || term_counts[i] == 0) {
+          return false;
+        }
+        previous = document_ids[i];
+      }
+      if (previous != header.last_document_id) {
+        return false;
+      }
+      // Term frequencies stay positive and below the bound
+      const uint32_t max_bits = GetTermFreqBits(header.max_term_freq);
+      bit_packing::Unpack(storage.data + header.offset +
+                              bit_packing::PackedWordCount(header.document_bits) +
+                              bit_packing::PackedWordCount(header.count_bits),
+                          header.term_freq_bits, term_freq_gaps);
+      if (!std::all_of(term_freq_gaps, term_freq_gaps + BLOCK_SIZE,
+                       [max_bits](uint32_t gap) { return gap < max_bits; })) {
+        return false;
+      }
+    }
+    previous = header.last_document_id;
+  }
+  for (size_t i = 0; i < storage.tail_size; ++i) {
+    const Entry& entry = storage.tail[i];
+    if (entry.document_id <= previous || entry.document_id >= document_limit ||
+        entry.term_count == 0) {
+      return false;
+    }
+    previous = entry.document_id;
+  }
+  return true;
+}
+
+void PostingList::DecodeBlock(const Storage& storage,
+                              size_t block,
+                              uint32_t* document_ids,
+                              uint32_t* term_counts) {
+  const auto& header = storage.blocks[block];
+  const uint32_t base = block == 0 ? ~0u : storage.blocks[block - 1].last_document_id;
+  const uint32_t* packed = storage.data + header.offset;
+  bit_packing::UnpackGaps(packed, header.document_bits, base, document_ids);
+  bit_packing::Unpack(packed + bit_packing::PackedWordCount(header.document_bits),
+                      header.count_bits, term_counts);
+  for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+    ++term_counts[i];
+  }
+}
+
+void PostingList::DecodeTermFreqs(const Storage& storage, size_t block, float* term_freqs) {
+  const auto& header = storage.blocks[block];
+  const uint32_t* packed = storage.data + header.offset +
+                           bit_packing::PackedWordCount(header.document_bits) +
+                           bit_packing::PackedWordCount(header.count_bits);
+  uint32_t gaps[BLOCK_SIZE];
+  bit_packing::Unpack(packed, header.term_freq_bits, gaps);
+  const uint32_t max_bits = GetTermFreqBits(header.max_term_freq);
+  for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+    term_freqs[i] = MakeTermFreq(max_bits - gaps[i]);
+  }
+}
+
+size_t PostingList::FindBlock(const Storage& storage, int document_id, size_t first_block) {
+  return GallopLowerBound(storage.blocks + first_block, storage.blocks + storage.block_count,
+                          document_id,
+                          [](const Block& block, int id) { return block.last_document_id < id; }) -
+         storage.blocks;
+}
+
+PostingList::BlockBound PostingList::GetBlockBound(int document_id) const {
+  return FindBlockBound(GetStorage(), document_id, 0);
+}
+
+PostingList::BlockBound PostingList::FindBlockBound(const Storage& storage,
+                                                    int document_id,
+                                                    size_t first_block) {
+  const Block* blocks = storage.blocks;
+  size_t block = first_block;
+  if (block < storage.block_count && blocks[block].last_document_id < document_id) {
+    block = FindBlock(storage, document_id, block + 1);
+  }
+  if (block < storage.block_count) {
+    return {blocks[block].last_document_id, blocks[block].max_term_freq};
+  }
+  if (block == storage.block_count && storage.tail_size > 0 &&
+      storage.tail[storage.tail_size - 1].document_id >= document_id) {
+    return {storage.tail[storage.tail_size - 1].document_id, storage.tail_max_term_freq};
+  }
+  return {END, 0};
+}
+
+void PostingList::Detach() {
+  if (!is_mapped_) {
+    return;
+  }
+  blocks_.assign(mapped_.blocks, mapped_.blocks + mapped_.block_count);
+  data_.assign(mapped_.data, mapped_.data + mapped_.data_size);
+  tail_.assign(mapped_.tail, mapped_.tail + mapped_.tail_size);
+  is_mapped_ = false;
+}
+
+void PostingList::Append(const Entry& entry) {
+  tail_.push_back(entry);
+  tail_max_term_freq_ = std::max(tail_max_term_freq_, entry.term_freq);
+  max_term_freq_ = std::max(max_term_freq_, entry.term_freq);
+  if (tail_.size() == BLOCK_SIZE) {
+    SealTail();
+  }
+}
+
+void PostingList::SealTail() {
+  uint32_t gaps[BLOCK_SIZE];
+  uint32_t counts[BLOCK_SIZE];
+  uint32_t term_freq_gaps[BLOCK_SIZE];
+  uint32_t previous = blocks_.empty() ? ~0u : blocks_.back().last_document_id;
+  const uint32_t max_term_freq_bits = GetTermFreqBits(tail_max_term_freq_);
+  for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+    const auto document_id = static_cast<uint32_t>(tail_[i].document_id);
+    gaps[i] = document_id - previous - 1;
+    counts[i] = tail_[i].term_count - 1;
+    term_freq_gaps[i] = max_term_freq_bits - GetTermFreqBits(tail_[i].term_freq);
+    previous = document_id;
+  }
+  const uint32_t document_bits = bit_packing::RequiredBitWidth(gaps, BLOCK_SIZE);
+  const uint32_t count_bits = bit_packing::RequiredBitWidth(counts, BLOCK_SIZE);
+  const uint32_t term_freq_bits = bit_packing::RequiredBitWidth(term_freq_gaps, BLOCK_SIZE);
+  const size_t offset = data_.size();
+  const size_t count_offset = offset + bit_packing::PackedWordCount(document_bits);
+  const size_t term_freq_offset = count_offset + bit_packing::PackedWordCount(count_bits);
+  data_.resize(term_freq_offset + bit_packing::PackedWordCount(term_freq_bits));
+  bit_packing::Pack(gaps, document_bits, data_.data() + offset);
+  bit_packing::Pack(counts, count_bits, data_.data() + count_offset);
+  bit_packing::Pack(term_freq_gaps, term_freq_bits, data_.data() + term_freq_offset);
+  blocks_.push_back({tail_.back().document_id, static_cast<uint32_t>(offset),
+                     tail_max_term_freq_, static_cast<uint8_t>(document_bits),
+                     static_cast<uint8_t>(count_bits), static_cast<uint8_t>(term_freq_bits), 0});
+  tail_.clear();
+  tail_max_term_freq_ = 0;
+}
+
+std::vector<PostingList::Entry> PostingList::ExtractFrom(size_t block) {
+  std::vector<Entry> entries;
+  entries.reserve((blocks_.size() - block) * BLOCK_SIZE + tail_.size());
+  const Storage storage = GetStorage();
+  uint32_t document_ids[BLOCK_SIZE];
+  uint32_t term_counts[BLOCK_SIZE];
+  float term_freqs[BLOCK_SIZE];
+  for (size_t i = block; i < blocks_.size(); ++i) {
+    DecodeBlock(storage, i, document_ids, term_counts);
+    DecodeTermFreqs(storage, i, term_freqs);
+    for (size_t j = 0; j < BLOCK_SIZE; ++j) {
+      entries.push_back({static_cast<int>(document_ids[j]), term_counts[j], term_freqs[j]});
+    }
+  }
+  entries.insert(entries.end(), tail_.begin(), tail_.end());
+  if (block < blocks_.size()) {
+    data_.resize(blocks_[block].offset);
+    blocks_.resize(block);
+  }
+  tail_.clear();
+  tail_max_term_freq_ = 0;
+  return entries;
+}
+
+PostingList::Cursor::Cursor(const PostingList& postings) : storage_(postings.GetStorage()) {
+  Load(0);
+}
+
+bool PostingList::Cursor::IsEnd() const {
+  return document_id_ == END;
+}
+
+int PostingList::Cursor::GetDocumentId() const {
+  return document_id_;
+}
+
+uint32_t PostingList::Cursor::GetTermCount() const {
+  return term_counts_[position_];
+}
+
+float PostingList::Cursor::GetTermFreq() {
+  if (!has_term_freqs_) {
+    DecodeTermFreqs(storage_, block_, term_freqs_);
+    has_term_freqs_ = true;
+  }
+  return term_freqs_[position_];
+}
+
+void PostingList::Cursor::Next() {
+  if (++position_ < count_) {
+    document_id_ = static_cast<int>(document_ids_[position_]);
+  } else {
+    Load(block_ + 1);
+  }
+}
+
+void PostingList::Cursor::Advance(int document_id) {
+  if (document_id_ >= document_id) {
+    return;
+  }
+  if (block_ < storage_.block_count &&
+      storage_.blocks[block_].last_document_id < document_id) {
+    Load(FindBlock(storage_, document_id, block_ + 1));
+  }
+  position_ += bit_packing::LowerBound(document_ids_ + position_, count_ - position_,
+                                       static_cast<uint32_t>(document_id));
+  if (position_ < count_) {
+    document_id_ = static_cast<int>(document_ids_[position_]);
+  } else {
+    Load(block_ + 1);
+  }
+}
+
+PostingList::BlockBound PostingList::Cursor::GetBlockBound(int document_id) const {
+  return FindBlockBound(storage_, document_id, block_);
+}
+
+void PostingList::Cursor::Load(size_t block) {
+  block_ = block;
+  position_ = 0;
+  has_term_freqs_ = false;
+  if (block < storage_.block_count) {
+    DecodeBlock(storage_, block, document_ids_, term_counts_);
+    count_ = BLOCK_SIZE;
+  } else if (block == storage_.block_count) {
+    count_ = storage_.tail_size;
+    for (size_t i = 0; i < count_; ++i) {
+      document_ids_[i] = static_cast<uint32_t>(storage_.tail[i].document_id);
+      term_counts_[i] = storage_.tail[i].term_count;
+      term_freqs_[i] = storage_.tail[i].term_freq;
+    }
+    has_term_freqs_ = true;
+  } else {
+    count_ = 0;
+  }
+  document_id_ = count_ > 0 ? static_cast<int>(document_ids_[0]) : END;
+}
@@ -0,0 +1,236 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#include "bit_packing.h"
+
+// Postings of a single term, sorted by document id.
+// Full blocks of BLOCK_SIZE postings are compressed: document ids as bit-packed gaps,
+// term counts and term frequencies bit-packed. Recent postings stay in a small uncompressed
+// tail. Every block also keeps an upper bound of the term frequencies inside it.
+class PostingList {
+ public:
+  static constexpr size_t BLOCK_SIZE = bit_packing::BLOCK_SIZE;
+  static constexpr int END = std::numeric_limits<int>::max();
+
+  struct BlockBound {
+    int last_document_id;
+    float max_term_freq;
+  };
+
+  // Layouts of Block and Entry are stored in index files as is
+  struct Block {
+    int last_document_id;
+    uint32_t offset;
+    float max_term_freq;
+    uint8_t document_bits;
+    uint8_t count_bits;
+    // Term frequencies are packed as the distance of their 16 bits below the ones of
+    // max_term_freq
+    uint8_t term_freq_bits;
+    uint8_t reserved;
+  };
+
+  struct Entry {
+    int document_id;
+    uint32_t term_count;
+    float term_freq;
+  };
+
+  // Raw contents of a list
+  struct Storage {
+    const Block* blocks;
+    size_t block_count;
+    const uint32_t* data;
+    size_t data_size;
+    const Entry* tail;
+    size_t tail_size;
+    float max_term_freq;
+    float tail_max_term_freq;
+  };
+
+  class Cursor;
+
+  // Term frequencies and their bounds are kept in floats rounded up to the upper 16 bits,
+  // a relative error below 2^-7. Bounds are never below the exact frequency they cover
+  static float RoundUpTermFreq(double term_freq);
+
+  // Whether a posting callback takes the term frequency after the term count
+  template <typename Callback>
+  static constexpr bool TAKES_TERM_FREQ = std::is_invocable_v<Callback&, int, uint32_t, float>;
+
+  // Calls callback(document_id, term_count, term_freq) or callback(document_id, term_count)
+  template <typename Callback>
+  static void Visit(Callback& callback, int document_id, uint32_t term_count, float term_freq);
+
+  size_t size() const;
+
+  bool empty() const;
+
+  // Appending increasing document ids is O(1); out of order ids re-encode the suffix
+  void Add(int document_id, uint32_t term_count, double term_freq);
+
+  bool Remove(int document_id);
+
+  bool Contains(int document_id) const;
+
+  // Calls callback(document_id, term_count) in increasing document_id order. Callbacks
+  // taking the term frequency too get the stored one, blocks decode it only for them
+  template <typename Callback>
+  void ForEach(Callback callback) const;
+
+  // Upper bound of the term frequency over the whole list
+  float GetMaxTermFreq() const;
+
+  // Bound of the block which may contain document_id, see Cursor::GetBlockBound
+  BlockBound GetBlockBound(int document_id) const;
+
+  // Mapped storage is not counted
+  size_t GetMemoryUsage() const;
+
+  Storage GetStorage() const;
+
+  // Whether the blocks stay inside the data, document ids increase and are below the limit.
+  // Decoding the blocks also checks their contents
+  static bool IsValidStorage(const Storage& storage, int document_limit, bool decode_blocks);
+
+  // The list refers to storage kept elsewhere, e.g. in a mapped index file, which must
+  // outlive the list. The storage is copied on the first modification
+  static PostingList FromStorage(const Storage& storage);
+
+ private:
+  static void DecodeBlock(const Storage& storage,
+                          size_t block,
+                          uint32_t* document_ids,
+                          uint32_t* term_counts);
+
+  static void DecodeTermFreqs(const Storage& storage, size_t block, float* term_freqs);
+
+  static size_t FindBlock(const Storage& storage, int document_id, size_t first_block = 0);
+
+  static BlockBound FindBlockBound(const Storage& storage, int document_id, size_t first_block);
+
+  void Detach();
+
+  void Append(const Entry& entry);
+
+  void SealTail();
+
+  // Decodes blocks starting from the given one together with the tail and drops them
+  std::vector<Entry> ExtractFrom(size_t block);
+
+  std::vector<Block> blocks_;
+  std::vector<uint32_t> data_;
+  std::vector<Entry> tail_;
+  float tail_max_term_freq_ = 0;
+  float max_term_freq_ = 0;
+  Storage mapped_{};
+  bool is_mapped_ = false;
+};
+
+// Document-at-a-time iteration which decodes one block at a time and skips
+// whole blocks while advancing
+class PostingList::Cursor {
+ public:
+  explicit Cursor(const PostingList& postings);
+
+  bool IsEnd() const;
+
+  // END once the cursor is exhausted
+  int GetDocumentId() const;
+
+  uint32_t GetTermCount() const;
+
+  // Decodes the term frequencies of the block on the first call
+  float GetTermFreq();
+
+  void Next();
+
+  // Moves to the first posting with an id not less than document_id
+  void Advance(int document_id);
+
+  // Calls callback(document_id, term_count) for the postings from the current one on
+  // while their ids are below document_limit and stops at the first one which isn't.
+  // Callbacks may take the term frequency too, see PostingList::ForEach
+  template <typename Callback>
+  void ForEachBelow(int document_limit, Callback callback);
+
+  // Bound of the block which may contain document_id, the block is not decoded.
+  // document_id must not be less than the current one
+  BlockBound GetBlockBound(int document_id) const;
+
+ private:
+  void Load(size_t block);
+
+  PostingList::Storage storage_;
+  size_t block_ = 0;
+  size_t position_ = 0;
+  size_t count_ = 0;
+  int document_id_ = END;
+  uint32_t document_ids_[BLOCK_SIZE];
+  uint32_t term_counts_[BLOCK_SIZE];
+  float term_freqs_[BLOCK_SIZE];
+  bool has_term_freqs_ = false;
+};
+
+template <typename Callback>
+void PostingList::Visit(Callback& callback, int document_id, uint32_t term_count,
+                        float term_freq) {
+  if constexpr (TAKES_TERM_FREQ<Callback>) {
+    callback(document_id, term_count, term_freq);
+  } else {
+    callback(document_id, term_count);
+  }
+}
+
+template <typename Callback>
+void PostingList::ForEach(Callback callback) const {
+  const Storage storage = GetStorage();
+  uint32_t document_ids[BLOCK_SIZE];
+  uint32_t term_counts[BLOCK_SIZE];
+  float term_freqs[BLOCK_SIZE];
+  for (size_t block = 0; block < storage.block_count; ++block) {
+    DecodeBlock(storage, block, document_ids, term_counts);
+    if constexpr (TAKES_TERM_FREQ<Callback>) {
+      DecodeTermFreqs(storage, block, term_freqs);
+      for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+        callback(static_cast<int>(document_ids[i]), term_counts[i], term_freqs[i]);
+      }
+    } else {
+      for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+        callback(static_cast<int>(document_ids[i]), term_counts[i]);
+      }
+    }
+  }
+  for (size_t i = 0; i < storage.tail_size; ++i) {
+    const Entry& entry = storage.tail[i];
+    Visit(callback, entry.document_id, entry.term_count, entry.term_freq);
+  }
+}
+
+template <typename Callback>
+void PostingList::Cursor::ForEachBelow(int document_limit, Callback callback) {
+  while (document_id_ < document_limit) {
+    if constexpr (TAKES_TERM_FREQ<Callback>) {
+      GetTermFreq();
+    }
+    size_t position = position_;
+    while (position < count_ && static_cast<int>(document_ids_[position]) < document_limit) {
+      const int document_id = static_cast<int>(document_ids_[position]);
+      if constexpr (TAKES_TERM_FREQ<Callback>) {
+        callback(document_id, term_counts_[position], term_freqs_[position]);
+      } else {
+        callback(document_id, term_counts_[position]);
+      }
+      ++position;
+    }
+    if (position < count_) {
+      position_ = position;
+      document_id_ = static_cast<int>(document_ids_[position]);
+      return;
+    }
+    Load(block_ + 1);
+  }
+}
@@ -0,0 +1,137 @@
+﻿#include "prepared_query.h"
+#include <vector>
+
+namespace {
+
+constexpr size_t MAX_POOLED_QUERIES = 4;
+
+std::vector<std::unique_ptr<PreparedQuery>>& GetThreadPool() {
+  thread_local std::vector<std::unique_ptr<PreparedQuery>> pool;
+  return pool;
+}
+
+}  // namespace
+
+std::string_view PreparedQuery::GetText() const {
+  return text_;
+}
+
+uint64_t PreparedQuery::GetGeneration() const {
+  return generation_;
+}
+
+void PreparedQuery::AppendNormalizedText(std::string& text) const {
+  // Required words are a subset of the plus words in the same order
+  for (size_t i = 0, required = 0; i < plus_words_.size(); ++i) {
+    const std::string_view word = GetWord(plus_words_[i]);
+    if (required < required_words_.size() && GetWord(required_words_[required]) == word) {
+      text += '+';
+      ++required;
+    }
+    text += word;
+    text += ' ';
+  }
+  for (const auto& word : minus_words_) {
+    text += '-';
+    text += GetWord(word);
+    text += ' ';
+  }
+  for (size_t phrase = 0, i = 0; phrase < phrase_ends_.size(); ++phrase) {
+    text += '"';
+    for (; i < phrase_ends_[phrase]; ++i) {
+      text += GetWord(phrase_words_[i]);
+      text += i + 1 < phrase_ends_[phrase] ? ' ' : '"';
+    }
+    text += ' ';
+  }
+  for (size_t i = 0, required = 0; i < prefix_words_.size(); ++i) {
+    const std::string_view word = GetWord(prefix_words_[i]);
+    if (required < required_prefix_words_.size() &&
+        GetWord(required_prefix_words_[required]) == word) {
+      text += '+';
+      ++required;
+    }
+    text += word;
+    text += "* ";
+  }
+  for (const auto& word : minus_prefix_words_) {
+    text += '-';
+    text += GetWord(word);
+    text += "* ";
+  }
+}
+
+bool PreparedQuery::HasPhrases() const {
+  return !phrase_ends_.empty();
+}
+
+bool PreparedQuery::HasRequiredWords() const {
+  return !required_words_.empty() || !required_prefix_words_.empty();
+}
+
+bool PreparedQuery::HasPrefixes() const {
+  return !prefix_words_.empty() || !minus_prefix_words_.empty();
+}
+
+InvertedIndex::TermId PreparedQuery::GetCommonestTerm() const {
+  InvertedIndex::TermId result = InvertedIndex::NO_TERM;
+  double min_inverse_document_freq = 0;
+  for (size_t i = 0; i < plus_words_.size() && i < terms_.size(); ++i) {
+    const Term& term = terms_[i];
+    if (term.term_id != InvertedIndex::NO_TERM &&
+        (result == InvertedIndex::NO_TERM ||
+         term.inverse_document_freq < min_inverse_document_freq)) {
+      result = term.term_id;
+      min_inverse_document_freq = term.inverse_document_freq;
+    }
+  }
+  return result;
+}
+
+std::string_view PreparedQuery::GetWord(const Word& word) const {
+  return std::string_view(text_).substr(word.offset, word.length);
+}
+
+void PreparedQuery::Clear() {
+  text_.clear();
+  plus_words_.clear();
+  minus_words_.clear();
+  phrase_words_.clear();
+  phrase_ends_.clear();
+  required_words_.clear();
+  prefix_words_.clear();
+  minus_prefix_words_.clear();
+  required_prefix_words_.clear();
+  terms_.clear();
+  server_id_ = 0;
+  generation_ = 0;
+}
+
+PooledPreparedQuery::PooledPreparedQuery() {
+  auto& pool = GetThreadPool();
+  if (pool.empty()) {
+    query_ = std::make_unique<PreparedQuery>();
+  } else {
+    query_ = std::move(pool.back());
+    pool.pop_back();
+  }
+}
+
+PooledPreparedQuery::~PooledPreparedQuery() {
+  if (!query_) {
+    return;
+  }
+  auto& pool = GetThreadPool();
+  if (pool.size() < MAX_POOLED_QUERIES) {
+    query_->Clear();
+    pool.push_back(std::move(query_));
+  }
+}
+
+PreparedQuery& PooledPreparedQuery::operator*() const {
+  return *query_;
+}
+
+PreparedQuery* PooledPreparedQuery::operator->() const {
+  return query_.get();
+}
@@ -0,0 +1,103 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "inverted_index.h"
+#include "small_vector.h"
+
+// Query parsed once for any number of searches, also on several threads at once.
+// Made by SearchServer::PrepareQuery. Words are resolved to terms with their inverse
+// document frequencies in the index version current at preparation, searches in later
+// versions resolve them again on the fly
+class PreparedQuery {
+ public:
+  std::string_view GetText() const;
+
+  // Index generation the words were resolved in
+  uint64_t GetGeneration() const;
+
+  // Appends the distinct plus words and then the distinct minus words with their signs,
+  // each group in lexicographic order, then the quoted phrases and the prefix words.
+  // Queries differing only in word order, repeats and stop words get the same text
+  void AppendNormalizedText(std::string& text) const;
+
+  bool HasPhrases() const;
+
+  bool HasRequiredWords() const;
+
+  bool HasPrefixes() const;
+
+  // Plus term with the longest posting list at preparation, NO_TERM if there is none.
+  // Queries sharing it are worth running together
+  InvertedIndex::TermId GetCommonestTerm() const;
+
+ private:
+  friend class PooledPreparedQuery;
+  friend class SearchServer;
+
+  static constexpr size_t INLINE_WORD_COUNT = 8;
+
+  // Position of a word in the text
+  struct Word {
+    size_t offset;
+    size_t length;
+  };
+
+  struct Term {
+    // NO_TERM for words without live documents
+    InvertedIndex::TermId term_id;
+    double inverse_document_freq;
+  };
+
+  using Words = SmallVector<Word, INLINE_WORD_COUNT>;
+  // Terms of the plus words, the minus words, the phrase words and then the required words
+  using Terms = SmallVector<Term, INLINE_WORD_COUNT * 2>;
+  using PhraseEnds = SmallVector<uint32_t, INLINE_WORD_COUNT>;
+
+  std::string_view GetWord(const Word& word) const;
+
+  void Clear();
+
+  std::string text_;
+  // Distinct words in lexicographic order
+  Words plus_words_;
+  Words minus_words_;
+  // Words of the phrases in the order of the text. Phrase i ends at phrase_ends_[i],
+  // its words are plus words as well
+  Words phrase_words_;
+  PhraseEnds phrase_ends_;
+  // Plus words marked as required, distinct and in lexicographic order
+  Words required_words_;
+  // Words of word* terms without the star, distinct and in lexicographic order.
+  // They are expanded in every search, so they have no terms
+  Words prefix_words_;
+  Words minus_prefix_words_;
+  Words required_prefix_words_;
+  Terms terms_;
+  // Server and index generation of terms_, 0 if the terms are not resolved
+  uint64_t server_id_ = 0;
+  uint64_t generation_ = 0;
+};
+
+// Borrows a prepared query from the pool of the current thread and returns it there,
+// so parsing reuses the storage of earlier queries
+class PooledPreparedQuery {
+ public:
+  PooledPreparedQuery();
+
+  PooledPreparedQuery(PooledPreparedQuery&& other) = default;
+
+  PooledPreparedQuery& operator=(PooledPreparedQuery&& other) = default;
+
+  ~PooledPreparedQuery();
+
+  PreparedQuery& operator*() const;
+
+  PreparedQuery* operator->() const;
+
+ private:
+  std::unique_ptr<PreparedQuery> query_;
+};
@@ -1,36 +1,124 @@
 ﻿#include "process_queries.h"
 #include <algorithm>
-#include <execution>
 #include <functional>
-#include <list>
+#include <numeric>
 #include <string>
 #include <utility>
+#include "work_stealing_pool.h"
+
+namespace {
+
+// Queries prepared at once, bounds the memory of large batches
+constexpr size_t QUERY_WINDOW_SIZE = 4096;
+// Queries sharing the reads of posting lists
+constexpr size_t QUERY_GROUP_SIZE = 32;
+
+WorkStealingPool& GetQueryPool() {
+  static WorkStealingPool pool;
+  return pool;
+}
+
+// Writes the results of query i from slots + i * MAX_RESULT_DOCUMENT_COUNT on and their
+// number to counts[i]
+void FindTopDocuments(const SearchServer& search_server,
+                      const std::vector<std::string>& queries,
+                      Document* slots,
+                      size_t* counts) {
+  WorkStealingPool& pool = GetQueryPool();
+  std::vector<PreparedQuery> prepared(std::min(queries.size(), QUERY_WINDOW_SIZE));
+  std::vector<size_t> order;
+  for (size_t window = 0; window < queries.size(); window += QUERY_WINDOW_SIZE) {
+    const size_t window_size = std::min(queries.size() - window, QUERY_WINDOW_SIZE);
+    pool.ParallelFor(window_size, [&](size_t i) {
+      search_server.PrepareQuery(queries[window + i], prepared[i]);
+    });
+
+    // Queries with the same longest posting list go to the same group, which reads it once
+    order.resize(window_size);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&prepared](size_t lhs, size_t rhs) {
+      return prepared[lhs].GetCommonestTerm() < prepared[rhs].GetCommonestTerm();
+    });
+
+    const size_t group_count = (window_size + QUERY_GROUP_SIZE - 1) / QUERY_GROUP_SIZE;
+    pool.ParallelFor(group_count, [&](size_t group) {
+      const size_t first = group * QUERY_GROUP_SIZE;
+      const size_t last = std::min(first + QUERY_GROUP_SIZE, window_size);
+      std::vector<BatchQuery> batch;
+      batch.reserve(last - first);
+      for (size_t i = first; i < last; ++i) {
+        const size_t query_index = window + order[i];
+        batch.push_back({&prepared[order[i]], DocumentStatus::ACTUAL, {},
+                         slots + query_index * MAX_RESULT_DOCUMENT_COUNT});
+      }
+      search_server.FindTopDocumentsBatch(batch);
+      for (size_t i = first; i < last; ++i) {
+        counts[window + order[i]] = batch[i - first].result_count;
+      }
+    });
+  }
+}
+
+}  // namespace
+
 
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server,
                                                   const std::vector<std::string>& queries) {
+  std::vector<Document> slots(queries.size() * MAX_RESULT_DOCUMENT_COUNT);
+  std::vector<size_t> counts(queries.size());
+  FindTopDocuments(search_server, queries, slots.data(), counts.data());
   std::vector<std::vector<Document>> res(queries.size());
-  /*for (const std::string& query : queries) {
-    res.push_back(search_server.FindTopDocuments(query));
-  }*/
-  std::transform(
-      std::execution::par, queries.begin(), queries.end(), res.begin(),
-      [&search_server](const auto& query) { return search_server.FindTopDocuments(query); });
+  for (size_t i = 0; i < queries.size(); ++i) {
+    const Document* first = slots.data() + i * MAX_RESULT_DOCUMENT_COUNT;
+    res[i].assign(first, first + counts[i]);
+  }
   return res;
 }
 
-/*template <typename T>
-std::set<T> getUnion(const std::set<T>& a, const std::set<T>& b) {
-  std::set<T> result = a;
-  result.insert(b.begin(), b.end());
-  return result;
-}*/
+QueryResults ProcessQueriesJoined(const SearchServer& search_server,
+                                  const std::vector<std::string>& queries) {
+  QueryResults res;
+  auto& documents = res.documents_;
+  documents.resize(queries.size() * MAX_RESULT_DOCUMENT_COUNT);
+  std::vector<size_t> counts(queries.size());
+  FindTopDocuments(search_server, queries, documents.data(), counts.data());
 
-std::list<Document> ProcessQueriesJoined(const SearchServer& search_server,
-                                         const std::vector<std::string>& queries) {
-  std::list<Document> res;
-  for (const auto& el : ProcessQueries(search_server, queries)) {
-    std::list<Document> temp(el.begin(), el.end());
-    res.splice(res.end(), temp);
+  // The results are moved down over the unused slots in place
+  res.offsets_.resize(queries.size() + 1);
+  for (size_t i = 0; i < queries.size(); ++i) {
+    const size_t slot = i * MAX_RESULT_DOCUMENT_COUNT;
+    const size_t offset = res.offsets_[i];
+    if (offset != slot) {
+      std::copy(documents.begin() + slot, documents.begin() + slot + counts[i],
+                documents.begin() + offset);
+    }
+    res.offsets_[i + 1] = offset + counts[i];
   }
+  documents.resize(res.offsets_.back());
   return res;
-}
\ No newline at end of file
+}
+
+QueryResults::Iterator QueryResults::begin() const {
+  return documents_.data();
+}
+
+QueryResults::Iterator QueryResults::end() const {
+  return documents_.data() + documents_.size();
+}
+
+size_t QueryResults::size() const {
+  return documents_.size();
+}
+
+bool QueryResults::empty() const {
+  return documents_.empty();
+}
+
+size_t QueryResults::GetQueryCount() const {
+  return offsets_.size() - 1;
+}
+
+IteratorRange<QueryResults::Iterator> QueryResults::GetQueryResults(size_t query_index) const {
+  return {documents_.data() + offsets_[query_index],
+          documents_.data() + offsets_[query_index + 1]};
+}
@@ -1,11 +1,49 @@
-﻿#include <list>
-#include <set>
+﻿#pragma once
+
+#include <cstddef>
 #include <string>
 #include <vector>
+#include "document.h"
+#include "paginator.h"
 #include "search_server.h"
 
+// Results of a batch of queries in one buffer, the documents of every query follow the ones
+// of the query before it. Iteration goes over all the documents, GetQueryResults gives the
+// ones of a query
+class QueryResults {
+ public:
+  using Iterator = const Document*;
+
+  Iterator begin() const;
+
+  Iterator end() const;
+
+  size_t size() const;
+
+  bool empty() const;
+
+  size_t GetQueryCount() const;
+
+  IteratorRange<Iterator> GetQueryResults(size_t query_index) const;
+
+ private:
+  friend QueryResults ProcessQueriesJoined(const SearchServer& search_server,
+                                           const std::vector<std::string>& queries);
+
+  std::vector<Document> documents_;
+  // Documents of query i are [offsets_[i], offsets_[i + 1])
+  std::vector<size_t> offsets_{0};
+};
+
+// Top documents of every query like FindTopDocuments(query) finds them: TfIdfScorer,
+// ACTUAL documents and the default QueryOptions. The queries go through
+// SearchServer::FindTopDocumentsBatch
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server,
                                                   const std::vector<std::string>& queries);
 
-std::list<Document> ProcessQueriesJoined(const SearchServer& search_server,
-                                         const std::vector<std::string>& queries);
\ No newline at end of file
+// The documents of all the queries in the order of the queries. It used to return them in
+// a std::list<Document>: QueryResults iterates the same documents in the same order over
+// one buffer, so range-for loops over the result compile and behave as before. Callers
+// keeping a list can build it from begin() and end()
+QueryResults ProcessQueriesJoined(const SearchServer& search_server,
+                                  const std::vector<std::string>& queries);
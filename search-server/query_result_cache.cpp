@@ -0,0 +1,149 @@
+﻿#include "query_result_cache.h"
+#include <functional>
+#include <utility>
+
+namespace {
+
+// Rough size of the nodes of the list and of the index
+constexpr size_t ENTRY_OVERHEAD = sizeof(void*) * 8;
+
+}  // namespace
+
+double QueryResultCacheStats::GetHitRate() const {
+  const uint64_t lookups = hits + misses;
+  return lookups == 0 ? 0.0 : static_cast<double>(hits) / lookups;
+}
+
+QueryResultCache::QueryResultCache(const SearchServer& search_server, size_t byte_budget)
+    : search_server_(search_server),
+      shard_byte_budget_(byte_budget / SHARD_COUNT),
+      shards_(SHARD_COUNT) {}
+
+std::vector<Document> QueryResultCache::FindTopDocuments(const std::string_view& raw_query,
+                                                         DocumentStatus status,
+                                                         const QueryOptions& options) {
+  return FindCached(raw_query, static_cast<uintptr_t>(status), options,
+                    [this, status, &options](const PreparedQuery& query) {
+                      return search_server_.FindTopDocuments(query, status, options);
+                    });
+}
+
+std::vector<Document> QueryResultCache::FindTopDocuments(const std::string_view& raw_query) {
+  return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+}
+
+QueryResultCacheStats QueryResultCache::GetStats() const {
+  QueryResultCacheStats result;
+  for (const auto& shard : shards_) {
+    std::lock_guard guard(shard.mutex);
+    result.hits += shard.stats.hits;
+    result.misses += shard.stats.misses;
+    result.invalidations += shard.stats.invalidations;
+    result.evictions += shard.stats.evictions;
+    result.entry_count += shard.stats.entry_count;
+    result.memory_usage += shard.stats.memory_usage;
+  }
+  return result;
+}
+
+size_t QueryResultCache::GetByteBudget() const {
+  return shard_byte_budget_ * SHARD_COUNT;
+}
+
+void QueryResultCache::Clear() {
+  for (auto& shard : shards_) {
+    std::lock_guard guard(shard.mutex);
+    shard.index.clear();
+    shard.entries.clear();
+    shard.stats.entry_count = 0;
+    shard.stats.memory_usage = 0;
+  }
+}
+
+const std::string& QueryResultCache::MakeKey(const PreparedQuery& query,
+                                             uintptr_t filter,
+                                             const QueryOptions& options) {
+  thread_local std::string key;
+  key.clear();
+  query.AppendNormalizedText(key);
+  key += '|';
+  key += std::to_string(filter);
+  key += '|';
+  key += std::to_string(options.max_result_count);
+  key += '|';
+  key += std::to_string(static_cast<int>(options.evaluation));
+  key += '|';
+  key += std::to_string(static_cast<int>(options.match));
+  return key;
+}
+
+QueryResultCache::Shard& QueryResultCache::GetShard(const std::string& key) {
+  return shards_[std::hash<std::string>{}(key) % SHARD_COUNT];
+}
+
+bool QueryResultCache::Find(const std::string& key,
+                            uint64_t generation,
+                            std::vector<Document>& result) {
+  Shard& shard = GetShard(key);
+  std::lock_guard guard(shard.mutex);
+  const auto it = shard.index.find(key);
+  if (it == shard.index.end()) {
+    ++shard.stats.misses;
+    return false;
+  }
+  const auto entry = it->second;
+  if (entry->generation != generation) {
+    ++shard.stats.misses;
+    // A newer entry is kept for the queries of the new generation
+    if (entry->generation < generation) {
+      ++shard.stats.invalidations;
+      shard.stats.memory_usage -= entry->memory_usage;
+      --shard.stats.entry_count;
+      shard.index.erase(it);
+      shard.entries.erase(entry);
+    }
+    return false;
+  }
+  ++shard.stats.hits;
+  shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+  result = entry->documents;
+  return true;
+}
+
+void QueryResultCache::Insert(const std::string& key,
+                              uint64_t generation,
+                              const std::vector<Document>& documents) {
+  const size_t memory_usage =
+      sizeof(Entry) + ENTRY_OVERHEAD + key.size() + documents.size() * sizeof(Document);
+  if (memory_usage > shard_byte_budget_) {
+    return;
+  }
+  Shard& shard = GetShard(key);
+  std::lock_guard guard(shard.mutex);
+  if (const auto it = shard.index.find(key); it != shard.index.end()) {
+    const auto entry = it->second;
+    // Searches started in older generations may finish later
+    if (entry->generation >= generation) {
+      return;
+    }
+    shard.stats.memory_usage -= entry->memory_usage;
+    --shard.stats.entry_count;
+    shard.index.erase(it);
+    shard.entries.erase(entry);
+  }
+
+  while (shard.stats.memory_usage + memory_usage > shard_byte_budget_) {
+    const Entry& oldest = shard.entries.back();
+    shard.stats.memory_usage -= oldest.memory_usage;
+    --shard.stats.entry_count;
+    ++shard.stats.evictions;
+    shard.index.erase(oldest.key);
+    shard.entries.pop_back();
+  }
+
+  shard.entries.push_front({key, generation, documents, memory_usage});
+  // The view points into the key of the entry, which never moves
+  shard.index.emplace(shard.entries.front().key, shard.entries.begin());
+  shard.stats.memory_usage += memory_usage;
+  ++shard.stats.entry_count;
+}
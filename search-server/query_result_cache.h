@@ -0,0 +1,145 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "document.h"
+#include "prepared_query.h"
+#include "search_server.h"
+
+struct QueryResultCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  // Misses which found a result of an older index generation
+  uint64_t invalidations = 0;
+  uint64_t evictions = 0;
+  size_t entry_count = 0;
+  size_t memory_usage = 0;
+
+  double GetHitRate() const;
+};
+
+// Results of FindTopDocuments kept in front of a server, safe to use on any number of
+// threads. Keys are normalized queries with the filter and the options, so reordered and
+// repeated words hit the same entry. An entry is valid only for the index generation it
+// was found in: every AddDocument and RemoveDocument starts a new generation, and older
+// entries are dropped when met. Shards are LRU lists within their part of the byte budget.
+// Predicates are cached only if they are stateless, their type tells them apart
+class QueryResultCache {
+ public:
+  static constexpr size_t DEFAULT_BYTE_BUDGET = 64 << 20;
+  static constexpr size_t SHARD_COUNT = 16;
+
+  explicit QueryResultCache(const SearchServer& search_server,
+                            size_t byte_budget = DEFAULT_BYTE_BUDGET);
+
+  template <typename DocumentPredicate>
+  std::vector<Document> FindTopDocuments(const std::string_view& raw_query,
+                                         DocumentPredicate pred,
+                                         const QueryOptions& options = {});
+
+  std::vector<Document> FindTopDocuments(const std::string_view& raw_query,
+                                         DocumentStatus status,
+                                         const QueryOptions& options = {});
+
+  std::vector<Document> FindTopDocuments(const std::string_view& raw_query);
+
+  QueryResultCacheStats GetStats() const;
+
+  size_t GetByteBudget() const;
+
+  void Clear();
+
+ private:
+  struct Entry {
+    std::string key;
+    uint64_t generation;
+    std::vector<Document> documents;
+    size_t memory_usage;
+  };
+
+  using EntryList = std::list<Entry>;
+
+  struct Shard {
+    mutable std::mutex mutex;
+    // Most recently used first
+    EntryList entries;
+    std::unordered_map<std::string_view, EntryList::iterator> index;
+    QueryResultCacheStats stats;
+  };
+
+  // Address unique to the predicate type
+  template <typename DocumentPredicate>
+  static uintptr_t GetPredicateTag();
+
+  // Key buffer of the current thread, valid until the next call.
+  // Filters are statuses or tags of predicates
+  static const std::string& MakeKey(const PreparedQuery& query,
+                                    uintptr_t filter,
+                                    const QueryOptions& options);
+
+  Shard& GetShard(const std::string& key);
+
+  // Copies the documents into result, false if the key has no entry of the generation
+  bool Find(const std::string& key, uint64_t generation, std::vector<Document>& result);
+
+  void Insert(const std::string& key, uint64_t generation, const std::vector<Document>& documents);
+
+  // search(query) finds the documents on a miss
+  template <typename Search>
+  std::vector<Document> FindCached(const std::string_view& raw_query,
+                                   uintptr_t filter,
+                                   const QueryOptions& options,
+                                   Search search);
+
+  const SearchServer& search_server_;
+  const size_t shard_byte_budget_;
+  std::vector<Shard> shards_;
+};
+
+template <typename DocumentPredicate>
+std::vector<Document> QueryResultCache::FindTopDocuments(const std::string_view& raw_query,
+                                                         DocumentPredicate pred,
+                                                         const QueryOptions& options) {
+  if constexpr (std::is_empty_v<DocumentPredicate>) {
+    return FindCached(raw_query, GetPredicateTag<DocumentPredicate>(), options,
+                      [this, pred, &options](const PreparedQuery& query) {
+                        return search_server_.FindTopDocuments(query, pred, options);
+                      });
+  } else {
+    return search_server_.FindTopDocuments(raw_query, pred, options);
+  }
+}
+
+template <typename DocumentPredicate>
+uintptr_t QueryResultCache::GetPredicateTag() {
+  static char tag = 0;
+  return reinterpret_cast<uintptr_t>(&tag);
+}
+
+template <typename Search>
+std::vector<Document> QueryResultCache::FindCached(const std::string_view& raw_query,
+                                                   uintptr_t filter,
+                                                   const QueryOptions& options,
+                                                   Search search) {
+  const PooledPreparedQuery query;
+  search_server_.PrepareQuery(raw_query, *query);
+  const std::string& key = MakeKey(*query, filter, options);
+  std::vector<Document> result;
+  if (!Find(key, query->GetGeneration(), result)) {
+    result = search(*query);
+    // The search pins a version of its own. Generations only grow, so if the current one
+    // is still that of the query, the search ran on it too; otherwise the result belongs
+    // to an unknown later generation and isn't kept
+    if (search_server_.GetGeneration() == query->GetGeneration()) {
+      Insert(key, query->GetGeneration(), result);
+    }
+  }
+  return result;
+}
@@ -1,23 +1,210 @@
 ﻿#include "remove_duplicates.h"
-#include <string_view>
-
-void RemoveDuplicates(SearchServer& search_server) {
-  std::set<int> ids_to_remove;
-  std::set<std::set<std::string_view>> word_sets{};
-  for (const auto& document_id : search_server) {
-    const auto& word_freqs = search_server.GetWordFrequencies(document_id);
-    std::set<std::string_view> word_set{};
-    for (const auto& [key, _] : word_freqs) {
-      word_set.insert(key);
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <tuple>
+#include <utility>
+
+namespace {
+
+using TermRange = IteratorRange<const InvertedIndex::TermEntry*>;
+
+struct Fingerprint {
+  uint64_t low = 0;
+  uint64_t high = 0;
+
+  bool operator<(const Fingerprint& other) const {
+    return std::tie(low, high) < std::tie(other.low, other.high);
+  }
+
+  bool operator==(const Fingerprint& other) const {
+    return low == other.low && high == other.high;
+  }
+};
+
+uint64_t Mix(uint64_t value) {
+  value ^= value >> 30;
+  value *= 0xbf58476d1ce4e5b9;
+  value ^= value >> 27;
+  value *= 0x94d049bb133111eb;
+  return value ^ (value >> 31);
+}
+
+// Sums of two hashes of the terms, so the order of the terms doesn't matter
+Fingerprint ComputeFingerprint(TermRange terms) {
+  Fingerprint result;
+  for (const auto& entry : terms) {
+    result.low += Mix(entry.term_id);
+    result.high += Mix(entry.term_id ^ 0x9e3779b97f4a7c15);
+  }
+  return result;
+}
+
+// Hashes of the bands of the MinHash signature of the terms
+void ComputeBandKeys(TermRange terms, const DuplicateOptions& options, uint64_t* keys) {
+  for (size_t band = 0; band < options.band_count; ++band) {
+    uint64_t key = band;
+    for (size_t row = 0; row < options.band_size; ++row) {
+      const uint64_t seed = Mix(band * options.band_size + row + 1);
+      uint64_t min_hash = UINT64_MAX;
+      for (const auto& entry : terms) {
+        min_hash = std::min(min_hash, Mix(entry.term_id ^ seed));
+      }
+      key = Mix(key ^ min_hash);
+    }
+    keys[band] = key;
+  }
+}
+
+// Both ranges are in increasing term order
+double ComputeJaccard(TermRange lhs, TermRange rhs) {
+  size_t common = 0;
+  for (auto left = lhs.begin(), right = rhs.begin(); left != lhs.end() && right != rhs.end();) {
+    if (left->term_id < right->term_id) {
+      ++left;
+    } else if (right->term_id < left->term_id) {
+      ++right;
+    } else {
+      ++common;
+      ++left;
+      ++right;
     }
-    if (word_sets.count(word_set))
-      ids_to_remove.insert(document_id);
-    else
-      word_sets.insert(word_set);
   }
+  const size_t united = lhs.size() + rhs.size() - common;
+  return united == 0 ? 1.0 : static_cast<double>(common) / united;
+}
+
+template <typename ExecutionPolicy>
+std::vector<int> FindDuplicatesImpl(const ExecutionPolicy& policy,
+                                    const SearchServer& search_server,
+                                    const DuplicateOptions& options) {
+  const std::vector<int> ids(search_server.begin(), search_server.end());
+  std::vector<size_t> indexes(ids.size());
+  std::iota(indexes.begin(), indexes.end(), 0);
+  std::vector<TermRange> terms(ids.size(), TermRange(nullptr, nullptr));
+  std::vector<Fingerprint> fingerprints(ids.size());
+  std::for_each(policy, indexes.begin(), indexes.end(), [&](size_t i) {
+    terms[i] = search_server.GetDocumentTerms(ids[i]);
+    fingerprints[i] = ComputeFingerprint(terms[i]);
+  });
 
-  for (const auto id : ids_to_remove) {
-    std::cout << "Found duplicate document id " << id << std::endl;
-    search_server.RemoveDocument(id);
+  // Equal word sets: the document with the smallest id is kept
+  std::vector<char> is_duplicate(ids.size());
+  std::vector<size_t> order = indexes;
+  std::sort(policy, order.begin(), order.end(), [&fingerprints](size_t lhs, size_t rhs) {
+    return std::tie(fingerprints[lhs], lhs) < std::tie(fingerprints[rhs], rhs);
+  });
+  for (size_t i = 1; i < order.size(); ++i) {
+    if (fingerprints[order[i]] == fingerprints[order[i - 1]]) {
+      is_duplicate[order[i]] = true;
+    }
   }
-}
\ No newline at end of file
+
+  if (options.jaccard_threshold < 1.0 && options.band_count > 0 && options.band_size > 0) {
+    std::vector<size_t> kept;
+    std::copy_if(indexes.begin(), indexes.end(), std::back_inserter(kept),
+                 [&is_duplicate](size_t i) { return !is_duplicate[i]; });
+    std::vector<uint64_t> keys(kept.size() * options.band_count);
+    std::vector<size_t> positions(kept.size());
+    std::iota(positions.begin(), positions.end(), 0);
+    std::for_each(policy, positions.begin(), positions.end(), [&](size_t position) {
+      ComputeBandKeys(terms[kept[position]], options, &keys[position * options.band_count]);
+    });
+
+    // Pairs (first, other) of every bucket of documents with an equal band, so a band
+    // costs as many pairs as documents even when a common band puts most of them together
+    std::vector<std::vector<std::pair<size_t, size_t>>> band_pairs(options.band_count);
+    std::vector<size_t> bands(options.band_count);
+    std::iota(bands.begin(), bands.end(), 0);
+    std::for_each(policy, bands.begin(), bands.end(), [&](size_t band) {
+      std::vector<std::pair<uint64_t, size_t>> band_keys(kept.size());
+      for (size_t position = 0; position < kept.size(); ++position) {
+        band_keys[position] = {keys[position * options.band_count + band], kept[position]};
+      }
+      std::sort(band_keys.begin(), band_keys.end());
+      for (size_t first = 0, last = 0; first < band_keys.size(); first = last) {
+        while (last < band_keys.size() && band_keys[last].first == band_keys[first].first) {
+          ++last;
+        }
+        for (size_t i = first + 1; i < last; ++i) {
+          band_pairs[band].emplace_back(band_keys[first].second, band_keys[i].second);
+        }
+      }
+    });
+    std::vector<std::pair<size_t, size_t>> pairs;
+    for (auto& band : band_pairs) {
+      pairs.insert(pairs.end(), band.begin(), band.end());
+      band = {};
+    }
+    std::sort(policy, pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    std::vector<char> is_similar(pairs.size());
+    std::vector<size_t> pair_indexes(pairs.size());
+    std::iota(pair_indexes.begin(), pair_indexes.end(), 0);
+    std::for_each(policy, pair_indexes.begin(), pair_indexes.end(), [&](size_t i) {
+      is_similar[i] = ComputeJaccard(terms[pairs[i].first], terms[pairs[i].second]) >=
+                      options.jaccard_threshold;
+    });
+    // Similar pairs join groups whose root is the document with the smallest id
+    std::vector<size_t> parents = indexes;
+    const auto find_root = [&parents](size_t i) {
+      while (parents[i] != i) {
+        parents[i] = parents[parents[i]];
+        i = parents[i];
+      }
+      return i;
+    };
+    for (size_t i = 0; i < pairs.size(); ++i) {
+      if (is_similar[i]) {
+        const size_t lhs = find_root(pairs[i].first);
+        const size_t rhs = find_root(pairs[i].second);
+        parents[std::max(lhs, rhs)] = std::min(lhs, rhs);
+      }
+    }
+    for (const size_t i : kept) {
+      if (find_root(i) != i) {
+        is_duplicate[i] = true;
+      }
+    }
+  }
+
+  std::vector<int> result;
+  for (size_t i = 0; i < ids.size(); ++i) {
+    if (is_duplicate[i]) {
+      result.push_back(ids[i]);
+    }
+  }
+  return result;
+}
+
+void RemoveFound(SearchServer& search_server, const std::vector<int>& ids) {
+  for (const auto id : ids) {
+    std::cout << "Found duplicate document id " << id << '\n';
+  }
+  search_server.RemoveDocuments(ids);
+}
+
+}  // namespace
+
+std::vector<int> FindDuplicates(const SearchServer& search_server,
+                                const DuplicateOptions& options) {
+  return FindDuplicatesImpl(std::execution::seq, search_server, options);
+}
+
+std::vector<int> FindDuplicates(std::execution::parallel_policy policy,
+                                const SearchServer& search_server,
+                                const DuplicateOptions& options) {
+  return FindDuplicatesImpl(policy, search_server, options);
+}
+
+void RemoveDuplicates(SearchServer& search_server, const DuplicateOptions& options) {
+  RemoveFound(search_server, FindDuplicates(search_server, options));
+}
+
+void RemoveDuplicates(std::execution::parallel_policy policy,
+                      SearchServer& search_server,
+                      const DuplicateOptions& options) {
+  RemoveFound(search_server, FindDuplicates(policy, search_server, options));
+}
@@ -1,7 +1,35 @@
 ﻿#pragma once
 
 #include <algorithm>
+#include <cstddef>
+#include <execution>
 #include <set>
+#include <vector>
 #include "search_server.h"
 
-void RemoveDuplicates(SearchServer& search_server);
\ No newline at end of file
+struct DuplicateOptions {
+  // Documents whose word sets have at least this Jaccard similarity are duplicates,
+  // 1 finds equal word sets only
+  double jaccard_threshold = 1.0;
+  // Near duplicates are looked for among the documents with an equal band of their
+  // MinHash signatures: each is compared with the first one with the band. The defaults
+  // find pairs above 0.7 almost surely
+  size_t band_count = 16;
+  size_t band_size = 4;
+};
+
+// Ids of the documents which duplicate a kept document with a smaller id, in increasing
+// order. Equal word sets are found by 128-bit fingerprints of their terms. Near duplicate
+// pairs link documents into groups, the one with the smallest id is kept of every group
+std::vector<int> FindDuplicates(const SearchServer& search_server,
+                                const DuplicateOptions& options = {});
+
+std::vector<int> FindDuplicates(std::execution::parallel_policy policy,
+                                const SearchServer& search_server,
+                                const DuplicateOptions& options = {});
+
+void RemoveDuplicates(SearchServer& search_server, const DuplicateOptions& options = {});
+
+void RemoveDuplicates(std::execution::parallel_policy policy,
+                      SearchServer& search_server,
+                      const DuplicateOptions& options = {});
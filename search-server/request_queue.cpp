@@ -1,29 +1,139 @@
 ﻿#include "request_queue.h"
+#include <algorithm>
 
-RequestQueue::RequestQueue(const SearchServer& search_server)
-    : search_server_(search_server) {}
+double RequestStats::LatencyBucket::GetNoResultRate() const {
+  return request_count == 0 ? 0.0 : static_cast<double>(no_result_count) / request_count;
+}
+
+double RequestStats::GetNoResultRate() const {
+  return request_count == 0 ? 0.0 : static_cast<double>(no_result_count) / request_count;
+}
+
+RequestQueue::RequestQueue(const SearchServer& search_server, const RequestQueueOptions& options)
+    : search_server_(search_server),
+      capacity_(std::max<size_t>(options.request_window, 1)),
+      time_window_(
+          std::chrono::duration_cast<std::chrono::microseconds>(options.time_window).count()),
+      slots_(std::make_unique<std::atomic<uint64_t>[]>(capacity_)),
+      written_tickets_(std::make_unique<std::atomic<uint64_t>[]>(capacity_)) {}
+
+RequestQueue::RequestQueue(const SearchServer& search_server,
+                           QueryResultCache& cache,
+                           const RequestQueueOptions& options)
+    : RequestQueue(search_server, options) {
+  cache_ = &cache;
+}
 
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query,
                                                    DocumentStatus status) {
-  auto result = search_server_.FindTopDocuments(raw_query, status);
-  requests_.emplace_back(QueryResult{not result.empty()});
-  if (requests_.size() > min_in_day_) {
-    requests_.pop_front();
-  }
-  time++;
+  const auto start = Clock::now();
+  auto result = cache_ ? cache_->FindTopDocuments(raw_query, status)
+                       : search_server_.FindTopDocuments(raw_query, status);
+  Record(!result.empty(), start);
   return result;
 }
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query) {
-  auto result = search_server_.FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
-  requests_.emplace_back(QueryResult{not result.empty()});
-  if (requests_.size() > min_in_day_) {
-    requests_.pop_front();
+  return AddFindRequest(raw_query, DocumentStatus::ACTUAL);
+}
+
+int RequestQueue::GetNoResultRequests() const {
+  EvictExpired(GetTime(Clock::now()));
+  return static_cast<int>(total_.no_result_count.load(std::memory_order_relaxed));
+}
+
+RequestStats RequestQueue::GetStats() const {
+  EvictExpired(GetTime(Clock::now()));
+  RequestStats result;
+  result.request_count = total_.request_count.load(std::memory_order_relaxed);
+  result.no_result_count = total_.no_result_count.load(std::memory_order_relaxed);
+  result.latency_buckets.reserve(LATENCY_BUCKET_COUNT);
+  for (size_t bucket = 0; bucket < LATENCY_BUCKET_COUNT; ++bucket) {
+    result.latency_buckets.push_back(
+        {bucket + 1 < LATENCY_BUCKET_COUNT ? std::chrono::microseconds(int64_t{1} << bucket)
+                                           : std::chrono::microseconds::max(),
+         static_cast<size_t>(buckets_[bucket].request_count.load(std::memory_order_relaxed)),
+         static_cast<size_t>(buckets_[bucket].no_result_count.load(std::memory_order_relaxed))});
   }
-  time++;
   return result;
 }
 
-int RequestQueue::GetNoResultRequests() const {
-  return count_if(requests_.begin(), requests_.end(),
-                  [](const QueryResult& Q) { return not Q.success; });
+size_t RequestQueue::GetLatencyBucket(Clock::duration latency) {
+  const auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+  size_t bucket = 0;
+  while (bucket + 1 < LATENCY_BUCKET_COUNT && (int64_t{1} << bucket) <= microseconds) {
+    ++bucket;
+  }
+  return bucket;
+}
+
+void RequestQueue::Record(bool has_results, Clock::time_point start) {
+  const auto end = Clock::now();
+  const uint64_t now = GetTime(end);
+  const uint64_t slot = (now << TIME_SHIFT) | (GetLatencyBucket(end - start) << BUCKET_SHIFT) |
+                        (has_results ? 0 : NO_RESULT_BIT) | USED_BIT;
+  const uint64_t ticket = next_ticket_.fetch_add(1, std::memory_order_relaxed);
+  // The request pushed out of the window leaves the counters as this one comes in.
+  // A producer late by a whole ring may overwrite a newer request, the counters still
+  // match the slots
+  Count(slot, 1);
+  Count(slots_[ticket % capacity_].exchange(slot, std::memory_order_acq_rel), -1);
+  // A producer late by a whole ring doesn't take the mark of the newer request back
+  auto& written_ticket = written_tickets_[ticket % capacity_];
+  uint64_t written = written_ticket.load(std::memory_order_relaxed);
+  while (written < ticket + 1 &&
+         !written_ticket.compare_exchange_weak(written, ticket + 1, std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+  }
+  EvictExpired(now);
+}
+
+void RequestQueue::Count(uint64_t slot, int delta) const {
+  if ((slot & USED_BIT) == 0) {
+    return;
+  }
+  Counters& bucket = buckets_[(slot >> BUCKET_SHIFT) & BUCKET_MASK];
+  total_.request_count.fetch_add(delta, std::memory_order_relaxed);
+  bucket.request_count.fetch_add(delta, std::memory_order_relaxed);
+  if (slot & NO_RESULT_BIT) {
+    total_.no_result_count.fetch_add(delta, std::memory_order_relaxed);
+    bucket.no_result_count.fetch_add(delta, std::memory_order_relaxed);
+  }
+}
+
+void RequestQueue::EvictExpired(uint64_t now) const {
+  if (time_window_ == 0 || now < time_window_) {
+    return;
+  }
+  const uint64_t min_time = now - time_window_;
+  const uint64_t end = next_ticket_.load(std::memory_order_relaxed);
+  uint64_t ticket = expiry_ticket_.load(std::memory_order_relaxed);
+  // Requests before the ring were pushed out already
+  ticket = std::max(ticket, end > capacity_ ? end - capacity_ : 0);
+  for (; ticket < end; ++ticket) {
+    // Stops at the first slot its producer hasn't written yet: the ticket would be passed
+    // and the request, which may be the oldest one, would never expire
+    if (written_tickets_[ticket % capacity_].load(std::memory_order_acquire) <= ticket) {
+      break;
+    }
+    auto& slot = slots_[ticket % capacity_];
+    uint64_t value = slot.load(std::memory_order_acquire);
+    // Another reader evicted the request already
+    if ((value & USED_BIT) == 0) {
+      continue;
+    }
+    if ((value >> TIME_SHIFT) >= min_time) {
+      break;
+    }
+    if (slot.compare_exchange_strong(value, 0, std::memory_order_acq_rel)) {
+      Count(value, -1);
+    }
+  }
+  uint64_t expiry_ticket = expiry_ticket_.load(std::memory_order_relaxed);
+  while (expiry_ticket < ticket &&
+         !expiry_ticket_.compare_exchange_weak(expiry_ticket, ticket, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t RequestQueue::GetTime(Clock::time_point time) const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(time - start_time_).count();
 }
@@ -1,14 +1,56 @@
 ﻿#pragma once
 #include "document.h"
+#include "query_result_cache.h"
 #include "search_server.h"
 
-#include <deque>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
+struct RequestQueueOptions {
+  // Number of the latest requests in the statistics
+  size_t request_window = 1440;
+  // Requests older than this leave the statistics too, zero keeps them until they are
+  // pushed out by newer ones
+  std::chrono::steady_clock::duration time_window{};
+};
+
+struct RequestStats {
+  struct LatencyBucket {
+    // Latencies of the bucket are below the bound, the last bucket has no bound
+    std::chrono::microseconds upper_bound;
+    size_t request_count = 0;
+    size_t no_result_count = 0;
+
+    double GetNoResultRate() const;
+  };
+
+  size_t request_count = 0;
+  size_t no_result_count = 0;
+  std::vector<LatencyBucket> latency_buckets;
+
+  double GetNoResultRate() const;
+};
+
+// Runs search requests from any number of threads and keeps statistics of the requests
+// in the window. Requests go to a ring of atomic slots and running counters follow every
+// change of a slot, so the statistics are read in constant time without locks
 class RequestQueue {
  public:
-  explicit RequestQueue(const SearchServer& search_server);
+  static constexpr size_t LATENCY_BUCKET_COUNT = 24;
+
+  explicit RequestQueue(const SearchServer& search_server,
+                        const RequestQueueOptions& options = {});
+
+  // Requests are answered through the cache, which may be shared with other queues
+  RequestQueue(const SearchServer& search_server,
+               QueryResultCache& cache,
+               const RequestQueueOptions& options = {});
 
   template <typename DocumentPredicate>
   std::vector<Document> AddFindRequest(const std::string& raw_query,
@@ -20,24 +62,59 @@ class RequestQueue {
 
   int GetNoResultRequests() const;
 
+  RequestStats GetStats() const;
+
  private:
-  struct QueryResult {
-    bool success;
+  using Clock = std::chrono::steady_clock;
+
+  // Slot layout: time of the request in microseconds since the queue was made, the latency
+  // bucket, the no result flag and the flag of a used slot
+  static constexpr uint64_t USED_BIT = 1;
+  static constexpr uint64_t NO_RESULT_BIT = 2;
+  static constexpr int BUCKET_SHIFT = 2;
+  static constexpr uint64_t BUCKET_MASK = 31;
+  static constexpr int TIME_SHIFT = 7;
+  static_assert(LATENCY_BUCKET_COUNT <= BUCKET_MASK + 1);
+
+  struct alignas(64) Counters {
+    std::atomic<int64_t> request_count = 0;
+    std::atomic<int64_t> no_result_count = 0;
   };
-  std::deque<QueryResult> requests_;
-  const static int min_in_day_ = 1440;
-  int time = 0;
+
+  static size_t GetLatencyBucket(Clock::duration latency);
+
+  void Record(bool has_results, Clock::time_point start);
+
+  // Takes the request of the slot out of the counters or puts it in
+  void Count(uint64_t slot, int delta) const;
+
+  // Clears the slots of requests older than the time window
+  void EvictExpired(uint64_t now) const;
+
+  uint64_t GetTime(Clock::time_point time) const;
+
   const SearchServer& search_server_;
+  QueryResultCache* cache_ = nullptr;
+  const size_t capacity_;
+  const uint64_t time_window_;
+  const Clock::time_point start_time_ = Clock::now();
+  mutable std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+  // Ticket + 1 of the request last written to each slot, stored after the slot. A ticket
+  // is taken before its slot is written, so the ticket alone doesn't tell a written slot
+  std::unique_ptr<std::atomic<uint64_t>[]> written_tickets_;
+  std::atomic<uint64_t> next_ticket_ = 0;
+  // Ticket of the oldest request the time window check hasn't passed
+  mutable std::atomic<uint64_t> expiry_ticket_ = 0;
+  mutable Counters total_;
+  mutable std::array<Counters, LATENCY_BUCKET_COUNT> buckets_;
 };
 
 template <typename DocumentPredicate>
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query,
                                               DocumentPredicate document_predicate) {
-  const auto result = search_server_.FindTopDocuments(raw_query, document_predicate);
-  requests_.push_back({not result.empty()});
-  if (requests_.size() > min_in_day_) {
-    requests_.pop_front();
-  }
-  time++;
+  const auto start = Clock::now();
+  auto result = cache_ ? cache_->FindTopDocuments(raw_query, document_predicate)
+                       : search_server_.FindTopDocuments(raw_query, document_predicate);
+  Record(!result.empty(), start);
   return result;
-}
\ No newline at end of file
+}
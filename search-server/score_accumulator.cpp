@@ -0,0 +1,141 @@
+﻿#include "score_accumulator.h"
+#include <algorithm>
+
+namespace {
+
+std::vector<std::unique_ptr<ScoreAccumulator>>& GetThreadPool() {
+  thread_local std::vector<std::unique_ptr<ScoreAccumulator>> pool;
+  return pool;
+}
+
+}  // namespace
+
+void ScoreAccumulator::Add(int document_id, double score) {
+  const size_t page_index = static_cast<size_t>(document_id) / PAGE_SIZE;
+  const size_t slot = static_cast<size_t>(document_id) % PAGE_SIZE;
+  Page& page = GetPage(page_index);
+  uint64_t& word = page.touched[slot / 64];
+  const uint64_t bit = uint64_t{1} << (slot % 64);
+  if (word & bit) {
+    page.scores[slot] += score;
+  } else {
+    word |= bit;
+    page.scores[slot] = score;
+    ++size_;
+  }
+}
+
+void ScoreAccumulator::Erase(int document_id) {
+  const size_t page_index = static_cast<size_t>(document_id) / PAGE_SIZE;
+  const size_t slot = static_cast<size_t>(document_id) % PAGE_SIZE;
+  if (page_index >= pages_.size() || !pages_[page_index]) {
+    return;
+  }
+  uint64_t& word = pages_[page_index]->touched[slot / 64];
+  const uint64_t bit = uint64_t{1} << (slot % 64);
+  if (word & bit) {
+    word &= ~bit;
+    --size_;
+  }
+}
+
+void ScoreAccumulator::Merge(const ScoreAccumulator& other) {
+  for (const size_t page_index : other.touched_pages_) {
+    const Page& source = *other.pages_[page_index];
+    Page& target = GetPage(page_index);
+    for (size_t word = 0; word < WORD_COUNT; ++word) {
+      for (uint64_t bits = source.touched[word]; bits != 0; bits &= bits - 1) {
+        const size_t slot = word * 64 + __builtin_ctzll(bits);
+        const uint64_t bit = uint64_t{1} << (slot % 64);
+        if (target.touched[word] & bit) {
+          target.scores[slot] += source.scores[slot];
+        } else {
+          target.touched[word] |= bit;
+          target.scores[slot] = source.scores[slot];
+          ++size_;
+        }
+      }
+    }
+  }
+}
+
+void ScoreAccumulator::Clear() {
+  for (const size_t page_index : touched_pages_) {
+    Page& page = *pages_[page_index];
+    std::fill(page.touched, page.touched + WORD_COUNT, 0);
+    page.is_listed = false;
+  }
+  touched_pages_.clear();
+  size_ = 0;
+}
+
+void ScoreAccumulator::Release() {
+  pages_.clear();
+  pages_.shrink_to_fit();
+  touched_pages_.clear();
+  touched_pages_.shrink_to_fit();
+  size_ = 0;
+  page_count_ = 0;
+}
+
+size_t ScoreAccumulator::size() const {
+  return size_;
+}
+
+size_t ScoreAccumulator::GetPageCount() const {
+  return page_count_;
+}
+
+ScoreAccumulator::Page& ScoreAccumulator::GetPage(size_t page_index) {
+  if (page_index >= pages_.size()) {
+    pages_.resize(page_index + 1);
+  }
+  auto& page = pages_[page_index];
+  if (!page) {
+    page = std::make_unique<Page>();
+    ++page_count_;
+  }
+  if (!page->is_listed) {
+    page->is_listed = true;
+    touched_pages_.push_back(page_index);
+  }
+  return *page;
+}
+
+PooledScoreAccumulator::PooledScoreAccumulator() {
+  auto& pool = GetThreadPool();
+  if (pool.empty()) {
+    accumulator_ = std::make_unique<ScoreAccumulator>();
+  } else {
+    accumulator_ = std::move(pool.back());
+    pool.pop_back();
+  }
+}
+
+PooledScoreAccumulator::~PooledScoreAccumulator() {
+  if (!accumulator_) {
+    return;
+  }
+  auto& pool = GetThreadPool();
+  if (pool.size() == MAX_POOLED_COUNT) {
+    return;
+  }
+  size_t pooled_page_count = accumulator_->GetPageCount();
+  for (const auto& accumulator : pool) {
+    pooled_page_count += accumulator->GetPageCount();
+  }
+  if (pooled_page_count > MAX_POOLED_PAGE_COUNT) {
+    accumulator_->Release();
+  } else {
+    accumulator_->Clear();
+  }
+  pool.push_back(std::move(accumulator_));
+}
+
+ScoreAccumulator& PooledScoreAccumulator::operator*() const {
+  return *accumulator_;
+}
+
+ScoreAccumulator* PooledScoreAccumulator::operator->() const {
+  return accumulator_.get();
+}
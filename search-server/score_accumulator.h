@@ -0,0 +1,92 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Relevance accumulator indexed by document id. Pages of scores are allocated on
+// first touch and kept, only the touched pages are reset between queries.
+class ScoreAccumulator {
+ public:
+  static constexpr size_t PAGE_SIZE = 4096;
+
+  void Add(int document_id, double score);
+
+  void Erase(int document_id);
+
+  // Not thread safe for the same accumulator
+  void Merge(const ScoreAccumulator& other);
+
+  void Clear();
+
+  // Clears and frees the pages, for accumulators kept idle
+  void Release();
+
+  size_t size() const;
+
+  // Allocated pages, each takes a bit over PAGE_SIZE doubles
+  size_t GetPageCount() const;
+
+  // Calls callback(document_id, relevance) in increasing document_id order
+  template <typename Callback>
+  void ForEach(Callback callback);
+
+ private:
+  static constexpr size_t WORD_COUNT = PAGE_SIZE / 64;
+
+  struct Page {
+    double scores[PAGE_SIZE];
+    uint64_t touched[WORD_COUNT];
+    bool is_listed;
+  };
+
+  Page& GetPage(size_t page_index);
+
+  std::vector<std::unique_ptr<Page>> pages_;
+  std::vector<size_t> touched_pages_;
+  size_t size_ = 0;
+  size_t page_count_ = 0;
+};
+
+// Borrows a cleared accumulator from the pool of the current thread and returns it there
+class PooledScoreAccumulator {
+ public:
+  // Idle accumulators a thread keeps, whatever the core count. A parallel query borrows
+  // one per chunk, the ones beyond that are freed when they come back
+  static constexpr size_t MAX_POOLED_COUNT = 8;
+  // Pages the idle accumulators of a thread keep, about 8 MB of scores. A query of common
+  // words touches every page of the corpus, an accumulator returned over the budget is
+  // released
+  static constexpr size_t MAX_POOLED_PAGE_COUNT = 256;
+
+  PooledScoreAccumulator();
+
+  PooledScoreAccumulator(PooledScoreAccumulator&& other) = default;
+
+  PooledScoreAccumulator& operator=(PooledScoreAccumulator&& other) = default;
+
+  ~PooledScoreAccumulator();
+
+  ScoreAccumulator& operator*() const;
+
+  ScoreAccumulator* operator->() const;
+
+ private:
+  std::unique_ptr<ScoreAccumulator> accumulator_;
+};
+
+template <typename Callback>
+void ScoreAccumulator::ForEach(Callback callback) {
+  std::sort(touched_pages_.begin(), touched_pages_.end());
+  for (const size_t page_index : touched_pages_) {
+    const Page& page = *pages_[page_index];
+    for (size_t word = 0; word < WORD_COUNT; ++word) {
+      for (uint64_t bits = page.touched[word]; bits != 0; bits &= bits - 1) {
+        const size_t slot = word * 64 + __builtin_ctzll(bits);
+        callback(static_cast<int>(page_index * PAGE_SIZE + slot), page.scores[slot]);
+      }
+    }
+  }
+}
@@ -0,0 +1,40 @@
+﻿#include "scorer.h"
+#include <algorithm>
+#include <cmath>
+
+TfIdfScorer::TfIdfScorer([[maybe_unused]] const IndexSnapshot& snapshot,
+                         const DocumentTable& documents)
+    : documents_(&documents) {}
+
+TfIdfScorer::Term TfIdfScorer::PrepareTerm([[maybe_unused]] InvertedIndex::TermId term_id,
+                                           double inverse_document_freq) const {
+  return {inverse_document_freq};
+}
+
+TfIdfScorer::Term TfIdfScorer::PrepareTerms([[maybe_unused]] size_t document_freq,
+                                            double inverse_document_freq) const {
+  return {inverse_document_freq};
+}
+
+Bm25Scorer::Bm25Scorer(const IndexSnapshot& snapshot, const DocumentTable& documents)
+    : snapshot_(&snapshot), documents_(&documents), length_norm_(K1 * (1 - B)) {
+  const double average_length =
+      std::max<double>(snapshot.GetWordCount(), 1) /
+      std::max<double>(snapshot.GetDocumentCount(), 1);
+  average_length_norm_ = K1 * B / average_length;
+}
+
+Bm25Scorer::Term Bm25Scorer::PrepareTerm(InvertedIndex::TermId term_id,
+                                         double inverse_document_freq) const {
+  return PrepareTerms(snapshot_->GetDocumentFreq(term_id), inverse_document_freq);
+}
+
+Bm25Scorer::Term Bm25Scorer::PrepareTerms(size_t terms_document_freq,
+                                          [[maybe_unused]] double inverse_document_freq) const {
+  const double document_count = static_cast<double>(snapshot_->GetDocumentCount());
+  const double document_freq = static_cast<double>(terms_document_freq);
+  // Never negative unlike the classic form, so frequent terms don't lower the relevance
+  const double bm25_inverse_document_freq =
+      std::log(1 + (document_count - document_freq + 0.5) / (document_freq + 0.5));
+  return {bm25_inverse_document_freq * (K1 + 1)};
+}
@@ -0,0 +1,92 @@
+﻿#pragma once
+
+#include <cstdint>
+#include "document_table.h"
+#include "inverted_index.h"
+
+// Relevance models of SearchServer::FindTopDocuments. A scorer is made for every query from
+// the snapshot it reads and prepares the statistics of each plus term once, postings are
+// then scored by inlined Score calls. Any class with the same members can be a scorer
+
+// Sum of term_freq * inverse_document_freq with term_freq = term_count / document_length
+class TfIdfScorer {
+ public:
+  struct Term {
+    double inverse_document_freq;
+  };
+
+  TfIdfScorer(const IndexSnapshot& snapshot, const DocumentTable& documents);
+
+  // The inverse document frequency is the one resolved with the query
+  Term PrepareTerm(InvertedIndex::TermId term_id, double inverse_document_freq) const;
+
+  // Terms scored as one word, like the ones of a prefix: term counts of a document are
+  // summed, document_freq counts the documents with any of the terms
+  Term PrepareTerms(size_t document_freq, double inverse_document_freq) const;
+
+  double Score(const Term& term, int internal_id, uint32_t term_count) const {
+    return term_count * documents_->GetInvWordCount(internal_id) * term.inverse_document_freq;
+  }
+
+  // Score of a posting by the term frequency stored in it, which never underestimates
+  // term_count / document_length. Must not exceed GetMaxScore of a larger frequency
+  double ScoreTermFreq(const Term& term,
+                       [[maybe_unused]] int internal_id,
+                       double term_freq) const {
+    return term_freq * term.inverse_document_freq;
+  }
+
+  // Upper bound of the scores of postings whose term_freq doesn't exceed max_term_freq
+  double GetMaxScore(const Term& term, double max_term_freq) const {
+    return max_term_freq * term.inverse_document_freq;
+  }
+
+ private:
+  const DocumentTable* documents_;
+};
+
+// Okapi BM25. The length norm k1 * (1 - b + b * document_length / average_length) is applied
+// through the inverse word counts of the documents, so a posting costs one division
+class Bm25Scorer {
+ public:
+  static constexpr double K1 = 1.2;
+  static constexpr double B = 0.75;
+
+  struct Term {
+    // inverse_document_freq * (K1 + 1)
+    double weight;
+  };
+
+  Bm25Scorer(const IndexSnapshot& snapshot, const DocumentTable& documents);
+
+  Term PrepareTerm(InvertedIndex::TermId term_id, double inverse_document_freq) const;
+
+  Term PrepareTerms(size_t document_freq, double inverse_document_freq) const;
+
+  double Score(const Term& term, int internal_id, uint32_t term_count) const {
+    const double inv_word_count = documents_->GetInvWordCount(internal_id);
+    const double term_freq = term_count * inv_word_count;
+    return term.weight * term_freq /
+           (term_freq + length_norm_ * inv_word_count + average_length_norm_);
+  }
+
+  double ScoreTermFreq(const Term& term, int internal_id, double term_freq) const {
+    return term.weight * term_freq /
+           (term_freq + length_norm_ * documents_->GetInvWordCount(internal_id) +
+            average_length_norm_);
+  }
+
+  double GetMaxScore(const Term& term, double max_term_freq) const {
+    return max_term_freq > 0
+               ? term.weight * max_term_freq / (max_term_freq + average_length_norm_)
+               : 0;
+  }
+
+ private:
+  const IndexSnapshot* snapshot_;
+  const DocumentTable* documents_;
+  // K1 * (1 - B)
+  double length_norm_;
+  // K1 * B / average_length
+  double average_length_norm_;
+};
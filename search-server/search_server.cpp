@@ -1,7 +1,11 @@
 ﻿#include "search_server.h"
 #include <algorithm>
+#include <atomic>
 #include <execution>
 #include <numeric>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
 SearchServer::SearchServer(const std::string& stop_words_text)
@@ -10,53 +14,192 @@ SearchServer::SearchServer(const std::string& stop_words_text)
 SearchServer::SearchServer(const std::string_view& stop_words_text)
     : SearchServer(SplitIntoWords(stop_words_text)) {}
 
+SearchServer::SearchServer(std::shared_ptr<const IndexFile> index_file)
+    : SearchServer(index_file->GetText(IndexSection::STOP_WORDS)) {
+  index_file_ = std::move(index_file);
+  documents_.Load(*index_file_);
+  const int document_count = documents_.GetInternalIdLimit();
+  const size_t term_count = InvertedIndex::GetTermCount(*index_file_);
+  forward_index_.Load(*index_file_, document_count, term_count);
+  positions_.Load(*index_file_, document_count, term_count);
+  uint64_t word_count = 0;
+  for (int internal_id = 0; internal_id < documents_.GetInternalIdLimit(); ++internal_id) {
+    const int document_id = documents_.GetExternalId(internal_id);
+    if (documents_.FindInternalId(document_id) == internal_id) {
+      document_ids_.insert(document_id);
+      for (const auto& entry : forward_index_.GetEntries(internal_id)) {
+        word_count += entry.term_count;
+      }
+    }
+  }
+  index_.Load(*index_file_, documents_.size(), word_count);
+}
+
 void SearchServer::AddDocument(int document_id,
                                const std::string_view& document,
                                DocumentStatus status,
                                const std::vector<int>& ratings) {
-  if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+  std::lock_guard guard(write_mutex_);
+  if ((document_id < 0) ||
+      (documents_.FindInternalId(document_id) != DocumentTable::NO_DOCUMENT)) {
     throw std::invalid_argument("Invalid document_id"s);
   }
-  const auto words = SplitIntoWordsNoStop(document);
+  std::vector<std::string_view> words;
+  SplitIntoWordsNoStop(document, words);
 
+  std::vector<InvertedIndex::TermId> term_ids(words.size());
+  std::transform(words.begin(), words.end(), term_ids.begin(),
+                 [this](const auto& word) { return index_.AddTerm(word); });
+  positions_.Add(term_ids);
+  std::sort(term_ids.begin(), term_ids.end());
+
+  // The document gets the next internal id in every structure, so postings are always
+  // appended to the end of the lists of the mutable segment. Queries don't see it
+  // before the index publishes its postings
   const double inv_word_count = 1.0 / words.size();
-  for (const auto& word : words) {
-    word_to_document_freqs_[std::string(word)][document_id] += inv_word_count;
-    document_to_word_freqs_[document_id][std::move(word)] += inv_word_count;
+  documents_.Add(document_id, ComputeAverageRating(ratings), status, inv_word_count);
+  std::vector<InvertedIndex::TermEntry> entries;
+  for (auto it = term_ids.begin(); it != term_ids.end();) {
+    const auto next = std::upper_bound(it, term_ids.end(), *it);
+    entries.push_back({*it, static_cast<uint32_t>(next - it)});
+    it = next;
   }
-
-  documents_.emplace(document_id, DocumentData{ComputeAverageRating(ratings), status});
+  index_.AddDocument(inv_word_count, entries);
+  forward_index_.Add(entries);
   document_ids_.insert(document_id);
 }
 
-int SearchServer::GetDocumentCount() const {
-  return documents_.size();
-}
+std::vector<AddDocumentResult> SearchServer::AddDocuments(
+    const std::vector<DocumentToAdd>& documents) {
+  std::lock_guard guard(write_mutex_);
+  std::vector<AddDocumentResult> results(documents.size(), AddDocumentResult::ADDED);
+  std::unordered_set<int> batch_ids;
+  for (size_t i = 0; i < documents.size(); ++i) {
+    const int document_id = documents[i].document_id;
+    if (document_id < 0) {
+      results[i] = AddDocumentResult::INVALID_ID;
+    } else if (documents_.FindInternalId(document_id) != DocumentTable::NO_DOCUMENT ||
+               !batch_ids.insert(document_id).second) {
+      results[i] = AddDocumentResult::DUPLICATE_ID;
+    }
+  }
 
-SearchServer::MatchedWords SearchServer::MatchDocument(const std::string_view& raw_query,
-                                                       int document_id) const {
-  const auto query = ParseQuery(raw_query);
-  std::vector<std::string_view> matched_words;
-  for (const auto& word : query.minus_words) {
-    if (word_to_document_freqs_.count(word) == 0) {
-      continue;
+  // Every chunk of the batch is tokenized on its own thread against a local vocabulary,
+  // so the shared dictionary is searched once per distinct word of a chunk
+  struct TokenizedChunk {
+    size_t begin;
+    size_t end;
+    std::vector<std::string_view> words;
+    // Entries of the documents of the chunk with ids of words
+    std::vector<std::vector<InvertedIndex::TermEntry>> entries;
+    std::vector<size_t> word_counts;
+    // Ids of words of the documents in the order of their texts, for the position index
+    std::vector<std::vector<uint32_t>> texts;
+  };
+  const size_t chunk_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                              std::max<size_t>(documents.size(), 1));
+  std::vector<TokenizedChunk> chunks(chunk_count);
+  for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+    chunks[chunk].begin = documents.size() * chunk / chunk_count;
+    chunks[chunk].end = documents.size() * (chunk + 1) / chunk_count;
+  }
+
+  std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](TokenizedChunk& chunk) {
+    std::unordered_map<std::string_view, uint32_t> word_ids;
+    std::vector<uint32_t> ids;
+    std::vector<std::string_view> words;
+    chunk.entries.resize(chunk.end - chunk.begin);
+    chunk.word_counts.resize(chunk.end - chunk.begin);
+    chunk.texts.resize(positions_.IsEnabled() ? chunk.end - chunk.begin : 0);
+    for (size_t i = chunk.begin; i < chunk.end; ++i) {
+      if (results[i] != AddDocumentResult::ADDED) {
+        continue;
+      }
+      try {
+        SplitIntoWordsNoStop(documents[i].text, words);
+      } catch (const std::invalid_argument&) {
+        results[i] = AddDocumentResult::INVALID_WORD;
+        continue;
+      }
+      ids.clear();
+      for (const auto& word : words) {
+        const auto [it, inserted] =
+            word_ids.try_emplace(word, static_cast<uint32_t>(chunk.words.size()));
+        if (inserted) {
+          chunk.words.push_back(word);
+        }
+        ids.push_back(it->second);
+      }
+      if (!chunk.texts.empty()) {
+        chunk.texts[i - chunk.begin] = ids;
+      }
+      std::sort(ids.begin(), ids.end());
+      auto& entries = chunk.entries[i - chunk.begin];
+      for (auto it = ids.begin(); it != ids.end();) {
+        const auto next = std::upper_bound(it, ids.end(), *it);
+        entries.push_back({*it, static_cast<uint32_t>(next - it)});
+        it = next;
+      }
+      chunk.word_counts[i - chunk.begin] = words.size();
     }
-    if (word_to_document_freqs_.at(std::string(word)).count(document_id)) {
-      matched_words.clear();
-      return {matched_words, documents_.at(document_id).status};
+  });
+
+  // Documents get consecutive internal ids in the order of the batch
+  std::vector<InvertedIndex::DocumentEntries> batch;
+  for (auto& chunk : chunks) {
+    std::vector<InvertedIndex::TermId> term_ids(chunk.words.size(), InvertedIndex::NO_TERM);
+    for (size_t i = chunk.begin; i < chunk.end; ++i) {
+      if (results[i] != AddDocumentResult::ADDED) {
+        continue;
+      }
+      auto& entries = chunk.entries[i - chunk.begin];
+      for (auto& entry : entries) {
+        auto& term_id = term_ids[entry.term_id];
+        if (term_id == InvertedIndex::NO_TERM) {
+          term_id = index_.AddTerm(chunk.words[entry.term_id]);
+        }
+        entry.term_id = term_id;
+      }
+      if (!chunk.texts.empty()) {
+        auto& text = chunk.texts[i - chunk.begin];
+        for (auto& word : text) {
+          word = term_ids[word];
+        }
+        positions_.Add(text);
+      }
+      std::sort(entries.begin(), entries.end(),
+                [](const auto& lhs, const auto& rhs) { return lhs.term_id < rhs.term_id; });
+      const double inv_word_count = 1.0 / chunk.word_counts[i - chunk.begin];
+      documents_.Add(documents[i].document_id, ComputeAverageRating(documents[i].ratings),
+                     documents[i].status, inv_word_count);
+      batch.push_back({inv_word_count, std::move(entries)});
     }
   }
+  index_.AddDocuments(batch);
 
-  for (const auto& word : query.plus_words) {
-    if (word_to_document_freqs_.count(word) == 0) {
-      continue;
-    }
-    if (word_to_document_freqs_.at(std::string(word)).count(document_id)) {
-      matched_words.push_back(word);
+  size_t added = 0;
+  for (size_t i = 0; i < documents.size(); ++i) {
+    if (results[i] == AddDocumentResult::ADDED) {
+      forward_index_.Add(batch[added++].entries);
+      document_ids_.insert(documents[i].document_id);
     }
   }
+  return results;
+}
+
+int SearchServer::GetDocumentCount() const {
+  return static_cast<int>(index_.GetSnapshot().GetDocumentCount());
+}
+
+uint64_t SearchServer::GetGeneration() const {
+  return index_.GetSnapshot().GetGeneration();
+}
 
-  return {matched_words, documents_.at(document_id).status};
+SearchServer::MatchedWords SearchServer::MatchDocument(const std::string_view& raw_query,
+                                                       int document_id) const {
+  const PooledPreparedQuery query;
+  ParseQuery(raw_query, *query);
+  return MatchDocument(*query, raw_query, document_id);
 }
 
 SearchServer::MatchedWords SearchServer::MatchDocument(
@@ -73,29 +216,85 @@ SearchServer::MatchedWords SearchServer::MatchDocument(
     [[maybe_unused]] std::execution::parallel_policy par,
     const std::string_view& raw_query,
     int document_id) const {
+  // A posting check per word is too little work to split between threads
+  return MatchDocument(raw_query, document_id);
+}
 
-  const auto query = ParseQuery(par, raw_query);
+SearchServer::MatchedWords SearchServer::MatchDocument(const PreparedQuery& query,
+                                                       int document_id) const {
+  return MatchDocument(query, query.GetText(), document_id);
+}
+
+SearchServer::MatchedWords SearchServer::MatchDocument(const PreparedQuery& query,
+                                                       std::string_view text,
+                                                       int document_id) const {
+  const auto snapshot = index_.GetSnapshot();
+  const int internal_id = GetInternalId(snapshot, document_id);
+  const DocumentStatus status = documents_.GetStatus(internal_id);
+  TermBuffer buffer;
+  const auto terms = GetQueryTerms(snapshot, query, buffer);
+  std::vector<std::string_view> matched_words;
+  for (const auto& term : terms.minus) {
+    if (term.term_id != InvertedIndex::NO_TERM &&
+        snapshot.HasPosting(term.term_id, internal_id)) {
+      return {matched_words, status};
+    }
+  }
+  const auto has_posting = [&snapshot, internal_id](InvertedIndex::TermId term_id) {
+    return snapshot.HasPosting(term_id, internal_id);
+  };
+  if (std::any_of(terms.minus_prefix.begin(), terms.minus_prefix.end(), has_posting)) {
+    return {matched_words, status};
+  }
+  for (const auto& prefix : terms.prefixes) {
+    if (prefix.is_required &&
+        std::none_of(prefix.terms.begin(), prefix.terms.end(), has_posting)) {
+      return {matched_words, status};
+    }
+  }
+  for (const auto& term : terms.required) {
+    if (term.term_id == InvertedIndex::NO_TERM || !snapshot.HasPosting(term.term_id, internal_id)) {
+      return {matched_words, status};
+    }
+  }
+  if (!HasPhrases(terms, internal_id)) {
+    return {matched_words, status};
+  }
 
-  if (query.plus_words.empty() or
-      any_of(query.minus_words.begin(), query.minus_words.end(),
-             [&w = word_to_document_freqs_, document_id](const auto& word) {
-               return w.count(word) && w.at(std::string(word)).count(document_id);
-             })) {
-    return MatchedWords{std::vector<std::string_view>{}, documents_.at(document_id).status};
+  for (size_t i = 0; i < query.plus_words_.size(); ++i) {
+    const auto term_id = terms.plus.begin()[i].term_id;
+    if (term_id != InvertedIndex::NO_TERM && snapshot.HasPosting(term_id, internal_id)) {
+      const auto& word = query.plus_words_[i];
+      matched_words.push_back(text.substr(word.offset, word.length));
+    }
   }
-  std::vector<std::string_view> matched_words(query.plus_words.size());
-  const auto it = copy_if(std::execution::par, query.plus_words.begin(),
-                          query.plus_words.end(), matched_words.begin(),
-                          [&w = word_to_document_freqs_, document_id](const auto& word) {
-                            return w.count(word) && w.at(std::string(word)).count(document_id);
-                          });
-  matched_words.erase(it, matched_words.end());
-  DeleteCopies(matched_words);
-  return MatchedWords{matched_words, documents_.at(document_id).status};
+  for (size_t i = 0; i < query.prefix_words_.size(); ++i) {
+    const auto& prefix_terms = terms.prefixes.begin()[i].terms;
+    if (std::any_of(prefix_terms.begin(), prefix_terms.end(), has_posting)) {
+      const auto& word = query.prefix_words_[i];
+      matched_words.push_back(text.substr(word.offset, word.length));
+    }
+  }
+
+  return {matched_words, status};
+}
+
+PreparedQuery SearchServer::PrepareQuery(const std::string_view& raw_query) const {
+  PreparedQuery query;
+  PrepareQuery(raw_query, query);
+  return query;
+}
+
+void SearchServer::PrepareQuery(const std::string_view& raw_query, PreparedQuery& query) const {
+  ParseQuery(raw_query, query);
+  const auto snapshot = index_.GetSnapshot();
+  ResolveTerms(snapshot, query, query.terms_);
+  query.server_id_ = server_id_;
+  query.generation_ = snapshot.GetGeneration();
 }
 
 bool SearchServer::IsStopWord(const std::string_view& word) const {
-  return stop_words_.count(word) > 0;
+  return stop_word_filter_.Contains(word);
 }
 
 bool SearchServer::IsValidWord(const std::string_view& word) {
@@ -103,16 +302,23 @@ bool SearchServer::IsValidWord(const std::string_view& word) {
   return std::none_of(word.begin(), word.end(), [](char c) { return c >= '\0' && c < ' '; });
 }
 
-std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(
-    const std::string_view& text) const {
-  std::vector<std::string_view> words;
-  for (const auto& word : SplitIntoWords(text)) {
-    if (!IsValidWord(word)) {
-      throw std::invalid_argument("Word "s + std::string(word) + " is invalid"s);
-    }
-    if (!IsStopWord(word)) {
-      words.push_back(word);
-    }
+void SearchServer::SplitIntoWordsNoStop(const std::string_view& text,
+                                        std::vector<std::string_view>& words) const {
+  if (!SplitIntoValidWords(text, words)) {
+    throw std::invalid_argument("Word "s + std::string(words.back()) + " is invalid"s);
+  }
+  if (!stop_word_filter_.empty()) {
+    words.erase(std::remove_if(words.begin(), words.end(),
+                               [this](const auto& word) { return IsStopWord(word); }),
+                words.end());
+  }
+}
+
+const std::vector<std::string_view>& SearchServer::SplitQueryIntoWords(
+    const std::string_view& text) {
+  thread_local std::vector<std::string_view> words;
+  if (!SplitIntoValidWords(text, words)) {
+    throw std::invalid_argument("Query word "s + std::string(words.back()) + " is invalid");
   }
   return words;
 }
@@ -129,76 +335,448 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(const std::string_view& tex
     throw std::invalid_argument("Query word is empty"s);
   }
   std::string_view word = text;
-  bool is_minus = false;
-  if (word[0] == '-') {
-    is_minus = true;
+  const bool is_minus = word[0] == '-';
+  const bool is_required = word[0] == '+';
+  if (is_minus || is_required) {
     word = word.substr(1);
   }
-  if (word.empty() || word[0] == '-' || !IsValidWord(word)) {
+  const bool is_prefix = !word.empty() && word.back() == '*';
+  if (is_prefix) {
+    word.remove_suffix(1);
+  }
+  // Special characters are rejected by the tokenizer
+  if (word.empty() || word[0] == '-' || word[0] == '+' || (is_prefix && word.back() == '*')) {
     throw std::invalid_argument("Query word "s + std::string(text) + " is invalid");
   }
 
-  return {word, is_minus, IsStopWord(word)};
+  // Prefixes of stop words may still start other words
+  return {word, is_minus, is_required, is_prefix, !is_prefix && IsStopWord(word)};
+}
+
+void SearchServer::ParseQuery(const std::string_view& text, PreparedQuery& query) const {
+  query.Clear();
+  query.text_ = text;
+  // Views into the copy of the text, so offsets can be taken from them
+  const std::string_view query_text = query.text_;
+  bool is_in_phrase = false;
+  for (const auto& token : SplitQueryIntoWords(query_text)) {
+    // Quotes open and close phrases at the edges of words
+    std::string_view word = token;
+    bool is_phrase_end = false;
+    if (!is_in_phrase && !word.empty() && word[0] == '"') {
+      is_in_phrase = true;
+      word.remove_prefix(1);
+    }
+    if (is_in_phrase && !word.empty() && word.back() == '"') {
+      is_phrase_end = true;
+      word.remove_suffix(1);
+    }
+    if (word.find('"') != std::string_view::npos) {
+      throw std::invalid_argument("Query word "s + std::string(token) + " is invalid");
+    }
+    if (!word.empty() || !is_in_phrase) {
+      const auto query_word = ParseQueryWord(word);
+      if (is_in_phrase &&
+          (query_word.is_minus || query_word.is_required || query_word.is_prefix)) {
+        throw std::invalid_argument("Query phrase word "s + std::string(token) + " is invalid");
+      }
+      const PreparedQuery::Word position{
+          static_cast<size_t>(query_word.data.data() - query_text.data()),
+          query_word.data.size()};
+      if (query_word.is_prefix) {
+        if (query_word.is_minus) {
+          query.minus_prefix_words_.push_back(position);
+        } else {
+          query.prefix_words_.push_back(position);
+        }
+        if (query_word.is_required) {
+          query.required_prefix_words_.push_back(position);
+        }
+      } else if (!query_word.is_stop) {
+        if (query_word.is_minus) {
+          query.minus_words_.push_back(position);
+        } else {
+          query.plus_words_.push_back(position);
+        }
+        if (is_in_phrase) {
+          query.phrase_words_.push_back(position);
+        }
+        if (query_word.is_required) {
+          query.required_words_.push_back(position);
+        }
+      }
+    }
+    if (is_phrase_end) {
+      is_in_phrase = false;
+      const auto phrase_end = static_cast<uint32_t>(query.phrase_words_.size());
+      // Phrases of stop words only don't restrict anything
+      if (phrase_end > (query.phrase_ends_.empty() ? 0 : query.phrase_ends_.end()[-1])) {
+        query.phrase_ends_.push_back(phrase_end);
+      }
+    }
+  }
+  if (is_in_phrase) {
+    throw std::invalid_argument("Query phrase is not closed"s);
+  }
+  if (query.HasPhrases() && !positions_.IsEnabled()) {
+    throw std::invalid_argument("Phrase queries are not enabled"s);
+  }
+
+  // Words are scored in lexicographic order, so equal queries sum relevance equally
+  const auto less = [&query](const PreparedQuery::Word& lhs, const PreparedQuery::Word& rhs) {
+    return query.GetWord(lhs) < query.GetWord(rhs);
+  };
+  const auto equal = [&query](const PreparedQuery::Word& lhs, const PreparedQuery::Word& rhs) {
+    return query.GetWord(lhs) == query.GetWord(rhs);
+  };
+  for (auto* words : {&query.plus_words_, &query.minus_words_, &query.required_words_,
+                      &query.prefix_words_, &query.minus_prefix_words_,
+                      &query.required_prefix_words_}) {
+    std::sort(words->begin(), words->end(), less);
+    words->resize(std::unique(words->begin(), words->end(), equal) - words->begin());
+  }
+}
+
+void SearchServer::ResolveTerms(const IndexSnapshot& snapshot,
+                                const PreparedQuery& query,
+                                PreparedQuery::Terms& terms) const {
+  terms.clear();
+  for (const auto& word : query.plus_words_) {
+    const auto term_id = snapshot.FindTerm(query.GetWord(word));
+    terms.push_back({term_id, term_id == InvertedIndex::NO_TERM
+                                  ? 0.0
+                                  : ComputeWordInverseDocumentFreq(snapshot, term_id)});
+  }
+  for (const auto* words : {&query.minus_words_, &query.phrase_words_, &query.required_words_}) {
+    for (const auto& word : *words) {
+      terms.push_back({snapshot.FindTerm(query.GetWord(word)), 0.0});
+    }
+  }
+}
+
+SearchServer::QueryTerms SearchServer::GetQueryTerms(const IndexSnapshot& snapshot,
+                                                     const PreparedQuery& query,
+                                                     TermBuffer& buffer) const {
+  const PreparedQuery::Terms* terms = &query.terms_;
+  if (query.server_id_ != server_id_ || query.generation_ != snapshot.GetGeneration()) {
+    ResolveTerms(snapshot, query, buffer.terms);
+    terms = &buffer.terms;
+  }
+
+  // Room for the longest expansions, so the ranges stay valid
+  buffer.prefix_terms.clear();
+  buffer.prefix_terms.reserve((query.prefix_words_.size() + query.minus_prefix_words_.size()) *
+                              MAX_PREFIX_TERM_COUNT);
+  buffer.prefixes.clear();
+  thread_local std::vector<InvertedIndex::TermId> expansion;
+  const auto expand = [&](const PreparedQuery::Word& word) {
+    snapshot.FindTermsWithPrefix(query.GetWord(word), MAX_PREFIX_TERM_COUNT, expansion);
+    const InvertedIndex::TermId* first = buffer.prefix_terms.data() + buffer.prefix_terms.size();
+    buffer.prefix_terms.insert(buffer.prefix_terms.end(), expansion.begin(), expansion.end());
+    return IteratorRange<const InvertedIndex::TermId*>(first, first + expansion.size());
+  };
+  // Required prefix words are a subset of the prefix words in the same order
+  for (size_t i = 0, required = 0; i < query.prefix_words_.size(); ++i) {
+    const auto& word = query.prefix_words_[i];
+    const bool is_required = required < query.required_prefix_words_.size() &&
+                             query.GetWord(query.required_prefix_words_[required]) ==
+                                 query.GetWord(word);
+    required += is_required;
+    buffer.prefixes.push_back({expand(word), is_required});
+  }
+  const InvertedIndex::TermId* minus_prefix_begin =
+      buffer.prefix_terms.data() + buffer.prefix_terms.size();
+  for (const auto& word : query.minus_prefix_words_) {
+    expand(word);
+  }
+
+  const PreparedQuery::Term* plus_end = terms->begin() + query.plus_words_.size();
+  const PreparedQuery::Term* minus_end = plus_end + query.minus_words_.size();
+  const PreparedQuery::Term* phrase_end = minus_end + query.phrase_words_.size();
+  return {{terms->begin(), plus_end},
+          {plus_end, minus_end},
+          {minus_end, phrase_end},
+          {query.phrase_ends_.begin(), query.phrase_ends_.end()},
+          {phrase_end, terms->end()},
+          {buffer.prefixes.data(), buffer.prefixes.data() + buffer.prefixes.size()},
+          {minus_prefix_begin, buffer.prefix_terms.data() + buffer.prefix_terms.size()}};
+}
+
+bool SearchServer::IsConjunctive(const PreparedQuery& query, QueryMatch match) {
+  return query.HasPhrases() || query.HasRequiredWords() ||
+         (match == QueryMatch::ALL_WORDS &&
+          (!query.plus_words_.empty() || !query.prefix_words_.empty()));
+}
+
+bool SearchServer::IsRequired(const Prefix& prefix, QueryMatch match) {
+  return prefix.is_required || match == QueryMatch::ALL_WORDS;
+}
+
+bool SearchServer::IsPruned(const QueryOptions& options) {
+  return options.evaluation != QueryEvaluation::EXHAUSTIVE;
+}
+
+SearchServer::PrunedCursor::PrunedCursor(const IndexSnapshot& snapshot,
+                                         InvertedIndex::TermId term_id)
+    : cursor_(std::in_place, snapshot, term_id) {}
+
+SearchServer::PrunedCursor::PrunedCursor(const PrefixPostings& postings, float max_term_freq)
+    : prefix_postings_(&postings), max_term_freq_(max_term_freq) {}
+
+int SearchServer::PrunedCursor::GetDocumentId() const {
+  if (cursor_) {
+    return cursor_->GetDocumentId();
+  }
+  return position_ < prefix_postings_->size() ? (*prefix_postings_)[position_].first
+                                              : PostingList::END;
+}
+
+uint32_t SearchServer::PrunedCursor::GetTermCount() const {
+  return cursor_ ? cursor_->GetTermCount() : (*prefix_postings_)[position_].second;
+}
+
+float SearchServer::PrunedCursor::GetTermFreq() {
+  return cursor_->GetTermFreq();
+}
+
+void SearchServer::PrunedCursor::Advance(int document_id) {
+  if (cursor_) {
+    cursor_->Advance(document_id);
+    return;
+  }
+  const auto first = prefix_postings_->begin() + position_;
+  position_ = std::lower_bound(first, prefix_postings_->end(), document_id,
+                               [](const auto& posting, int id) { return posting.first < id; }) -
+              prefix_postings_->begin();
+}
+
+PostingList::BlockBound SearchServer::PrunedCursor::GetBlockBound(int document_id) const {
+  if (cursor_) {
+    return cursor_->GetBlockBound(document_id);
+  }
+  if (position_ == prefix_postings_->size() || prefix_postings_->back().first < document_id) {
+    return {PostingList::END, 0};
+  }
+  return {prefix_postings_->back().first, max_term_freq_};
+}
+
+void SearchServer::MergePrefixPostings(const IndexSnapshot& snapshot,
+                                       const Prefix& prefix,
+                                       PrefixPostings& postings) const {
+  postings.clear();
+  snapshot.ForEachMergedPosting(
+      prefix.terms.begin(), prefix.terms.size(), [&](int internal_id, uint32_t term_count) {
+        if (!documents_.IsRemoved(internal_id, snapshot.GetGeneration())) {
+          postings.emplace_back(internal_id, term_count);
+        }
+      });
+}
+
+void SearchServer::EraseMinusDocuments(const IndexSnapshot& snapshot,
+                                       const QueryTerms& terms,
+                                       ScoreAccumulator& document_to_relevance) const {
+  const auto erase = [&document_to_relevance](int internal_id, uint32_t) {
+    document_to_relevance.Erase(internal_id);
+  };
+  for (const auto& term : terms.minus) {
+    if (term.term_id != InvertedIndex::NO_TERM) {
+      snapshot.ForEachPosting(term.term_id, erase);
+    }
+  }
+  for (const auto term_id : terms.minus_prefix) {
+    snapshot.ForEachPosting(term_id, erase);
+  }
+}
+
+bool SearchServer::HasPhrases(const QueryTerms& terms, int internal_id) const {
+  thread_local std::vector<InvertedIndex::TermId> phrase;
+  size_t first = 0;
+  for (const uint32_t last : terms.phrase_ends) {
+    phrase.clear();
+    for (size_t i = first; i < last; ++i) {
+      phrase.push_back(terms.phrase.begin()[i].term_id);
+    }
+    if (!positions_.HasPhrase(internal_id, phrase.data(), phrase.size())) {
+      return false;
+    }
+    first = last;
+  }
+  return true;
 }
 
-SearchServer::Query SearchServer::ParseQuery(const std::string_view& text) const {
-  Query result;
-  for (const auto& word : SplitIntoWords(text)) {
-    const auto query_word = ParseQueryWord(word);
-    if (!query_word.is_stop) {
-      if (query_word.is_minus) {
-        result.minus_words.insert(query_word.data);
-      } else {
-        result.plus_words.insert(query_word.data);
+void SearchServer::FindConjunctiveDocuments(const IndexSnapshot& snapshot,
+                                            const QueryTerms& terms,
+                                            QueryMatch match,
+                                            const std::vector<PrefixPostings>& prefix_postings,
+                                            std::vector<int>& documents) const {
+  documents.clear();
+  std::vector<const PrefixPostings*> required_prefixes;
+  for (size_t i = 0; i < prefix_postings.size(); ++i) {
+    if (IsRequired(terms.prefixes.begin()[i], match)) {
+      required_prefixes.push_back(&prefix_postings[i]);
+    }
+  }
+  std::vector<std::pair<size_t, InvertedIndex::TermId>> required_terms;
+  for (const auto range : {match == QueryMatch::ALL_WORDS ? terms.plus : terms.required,
+                           terms.phrase}) {
+    for (const auto& term : range) {
+      if (term.term_id == InvertedIndex::NO_TERM) {
+        return;
+      }
+      required_terms.emplace_back(snapshot.GetDocumentFreq(term.term_id), term.term_id);
+    }
+  }
+  if (required_terms.empty()) {
+    if (!required_prefixes.empty()) {
+      for (const auto& [internal_id, term_count] : *required_prefixes[0]) {
+        documents.push_back(internal_id);
       }
+      FilterPrefixDocuments(required_prefixes, documents);
     }
+    return;
+  }
+  // Distinct terms, rarest first
+  std::sort(required_terms.begin(), required_terms.end());
+  required_terms.erase(std::unique(required_terms.begin(), required_terms.end()),
+                       required_terms.end());
+  std::vector<SegmentSnapshot::Cursor> cursors;
+  cursors.reserve(required_terms.size());
+  for (const auto& [document_freq, term_id] : required_terms) {
+    cursors.emplace_back(snapshot, term_id);
   }
-  return result;
+
+  // The rarest list leads: the others gallop to its documents and the lead skips to
+  // wherever one of them lands. Positions are only read for documents with all the terms
+  auto& lead = cursors[0];
+  while (!lead.IsEnd()) {
+    const int document_id = lead.GetDocumentId();
+    int next_document_id = document_id;
+    for (size_t i = 1; i < cursors.size() && next_document_id == document_id; ++i) {
+      cursors[i].Advance(document_id);
+      next_document_id = cursors[i].GetDocumentId();
+    }
+    if (next_document_id != document_id) {
+      lead.Advance(next_document_id);
+      continue;
+    }
+    if (terms.phrase_ends.size() == 0 || HasPhrases(terms, document_id)) {
+      documents.push_back(document_id);
+    }
+    lead.Next();
+  }
+  FilterPrefixDocuments(required_prefixes, documents);
 }
 
-SearchServer::NewQuery SearchServer::ParseQuery(std::execution::parallel_policy par,
-                                                const std::string_view& text) const {
-  NewQuery res;
-  for (const auto& word : SplitIntoWords(text)) {
-    const auto query_word = ParseQueryWord(word);
-    if (!query_word.is_stop) {
-      if (query_word.is_minus) {
-        res.minus_words.push_back(query_word.data);
-      } else {
-        res.plus_words.push_back(query_word.data);
+void SearchServer::FilterPrefixDocuments(const std::vector<const PrefixPostings*>& prefixes,
+                                         std::vector<int>& documents) {
+  for (const PrefixPostings* postings : prefixes) {
+    auto posting = postings->begin();
+    size_t kept = 0;
+    for (const int internal_id : documents) {
+      posting = std::lower_bound(posting, postings->end(), std::make_pair(internal_id, 0u));
+      if (posting != postings->end() && posting->first == internal_id) {
+        documents[kept++] = internal_id;
       }
     }
+    documents.resize(kept);
+  }
+}
+
+uint64_t SearchServer::MakeServerId() {
+  static std::atomic<uint64_t> next_id = 1;
+  return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+double SearchServer::ComputeWordInverseDocumentFreq(const IndexSnapshot& snapshot,
+                                                    InvertedIndex::TermId term_id) {
+  return log(snapshot.GetDocumentCount() * 1.0 / snapshot.GetDocumentFreq(term_id));
+}
+
+void SearchServer::EnablePhraseQueries() {
+  std::lock_guard guard(write_mutex_);
+  if (documents_.GetInternalIdLimit() > 0) {
+    throw std::logic_error("Phrase queries must be enabled before documents are added"s);
   }
-  return res;
+  positions_.Enable();
+}
+
+void SearchServer::EnableImpactScoring() {
+  uses_impacts_.store(true, std::memory_order_relaxed);
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(const std::string_view& word) const {
-  return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(std::string(word)).size());
+void SearchServer::DisableImpactScoring() {
+  uses_impacts_.store(false, std::memory_order_relaxed);
+}
+
+bool SearchServer::UsesImpacts() const {
+  return uses_impacts_.load(std::memory_order_relaxed);
+}
+
+int SearchServer::GetInternalId(const IndexSnapshot& snapshot, int document_id) const {
+  const int internal_id = documents_.FindInternalId(document_id, snapshot.GetGeneration(),
+                                                    snapshot.GetDocumentLimit());
+  if (internal_id == DocumentTable::NO_DOCUMENT) {
+    throw std::out_of_range("Document "s + std::to_string(document_id) + " is not found"s);
+  }
+  return internal_id;
 }
+
 typename std::set<int>::const_iterator SearchServer::end() const {
   return document_ids_.end();
 }
 typename std::set<int>::const_iterator SearchServer::begin() const {
   return document_ids_.begin();
 }
+IteratorRange<const InvertedIndex::TermEntry*> SearchServer::GetDocumentTerms(
+    int document_id) const {
+  const int internal_id = documents_.FindInternalId(document_id);
+  if (internal_id == DocumentTable::NO_DOCUMENT) {
+    return {nullptr, nullptr};
+  }
+  return forward_index_.GetEntries(internal_id);
+}
+
 const std::map<std::string_view, double>& SearchServer::GetWordFrequencies(
     int document_id) const {
   static const std::map<std::string_view, double> empty_map{};
-  if (document_to_word_freqs_.count(document_id) == 0) {
+  std::lock_guard guard(write_mutex_);
+  const int internal_id = documents_.FindInternalId(document_id);
+  if (internal_id == DocumentTable::NO_DOCUMENT) {
     return empty_map;
   }
 
-  return document_to_word_freqs_.at(document_id);
+  const auto [it, inserted] = document_to_word_freqs_.try_emplace(document_id);
+  if (inserted) {
+    const double inv_word_count = documents_.GetInvWordCount(internal_id);
+    for (const auto& entry : forward_index_.GetEntries(internal_id)) {
+      it->second.emplace(index_.GetTerm(entry.term_id), entry.term_count * inv_word_count);
+    }
+  }
+  return it->second;
 }
 void SearchServer::RemoveDocument(int document_id) {
-  for (const auto& [word, _] : document_to_word_freqs_[document_id]) {
-    word_to_document_freqs_[std::string(word)].erase(document_id);
-  }
-  documents_.erase(document_id);
-
-  document_to_word_freqs_.erase(document_id);
+  RemoveDocuments({document_id});
+}
 
-  document_ids_.erase(document_id);
+void SearchServer::RemoveDocuments(const std::vector<int>& document_ids) {
+  std::lock_guard guard(write_mutex_);
+  // Stamped with the generation the index publishes next, so queries of older
+  // generations still see the documents
+  const uint64_t generation = index_.GetNextGeneration();
+  std::vector<InvertedIndex::RemovedDocument> removed;
+  for (const int document_id : document_ids) {
+    const int internal_id = documents_.FindInternalId(document_id);
+    if (internal_id == DocumentTable::NO_DOCUMENT) {
+      continue;
+    }
+    documents_.Remove(internal_id, generation);
+    removed.push_back({internal_id, forward_index_.GetEntries(internal_id)});
+    document_to_word_freqs_.erase(document_id);
+    document_ids_.erase(document_id);
+  }
+  if (!removed.empty()) {
+    index_.RemoveDocuments(removed);
+  }
 }
 
 void SearchServer::RemoveDocument([[maybe_unused]] std::execution::sequenced_policy seq,
@@ -206,40 +784,36 @@ void SearchServer::RemoveDocument([[maybe_unused]] std::execution::sequenced_pol
   RemoveDocument(document_id);
 }
 
-using str_ptr = const std::string_view*;
-
 void SearchServer::RemoveDocument([[maybe_unused]] std::execution::parallel_policy par,
                                   int document_id) {
+  // Postings stay in their segments until a merge, only counters are updated
+  RemoveDocument(document_id);
+}
 
-  std::vector<str_ptr> res(document_to_word_freqs_[document_id].size());
-  std::transform(std::execution::par, document_to_word_freqs_[document_id].begin(),
-                 document_to_word_freqs_[document_id].end(), res.begin(),
-                 [](const auto& el) { return &(el.first); });
-
-  std::for_each(std::execution::par, res.begin(), res.end(),
-                [&w_to_d = word_to_document_freqs_, document_id](const auto& el) {
-                  w_to_d.at(std::string(*el)).erase(document_id);
-                });
-
-  documents_.erase(document_id);
-
-  document_to_word_freqs_.erase(document_id);
+void SearchServer::WaitForMerges() const {
+  index_.WaitForMerges();
+}
 
-  document_ids_.erase(document_id);
+size_t SearchServer::GetSegmentCount() const {
+  return index_.GetSegmentCount();
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query,
-                                                     DocumentStatus status) const {
-  return FindTopDocuments(
-      raw_query, [status]([[maybe_unused]] int document_id, DocumentStatus document_status,
-                          [[maybe_unused]] int rating) { return document_status == status; });
+void SearchServer::SaveIndex(const std::string& path) const {
+  std::lock_guard guard(write_mutex_);
+  IndexFileWriter writer(path);
+  writer.BeginSection(IndexSection::STOP_WORDS);
+  for (const auto& word : stop_words_) {
+    writer.Write(word.data(), word.size());
+    writer.Write(" ", 1);
+  }
+  writer.EndSection();
+  index_.Save(writer);
+  documents_.Save(writer);
+  forward_index_.Save(writer);
+  positions_.Save(writer);
+  writer.Commit();
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query) const {
-  return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+SearchServer SearchServer::LoadIndex(const std::string& path, bool verify_checksum) {
+  return SearchServer(std::make_shared<const IndexFile>(path, verify_checksum));
 }
-void SearchServer::DeleteCopies(std::vector<std::string_view>& vec) {
-  std::sort(std::execution::par, vec.begin(), vec.end());
-  const auto last = std::unique(std::execution::par, vec.begin(), vec.end());
-  vec.erase(last, vec.end());
-}
\ No newline at end of file
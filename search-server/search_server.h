@@ -5,22 +5,95 @@
 #include <execution>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <set>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
-#include "concurrent_map.h"
 #include "document.h"
+#include "document_table.h"
+#include "epoch_manager.h"
+#include "forward_index.h"
+#include "index_file.h"
+#include "inverted_index.h"
+#include "position_index.h"
+#include "prepared_query.h"
+#include "score_accumulator.h"
+#include "scorer.h"
+#include "stop_word_filter.h"
 #include "string_processing.h"
+#include "top_documents.h"
 
 using std::string_literals::operator""s;
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
-const int BUCKET_COUNT = 1000;
-constexpr double eps = 1e-6;
+// Terms a word* query term expands to at most, the first ones in lexicographic order
+const size_t MAX_PREFIX_TERM_COUNT = 128;
+
+enum class QueryEvaluation {
+  // Term-at-a-time scoring of every matched document
+  EXHAUSTIVE,
+  // Scoring of windows of documents that walks only the postings of the terms whose score
+  // bounds may get a document into the top, the others are looked up for the candidates
+  WAND,
+  // WAND that also skips windows and candidates by the score bounds of posting blocks
+  BLOCK_MAX_WAND,
+};
+
+enum class QueryMatch {
+  // Documents with any plus word
+  ANY_WORD,
+  // Documents with every plus word, only they are scored
+  ALL_WORDS,
+};
+
+struct QueryOptions {
+  size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT;
+  // Every evaluation returns the same documents, with impact scoring on or off
+  QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE;
+  QueryMatch match = QueryMatch::ANY_WORD;
+};
+
+// Document of a batch given to SearchServer::AddDocuments
+struct DocumentToAdd {
+  int document_id;
+  std::string_view text;
+  DocumentStatus status;
+  std::vector<int> ratings;
+};
+
+// Query of SearchServer::FindTopDocumentsBatch with the place for its results
+struct BatchQuery {
+  const PreparedQuery* query;
+  DocumentStatus status = DocumentStatus::ACTUAL;
+  QueryOptions options;
+  // Room for options.max_result_count documents
+  Document* results = nullptr;
+  // Set to the number of the results
+  size_t result_count = 0;
+};
+
+enum class AddDocumentResult {
+  ADDED,
+  // Negative document id
+  INVALID_ID,
+  // Id of a document already in the index or earlier in the batch
+  DUPLICATE_ID,
+  // The text has a word with special characters
+  INVALID_WORD,
+};
+
+// Queries may run on any number of threads while one thread adds or removes documents:
+// every query reads a snapshot of the index taken when it starts
 class SearchServer {
  public:
   // friend void RemoveDuplicates(SearchServer& search_server);
@@ -36,32 +109,91 @@ class SearchServer {
                    DocumentStatus status,
                    const std::vector<int>& ratings);
 
-  // todo
-  template <typename DocumentPredicate>
+  // Adds the valid documents of the batch in their order, the others are skipped and
+  // reported. Texts are tokenized in parallel and the index publishes the batch at once
+  std::vector<AddDocumentResult> AddDocuments(const std::vector<DocumentToAdd>& documents);
+
+  // Scorer is the relevance model, see scorer.h. Pruned evaluations rely on its GetMaxScore.
+  // Words in quotes form a phrase: matched documents have the words one after another,
+  // stop words aside. Words marked +word must be in matched documents. Phrase and
+  // required words also count as plus words. A term word* stands for the words starting
+  // with word and is scored as one word
+  template <typename Scorer = TfIdfScorer, typename DocumentPredicate>
   std::vector<Document> FindTopDocuments(const std::string_view& raw_query,
-                                         DocumentPredicate pred) const;
+                                         DocumentPredicate pred,
+                                         const QueryOptions& options = {}) const;
 
-  template <typename ExecutionPolicy, typename DocumentPredicate>
+  template <typename Scorer = TfIdfScorer, typename ExecutionPolicy, typename DocumentPredicate>
   std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
                                          const std::string_view& raw_query,
-                                         DocumentPredicate pred) const;
+                                         DocumentPredicate pred,
+                                         const QueryOptions& options = {}) const;
 
+  template <typename Scorer = TfIdfScorer>
   std::vector<Document> FindTopDocuments(const std::string_view& raw_query,
-                                         DocumentStatus status) const;
+                                         DocumentStatus status,
+                                         const QueryOptions& options = {}) const;
 
+  template <typename Scorer = TfIdfScorer>
   std::vector<Document> FindTopDocuments(const std::string_view& raw_query) const;
 
-  template <typename ExecutionPolicy>
+  template <typename Scorer = TfIdfScorer, typename ExecutionPolicy>
   std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
                                          const std::string_view& raw_query,
-                                         DocumentStatus status) const;
+                                         DocumentStatus status,
+                                         const QueryOptions& options = {}) const;
 
-  template <typename ExecutionPolicy>
+  template <typename Scorer = TfIdfScorer, typename ExecutionPolicy>
   std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
                                          const std::string_view& raw_query) const;
 
+  // Parses the query once for many searches. Throws std::invalid_argument for invalid
+  // queries like the searches do
+  PreparedQuery PrepareQuery(const std::string_view& raw_query) const;
+
+  // Reuses the storage of the query
+  void PrepareQuery(const std::string_view& raw_query, PreparedQuery& query) const;
+
+  // Writes the results of FindTopDocuments<Scorer>(*query, status, options) for every query.
+  // The posting list of a term is read once for all the exhaustive disjunctive queries with
+  // it, so queries sharing terms are best given together. The others are searched one by one
+  template <typename Scorer = TfIdfScorer>
+  void FindTopDocumentsBatch(std::vector<BatchQuery>& queries) const;
+
+  template <typename Scorer = TfIdfScorer, typename DocumentPredicate>
+  std::vector<Document> FindTopDocuments(const PreparedQuery& query,
+                                         DocumentPredicate pred,
+                                         const QueryOptions& options = {}) const;
+
+  template <typename Scorer = TfIdfScorer, typename ExecutionPolicy, typename DocumentPredicate>
+  std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
+                                         const PreparedQuery& query,
+                                         DocumentPredicate pred,
+                                         const QueryOptions& options = {}) const;
+
+  template <typename Scorer = TfIdfScorer>
+  std::vector<Document> FindTopDocuments(const PreparedQuery& query,
+                                         DocumentStatus status,
+                                         const QueryOptions& options = {}) const;
+
+  template <typename Scorer = TfIdfScorer>
+  std::vector<Document> FindTopDocuments(const PreparedQuery& query) const;
+
+  template <typename Scorer = TfIdfScorer, typename ExecutionPolicy>
+  std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
+                                         const PreparedQuery& query,
+                                         DocumentStatus status,
+                                         const QueryOptions& options = {}) const;
+
+  template <typename Scorer = TfIdfScorer, typename ExecutionPolicy>
+  std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
+                                         const PreparedQuery& query) const;
+
   int GetDocumentCount() const;
 
+  // Generation of the current index version, every change of the documents raises it
+  uint64_t GetGeneration() const;
+
   // int GetDocumentId(int index) const;
 
   using MatchedWords = std::tuple<std::vector<std::string_view>, DocumentStatus>;
@@ -76,74 +208,320 @@ class SearchServer {
                              const std::string_view& raw_query,
                              int document_id) const;
 
+  // The matched words are views into the query
+  MatchedWords MatchDocument(const PreparedQuery& query, int document_id) const;
+
+  // Not safe while documents are added or removed
   typename std::set<int>::const_iterator begin() const;
 
   typename std::set<int>::const_iterator end() const;
 
   const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
 
+  // Queries score the postings of plain words by the term frequencies stored in them, see
+  // Scorer::ScoreTermFreq, instead of term counts and document lengths. TF-IDF then reads
+  // no document lengths. The frequencies are rounded up to 16 bits, so relevances may be
+  // up to 2^-7 larger. Every evaluation and the batches score alike, prefixes by counts
+  void EnableImpactScoring();
+
+  void DisableImpactScoring();
+
+  // Keeps the word positions of documents, which phrase queries need. Queries with phrases
+  // throw std::invalid_argument until it is called. Throws std::logic_error if documents
+  // were added before. Saved indexes keep the positions
+  void EnablePhraseQueries();
+
+  // Distinct words of the document as terms in increasing id order, empty for unknown
+  // documents. Equal words have equal terms. Not safe while documents are added or removed
+  IteratorRange<const InvertedIndex::TermEntry*> GetDocumentTerms(int document_id) const;
+
   void RemoveDocument(int document_id);
 
   void RemoveDocument(std::execution::parallel_policy par, int document_id);
 
   void RemoveDocument(std::execution::sequenced_policy seq, int document_id);
 
+  // Unknown ids are ignored. The documents disappear from queries at once, their
+  // postings are compacted in the background
+  void RemoveDocuments(const std::vector<int>& document_ids);
+
+  // Blocks until the background merges of postings segments are done. Queries never wait
+  // for them, this is for tests and benchmarks wanting a settled index
+  void WaitForMerges() const;
+
+  // Sealed postings segments, merges lower the number
+  size_t GetSegmentCount() const;
+
+  // Writes the whole index to a binary file, see LoadIndex
+  void SaveIndex(const std::string& path) const;
+
+  // Maps a file written by SaveIndex. Queries read postings from the mapped pages,
+  // documents added later are kept in memory. Throws std::runtime_error for missing
+  // or damaged files, the checksum check reads the whole file. Offsets between the
+  // sections are always checked; without the checksum postings, forward entries and
+  // positions are decoded and checked instead
+  static SearchServer LoadIndex(const std::string& path, bool verify_checksum = true);
+
  private:
-  struct DocumentData {
-    int rating;
+  explicit SearchServer(std::shared_ptr<const IndexFile> index_file);
+
+  // Predicate of the status overloads, answered by the status column
+  struct StatusFilter {
     DocumentStatus status;
+
+    bool operator()([[maybe_unused]] int document_id,
+                    DocumentStatus document_status,
+                    [[maybe_unused]] int rating) const {
+      return document_status == status;
+    }
+  };
+
+  // Terms a plus prefix word expands to in a snapshot
+  struct Prefix {
+    IteratorRange<const InvertedIndex::TermId*> terms;
+    bool is_required;
+  };
+
+  // Terms of a query resolved in a snapshot
+  struct QueryTerms {
+    IteratorRange<const PreparedQuery::Term*> plus;
+    IteratorRange<const PreparedQuery::Term*> minus;
+    // Words of all the phrases, phrase i ends at phrase_ends[i]
+    IteratorRange<const PreparedQuery::Term*> phrase;
+    IteratorRange<const uint32_t*> phrase_ends;
+    IteratorRange<const PreparedQuery::Term*> required;
+    // In the order of the prefix words of the query
+    IteratorRange<const Prefix*> prefixes;
+    IteratorRange<const InvertedIndex::TermId*> minus_prefix;
   };
-  static void DeleteCopies(std::vector<std::string_view>& vec);
+
+  // Where GetQueryTerms puts the terms it resolves
+  struct TermBuffer {
+    PreparedQuery::Terms terms;
+    std::vector<InvertedIndex::TermId> prefix_terms;
+    std::vector<Prefix> prefixes;
+  };
+
+  // Live postings of a prefix: internal ids with the summed term counts of its terms
+  using PrefixPostings = std::vector<std::pair<int, uint32_t>>;
+
+  // Postings FindTopDocumentsPruned walks: the ones of a plus term or of a prefix
+  class PrunedCursor {
+   public:
+    PrunedCursor(const IndexSnapshot& snapshot, InvertedIndex::TermId term_id);
+
+    // The postings must outlive the cursor, max_term_freq bounds every one of them
+    PrunedCursor(const PrefixPostings& postings, float max_term_freq);
+
+    int GetDocumentId() const;
+
+    uint32_t GetTermCount() const;
+
+    // Stored term frequency, only the postings of plus terms have one
+    float GetTermFreq();
+
+    void Advance(int document_id);
+
+    // See PostingList::Cursor::ForEachBelow
+    template <typename Callback>
+    void ForEachBelow(int document_limit, Callback callback);
+
+    // Same with callback(document_id, term_freq), for plus terms only
+    template <typename Callback>
+    void ForEachTermFreqBelow(int document_limit, Callback callback);
+
+    // Postings of a prefix are merged into one block
+    PostingList::BlockBound GetBlockBound(int document_id) const;
+
+   private:
+    std::optional<SegmentSnapshot::Cursor> cursor_;
+    const PrefixPostings* prefix_postings_ = nullptr;
+    float max_term_freq_ = 0;
+    size_t position_ = 0;
+  };
+
+  // Documents FindTopDocumentsPruned scores together. Their scores take 32 KiB, so a
+  // window stays in the L1 cache while its postings are added up
+  static constexpr int PRUNING_WINDOW_SIZE = 4096;
+
+  static uint64_t MakeServerId();
 
   const std::set<std::string, std::less<>> stop_words_;
+  const StopWordFilter stop_word_filter_{stop_words_};
+
+  // Keeps mapped terms and postings alive
+  std::shared_ptr<const IndexFile> index_file_;
+
+  // Keeps the state replaced by writers until no query can reach it
+  EpochManager epochs_;
+
+  InvertedIndex index_{epochs_};
 
-  std::map<std::string, std::map<int, double>, std::less<>> word_to_document_freqs_;
+  // Postings and accumulators use the internal ids of this table,
+  // the external ids only appear in the results
+  DocumentTable documents_{epochs_};
 
-  std::map<int, DocumentData> documents_;
+  ForwardIndex forward_index_;
 
-  std::map<int, std::map<std::string_view, double>> document_to_word_freqs_;
+  PositionIndex positions_;
+
+  // Built from forward_index_ on demand
+  mutable std::map<int, std::map<std::string_view, double>> document_to_word_freqs_;
+  // Serializes the writers and the readers of the fields above, queries don't take it
+  mutable std::mutex write_mutex_;
 
   std::set<int> document_ids_;
 
+  // Tells prepared queries of this server from the ones of others
+  const uint64_t server_id_ = MakeServerId();
+
+  // Read once by every query
+  std::atomic<bool> uses_impacts_ = false;
+
   bool IsStopWord(const std::string_view& word) const;
 
   static bool IsValidWord(const std::string_view& word);
 
-  std::vector<std::string_view> SplitIntoWordsNoStop(const std::string_view& text) const;
+  // Fills the buffer with the words of the text except stop words
+  void SplitIntoWordsNoStop(const std::string_view& text,
+                            std::vector<std::string_view>& words) const;
+
+  // Words of the query in a buffer reused by the thread
+  static const std::vector<std::string_view>& SplitQueryIntoWords(const std::string_view& text);
 
   static int ComputeAverageRating(const std::vector<int>& ratings);
 
   struct QueryWord {
     std::string_view data;
     bool is_minus;
+    bool is_required;
+    bool is_prefix;
     bool is_stop;
   };
 
   QueryWord ParseQueryWord(const std::string_view& text) const;
 
-  struct Query {
-    std::set<std::string_view> plus_words;
-    std::set<std::string_view> minus_words;
-  };
+  // Fills the words of the query, its terms are left unresolved
+  void ParseQuery(const std::string_view& text, PreparedQuery& query) const;
 
-  struct NewQuery {
-    std::vector<std::string_view> plus_words;
-    std::vector<std::string_view> minus_words;
-  };
+  void ResolveTerms(const IndexSnapshot& snapshot,
+                    const PreparedQuery& query,
+                    PreparedQuery::Terms& terms) const;
 
-  Query ParseQuery(const std::string_view& text) const;
+  // Terms prepared with the query if they were resolved in the version of the snapshot,
+  // otherwise the ones resolved into the buffer. Prefix words are always expanded into it
+  QueryTerms GetQueryTerms(const IndexSnapshot& snapshot,
+                           const PreparedQuery& query,
+                           TermBuffer& buffer) const;
 
-  NewQuery ParseQuery(std::execution::parallel_policy par, const std::string_view& text) const;
+  // Views of the matched words point into text, which has the words at the offsets of the query
+  MatchedWords MatchDocument(const PreparedQuery& query,
+                             std::string_view text,
+                             int document_id) const;
 
-  double ComputeWordInverseDocumentFreq(const std::string_view& word) const;
+  // Whether impact scoring is on, see EnableImpactScoring
+  bool UsesImpacts() const;
+
+  // Score of the posting of a plus term the cursor is at
+  template <typename Scorer, typename Cursor>
+  static double ScorePosting(const Scorer& scorer,
+                             const typename Scorer::Term& term,
+                             bool uses_impacts,
+                             int internal_id,
+                             Cursor& cursor);
+
+  // Adds the relevance of the plus term in every accepted document to the accumulator
+  template <typename Scorer, typename DocumentPredicate>
+  void ScoreTerm(const IndexSnapshot& snapshot,
+                 const Scorer& scorer,
+                 bool uses_impacts,
+                 const PreparedQuery::Term& term,
+                 const DocumentPredicate& pred,
+                 ScoreAccumulator& document_to_relevance) const;
+
+  // Whether only documents with certain words match: the ones of phrases, required words
+  // or, in ALL_WORDS mode, every plus word
+  static bool IsConjunctive(const PreparedQuery& query, QueryMatch match);
+
+  static bool IsRequired(const Prefix& prefix, QueryMatch match);
+
+  // Whether a disjunctive query goes to FindTopDocumentsPruned
+  static bool IsPruned(const QueryOptions& options);
+
+  void MergePrefixPostings(const IndexSnapshot& snapshot,
+                           const Prefix& prefix,
+                           PrefixPostings& postings) const;
+
+  // The prefix as one scored word
+  template <typename Scorer>
+  typename Scorer::Term PreparePrefix(const IndexSnapshot& snapshot,
+                                      const Scorer& scorer,
+                                      const PrefixPostings& postings) const;
+
+  // Adds the relevance of the prefix in every accepted document to the accumulator
+  template <typename Scorer, typename DocumentPredicate>
+  void ScorePrefix(const IndexSnapshot& snapshot,
+                   const Scorer& scorer,
+                   const Prefix& prefix,
+                   const DocumentPredicate& pred,
+                   ScoreAccumulator& document_to_relevance) const;
+
+  // Erases the documents with minus terms from the accumulator
+  void EraseMinusDocuments(const IndexSnapshot& snapshot,
+                           const QueryTerms& terms,
+                           ScoreAccumulator& document_to_relevance) const;
+
+  // Whether the document has every phrase of the query
+  bool HasPhrases(const QueryTerms& terms, int internal_id) const;
+
+  // Internal ids of the documents with every word the query requires and every phrase,
+  // in increasing order. Posting lists are intersected rarest first, so the work follows
+  // the rarest list. prefix_postings follow terms.prefixes
+  void FindConjunctiveDocuments(const IndexSnapshot& snapshot,
+                                const QueryTerms& terms,
+                                QueryMatch match,
+                                const std::vector<PrefixPostings>& prefix_postings,
+                                std::vector<int>& documents) const;
+
+  // Keeps the documents which are in the postings of every prefix
+  static void FilterPrefixDocuments(const std::vector<const PrefixPostings*>& prefixes,
+                                    std::vector<int>& documents);
+
+  // Scores only the documents of FindConjunctiveDocuments, for any evaluation
+  template <typename Scorer, typename DocumentPredicate>
+  std::vector<Document> FindTopConjunctiveDocuments(const IndexSnapshot& snapshot,
+                                                    const QueryTerms& terms,
+                                                    QueryMatch match,
+                                                    const DocumentPredicate& pred,
+                                                    size_t max_result_count) const;
+
+  // Throws std::out_of_range for documents unknown to the snapshot
+  int GetInternalId(const IndexSnapshot& snapshot, int document_id) const;
+
+  static double ComputeWordInverseDocumentFreq(const IndexSnapshot& snapshot,
+                                               InvertedIndex::TermId term_id);
 
   template <typename DocumentPredicate>
-  std::vector<Document> FindAllDocuments(const Query& query, DocumentPredicate pred) const;
+  bool IsAccepted(const IndexSnapshot& snapshot,
+                  int internal_id,
+                  const DocumentPredicate& pred) const;
+
+  template <typename Scorer, typename DocumentPredicate>
+  std::vector<Document> FindAllDocuments(const IndexSnapshot& snapshot,
+                                         const QueryTerms& terms,
+                                         DocumentPredicate pred) const;
 
-  template <typename ExecutionPolicy, typename DocumentPredicate>
+  template <typename Scorer, typename ExecutionPolicy, typename DocumentPredicate>
   std::vector<Document> FindAllDocuments(const ExecutionPolicy& policy,
-                                         const NewQuery& query,
+                                         const IndexSnapshot& snapshot,
+                                         const QueryTerms& terms,
                                          DocumentPredicate pred) const;
+
+  template <typename Scorer, typename DocumentPredicate>
+  std::vector<Document> FindTopDocumentsPruned(const IndexSnapshot& snapshot,
+                                               const QueryTerms& terms,
+                                               DocumentPredicate pred,
+                                               const QueryOptions& options) const;
 };
 
 template <typename StringContainer>
@@ -154,144 +532,774 @@ SearchServer::SearchServer(const StringContainer& stop_words)
   }
 }
 
-template <typename DocumentPredicate>
+template <typename Scorer, typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query,
-                                                     DocumentPredicate pred) const {
-  const auto query = ParseQuery(raw_query);
-
-  auto matched_documents = FindAllDocuments(query, pred);
+                                                     DocumentPredicate pred,
+                                                     const QueryOptions& options) const {
+  const PooledPreparedQuery query;
+  ParseQuery(raw_query, *query);
+  return FindTopDocuments<Scorer>(*query, pred, options);
+}
 
-  std::sort(matched_documents.begin(), matched_documents.end(),
-            [](const Document& lhs, const Document& rhs) {
-              if (std::abs(lhs.relevance - rhs.relevance) < eps) {
-                return lhs.rating > rhs.rating;
-              }
-              return lhs.relevance > rhs.relevance;
-            });
-  if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-    matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+template <typename Scorer, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query,
+                                                     DocumentPredicate pred,
+                                                     const QueryOptions& options) const {
+  const auto snapshot = index_.GetSnapshot();
+  TermBuffer buffer;
+  const auto terms = GetQueryTerms(snapshot, query, buffer);
+  if (IsConjunctive(query, options.match)) {
+    return FindTopConjunctiveDocuments<Scorer>(snapshot, terms, options.match, pred,
+                                               options.max_result_count);
+  }
+  if (IsPruned(options)) {
+    return FindTopDocumentsPruned<Scorer>(snapshot, terms, pred, options);
   }
 
-  return matched_documents;
+  TopDocuments top_documents(options.max_result_count);
+  for (const auto& document : FindAllDocuments<Scorer>(snapshot, terms, pred)) {
+    top_documents.Add(document);
+  }
+  return top_documents.Extract();
 }
 
-template <typename ExecutionPolicy, typename DocumentPredicate>
+template <typename Scorer, typename ExecutionPolicy, typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
                                                      const std::string_view& raw_query,
-                                                     DocumentPredicate pred) const {
+                                                     DocumentPredicate pred,
+                                                     const QueryOptions& options) const {
+  const PooledPreparedQuery query;
+  ParseQuery(raw_query, *query);
+  return FindTopDocuments<Scorer>(policy, *query, pred, options);
+}
+
+template <typename Scorer, typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
+                                                     const PreparedQuery& query,
+                                                     DocumentPredicate pred,
+                                                     const QueryOptions& options) const {
   if constexpr (std::is_same_v<ExecutionPolicy, std::execution::sequenced_policy>) {
-    return FindTopDocuments(raw_query, pred);
+    return FindTopDocuments<Scorer>(query, pred, options);
   } else {
+    const auto snapshot = index_.GetSnapshot();
+    TermBuffer buffer;
+    const auto terms = GetQueryTerms(snapshot, query, buffer);
+    if (IsConjunctive(query, options.match)) {
+      // Intersections leave few documents to score, threads wouldn't pay off
+      return FindTopConjunctiveDocuments<Scorer>(snapshot, terms, options.match, pred,
+                                                 options.max_result_count);
+    }
+    if (IsPruned(options)) {
+      return FindTopDocumentsPruned<Scorer>(snapshot, terms, pred, options);
+    }
 
-    auto query = ParseQuery(policy, raw_query);
-    DeleteCopies(query.plus_words);
-    DeleteCopies(query.minus_words);
-
-    auto matched_documents = FindAllDocuments(policy, query, pred);
+    const auto matched_documents = FindAllDocuments<Scorer>(policy, snapshot, terms, pred);
+
+    // Every chunk keeps its own bounded heap, the heaps are merged at the end
+    const size_t chunk_count = std::min<size_t>(
+        std::max(1u, std::thread::hardware_concurrency()), matched_documents.size() + 1);
+    const size_t chunk_size = (matched_documents.size() + chunk_count - 1) / chunk_count;
+    std::vector<TopDocuments> chunk_tops(chunk_count, TopDocuments(options.max_result_count));
+    std::vector<size_t> chunks(chunk_count);
+    std::iota(chunks.begin(), chunks.end(), 0);
+    std::for_each(policy, chunks.begin(), chunks.end(), [&](size_t chunk) {
+      const size_t first = std::min(chunk * chunk_size, matched_documents.size());
+      const size_t last = std::min(first + chunk_size, matched_documents.size());
+      for (size_t i = first; i < last; ++i) {
+        chunk_tops[chunk].Add(matched_documents[i]);
+      }
+    });
 
-    std::sort(policy, matched_documents.begin(), matched_documents.end(),
-              [](const Document& lhs, const Document& rhs) {
-                if (std::abs(lhs.relevance - rhs.relevance) < eps) {
-                  return lhs.rating > rhs.rating;
-                }
-                return lhs.relevance > rhs.relevance;
-              });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-      matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+    for (size_t chunk = 1; chunk < chunk_count; ++chunk) {
+      chunk_tops[0].Merge(chunk_tops[chunk]);
     }
-
-    return matched_documents;
+    return chunk_tops[0].Extract();
   }
 }
 
-template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query& query,
-                                                     DocumentPredicate pred) const {
-  std::map<int, double> document_to_relevance;
-  for (const auto& word : query.plus_words) {
-    if (word_to_document_freqs_.count(word) == 0) {
+template <typename Scorer>
+void SearchServer::FindTopDocumentsBatch(std::vector<BatchQuery>& queries) const {
+  struct TermUse {
+    std::string_view word;
+    InvertedIndex::TermId term_id;
+    size_t query;
+    double inverse_document_freq;
+  };
+  // About 8 MB of scores
+  constexpr size_t MAX_RETAINED_BATCH_PAGE_COUNT = 256;
+  thread_local std::vector<ScoreAccumulator> accumulators;
+  thread_local std::vector<std::pair<int, double>> postings;
+
+  const auto snapshot = index_.GetSnapshot();
+  const Scorer scorer(snapshot, documents_);
+  const bool uses_impacts = UsesImpacts();
+  std::vector<TermBuffer> buffers(queries.size());
+  // Queries whose posting lists are read together
+  std::vector<bool> is_shared(queries.size());
+  std::vector<TermUse> plus_uses;
+  std::vector<TermUse> minus_uses;
+  for (size_t i = 0; i < queries.size(); ++i) {
+    BatchQuery& batch_query = queries[i];
+    const PreparedQuery& query = *batch_query.query;
+    const QueryOptions& options = batch_query.options;
+    const StatusFilter pred{batch_query.status};
+    const auto terms = GetQueryTerms(snapshot, query, buffers[i]);
+    // Such queries share no whole posting lists with the others
+    if (IsConjunctive(query, options.match) || IsPruned(options)) {
+      const auto results = IsConjunctive(query, options.match)
+                               ? FindTopConjunctiveDocuments<Scorer>(snapshot, terms, options.match,
+                                                                     pred, options.max_result_count)
+                               : FindTopDocumentsPruned<Scorer>(snapshot, terms, pred, options);
+      batch_query.result_count =
+          std::copy(results.begin(), results.end(), batch_query.results) - batch_query.results;
+      continue;
+    }
+    if (query.HasPrefixes()) {
+      TopDocuments top_documents(options.max_result_count);
+      for (const auto& document : FindAllDocuments<Scorer>(snapshot, terms, pred)) {
+        top_documents.Add(document);
+      }
+      batch_query.result_count = top_documents.ExtractTo(batch_query.results);
       continue;
     }
-    const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-    for (const auto& [document_id, term_freq] :
-         word_to_document_freqs_.at(std::string(word))) {
-      const auto& document_data = documents_.at(document_id);
-      if (pred(document_id, document_data.status, document_data.rating)) {
-        document_to_relevance[document_id] += term_freq * inverse_document_freq;
+    is_shared[i] = true;
+    for (size_t j = 0; j < query.plus_words_.size(); ++j) {
+      const auto& term = terms.plus.begin()[j];
+      if (term.term_id != InvertedIndex::NO_TERM) {
+        plus_uses.push_back({query.GetWord(query.plus_words_[j]), term.term_id, i,
+                             term.inverse_document_freq});
+      }
+    }
+    for (const auto& term : terms.minus) {
+      if (term.term_id != InvertedIndex::NO_TERM) {
+        minus_uses.push_back({{}, term.term_id, i, 0.0});
+      }
+    }
+  }
+  // Words of every query stay in its lexicographic order, so each relevance is summed
+  // exactly like FindTopDocuments does
+  std::sort(plus_uses.begin(), plus_uses.end(), [](const TermUse& lhs, const TermUse& rhs) {
+    return std::tie(lhs.word, lhs.query) < std::tie(rhs.word, rhs.query);
+  });
+  std::sort(minus_uses.begin(), minus_uses.end(), [](const TermUse& lhs, const TermUse& rhs) {
+    return lhs.term_id < rhs.term_id;
+  });
+  if (accumulators.size() < queries.size()) {
+    accumulators.resize(queries.size());
+  }
+
+  for (size_t first = 0, last = 0; first < plus_uses.size(); first = last) {
+    // Terms resolved in one snapshot have one inverse document frequency, it is compared
+    // all the same so that the scores read once are the ones of every query of the group
+    const TermUse& use = plus_uses[first];
+    const DocumentStatus status = queries[use.query].status;
+    bool has_one_status = true;
+    while (last < plus_uses.size() && plus_uses[last].term_id == use.term_id &&
+           plus_uses[last].inverse_document_freq == use.inverse_document_freq) {
+      has_one_status = has_one_status && queries[plus_uses[last].query].status == status;
+      ++last;
+    }
+    // With one status the postings are filtered once, otherwise by every query
+    const auto is_accepted = [&](int internal_id, DocumentStatus query_status) {
+      return IsAccepted(snapshot, internal_id, StatusFilter{query_status});
+    };
+    const auto scorer_term = scorer.PrepareTerm(use.term_id, use.inverse_document_freq);
+    postings.clear();
+    if (uses_impacts) {
+      snapshot.ForEachPosting(use.term_id, [&](int internal_id, uint32_t, float term_freq) {
+        if (!has_one_status || is_accepted(internal_id, status)) {
+          postings.emplace_back(internal_id,
+                                scorer.ScoreTermFreq(scorer_term, internal_id, term_freq));
+        }
+      });
+    } else {
+      snapshot.ForEachPosting(use.term_id, [&](int internal_id, uint32_t term_count) {
+        if (!has_one_status || is_accepted(internal_id, status)) {
+          postings.emplace_back(internal_id, scorer.Score(scorer_term, internal_id, term_count));
+        }
+      });
+    }
+    for (size_t i = first; i < last; ++i) {
+      const size_t query = plus_uses[i].query;
+      const DocumentStatus query_status = queries[query].status;
+      ScoreAccumulator& document_to_relevance = accumulators[query];
+      for (const auto& [internal_id, score] : postings) {
+        if (has_one_status || is_accepted(internal_id, query_status)) {
+          document_to_relevance.Add(internal_id, score);
+        }
       }
     }
   }
 
-  for (const auto& word : query.minus_words) {
-    if (word_to_document_freqs_.count(word) == 0) {
+  for (size_t first = 0, last = 0; first < minus_uses.size(); first = last) {
+    const auto term_id = minus_uses[first].term_id;
+    while (last < minus_uses.size() && minus_uses[last].term_id == term_id) {
+      ++last;
+    }
+    postings.clear();
+    snapshot.ForEachPosting(term_id, [](int internal_id, uint32_t) {
+      postings.emplace_back(internal_id, 0.0);
+    });
+    for (size_t i = first; i < last; ++i) {
+      ScoreAccumulator& document_to_relevance = accumulators[minus_uses[i].query];
+      for (const auto& posting : postings) {
+        document_to_relevance.Erase(posting.first);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < queries.size(); ++i) {
+    if (!is_shared[i]) {
       continue;
     }
-    for (const auto& [document_id, _] : word_to_document_freqs_.at(std::string(word))) {
-      document_to_relevance.erase(document_id);
+    TopDocuments top_documents(queries[i].options.max_result_count);
+    accumulators[i].ForEach([&](int internal_id, double relevance) {
+      top_documents.Add({documents_.GetExternalId(internal_id), relevance,
+                         documents_.GetRating(internal_id)});
+    });
+    queries[i].result_count = top_documents.ExtractTo(queries[i].results);
+    accumulators[i].Clear();
+  }
+
+  // Pages stay with the thread for its next batch up to a budget. Common words touch every
+  // page of the corpus, a group of such queries would otherwise keep them all per query
+  size_t retained_page_count = 0;
+  for (auto& accumulator : accumulators) {
+    if (retained_page_count + accumulator.GetPageCount() > MAX_RETAINED_BATCH_PAGE_COUNT) {
+      accumulator.Release();
     }
+    retained_page_count += accumulator.GetPageCount();
   }
+}
 
-  std::vector<Document> matched_documents;
-  matched_documents.reserve(document_to_relevance.size());
-  for (const auto [document_id, relevance] : document_to_relevance) {
-    matched_documents.emplace_back(document_id, relevance, documents_.at(document_id).rating);
+template <typename Scorer, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocuments(const IndexSnapshot& snapshot,
+                                                     const QueryTerms& terms,
+                                                     DocumentPredicate pred) const {
+  const Scorer scorer(snapshot, documents_);
+  const bool uses_impacts = UsesImpacts();
+  PooledScoreAccumulator document_to_relevance;
+  for (const auto& term : terms.plus) {
+    if (term.term_id != InvertedIndex::NO_TERM) {
+      ScoreTerm(snapshot, scorer, uses_impacts, term, pred, *document_to_relevance);
+    }
+  }
+  for (const auto& prefix : terms.prefixes) {
+    ScorePrefix(snapshot, scorer, prefix, pred, *document_to_relevance);
   }
+  EraseMinusDocuments(snapshot, terms, *document_to_relevance);
+
+  std::vector<Document> matched_documents;
+  matched_documents.reserve(document_to_relevance->size());
+  document_to_relevance->ForEach([&](int internal_id, double relevance) {
+    matched_documents.emplace_back(documents_.GetExternalId(internal_id), relevance,
+                                   documents_.GetRating(internal_id));
+  });
   return matched_documents;
 }
 
-template <typename ExecutionPolicy, typename DocumentPredicate>
+template <typename Scorer, typename ExecutionPolicy, typename DocumentPredicate>
 std::vector<Document> SearchServer::FindAllDocuments(const ExecutionPolicy& policy,
-                                                     const NewQuery& query,
+                                                     const IndexSnapshot& snapshot,
+                                                     const QueryTerms& terms,
                                                      DocumentPredicate pred) const {
+  // Every chunk of plus words is scored into its own accumulator without locks,
+  // then the accumulators are merged pairwise
+  const size_t plus_count = terms.plus.size();
+  const size_t chunk_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                              std::max<size_t>(plus_count, 1));
+  const Scorer scorer(snapshot, documents_);
+  const bool uses_impacts = UsesImpacts();
+  std::vector<PooledScoreAccumulator> accumulators(chunk_count);
+  std::vector<size_t> chunks(chunk_count);
+  std::iota(chunks.begin(), chunks.end(), 0);
+
+  std::for_each(policy, chunks.begin(), chunks.end(), [&](size_t chunk) {
+    auto& document_to_relevance = *accumulators[chunk];
+    for (size_t i = chunk; i < plus_count; i += chunk_count) {
+      const auto& term = terms.plus.begin()[i];
+      if (term.term_id != InvertedIndex::NO_TERM) {
+        ScoreTerm(snapshot, scorer, uses_impacts, term, pred, document_to_relevance);
+      }
+    }
+  });
+
+  for (size_t step = 1; step < chunk_count; step *= 2) {
+    std::vector<size_t> targets;
+    for (size_t i = 0; i + step < chunk_count; i += 2 * step) {
+      targets.push_back(i);
+    }
+    std::for_each(policy, targets.begin(), targets.end(), [&accumulators, step](size_t i) {
+      accumulators[i]->Merge(*accumulators[i + step]);
+    });
+  }
+  auto& document_to_relevance = *accumulators[0];
+  for (const auto& prefix : terms.prefixes) {
+    ScorePrefix(snapshot, scorer, prefix, pred, document_to_relevance);
+  }
+  EraseMinusDocuments(snapshot, terms, document_to_relevance);
 
-  ConcurrentMap<int, double> document_to_relevance(BUCKET_COUNT);
+  std::vector<Document> matched_documents;
+  matched_documents.reserve(document_to_relevance.size());
+  document_to_relevance.ForEach([&](int internal_id, double relevance) {
+    matched_documents.emplace_back(documents_.GetExternalId(internal_id), relevance,
+                                   documents_.GetRating(internal_id));
+  });
+  return matched_documents;
+}
 
-  std::for_each(
-      policy, query.plus_words.cbegin(), query.plus_words.cend(),
-      [this, &w = word_to_document_freqs_, &document_to_relevance, &pred](const auto& word) {
-        if (w.count(word) != 0) {
-          const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
+template <typename Scorer, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopConjunctiveDocuments(const IndexSnapshot& snapshot,
+                                                                const QueryTerms& terms,
+                                                                QueryMatch match,
+                                                                const DocumentPredicate& pred,
+                                                                size_t max_result_count) const {
+  std::vector<PrefixPostings> prefix_postings(terms.prefixes.size());
+  for (size_t i = 0; i < prefix_postings.size(); ++i) {
+    MergePrefixPostings(snapshot, terms.prefixes.begin()[i], prefix_postings[i]);
+  }
+  std::vector<int> candidates;
+  FindConjunctiveDocuments(snapshot, terms, match, prefix_postings, candidates);
 
-          for (const auto& [document_id, term_freq] : w.at(std::string(word))) {
-            const auto& document_data = documents_.at(document_id);
-            if (pred(document_id, document_data.status, document_data.rating)) {
-              document_to_relevance[document_id].ref_to_value +=
-                  term_freq * inverse_document_freq;
-            }
+  struct TermCursor {
+    SegmentSnapshot::Cursor cursor;
+    typename Scorer::Term term;
+  };
+  const Scorer scorer(snapshot, documents_);
+  const bool uses_impacts = UsesImpacts();
+  // Kept in the order of query words: scores are summed exactly like FindAllDocuments does
+  std::vector<TermCursor> plus_cursors;
+  for (const auto& term : terms.plus) {
+    if (term.term_id != InvertedIndex::NO_TERM) {
+      plus_cursors.push_back({SegmentSnapshot::Cursor(snapshot, term.term_id),
+                              scorer.PrepareTerm(term.term_id, term.inverse_document_freq)});
+    }
+  }
+  struct PrefixCursor {
+    const std::pair<int, uint32_t>* posting;
+    const std::pair<int, uint32_t>* end;
+    typename Scorer::Term term;
+  };
+  std::vector<PrefixCursor> prefix_cursors;
+  for (const auto& postings : prefix_postings) {
+    prefix_cursors.push_back({postings.data(), postings.data() + postings.size(),
+                              PreparePrefix(snapshot, scorer, postings)});
+  }
+  std::vector<SegmentSnapshot::Cursor> minus_cursors;
+  for (const auto& term : terms.minus) {
+    if (term.term_id != InvertedIndex::NO_TERM) {
+      minus_cursors.emplace_back(snapshot, term.term_id);
+    }
+  }
+  for (const auto term_id : terms.minus_prefix) {
+    minus_cursors.emplace_back(snapshot, term_id);
+  }
+
+  TopDocuments top_documents(max_result_count);
+  for (const int internal_id : candidates) {
+    if (!IsAccepted(snapshot, internal_id, pred) ||
+        std::any_of(minus_cursors.begin(), minus_cursors.end(), [internal_id](auto& cursor) {
+          cursor.Advance(internal_id);
+          return cursor.GetDocumentId() == internal_id;
+        })) {
+      continue;
+    }
+    double relevance = 0;
+    for (auto& [cursor, term] : plus_cursors) {
+      cursor.Advance(internal_id);
+      if (cursor.GetDocumentId() == internal_id) {
+        relevance += ScorePosting(scorer, term, uses_impacts, internal_id, cursor);
+      }
+    }
+    for (auto& [posting, end, term] : prefix_cursors) {
+      posting = std::lower_bound(posting, end, std::make_pair(internal_id, uint32_t{0}));
+      if (posting != end && posting->first == internal_id) {
+        relevance += scorer.Score(term, internal_id, posting->second);
+      }
+    }
+    top_documents.Add({documents_.GetExternalId(internal_id), relevance,
+                       documents_.GetRating(internal_id)});
+  }
+  return top_documents.Extract();
+}
+
+template <typename Scorer, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsPruned(const IndexSnapshot& snapshot,
+                                                           const QueryTerms& query_terms,
+                                                           DocumentPredicate pred,
+                                                           const QueryOptions& options) const {
+  struct PrunedTerm {
+    PrunedCursor cursor;
+    typename Scorer::Term term;
+    double max_score;
+    // Prefixes are scored by counts
+    bool uses_impacts;
+    bool is_essential;
+    // Bound of the block the last candidate fell into, see get_block_score
+    PostingList::BlockBound block;
+    double block_score;
+  };
+  // Bounds are inflated a little, so rounding never puts them below a real score
+  constexpr double bound_margin = 1.0 + 1e-9;
+  constexpr size_t window_word_count = PRUNING_WINDOW_SIZE / 64;
+
+  if (options.max_result_count == 0) {
+    return {};
+  }
+
+  // Plus terms, then prefixes, in the order of query words: a document's scores are summed
+  // in the same order as FindAllDocuments sums them
+  const Scorer scorer(snapshot, documents_);
+  const bool uses_impacts = UsesImpacts();
+  std::vector<PrefixPostings> prefix_postings(query_terms.prefixes.size());
+  std::vector<PrunedTerm> terms;
+  terms.reserve(query_terms.plus.size() + query_terms.prefixes.size());
+  const auto add_term = [&](PrunedCursor cursor, typename Scorer::Term term, float max_term_freq,
+                            bool term_uses_impacts) {
+    terms.push_back({std::move(cursor), term,
+                     scorer.GetMaxScore(term, max_term_freq) * bound_margin, term_uses_impacts,
+                     true, {-1, 0}, 0});
+  };
+  for (const auto& term : query_terms.plus) {
+    if (term.term_id != InvertedIndex::NO_TERM) {
+      add_term(PrunedCursor(snapshot, term.term_id),
+               scorer.PrepareTerm(term.term_id, term.inverse_document_freq),
+               snapshot.GetMaxTermFreq(term.term_id), uses_impacts);
+    }
+  }
+  for (size_t i = 0; i < prefix_postings.size(); ++i) {
+    PrefixPostings& postings = prefix_postings[i];
+    MergePrefixPostings(snapshot, query_terms.prefixes.begin()[i], postings);
+    if (postings.empty()) {
+      continue;
+    }
+    float max_term_freq = 0;
+    for (const auto& [internal_id, term_count] : postings) {
+      const double term_freq = term_count * documents_.GetInvWordCount(internal_id);
+      max_term_freq = std::max(max_term_freq, PostingList::RoundUpTermFreq(term_freq));
+    }
+    add_term(PrunedCursor(postings, max_term_freq), PreparePrefix(snapshot, scorer, postings),
+             max_term_freq, false);
+  }
+
+  std::vector<SegmentSnapshot::Cursor> minus_cursors;
+  minus_cursors.reserve(query_terms.minus.size() + query_terms.minus_prefix.size());
+  for (const auto& term : query_terms.minus) {
+    if (term.term_id != InvertedIndex::NO_TERM) {
+      minus_cursors.emplace_back(snapshot, term.term_id);
+    }
+  }
+  for (const auto term_id : query_terms.minus_prefix) {
+    minus_cursors.emplace_back(snapshot, term_id);
+  }
+
+  // Terms by increasing bound. The first ones, whose bounds sum to no more than the
+  // threshold, can't get a document into the top by themselves: only the postings of the
+  // essential others are walked, the non-essential ones are probed for the candidates
+  std::vector<PrunedTerm*> by_bound;
+  by_bound.reserve(terms.size());
+  for (auto& term : terms) {
+    by_bound.push_back(&term);
+  }
+  std::stable_sort(by_bound.begin(), by_bound.end(), [](const auto* lhs, const auto* rhs) {
+    return lhs->max_score < rhs->max_score;
+  });
+  // bound_sums[i] sums the bounds of the first i terms
+  std::vector<double> bound_sums(by_bound.size() + 1);
+  for (size_t i = 0; i < by_bound.size(); ++i) {
+    bound_sums[i + 1] = bound_sums[i] + by_bound[i]->max_score;
+  }
+  size_t non_essential_count = 0;
+
+  const bool use_block_max = options.evaluation == QueryEvaluation::BLOCK_MAX_WAND;
+  // Bound of the term in the block with the document, the cursor must not have passed
+  // the postings before it
+  const auto get_block_score = [&](PrunedTerm& term, int document_id) {
+    if (term.block.last_document_id < document_id) {
+      term.block = term.cursor.GetBlockBound(document_id);
+      term.block_score = term.block.last_document_id == PostingList::END
+                             ? 0
+                             : scorer.GetMaxScore(term.term, term.block.max_term_freq) *
+                                   bound_margin;
+    }
+    return term.block_score;
+  };
+
+  // Scores of the window documents, valid where their bits are set
+  thread_local std::vector<double> window_scores(PRUNING_WINDOW_SIZE);
+  thread_local std::vector<uint64_t> window_documents(window_word_count);
+  // A query that threw may have left its bits
+  std::fill(window_documents.begin(), window_documents.end(), 0);
+
+  TopDocuments top_documents(options.max_result_count);
+  // A document gets into a full top only if its relevance exceeds worst - eps
+  double threshold = -std::numeric_limits<double>::infinity();
+  while (true) {
+    while (non_essential_count < by_bound.size() &&
+           bound_sums[non_essential_count + 1] <= threshold) {
+      by_bound[non_essential_count++]->is_essential = false;
+    }
+    int window_first = PostingList::END;
+    for (size_t i = non_essential_count; i < by_bound.size(); ++i) {
+      window_first = std::min(window_first, by_bound[i]->cursor.GetDocumentId());
+    }
+    if (window_first == PostingList::END) {
+      break;
+    }
+    const int window_end = window_first < PostingList::END - PRUNING_WINDOW_SIZE
+                               ? window_first + PRUNING_WINDOW_SIZE
+                               : PostingList::END;
+
+    if (use_block_max && top_documents.IsFull()) {
+      // No document of the window gets into the top if the best blocks of all terms
+      // there can't put it in
+      double window_bound = 0;
+      for (auto* term : by_bound) {
+        double term_bound = 0;
+        for (int document_id = std::max(window_first, term->cursor.GetDocumentId());
+             document_id < window_end;) {
+          const auto block = term->cursor.GetBlockBound(document_id);
+          if (block.last_document_id == PostingList::END) {
+            break;
           }
+          term_bound = std::max(term_bound, scorer.GetMaxScore(term->term, block.max_term_freq));
+          document_id = block.last_document_id + 1;
         }
-      });
+        window_bound += term_bound * bound_margin;
+      }
+      if (window_bound <= threshold) {
+        for (size_t i = non_essential_count; i < by_bound.size(); ++i) {
+          by_bound[i]->cursor.Advance(window_end);
+        }
+        continue;
+      }
+    }
 
-  std::for_each(policy, query.minus_words.cbegin(), query.minus_words.cend(),
-                [&w = word_to_document_freqs_, &document_to_relevance](const auto& word) {
-                  if (w.count(word) != 0)
-                    for (const auto& [document_id, _] : w.at(std::string(word))) {
-                      document_to_relevance.erase(document_id);
-                    }
-                });
-
-  const auto results = document_to_relevance.BuildFlatContainer();
-  std::vector<Document> matched_documents(results.size());
-
-  std::transform(policy, results.begin(), results.end(), matched_documents.begin(),
-                 [&d = documents_](const auto& el) {
-                   return Document{el.first, el.second, d.at(el.first).rating};
-                 });
-  return matched_documents;
+    for (auto& term : terms) {
+      if (!term.is_essential) {
+        continue;
+      }
+      const auto add_score = [&](int internal_id, double score) {
+        const size_t slot = internal_id - window_first;
+        uint64_t& word = window_documents[slot / 64];
+        const uint64_t bit = uint64_t{1} << (slot % 64);
+        window_scores[slot] = (word & bit) != 0 ? window_scores[slot] + score : score;
+        word |= bit;
+      };
+      if (term.uses_impacts) {
+        term.cursor.ForEachTermFreqBelow(window_end, [&](int internal_id, float term_freq) {
+          add_score(internal_id, scorer.ScoreTermFreq(term.term, internal_id, term_freq));
+        });
+      } else {
+        term.cursor.ForEachBelow(window_end, [&](int internal_id, uint32_t term_count) {
+          add_score(internal_id, scorer.Score(term.term, internal_id, term_count));
+        });
+      }
+    }
+
+    for (size_t word = 0; word < window_word_count; ++word) {
+      for (uint64_t bits = std::exchange(window_documents[word], 0); bits != 0;
+           bits &= bits - 1) {
+        const size_t slot = word * 64 + __builtin_ctzll(bits);
+        const int internal_id = window_first + static_cast<int>(slot);
+        double relevance = window_scores[slot];
+        // Bound of what the non-essential terms may add
+        double remaining = bound_sums[non_essential_count];
+        if (relevance + remaining <= threshold) {
+          continue;
+        }
+        if (use_block_max && non_essential_count > 0) {
+          remaining = 0;
+          for (size_t i = 0; i < non_essential_count; ++i) {
+            remaining += get_block_score(*by_bound[i], internal_id);
+          }
+          if (relevance + remaining <= threshold) {
+            continue;
+          }
+        }
+        if (!IsAccepted(snapshot, internal_id, pred)) {
+          continue;
+        }
+        // Largest bounds first, so hopeless candidates are given up early
+        bool is_hopeless = false;
+        for (size_t i = non_essential_count; i-- > 0;) {
+          PrunedTerm& term = *by_bound[i];
+          remaining -= use_block_max ? term.block_score : term.max_score;
+          term.cursor.Advance(internal_id);
+          if (term.cursor.GetDocumentId() == internal_id) {
+            relevance +=
+                ScorePosting(scorer, term.term, term.uses_impacts, internal_id, term.cursor);
+          }
+          if (relevance + remaining <= threshold) {
+            is_hopeless = true;
+            break;
+          }
+        }
+        if (is_hopeless) {
+          continue;
+        }
+        bool is_excluded = false;
+        for (auto& cursor : minus_cursors) {
+          cursor.Advance(internal_id);
+          if (cursor.GetDocumentId() == internal_id) {
+            is_excluded = true;
+            break;
+          }
+        }
+        if (is_excluded) {
+          continue;
+        }
+        top_documents.Add({documents_.GetExternalId(internal_id), relevance,
+                           documents_.GetRating(internal_id)});
+        if (top_documents.IsFull()) {
+          threshold = top_documents.GetWorst().relevance - eps;
+        }
+      }
+    }
+  }
+  return top_documents.Extract();
 }
 
-template <typename ExecutionPolicy>
+template <typename Scorer>
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query,
+                                                     DocumentStatus status,
+                                                     const QueryOptions& options) const {
+  return FindTopDocuments<Scorer>(raw_query, StatusFilter{status}, options);
+}
+
+template <typename Scorer>
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query) const {
+  return FindTopDocuments<Scorer>(raw_query, DocumentStatus::ACTUAL);
+}
+
+template <typename Scorer, typename ExecutionPolicy>
 std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
                                                      const std::string_view& raw_query,
-                                                     DocumentStatus status) const {
-  return FindTopDocuments(
-      policy, raw_query,
-      [status]([[maybe_unused]] int document_id, DocumentStatus document_status,
-               [[maybe_unused]] int rating) { return document_status == status; });
+                                                     DocumentStatus status,
+                                                     const QueryOptions& options) const {
+  return FindTopDocuments<Scorer>(policy, raw_query, StatusFilter{status}, options);
 }
 
-template <typename ExecutionPolicy>
+template <typename Scorer, typename ExecutionPolicy>
 std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
                                                      const std::string_view& raw_query) const {
-  return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+  return FindTopDocuments<Scorer>(policy, raw_query, DocumentStatus::ACTUAL);
+}
+
+template <typename Scorer>
+std::vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query,
+                                                     DocumentStatus status,
+                                                     const QueryOptions& options) const {
+  return FindTopDocuments<Scorer>(query, StatusFilter{status}, options);
+}
+
+template <typename Scorer>
+std::vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query) const {
+  return FindTopDocuments<Scorer>(query, DocumentStatus::ACTUAL);
+}
+
+template <typename Scorer, typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
+                                                     const PreparedQuery& query,
+                                                     DocumentStatus status,
+                                                     const QueryOptions& options) const {
+  return FindTopDocuments<Scorer>(policy, query, StatusFilter{status}, options);
+}
+
+template <typename Scorer, typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
+                                                     const PreparedQuery& query) const {
+  return FindTopDocuments<Scorer>(policy, query, DocumentStatus::ACTUAL);
+}
+
+template <typename Scorer, typename Cursor>
+double SearchServer::ScorePosting(const Scorer& scorer,
+                                  const typename Scorer::Term& term,
+                                  bool uses_impacts,
+                                  int internal_id,
+                                  Cursor& cursor) {
+  return uses_impacts ? scorer.ScoreTermFreq(term, internal_id, cursor.GetTermFreq())
+                      : scorer.Score(term, internal_id, cursor.GetTermCount());
+}
+
+template <typename Scorer>
+typename Scorer::Term SearchServer::PreparePrefix(const IndexSnapshot& snapshot,
+                                                  const Scorer& scorer,
+                                                  const PrefixPostings& postings) const {
+  const double inverse_document_freq =
+      postings.empty() ? 0.0 : log(snapshot.GetDocumentCount() * 1.0 / postings.size());
+  return scorer.PrepareTerms(postings.size(), inverse_document_freq);
+}
+
+template <typename Scorer, typename DocumentPredicate>
+void SearchServer::ScorePrefix(const IndexSnapshot& snapshot,
+                               const Scorer& scorer,
+                               const Prefix& prefix,
+                               const DocumentPredicate& pred,
+                               ScoreAccumulator& document_to_relevance) const {
+  thread_local PrefixPostings postings;
+  MergePrefixPostings(snapshot, prefix, postings);
+  const auto term = PreparePrefix(snapshot, scorer, postings);
+  for (const auto& [internal_id, term_count] : postings) {
+    if (IsAccepted(snapshot, internal_id, pred)) {
+      document_to_relevance.Add(internal_id, scorer.Score(term, internal_id, term_count));
+    }
+  }
+}
+
+template <typename Scorer, typename DocumentPredicate>
+void SearchServer::ScoreTerm(const IndexSnapshot& snapshot,
+                             const Scorer& scorer,
+                             bool uses_impacts,
+                             const PreparedQuery::Term& term,
+                             const DocumentPredicate& pred,
+                             ScoreAccumulator& document_to_relevance) const {
+  const auto scorer_term = scorer.PrepareTerm(term.term_id, term.inverse_document_freq);
+  if (uses_impacts) {
+    snapshot.ForEachPosting(term.term_id, [&](int internal_id, uint32_t, float term_freq) {
+      if (IsAccepted(snapshot, internal_id, pred)) {
+        document_to_relevance.Add(internal_id,
+                                  scorer.ScoreTermFreq(scorer_term, internal_id, term_freq));
+      }
+    });
+    return;
+  }
+  snapshot.ForEachPosting(term.term_id, [&](int internal_id, uint32_t term_count) {
+    if (IsAccepted(snapshot, internal_id, pred)) {
+      document_to_relevance.Add(internal_id, scorer.Score(scorer_term, internal_id, term_count));
+    }
+  });
+}
+
+template <typename DocumentPredicate>
+bool SearchServer::IsAccepted(const IndexSnapshot& snapshot,
+                              int internal_id,
+                              const DocumentPredicate& pred) const {
+  if constexpr (std::is_same_v<DocumentPredicate, StatusFilter>) {
+    return documents_.HasStatus(internal_id, pred.status, snapshot.GetGeneration());
+  } else {
+    return !documents_.IsRemoved(internal_id, snapshot.GetGeneration()) &&
+           pred(documents_.GetExternalId(internal_id), documents_.GetStatus(internal_id),
+                documents_.GetRating(internal_id));
+  }
+}
+
+template <typename Callback>
+void SearchServer::PrunedCursor::ForEachBelow(int document_limit, Callback callback) {
+  if (cursor_) {
+    cursor_->ForEachBelow(document_limit, callback);
+    return;
+  }
+  for (; position_ < prefix_postings_->size() &&
+         (*prefix_postings_)[position_].first < document_limit;
+       ++position_) {
+    callback((*prefix_postings_)[position_].first, (*prefix_postings_)[position_].second);
+  }
+}
+
+template <typename Callback>
+void SearchServer::PrunedCursor::ForEachTermFreqBelow(int document_limit, Callback callback) {
+  cursor_->ForEachBelow(document_limit, [&callback](int document_id, uint32_t, float term_freq) {
+    callback(document_id, term_freq);
+  });
 }
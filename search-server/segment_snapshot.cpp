@@ -0,0 +1,134 @@
+﻿#include "segment_snapshot.h"
+#include <algorithm>
+#include <iterator>
+
+SegmentSnapshot::SegmentSnapshot(const SegmentList& segments,
+                                 const MutableSegment& mutable_segment,
+                                 int document_limit)
+    : segments_(&segments), mutable_segment_(&mutable_segment), document_limit_(document_limit) {}
+
+bool SegmentSnapshot::HasPosting(IndexSegment::TermId term_id, int document_id) const {
+  if (document_id >= mutable_segment_->GetFirstDocumentId()) {
+    const PostingBuffer* postings = mutable_segment_->FindPostings(term_id);
+    return document_id < document_limit_ && postings != nullptr &&
+           postings->Contains(document_id);
+  }
+  const auto it = std::upper_bound(
+      segments_->begin(), segments_->end(), document_id,
+      [](int id, const auto& segment) { return id < segment->GetFirstDocumentId(); });
+  if (it == segments_->begin()) {
+    return false;
+  }
+  const PostingList* postings = (*std::prev(it))->FindPostings(term_id);
+  return postings != nullptr && postings->Contains(document_id);
+}
+
+float SegmentSnapshot::GetMaxTermFreq(IndexSegment::TermId term_id) const {
+  float result = 0;
+  for (const auto& segment : *segments_) {
+    if (const PostingList* postings = segment->FindPostings(term_id)) {
+      result = std::max(result, postings->GetMaxTermFreq());
+    }
+  }
+  if (const PostingBuffer* postings = mutable_segment_->FindPostings(term_id)) {
+    result = std::max(result, postings->GetMaxTermFreq());
+  }
+  return result;
+}
+
+const SegmentList& SegmentSnapshot::GetSegments() const {
+  return *segments_;
+}
+
+const MutableSegment& SegmentSnapshot::GetMutableSegment() const {
+  return *mutable_segment_;
+}
+
+int SegmentSnapshot::GetDocumentLimit() const {
+  return document_limit_;
+}
+
+SegmentSnapshot::Cursor::Cursor(const SegmentSnapshot& snapshot, IndexSegment::TermId term_id) {
+  for (const auto& segment : snapshot.GetSegments()) {
+    if (const PostingList* postings = segment->FindPostings(term_id)) {
+      if (!postings->empty()) {
+        parts_.push_back({postings, segment->GetDocumentLimit()});
+      }
+    }
+  }
+  if (const PostingBuffer* postings = snapshot.GetMutableSegment().FindPostings(term_id)) {
+    postings->ForEach(snapshot.GetDocumentLimit(), [this](const PostingList::Entry& entry) {
+      buffered_postings_.Add(entry.document_id, entry.term_count, entry.term_freq);
+    });
+    if (!buffered_postings_.empty()) {
+      parts_.push_back({nullptr, snapshot.GetDocumentLimit()});
+    }
+  }
+  if (!parts_.empty()) {
+    Open(0);
+  }
+}
+
+bool SegmentSnapshot::Cursor::IsEnd() const {
+  return !cursor_ || cursor_->IsEnd();
+}
+
+int SegmentSnapshot::Cursor::GetDocumentId() const {
+  return cursor_ ? cursor_->GetDocumentId() : PostingList::END;
+}
+
+uint32_t SegmentSnapshot::Cursor::GetTermCount() const {
+  return cursor_->GetTermCount();
+}
+
+float SegmentSnapshot::Cursor::GetTermFreq() {
+  return cursor_->GetTermFreq();
+}
+
+void SegmentSnapshot::Cursor::Next() {
+  cursor_->Next();
+  SkipExhausted();
+}
+
+void SegmentSnapshot::Cursor::Advance(int document_id) {
+  if (IsEnd() || cursor_->GetDocumentId() >= document_id) {
+    return;
+  }
+  size_t part = part_;
+  while (part + 1 < parts_.size() && parts_[part].document_limit <= document_id) {
+    ++part;
+  }
+  if (part != part_) {
+    Open(part);
+  }
+  cursor_->Advance(document_id);
+  SkipExhausted();
+}
+
+PostingList::BlockBound SegmentSnapshot::Cursor::GetBlockBound(int document_id) const {
+  if (IsEnd()) {
+    return {PostingList::END, 0};
+  }
+  // Later parts only hold larger ids, so the first part with a bound has the right block
+  auto bound = cursor_->GetBlockBound(document_id);
+  for (size_t part = part_ + 1; part < parts_.size() && bound.last_document_id == PostingList::END;
+       ++part) {
+    bound = GetPostings(part).GetBlockBound(document_id);
+  }
+  return bound;
+}
+
+const PostingList& SegmentSnapshot::Cursor::GetPostings(size_t part) const {
+  return parts_[part].postings != nullptr ? *parts_[part].postings : buffered_postings_;
+}
+
+void SegmentSnapshot::Cursor::Open(size_t part) {
+  part_ = part;
+  cursor_.emplace(GetPostings(part));
+}
+
+void SegmentSnapshot::Cursor::SkipExhausted() {
+  while (cursor_->IsEnd() && part_ + 1 < parts_.size()) {
+    Open(part_ + 1);
+  }
+}
@@ -0,0 +1,191 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "index_segment.h"
+#include "mutable_segment.h"
+#include "posting_list.h"
+
+// Segments of one index version seen by a query: the sealed ones and the documents of the
+// mutable segment below the limit of the version. Nothing is owned, the version must stay
+// pinned while the snapshot is used
+class SegmentSnapshot {
+ public:
+  class Cursor;
+
+  SegmentSnapshot(const SegmentList& segments,
+                  const MutableSegment& mutable_segment,
+                  int document_limit);
+
+  // Calls callback(document_id, term_count) in increasing document_id order, see
+  // PostingList::ForEach for callbacks taking the term frequency
+  template <typename Callback>
+  void ForEachPosting(IndexSegment::TermId term_id, Callback callback) const;
+
+  // Same for the documents from first_document_id on, earlier segments are skipped
+  template <typename Callback>
+  void ForEachPosting(IndexSegment::TermId term_id, int first_document_id, Callback callback) const;
+
+  // Calls callback(document_id, term_count) in increasing document_id order for the documents
+  // with any of the terms, term_count sums the counts of the terms. Cursors of the terms
+  // are merged with a heap, so the work is O(log count) per posting
+  template <typename Callback>
+  void ForEachMergedPosting(const IndexSegment::TermId* term_ids,
+                            size_t count,
+                            Callback callback) const;
+
+  bool HasPosting(IndexSegment::TermId term_id, int document_id) const;
+
+  // Upper bound of the term frequency over all segments
+  float GetMaxTermFreq(IndexSegment::TermId term_id) const;
+
+  const SegmentList& GetSegments() const;
+
+  const MutableSegment& GetMutableSegment() const;
+
+  // Documents from this internal id on are not seen
+  int GetDocumentLimit() const;
+
+ private:
+  const SegmentList* segments_;
+  const MutableSegment* mutable_segment_;
+  int document_limit_;
+};
+
+// PostingList::Cursor chained over the segments of a snapshot
+class SegmentSnapshot::Cursor {
+ public:
+  Cursor(const SegmentSnapshot& snapshot, IndexSegment::TermId term_id);
+
+  bool IsEnd() const;
+
+  int GetDocumentId() const;
+
+  uint32_t GetTermCount() const;
+
+  float GetTermFreq();
+
+  void Next();
+
+  void Advance(int document_id);
+
+  // See PostingList::Cursor::ForEachBelow
+  template <typename Callback>
+  void ForEachBelow(int document_limit, Callback callback);
+
+  PostingList::BlockBound GetBlockBound(int document_id) const;
+
+ private:
+  struct Part {
+    // nullptr for the postings of the mutable segment
+    const PostingList* postings;
+    int document_limit;
+  };
+
+  const PostingList& GetPostings(size_t part) const;
+
+  void Open(size_t part);
+
+  void SkipExhausted();
+
+  std::vector<Part> parts_;
+  // Postings of the mutable segment below the limit, compressed for the cursor
+  PostingList buffered_postings_;
+  size_t part_ = 0;
+  std::optional<PostingList::Cursor> cursor_;
+};
+
+template <typename Callback>
+void SegmentSnapshot::ForEachPosting(IndexSegment::TermId term_id, Callback callback) const {
+  for (const auto& segment : *segments_) {
+    if (const PostingList* postings = segment->FindPostings(term_id)) {
+      postings->ForEach(callback);
+    }
+  }
+  if (const PostingBuffer* postings = mutable_segment_->FindPostings(term_id)) {
+    postings->ForEach(document_limit_, [&callback](const PostingList::Entry& entry) {
+      PostingList::Visit(callback, entry.document_id, entry.term_count, entry.term_freq);
+    });
+  }
+}
+
+template <typename Callback>
+void SegmentSnapshot::ForEachPosting(IndexSegment::TermId term_id,
+                                     int first_document_id,
+                                     Callback callback) const {
+  for (const auto& segment : *segments_) {
+    if (segment->GetDocumentLimit() <= first_document_id) {
+      continue;
+    }
+    if (const PostingList* postings = segment->FindPostings(term_id)) {
+      if (segment->GetFirstDocumentId() >= first_document_id) {
+        postings->ForEach(callback);
+      } else if constexpr (PostingList::TAKES_TERM_FREQ<Callback>) {
+        postings->ForEach([&](int document_id, uint32_t term_count, float term_freq) {
+          if (document_id >= first_document_id) {
+            callback(document_id, term_count, term_freq);
+          }
+        });
+      } else {
+        postings->ForEach([&](int document_id, uint32_t term_count) {
+          if (document_id >= first_document_id) {
+            callback(document_id, term_count);
+          }
+        });
+      }
+    }
+  }
+  if (const PostingBuffer* postings = mutable_segment_->FindPostings(term_id)) {
+    postings->ForEach(document_limit_, [&](const PostingList::Entry& entry) {
+      if (entry.document_id >= first_document_id) {
+        PostingList::Visit(callback, entry.document_id, entry.term_count, entry.term_freq);
+      }
+    });
+  }
+}
+
+template <typename Callback>
+void SegmentSnapshot::ForEachMergedPosting(const IndexSegment::TermId* term_ids,
+                                           size_t count,
+                                           Callback callback) const {
+  std::vector<Cursor> cursors;
+  cursors.reserve(count);
+  // Current document and cursor, the smallest document on top
+  std::vector<std::pair<int, size_t>> heap;
+  for (size_t i = 0; i < count; ++i) {
+    auto& cursor = cursors.emplace_back(*this, term_ids[i]);
+    if (!cursor.IsEnd()) {
+      heap.emplace_back(cursor.GetDocumentId(), i);
+    }
+  }
+  const auto greater = std::greater<std::pair<int, size_t>>();
+  std::make_heap(heap.begin(), heap.end(), greater);
+  while (!heap.empty()) {
+    const int document_id = heap.front().first;
+    uint32_t term_count = 0;
+    while (!heap.empty() && heap.front().first == document_id) {
+      std::pop_heap(heap.begin(), heap.end(), greater);
+      auto& cursor = cursors[heap.back().second];
+      term_count += cursor.GetTermCount();
+      cursor.Next();
+      if (cursor.IsEnd()) {
+        heap.pop_back();
+      } else {
+        heap.back().first = cursor.GetDocumentId();
+        std::push_heap(heap.begin(), heap.end(), greater);
+      }
+    }
+    callback(document_id, term_count);
+  }
+}
+
+template <typename Callback>
+void SegmentSnapshot::Cursor::ForEachBelow(int document_limit, Callback callback) {
+  while (cursor_ && cursor_->GetDocumentId() < document_limit) {
+    cursor_->ForEachBelow(document_limit, callback);
+    SkipExhausted();
+  }
+}
@@ -0,0 +1,172 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Vector of trivially copyable elements stored inline while there are at most N of them.
+// A larger one moves to the heap and keeps that storage when cleared, so a reused
+// vector stops allocating
+template <typename T, size_t N>
+class SmallVector {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  SmallVector() = default;
+
+  SmallVector(const SmallVector& other) = default;
+
+  SmallVector& operator=(const SmallVector& other) = default;
+
+  SmallVector(SmallVector&& other) noexcept;
+
+  SmallVector& operator=(SmallVector&& other) noexcept;
+
+  void push_back(const T& value);
+
+  // New elements are value-initialized
+  void resize(size_t size);
+
+  void clear();
+
+  T* data();
+
+  const T* data() const;
+
+  T& operator[](size_t index);
+
+  const T& operator[](size_t index) const;
+
+  T* begin();
+
+  T* end();
+
+  const T* begin() const;
+
+  const T* end() const;
+
+  size_t size() const;
+
+  bool empty() const;
+
+ private:
+  bool IsOnHeap() const;
+
+  void MoveToHeap(size_t capacity);
+
+  std::array<T, N> inline_;
+  // Holds all the elements once it has a capacity
+  std::vector<T> heap_;
+  size_t size_ = 0;
+};
+
+template <typename T, size_t N>
+SmallVector<T, N>::SmallVector(SmallVector&& other) noexcept
+    : inline_(other.inline_), heap_(std::move(other.heap_)), size_(std::exchange(other.size_, 0)) {
+  other.heap_ = {};
+}
+
+template <typename T, size_t N>
+SmallVector<T, N>& SmallVector<T, N>::operator=(SmallVector&& other) noexcept {
+  inline_ = other.inline_;
+  heap_ = std::move(other.heap_);
+  size_ = std::exchange(other.size_, 0);
+  other.heap_ = {};
+  return *this;
+}
+
+template <typename T, size_t N>
+void SmallVector<T, N>::push_back(const T& value) {
+  if (!IsOnHeap()) {
+    if (size_ < N) {
+      inline_[size_++] = value;
+      return;
+    }
+    MoveToHeap(N * 2);
+  }
+  heap_.push_back(value);
+  ++size_;
+}
+
+template <typename T, size_t N>
+void SmallVector<T, N>::resize(size_t size) {
+  if (!IsOnHeap() && size > N) {
+    MoveToHeap(size);
+  }
+  if (IsOnHeap()) {
+    heap_.resize(size);
+  } else {
+    std::fill(inline_.begin() + std::min(size_, size), inline_.begin() + size, T{});
+  }
+  size_ = size;
+}
+
+template <typename T, size_t N>
+void SmallVector<T, N>::clear() {
+  heap_.clear();
+  size_ = 0;
+}
+
+template <typename T, size_t N>
+T* SmallVector<T, N>::data() {
+  return IsOnHeap() ? heap_.data() : inline_.data();
+}
+
+template <typename T, size_t N>
+const T* SmallVector<T, N>::data() const {
+  return IsOnHeap() ? heap_.data() : inline_.data();
+}
+
+template <typename T, size_t N>
+T& SmallVector<T, N>::operator[](size_t index) {
+  return data()[index];
+}
+
+template <typename T, size_t N>
+const T& SmallVector<T, N>::operator[](size_t index) const {
+  return data()[index];
+}
+
+template <typename T, size_t N>
+T* SmallVector<T, N>::begin() {
+  return data();
+}
+
+template <typename T, size_t N>
+T* SmallVector<T, N>::end() {
+  return data() + size_;
+}
+
+template <typename T, size_t N>
+const T* SmallVector<T, N>::begin() const {
+  return data();
+}
+
+template <typename T, size_t N>
+const T* SmallVector<T, N>::end() const {
+  return data() + size_;
+}
+
+template <typename T, size_t N>
+size_t SmallVector<T, N>::size() const {
+  return size_;
+}
+
+template <typename T, size_t N>
+bool SmallVector<T, N>::empty() const {
+  return size_ == 0;
+}
+
+template <typename T, size_t N>
+bool SmallVector<T, N>::IsOnHeap() const {
+  return heap_.capacity() != 0;
+}
+
+template <typename T, size_t N>
+void SmallVector<T, N>::MoveToHeap(size_t capacity) {
+  heap_.reserve(std::max(capacity, size_));
+  heap_.assign(inline_.begin(), inline_.begin() + size_);
+}
@@ -0,0 +1,30 @@
+﻿#include "sorted_terms.h"
+#include <iterator>
+#include <utility>
+
+SortedTerms::SortedTerms(const Texts& texts) : texts_(&texts) {}
+
+std::shared_ptr<const SortedTerms> SortedTerms::Add(std::vector<TermId> term_ids) const {
+  const Texts& texts = *texts_;
+  const auto less = [&texts](TermId lhs, TermId rhs) { return texts[lhs] < texts[rhs]; };
+  auto result = std::make_shared<SortedTerms>(*this);
+  result->size_ += term_ids.size();
+  std::sort(term_ids.begin(), term_ids.end(), less);
+  auto run = std::make_shared<Run>(std::move(term_ids));
+  // Runs not much longer than the new one are merged into it
+  auto& runs = result->runs_;
+  while (!runs.empty() && runs.back()->size() <= 2 * run->size()) {
+    auto merged = std::make_shared<Run>();
+    merged->reserve(runs.back()->size() + run->size());
+    std::merge(runs.back()->begin(), runs.back()->end(), run->begin(), run->end(),
+               std::back_inserter(*merged), less);
+    run = std::move(merged);
+    runs.pop_back();
+  }
+  runs.push_back(std::move(run));
+  return result;
+}
+
+size_t SortedTerms::size() const {
+  return size_;
+}
@@ -0,0 +1,60 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "concurrent_vector.h"
+#include "index_segment.h"
+
+// Term ids in the lexicographic order of their texts. The ids are kept in sorted runs,
+// and each run is more than twice as long as the next one, so there are O(log n) runs.
+// Never changed once built: adding terms makes a new dictionary. It shares every run
+// except the ones the new terms were merged with
+class SortedTerms {
+ public:
+  using TermId = IndexSegment::TermId;
+  // Texts by term id, they must outlive the dictionary
+  using Texts = ConcurrentVector<std::string_view>;
+
+  explicit SortedTerms(const Texts& texts);
+
+  std::shared_ptr<const SortedTerms> Add(std::vector<TermId> term_ids) const;
+
+  // Calls callback(first, last) with the terms starting with prefix in every run, each range
+  // in lexicographic order. Costs O(log n) per run
+  template <typename Callback>
+  void ForEachWithPrefix(std::string_view prefix, Callback callback) const;
+
+  size_t size() const;
+
+ private:
+  using Run = std::vector<TermId>;
+
+  const Texts* texts_;
+  // Longest first
+  std::vector<std::shared_ptr<const Run>> runs_;
+  size_t size_ = 0;
+};
+
+template <typename Callback>
+void SortedTerms::ForEachWithPrefix(std::string_view prefix, Callback callback) const {
+  // Texts cut to the length of the prefix keep the order, terms with the prefix are equal
+  struct Less {
+    bool operator()(TermId term_id, std::string_view text) const {
+      return texts[term_id].substr(0, text.size()) < text;
+    }
+    bool operator()(std::string_view text, TermId term_id) const {
+      return text < texts[term_id].substr(0, text.size());
+    }
+    const Texts& texts;
+  };
+  for (const auto& run : runs_) {
+    const auto [first, last] = std::equal_range(run->data(), run->data() + run->size(), prefix,
+                                                Less{*texts_});
+    if (first != last) {
+      callback(first, last);
+    }
+  }
+}
@@ -0,0 +1,95 @@
+﻿#include "stop_word_filter.h"
+#include <algorithm>
+#include <functional>
+#include <numeric>
+
+namespace {
+
+// Average number of words in a bucket. Larger buckets need fewer seeds,
+// but searching seeds for them takes longer
+constexpr size_t BUCKET_SIZE = 4;
+constexpr uint32_t MAX_SEED = 1 << 16;
+
+}  // namespace
+
+StopWordFilter::StopWordFilter(const std::set<std::string, std::less<>>& words) {
+  std::vector<std::string_view> non_empty_words;
+  for (const auto& word : words) {
+    if (!word.empty()) {
+      non_empty_words.push_back(word);
+    }
+  }
+  if (non_empty_words.empty()) {
+    return;
+  }
+  // A table with a few spare slots is tried if no seeds fit the minimal one
+  size_t slot_count = non_empty_words.size();
+  while (!Build(non_empty_words, slot_count)) {
+    slot_count += slot_count / 16 + 1;
+  }
+}
+
+bool StopWordFilter::empty() const {
+  return entries_.empty();
+}
+
+bool StopWordFilter::Build(const std::vector<std::string_view>& words, size_t slot_count) {
+  std::vector<uint64_t> hashes(words.size());
+  std::transform(words.begin(), words.end(), hashes.begin(), std::hash<std::string_view>{});
+  seeds_.assign((words.size() + BUCKET_SIZE - 1) / BUCKET_SIZE, 0);
+  std::vector<std::vector<size_t>> buckets(seeds_.size());
+  for (size_t i = 0; i < words.size(); ++i) {
+    buckets[Reduce(hashes[i], seeds_.size())].push_back(i);
+  }
+  // The largest buckets are placed first, while most slots are free
+  std::vector<size_t> order(buckets.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&buckets](size_t lhs, size_t rhs) {
+    return buckets[lhs].size() > buckets[rhs].size();
+  });
+
+  std::vector<bool> is_taken(slot_count, false);
+  std::vector<size_t> word_slots(words.size());
+  std::vector<size_t> slots;
+  for (const size_t bucket : order) {
+    if (buckets[bucket].empty()) {
+      break;
+    }
+    uint32_t seed = 0;
+    for (; seed < MAX_SEED; ++seed) {
+      slots.clear();
+      for (const size_t i : buckets[bucket]) {
+        const size_t slot = Reduce(GetSlotHash(hashes[i], seed), slot_count);
+        if (is_taken[slot] || std::find(slots.begin(), slots.end(), slot) != slots.end()) {
+          break;
+        }
+        slots.push_back(slot);
+      }
+      if (slots.size() == buckets[bucket].size()) {
+        break;
+      }
+    }
+    if (seed == MAX_SEED) {
+      return false;
+    }
+    seeds_[bucket] = seed;
+    for (size_t j = 0; j < slots.size(); ++j) {
+      is_taken[slots[j]] = true;
+      word_slots[buckets[bucket][j]] = slots[j];
+    }
+  }
+
+  entries_.assign(slot_count, {0, 0, 0});
+  storage_.clear();
+  lengths_ = 0;
+  first_bytes_.fill(0);
+  for (size_t i = 0; i < words.size(); ++i) {
+    entries_[word_slots[i]] = {GetFingerprint(hashes[i]), static_cast<uint32_t>(words[i].size()),
+                               storage_.size()};
+    storage_ += words[i];
+    lengths_ |= uint64_t{1} << std::min<size_t>(words[i].size(), 63);
+    const auto first_byte = static_cast<unsigned char>(words[i][0]);
+    first_bytes_[first_byte / 64] |= uint64_t{1} << (first_byte % 64);
+  }
+  return true;
+}
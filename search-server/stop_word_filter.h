@@ -0,0 +1,78 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Set of stop words built once for fast membership tests of tokens. Lengths and first
+// bytes of the words reject most tokens without hashing, the rest is looked up in
+// a minimal perfect hash table: one probe, a fingerprint check and one comparison
+class StopWordFilter {
+ public:
+  explicit StopWordFilter(const std::set<std::string, std::less<>>& words);
+
+  bool Contains(std::string_view word) const;
+
+  bool empty() const;
+
+ private:
+  struct Entry {
+    uint32_t fingerprint;
+    uint32_t length;
+    size_t offset;
+  };
+
+  static uint64_t GetSlotHash(uint64_t hash, uint32_t seed);
+
+  static uint32_t GetFingerprint(uint64_t hash);
+
+  static size_t Reduce(uint64_t hash, size_t size);
+
+  bool Build(const std::vector<std::string_view>& words, size_t slot_count);
+
+  // Bit min(length, 63) is set for the lengths of the words
+  uint64_t lengths_ = 0;
+  std::array<uint64_t, 4> first_bytes_{};
+  // Hash seeds of the buckets which place their words into distinct slots
+  std::vector<uint32_t> seeds_;
+  std::vector<Entry> entries_;
+  std::string storage_;
+};
+
+inline bool StopWordFilter::Contains(std::string_view word) const {
+  if (word.empty() || ((lengths_ >> std::min<size_t>(word.size(), 63)) & 1) == 0) {
+    return false;
+  }
+  const auto first_byte = static_cast<unsigned char>(word[0]);
+  if (((first_bytes_[first_byte / 64] >> (first_byte % 64)) & 1) == 0) {
+    return false;
+  }
+  const uint64_t hash = std::hash<std::string_view>{}(word);
+  const uint32_t seed = seeds_[Reduce(hash, seeds_.size())];
+  const Entry& entry = entries_[Reduce(GetSlotHash(hash, seed), entries_.size())];
+  return entry.fingerprint == GetFingerprint(hash) && entry.length == word.size() &&
+         std::string_view(storage_).substr(entry.offset, entry.length) == word;
+}
+
+inline uint64_t StopWordFilter::GetSlotHash(uint64_t hash, uint32_t seed) {
+  // Finalizer of splitmix64
+  hash += (seed + 1) * 0x9E3779B97F4A7C15ull;
+  hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+  hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+  return hash ^ (hash >> 31);
+}
+
+inline uint32_t StopWordFilter::GetFingerprint(uint64_t hash) {
+  return static_cast<uint32_t>(hash >> 32) ^ static_cast<uint32_t>(hash);
+}
+
+inline size_t StopWordFilter::Reduce(uint64_t hash, size_t size) {
+  // Maps the hash to [0, size) by a multiplication instead of a division
+  return static_cast<size_t>((static_cast<unsigned __int128>(hash) * size) >> 64);
+}
@@ -1,6 +1,130 @@
 ﻿#include "string_processing.h"
+#include <cstdint>
+#include <stdexcept>
 
+#if !defined(SEARCH_SERVER_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define STRING_PROCESSING_X86_KERNELS
+#include <immintrin.h>
+#endif
 
+namespace {
+
+bool IsSpecial(char c) {
+  return static_cast<unsigned char>(c) < ' ';
+}
+
+// Adds the words ended by the spaces of the mask, bit i stands for text[offset + i]
+void AddWordsBeforeSpaces(std::string_view text,
+                          size_t offset,
+                          uint32_t space_mask,
+                          size_t& first,
+                          std::vector<std::string_view>& words) {
+  while (space_mask != 0) {
+    const size_t position = offset + __builtin_ctz(space_mask);
+    if (first != position) {
+      words.push_back(text.substr(first, position - first));
+    }
+    first = position + 1;
+    space_mask &= space_mask - 1;
+  }
+}
+
+// Continues splitting from position, where the current word starts at first
+bool SplitScalar(std::string_view text,
+                 size_t position,
+                 size_t first,
+                 std::vector<std::string_view>& words) {
+  for (; position < text.size(); ++position) {
+    if (text[position] == ' ') {
+      if (first != position) {
+        words.push_back(text.substr(first, position - first));
+      }
+      first = position + 1;
+    } else if (IsSpecial(text[position])) {
+      const size_t last = text.find(' ', position);
+      words.push_back(text.substr(first, last == std::string_view::npos ? last : last - first));
+      return false;
+    }
+  }
+  if (first < text.size()) {
+    words.push_back(text.substr(first));
+  }
+  return true;
+}
+
+bool SplitScalar(std::string_view text, std::vector<std::string_view>& words) {
+  return SplitScalar(text, 0, 0, words);
+}
+
+#ifdef STRING_PROCESSING_X86_KERNELS
+
+// Chunks with special characters and the tail are left to the scalar loop
+__attribute__((target("sse2"))) bool SplitSse2(std::string_view text,
+                                               std::vector<std::string_view>& words) {
+  const __m128i spaces = _mm_set1_epi8(' ');
+  const __m128i last_special = _mm_set1_epi8(' ' - 1);
+  size_t first = 0;
+  size_t position = 0;
+  for (; position + 16 <= text.size(); position += 16) {
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + position));
+    const __m128i special = _mm_cmpeq_epi8(_mm_min_epu8(bytes, last_special), bytes);
+    if (_mm_movemask_epi8(special) != 0) {
+      break;
+    }
+    AddWordsBeforeSpaces(text, position, _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, spaces)), first,
+                         words);
+  }
+  return SplitScalar(text, position, first, words);
+}
+
+__attribute__((target("avx2"))) bool SplitAvx2(std::string_view text,
+                                               std::vector<std::string_view>& words) {
+  const __m256i spaces = _mm256_set1_epi8(' ');
+  const __m256i last_special = _mm256_set1_epi8(' ' - 1);
+  size_t first = 0;
+  size_t position = 0;
+  for (; position + 32 <= text.size(); position += 32) {
+    const __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text.data() + position));
+    const __m256i special = _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, last_special), bytes);
+    if (_mm256_movemask_epi8(special) != 0) {
+      break;
+    }
+    AddWordsBeforeSpaces(text, position, _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, spaces)),
+                         first, words);
+  }
+  return SplitScalar(text, position, first, words);
+}
+
+#endif
+
+struct Kernel {
+  const char* name;
+  bool (*split)(std::string_view, std::vector<std::string_view>&);
+};
+
+std::vector<Kernel> GetSupportedKernels() {
+  std::vector<Kernel> kernels;
+#ifdef STRING_PROCESSING_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back({"avx2", SplitAvx2});
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    kernels.push_back({"sse2", SplitSse2});
+  }
+#endif
+  kernels.push_back({"scalar", SplitScalar});
+  return kernels;
+}
+
+Kernel& GetKernel() {
+  static Kernel kernel = GetSupportedKernels().front();
+  return kernel;
+}
+
+}  // namespace
 
 std::vector<std::string_view> SplitIntoWords(const std::string_view& text) {
   std::vector<std::string_view> output;
@@ -17,4 +141,31 @@ std::vector<std::string_view> SplitIntoWords(const std::string_view& text) {
     first = second + 1;
   }
   return output;
-}
\ No newline at end of file
+}
+
+bool SplitIntoValidWords(std::string_view text, std::vector<std::string_view>& words) {
+  words.clear();
+  return GetKernel().split(text, words);
+}
+
+const char* GetTokenizerKernelName() {
+  return GetKernel().name;
+}
+
+std::vector<std::string_view> GetSupportedTokenizerKernelNames() {
+  std::vector<std::string_view> names;
+  for (const auto& kernel : GetSupportedKernels()) {
+    names.push_back(kernel.name);
+  }
+  return names;
+}
+
+void SelectTokenizerKernel(std::string_view name) {
+  for (const auto& kernel : GetSupportedKernels()) {
+    if (kernel.name == name) {
+      GetKernel() = kernel;
+      return;
+    }
+  }
+  throw std::invalid_argument("Unsupported tokenizer kernel " + std::string(name));
+}
@@ -7,6 +7,20 @@
 
 std::vector<std::string_view> SplitIntoWords(const std::string_view& text);
 
+// Splits the text by spaces into the buffer, which is cleared first. Returns false if a word
+// has a special character (a byte below ' '), the buffer then ends with that word.
+// Scans the text with AVX2 or SSE2 when the processor has them
+bool SplitIntoValidWords(std::string_view text, std::vector<std::string_view>& words);
+
+const char* GetTokenizerKernelName();
+
+// Names of the kernels this CPU can run, the one chosen at startup first
+std::vector<std::string_view> GetSupportedTokenizerKernelNames();
+
+// Makes SplitIntoValidWords use the named kernel. For tests comparing the kernels, not safe
+// while other threads tokenize. Throws std::invalid_argument for unsupported kernels
+void SelectTokenizerKernel(std::string_view name);
+
 template <typename StringContainer>
 std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
   std::set<std::string, std::less<>> non_empty_strings;
@@ -0,0 +1,2032 @@
+﻿#include "tests.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <execution>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "bit_packing.h"
+#include "concurrent_hash_map.h"
+#include "concurrent_map.h"
+#include "document_table.h"
+#include "epoch_manager.h"
+#include "index_file.h"
+#include "inverted_index.h"
+#include "posting_list.h"
+#include "process_queries.h"
+#include "query_result_cache.h"
+#include "remove_duplicates.h"
+#include "request_queue.h"
+#include "score_accumulator.h"
+#include "search_server.h"
+#include "small_vector.h"
+#include "stop_word_filter.h"
+#include "string_processing.h"
+#include "test_framework.h"
+#include "top_documents.h"
+#include "work_stealing_pool.h"
+
+using namespace std;
+
+namespace {
+
+// Values of a block with every bit width from 0 to 32 bits
+vector<uint32_t> MakeBlock(mt19937& generator, uint32_t bit_width) {
+  vector<uint32_t> values(bit_packing::BLOCK_SIZE);
+  const uint32_t max_value = bit_width >= 32 ? ~0u : (1u << bit_width) - 1;
+  for (auto& value : values) {
+    value = uniform_int_distribution<uint32_t>(0, max_value)(generator);
+  }
+  if (bit_width > 0) {
+    values[bit_width % values.size()] = max_value;
+  }
+  return values;
+}
+
+void TestPackRoundTrip() {
+  mt19937 generator;
+  for (const auto kernel : bit_packing::GetSupportedKernelNames()) {
+    bit_packing::SelectKernel(kernel);
+    for (uint32_t bit_width = 0; bit_width <= 32; ++bit_width) {
+      const auto values = MakeBlock(generator, bit_width);
+      ASSERT_EQUAL(bit_packing::RequiredBitWidth(values.data(), values.size()), bit_width);
+      vector<uint32_t> packed(bit_packing::PackedWordCount(bit_width));
+      bit_packing::Pack(values.data(), bit_width, packed.data());
+      vector<uint32_t> unpacked(values.size());
+      bit_packing::Unpack(packed.data(), bit_width, unpacked.data());
+      ASSERT_EQUAL(unpacked, values);
+    }
+  }
+  bit_packing::SelectKernel(bit_packing::GetSupportedKernelNames().front());
+}
+
+// Every kernel this CPU runs decodes like the scalar one
+void TestKernelEquivalence() {
+  mt19937 generator;
+  const auto kernels = bit_packing::GetSupportedKernelNames();
+  for (uint32_t bit_width = 0; bit_width <= 31; ++bit_width) {
+    const auto gaps = MakeBlock(generator, bit_width);
+    vector<uint32_t> packed(bit_packing::PackedWordCount(bit_width));
+    bit_packing::Pack(gaps.data(), bit_width, packed.data());
+    const uint32_t base = bit_width % 2 == 0 ? 0u : 1000u;
+
+    bit_packing::SelectKernel("scalar"sv);
+    vector<uint32_t> expected_values(gaps.size());
+    bit_packing::Unpack(packed.data(), bit_width, expected_values.data());
+    vector<uint32_t> expected_ids(gaps.size());
+    bit_packing::UnpackGaps(packed.data(), bit_width, base, expected_ids.data());
+
+    for (const auto kernel : kernels) {
+      bit_packing::SelectKernel(kernel);
+      vector<uint32_t> values(gaps.size());
+      bit_packing::Unpack(packed.data(), bit_width, values.data());
+      ASSERT_EQUAL(values, expected_values);
+      vector<uint32_t> ids(gaps.size());
+      bit_packing::UnpackGaps(packed.data(), bit_width, base, ids.data());
+      ASSERT_EQUAL(ids, expected_ids);
+    }
+  }
+
+  // Counts around the register widths, keys before, inside, between and after the values
+  for (size_t count = 0; count <= 2 * bit_packing::LANE_COUNT + 3; ++count) {
+    vector<uint32_t> values(count);
+    for (size_t i = 0; i < count; ++i) {
+      values[i] = static_cast<uint32_t>(3 * i + 1);
+    }
+    for (uint32_t key = 0; key <= 3 * count + 2; ++key) {
+      bit_packing::SelectKernel("scalar"sv);
+      const size_t expected = bit_packing::LowerBound(values.data(), count, key);
+      ASSERT_EQUAL(expected, static_cast<size_t>(
+                                 lower_bound(values.begin(), values.end(), key) - values.begin()));
+      for (const auto kernel : kernels) {
+        bit_packing::SelectKernel(kernel);
+        ASSERT_EQUAL(bit_packing::LowerBound(values.data(), count, key), expected);
+      }
+    }
+  }
+  bit_packing::SelectKernel(kernels.front());
+  ASSERT_THROWS(bit_packing::SelectKernel("avx512"sv), invalid_argument);
+}
+
+// Term frequencies of TestPostingListBlocks, most of them not representable exactly
+double MakeTermFreq(size_t i) {
+  return 1.0 / static_cast<double>(i % 13 + 1) / 3.0;
+}
+
+// Postings filling whole blocks, a block and a partial tail, and a tail alone
+void TestPostingListBlocks() {
+  const size_t block_size = PostingList::BLOCK_SIZE;
+  for (const size_t count : {size_t{1}, block_size - 1, block_size, block_size + 1,
+                             2 * block_size, 3 * block_size + 17}) {
+    for (const auto kernel : bit_packing::GetSupportedKernelNames()) {
+      bit_packing::SelectKernel(kernel);
+      // Gaps grow with the position, so blocks get different bit widths
+      vector<int> document_ids;
+      PostingList postings;
+      for (size_t i = 0; i < count; ++i) {
+        const int document_id =
+            document_ids.empty() ? 5 : document_ids.back() + 1 + static_cast<int>(i % 7 * (i / 50));
+        document_ids.push_back(document_id);
+        postings.Add(document_id, static_cast<uint32_t>(i % 5 + 1), MakeTermFreq(i));
+      }
+      ASSERT_EQUAL(postings.size(), count);
+
+      vector<int> decoded_ids;
+      vector<uint32_t> decoded_counts;
+      postings.ForEach([&](int document_id, uint32_t term_count) {
+        decoded_ids.push_back(document_id);
+        decoded_counts.push_back(term_count);
+      });
+      ASSERT_EQUAL(decoded_ids, document_ids);
+      for (size_t i = 0; i < count; ++i) {
+        ASSERT_EQUAL(decoded_counts[i], i % 5 + 1);
+      }
+      // Stored term frequencies never underestimate and are off by less than 2^-7
+      vector<float> term_freqs;
+      postings.ForEach([&](int, uint32_t, float term_freq) { term_freqs.push_back(term_freq); });
+      ASSERT_EQUAL(term_freqs.size(), count);
+      for (size_t i = 0; i < count; ++i) {
+        ASSERT_EQUAL(term_freqs[i], PostingList::RoundUpTermFreq(MakeTermFreq(i)));
+        ASSERT(term_freqs[i] >= MakeTermFreq(i));
+        ASSERT(term_freqs[i] < MakeTermFreq(i) * (1 + 1.0 / 128));
+      }
+
+      // Every posting and every gap before it, across the block edges
+      PostingList::Cursor cursor(postings);
+      for (size_t i = 0; i < count; ++i) {
+        for (int target = i == 0 ? 0 : document_ids[i - 1] + 1; target <= document_ids[i];
+             ++target) {
+          PostingList::Cursor fresh(postings);
+          fresh.Advance(target);
+          ASSERT_EQUAL(fresh.GetDocumentId(), document_ids[i]);
+        }
+        cursor.Advance(document_ids[i]);
+        ASSERT_EQUAL(cursor.GetDocumentId(), document_ids[i]);
+        ASSERT_EQUAL(cursor.GetTermCount(), i % 5 + 1);
+        ASSERT_EQUAL(cursor.GetTermFreq(), term_freqs[i]);
+        ASSERT(postings.Contains(document_ids[i]));
+      }
+      cursor.Next();
+      ASSERT(cursor.IsEnd());
+      PostingList::Cursor past_end(postings);
+      past_end.Advance(document_ids.back() + 1);
+      ASSERT(past_end.IsEnd());
+      ASSERT_EQUAL(past_end.GetDocumentId(), PostingList::END);
+
+      // Blocks re-encoded around an inserted posting keep the term frequencies
+      postings.Add(0, 1, 1.0);
+      vector<float> reencoded_freqs;
+      postings.ForEach([&](int document_id, uint32_t, float term_freq) {
+        if (document_id != 0) {
+          reencoded_freqs.push_back(term_freq);
+        }
+      });
+      ASSERT_EQUAL(reencoded_freqs, term_freqs);
+    }
+  }
+  bit_packing::SelectKernel(bit_packing::GetSupportedKernelNames().front());
+}
+
+// Words of a small dictionary, so documents share many of them
+string MakeText(mt19937& generator, int word_count, double minus_prob = 0) {
+  static const vector<string> words = {"cat"s,   "dog"s,  "bird"s,  "fish"s,  "mouse"s,
+                                       "horse"s, "cow"s,  "sheep"s, "goat"s,  "duck"s,
+                                       "frog"s,  "wolf"s, "fox"s,   "bear"s,  "deer"s};
+  string text;
+  for (int i = 0; i < word_count; ++i) {
+    if (!text.empty()) {
+      text.push_back(' ');
+    }
+    if (uniform_real_distribution<>(0, 1)(generator) < minus_prob) {
+      text.push_back('-');
+    }
+    text += words[uniform_int_distribution<size_t>(0, words.size() - 1)(generator)];
+  }
+  return text;
+}
+
+vector<int> GetIds(const vector<Document>& documents) {
+  vector<int> ids;
+  for (const auto& document : documents) {
+    ids.push_back(document.id);
+  }
+  return ids;
+}
+
+// Turns every word of the text into its first letter or two followed by * with the
+// given probability, keeping minus signs
+string MakePrefixes(mt19937& generator, const string& text, double prefix_prob) {
+  string result;
+  for (const string_view word : SplitIntoWords(text)) {
+    if (!result.empty()) {
+      result.push_back(' ');
+    }
+    if (uniform_real_distribution<>(0, 1)(generator) >= prefix_prob) {
+      result += word;
+      continue;
+    }
+    const size_t sign_length = word[0] == '-' ? 1 : 0;
+    result += word.substr(0, sign_length + uniform_int_distribution<size_t>(1, 2)(generator));
+    result.push_back('*');
+  }
+  return result;
+}
+
+// WAND and block-max WAND find the documents exhaustive evaluation does, for short and
+// long queries, with and without prefixes
+template <typename Scorer>
+void CheckPrunedEvaluation(const SearchServer& search_server, mt19937& generator) {
+  for (const int word_count : {1, 2, 3, 4, 5, 6, 15, 40}) {
+    for (int i = 0; i < 20; ++i) {
+      const string text = MakeText(generator, word_count, 0.2);
+      const string query = i % 4 == 0 ? MakePrefixes(generator, text, 0.3) : text;
+      for (const size_t max_count : {size_t{1}, size_t{5}, size_t{50}}) {
+        const auto expected = GetIds(search_server.FindTopDocuments<Scorer>(
+            query, DocumentStatus::ACTUAL, {max_count, QueryEvaluation::EXHAUSTIVE}));
+        for (const auto evaluation : {QueryEvaluation::WAND, QueryEvaluation::BLOCK_MAX_WAND}) {
+          ASSERT_EQUAL(GetIds(search_server.FindTopDocuments<Scorer>(
+                           query, DocumentStatus::ACTUAL, {max_count, evaluation})),
+                       expected);
+        }
+      }
+    }
+  }
+}
+
+void TestPrunedEvaluation() {
+  mt19937 generator;
+  SearchServer search_server("and in"s);
+  // Texts of different lengths, so term frequencies and their bounds differ. The documents
+  // span several segments and pruning windows
+  for (int id = 0; id < 10000; ++id) {
+    search_server.AddDocument(id, MakeText(generator, uniform_int_distribution(1, 30)(generator)),
+                              id % 10 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL,
+                              {id % 7});
+  }
+  CheckPrunedEvaluation<TfIdfScorer>(search_server, generator);
+  CheckPrunedEvaluation<Bm25Scorer>(search_server, generator);
+}
+
+// BM25 relevances of a small corpus, computed by the textbook formula with the
+// idf = log(1 + (N - df + 0.5) / (df + 0.5)) the scorer uses
+void TestBm25Relevance() {
+  SearchServer search_server("and in"s);
+  search_server.AddDocument(1, "cat dog cat"s, DocumentStatus::ACTUAL, {1});
+  search_server.AddDocument(2, "dog and bird"s, DocumentStatus::ACTUAL, {2});
+  search_server.AddDocument(3, "fish bird bird fish fish"s, DocumentStatus::ACTUAL, {3});
+  search_server.AddDocument(4, "cat"s, DocumentStatus::ACTUAL, {4});
+  // Four documents of 3, 2, 5 and 1 words, stop words aside
+  const double average_length = 11.0 / 4;
+  const auto bm25 = [&](double term_count, double document_length, double document_freq) {
+    const double k1 = 1.2;
+    const double b = 0.75;
+    const double inverse_document_freq = log(1 + (4 - document_freq + 0.5) / (document_freq + 0.5));
+    return inverse_document_freq * term_count * (k1 + 1) /
+           (term_count + k1 * (1 - b + b * document_length / average_length));
+  };
+  // cat and bird are in two documents each
+  const vector<pair<int, double>> expected = {
+      {4, bm25(1, 1, 2)}, {1, bm25(2, 3, 2)}, {2, bm25(1, 2, 2)}, {3, bm25(2, 5, 2)}};
+  for (const auto evaluation : {QueryEvaluation::EXHAUSTIVE, QueryEvaluation::WAND,
+                                QueryEvaluation::BLOCK_MAX_WAND}) {
+    const auto documents = search_server.FindTopDocuments<Bm25Scorer>(
+        "cat bird"s, DocumentStatus::ACTUAL, {MAX_RESULT_DOCUMENT_COUNT, evaluation});
+    ASSERT_EQUAL(documents.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      ASSERT_EQUAL(documents[i].id, expected[i].first);
+      ASSERT(abs(documents[i].relevance - expected[i].second) < 1e-9);
+    }
+  }
+
+  // Both terms of one document add up, and a frequent term still scores above zero
+  search_server.AddDocument(5, "cat bird dog"s, DocumentStatus::ACTUAL, {5});
+  const auto documents = search_server.FindTopDocuments<Bm25Scorer>("cat bird"s);
+  ASSERT_EQUAL(documents.front().id, 5);
+  const double new_average_length = 14.0 / 5;
+  const auto term_score = [&](double document_freq) {
+    const double inverse_document_freq = log(1 + (5 - document_freq + 0.5) / (document_freq + 0.5));
+    return inverse_document_freq * 2.2 / (1 + 1.2 * (0.25 + 0.75 * 3 / new_average_length));
+  };
+  ASSERT(abs(documents.front().relevance - 2 * term_score(3)) < 1e-9);
+}
+
+void TestConcurrentHashMapChurn() {
+  ConcurrentHashMap<int, int> hash_map(4, 16);
+  const size_t initial_memory = hash_map.GetMemoryUsage();
+  // Every key is new, so without rebuilds sized by live keys the tables would only grow
+  for (int key = 0; key < 1'000'000; ++key) {
+    hash_map.Add(key, 1);
+    if (key % 10 == 0) {
+      continue;
+    }
+    ASSERT(hash_map.Erase(key));
+    ASSERT(!hash_map.Erase(key));
+  }
+  ASSERT_EQUAL(hash_map.size(), 100'000u);
+  ASSERT_EQUAL(hash_map.Find(10).value_or(0), 1);
+  ASSERT(!hash_map.Find(11));
+  const size_t filled_memory = hash_map.GetMemoryUsage();
+  ASSERT(filled_memory > initial_memory);
+
+  for (int key = 0; key < 1'000'000; key += 10) {
+    ASSERT(hash_map.Erase(key));
+  }
+  ASSERT_EQUAL(hash_map.size(), 0u);
+  for (int key = 1'000'000; key < 3'000'000; ++key) {
+    hash_map.Assign(key, key);
+    ASSERT(hash_map.Erase(key));
+  }
+  ASSERT_EQUAL(hash_map.size(), 0u);
+  ASSERT(hash_map.GetMemoryUsage() <= filled_memory);
+  ASSERT(hash_map.GetMemoryUsage() < 2 * initial_memory);
+
+  // Erased keys come back with fresh values
+  hash_map.Add(5, 3);
+  hash_map.Add(5, 4);
+  ASSERT_EQUAL(hash_map.Find(5).value_or(0), 7);
+}
+
+// Threads add to shared keys and now and then insert and erase keys of their own, which
+// forces rebuilds of the tables under the other adders. No increment may get lost
+template <typename AddFunction, typename FindFunction, typename ChurnFunction>
+void CheckNoLostUpdates(AddFunction add, FindFunction find, ChurnFunction churn) {
+  const int thread_count = 8;
+  const int key_count = 1000;
+  const int round_count = 100;
+  vector<thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([t, &add, &churn] {
+      mt19937 generator(t);
+      for (int round = 0; round < round_count; ++round) {
+        // Every thread adds 1 to every key once a round, in its own order
+        vector<int> keys(key_count);
+        iota(keys.begin(), keys.end(), 0);
+        shuffle(keys.begin(), keys.end(), generator);
+        for (const int key : keys) {
+          add(key);
+          if (key % 100 == 0) {
+            churn(key_count * (1 + t * round_count + round) + key);
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (int key = 0; key < key_count; ++key) {
+    ASSERT_EQUAL(find(key), thread_count * round_count);
+  }
+}
+
+void TestConcurrentMapsContention() {
+  {
+    ConcurrentMap<int, int> concurrent_map(7);
+    CheckNoLostUpdates([&](int key) { ++concurrent_map[key].ref_to_value; },
+                       [&](int key) { return concurrent_map[key].ref_to_value; },
+                       [&](int key) {
+                         concurrent_map[key].ref_to_value = 1;
+                         concurrent_map.erase(key);
+                       });
+    ASSERT_EQUAL(concurrent_map.BuildOrdinaryMap().size(), 1000u);
+  }
+  {
+    ConcurrentHashMap<int, int> hash_map(4, 16);
+    CheckNoLostUpdates([&](int key) { hash_map.Add(key, 1); },
+                       [&](int key) { return hash_map.Find(key).value_or(0); },
+                       [&](int key) {
+                         hash_map.Assign(key, 1);
+                         hash_map.Erase(key);
+                       });
+    ASSERT_EQUAL(hash_map.size(), 1000u);
+  }
+}
+
+string GetTemporaryPath(const string& name) {
+  return (filesystem::temp_directory_path() / name).string();
+}
+
+vector<char> ReadFile(const string& path) {
+  ifstream input(path, ios::binary);
+  return {istreambuf_iterator<char>(input), istreambuf_iterator<char>()};
+}
+
+void WriteFile(const string& path, const vector<char>& bytes) {
+  ofstream output(path, ios::binary | ios::trunc);
+  output.write(bytes.data(), bytes.size());
+}
+
+// Offsets in the header of an index file: magic, version, byte order mark, file size,
+// checksum, then the offsets and the sizes of the sections
+constexpr size_t VERSION_OFFSET = 8;
+constexpr size_t SECTION_OFFSETS_OFFSET = 32;
+constexpr size_t SECTION_SIZES_OFFSET =
+    SECTION_OFFSETS_OFFSET + static_cast<size_t>(IndexSection::COUNT) * sizeof(uint64_t);
+
+template <typename T>
+T ReadValue(const vector<char>& bytes, size_t offset) {
+  T value;
+  memcpy(&value, bytes.data() + offset, sizeof(value));
+  return value;
+}
+
+template <typename T>
+void WriteValue(vector<char>& bytes, size_t offset, T value) {
+  memcpy(bytes.data() + offset, &value, sizeof(value));
+}
+
+uint64_t GetSectionOffset(const vector<char>& bytes, IndexSection section) {
+  return ReadValue<uint64_t>(bytes,
+                             SECTION_OFFSETS_OFFSET + static_cast<size_t>(section) * sizeof(uint64_t));
+}
+
+// Enough documents for full posting blocks, removed ones and every status
+void AddIndexedDocuments(SearchServer& search_server) {
+  mt19937 generator;
+  search_server.EnablePhraseQueries();
+  for (int id = 0; id < 400; ++id) {
+    search_server.AddDocument(id * 3, MakeText(generator, uniform_int_distribution(1, 20)(generator)),
+                              static_cast<DocumentStatus>(id % 4), {id % 11, 2});
+  }
+  search_server.RemoveDocuments({3, 30, 300});
+}
+
+void CheckSameResults(const SearchServer& expected, const SearchServer& actual) {
+  ASSERT_EQUAL(actual.GetDocumentCount(), expected.GetDocumentCount());
+  for (const string& query : {"cat dog"s, "fox -bear"s, "\"cat dog\" mouse"s, "wolf fox deer"s}) {
+    for (const auto status : {DocumentStatus::ACTUAL, DocumentStatus::BANNED}) {
+      const auto expected_documents = expected.FindTopDocuments(query, status, {50});
+      const auto actual_documents = actual.FindTopDocuments(query, status, {50});
+      ASSERT_EQUAL(GetIds(actual_documents), GetIds(expected_documents));
+      for (size_t i = 0; i < expected_documents.size(); ++i) {
+        ASSERT(abs(actual_documents[i].relevance - expected_documents[i].relevance) < 1e-9);
+        ASSERT_EQUAL(actual_documents[i].rating, expected_documents[i].rating);
+      }
+    }
+  }
+  for (const int document_id : {0, 9, 12, 1197}) {
+    ASSERT_EQUAL(get<0>(actual.MatchDocument("cat dog fox"s, document_id)),
+                 get<0>(expected.MatchDocument("cat dog fox"s, document_id)));
+  }
+}
+
+void TestIndexFileRoundTrip() {
+  const string path = GetTemporaryPath("search_server_round_trip.idx"s);
+  {
+    SearchServer search_server("and in"s);
+    AddIndexedDocuments(search_server);
+    search_server.SaveIndex(path);
+  }
+  for (const bool verify_checksum : {true, false}) {
+    SearchServer expected("and in"s);
+    AddIndexedDocuments(expected);
+    auto loaded = SearchServer::LoadIndex(path, verify_checksum);
+    CheckSameResults(expected, loaded);
+    // Loaded blocks keep the term frequencies of impact scoring
+    expected.EnableImpactScoring();
+    loaded.EnableImpactScoring();
+    CheckSameResults(expected, loaded);
+    expected.DisableImpactScoring();
+    loaded.DisableImpactScoring();
+
+    // Loaded servers take new documents and removals like the saved one
+    for (auto* server : {&expected, &loaded}) {
+      server->AddDocument(5000, "cat cat dog fox"s, DocumentStatus::ACTUAL, {9});
+      server->RemoveDocument(6);
+    }
+    CheckSameResults(expected, loaded);
+  }
+  filesystem::remove(path);
+}
+
+void CheckRejected(const string& path, const vector<char>& bytes, bool verify_checksum) {
+  WriteFile(path, bytes);
+  ASSERT_THROWS(SearchServer::LoadIndex(path, verify_checksum), runtime_error);
+}
+
+void TestIndexFileRejectsDamagedFiles() {
+  const string path = GetTemporaryPath("search_server_damaged.idx"s);
+  {
+    SearchServer search_server("and in"s);
+    AddIndexedDocuments(search_server);
+    search_server.SaveIndex(path);
+  }
+  const auto bytes = ReadFile(path);
+  ASSERT_DOESNT_THROW(SearchServer::LoadIndex(path));
+
+  for (const bool verify_checksum : {true, false}) {
+    auto damaged = bytes;
+    damaged[0] = 'X';
+    CheckRejected(path, damaged, verify_checksum);
+
+    damaged = bytes;
+    WriteValue<uint32_t>(damaged, VERSION_OFFSET, 99);
+    CheckRejected(path, damaged, verify_checksum);
+
+    damaged = bytes;
+    damaged.resize(bytes.size() - 64);
+    CheckRejected(path, damaged, verify_checksum);
+    damaged.resize(16);
+    CheckRejected(path, damaged, verify_checksum);
+
+    // Sections out of alignment, over the header and past the end
+    const size_t terms_offset =
+        SECTION_OFFSETS_OFFSET + static_cast<size_t>(IndexSection::TERMS) * sizeof(uint64_t);
+    damaged = bytes;
+    WriteValue<uint64_t>(damaged, terms_offset, ReadValue<uint64_t>(bytes, terms_offset) + 4);
+    CheckRejected(path, damaged, verify_checksum);
+    damaged = bytes;
+    WriteValue<uint64_t>(damaged, terms_offset, 0);
+    CheckRejected(path, damaged, verify_checksum);
+    damaged = bytes;
+    WriteValue<uint64_t>(
+        damaged, SECTION_SIZES_OFFSET + static_cast<size_t>(IndexSection::TERMS) * sizeof(uint64_t),
+        bytes.size());
+    CheckRejected(path, damaged, verify_checksum);
+  }
+
+  // A damaged body is caught by the checksum, or by the checks of the sections without it
+  auto damaged = bytes;
+  damaged[damaged.size() - 1] ^= 1;
+  CheckRejected(path, damaged, true);
+
+  // The first posting block points past the posting data
+  damaged = bytes;
+  const uint64_t blocks = GetSectionOffset(bytes, IndexSection::POSTING_BLOCKS);
+  WriteValue<uint32_t>(damaged, blocks + offsetof(PostingList::Block, offset), 1u << 30);
+  CheckRejected(path, damaged, false);
+
+  // Gaps decode to other ids than the block ends with
+  damaged = bytes;
+  damaged[GetSectionOffset(bytes, IndexSection::POSTING_DATA)] ^= 1;
+  CheckRejected(path, damaged, false);
+
+  damaged = bytes;
+  WriteValue<uint32_t>(damaged, GetSectionOffset(bytes, IndexSection::FORWARD_ENTRIES), 1u << 30);
+  CheckRejected(path, damaged, false);
+
+  damaged = bytes;
+  WriteValue<uint64_t>(damaged, GetSectionOffset(bytes, IndexSection::POSITION_OFFSETS) + 8,
+                       1u << 30);
+  CheckRejected(path, damaged, false);
+
+  // The first position record lists more terms than it has room for
+  damaged = bytes;
+  WriteValue<uint32_t>(damaged, GetSectionOffset(bytes, IndexSection::POSITION_DATA), 1u << 20);
+  CheckRejected(path, damaged, false);
+
+  filesystem::remove(path);
+}
+
+// Results of each query with their relevances, rounded so equal sums compare equal
+vector<vector<pair<int, int64_t>>> FindForComparison(const SearchServer& search_server,
+                                                    const vector<string>& queries) {
+  vector<vector<pair<int, int64_t>>> results;
+  for (const string& query : queries) {
+    auto& query_results = results.emplace_back();
+    for (const auto& document : search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, {20})) {
+      query_results.emplace_back(document.id, llround(document.relevance * 1e9));
+    }
+  }
+  return results;
+}
+
+// Queries see the same documents while sealed segments are merged in the background as
+// they see in an index of a single segment, which a loaded file has
+void TestQueriesDuringMerges() {
+  const int segment_size = static_cast<int>(InvertedIndex::SEGMENT_DOCUMENT_COUNT);
+  const int last_id = InvertedIndex::MERGE_FACTOR * segment_size - 1;
+  mt19937 generator;
+  SearchServer search_server("and in"s);
+  const auto add_document = [&generator](SearchServer& server, int id) {
+    server.AddDocument(id, MakeText(generator, uniform_int_distribution(1, 8)(generator)),
+                       DocumentStatus::ACTUAL, {id % 5});
+  };
+  for (int id = 0; id < last_id; ++id) {
+    add_document(search_server, id);
+  }
+  // Half of the documents of the last two sealed segments, removed while they are merged
+  vector<int> removed;
+  for (int id = segment_size * 3 / 2; id < last_id; id += 2) {
+    removed.push_back(id);
+  }
+
+  const string path = GetTemporaryPath("search_server_merges.idx"s);
+  search_server.SaveIndex(path);
+  auto single_segment = SearchServer::LoadIndex(path);
+  filesystem::remove(path);
+  vector<string> queries;
+  for (int i = 0; i < 20; ++i) {
+    queries.push_back(MakeText(generator, 3, 0.2));
+  }
+  // Expected results of every state the index goes through, the generator adds the same
+  // last document to both servers
+  vector<vector<vector<pair<int, int64_t>>>> expected{FindForComparison(single_segment, queries)};
+  const auto last_generator = generator;
+  add_document(single_segment, last_id);
+  expected.push_back(FindForComparison(single_segment, queries));
+  single_segment.RemoveDocuments(removed);
+  expected.push_back(FindForComparison(single_segment, queries));
+  generator = last_generator;
+  ASSERT(expected[1] != expected[2]);
+
+  // A query must see the state it started in or a later one
+  atomic<size_t> state = 0;
+  atomic<bool> is_done = false;
+  atomic<int> mismatch_count = 0;
+  atomic<int> pass_count = 0;
+  vector<thread> threads;
+  for (int t = 0; t < 2; ++t) {
+    threads.emplace_back([&] {
+      while (!is_done) {
+        for (size_t i = 0; i < queries.size(); ++i) {
+          size_t first_state = state;
+          const auto results = FindForComparison(search_server, {queries[i]}).front();
+          while (first_state < expected.size() && results != expected[first_state][i]) {
+            ++first_state;
+          }
+          if (first_state == expected.size()) {
+            ++mismatch_count;
+          }
+        }
+        ++pass_count;
+      }
+    });
+  }
+  const auto wait_passes = [&pass_count] {
+    const int target = pass_count + 2;
+    while (pass_count < target) {
+      this_thread::yield();
+    }
+  };
+  wait_passes();
+  const size_t segment_count = search_server.GetSegmentCount();
+  // Seals the last segment of the tier, so the merge runs along with the queries
+  add_document(search_server, last_id);
+  state = 1;
+  search_server.RemoveDocuments(removed);
+  state = 2;
+  search_server.WaitForMerges();
+  wait_passes();
+  is_done = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQUAL(mismatch_count.load(), 0);
+  ASSERT_EQUAL(segment_count, static_cast<size_t>(InvertedIndex::MERGE_FACTOR - 1));
+  ASSERT_EQUAL(search_server.GetSegmentCount(), 1u);
+  ASSERT(FindForComparison(search_server, queries) == expected.back());
+  ASSERT_EQUAL(search_server.GetDocumentCount(), single_segment.GetDocumentCount());
+}
+
+// Cached results belong to the generation they were found in, so changes are seen at once
+void TestQueryResultCacheGenerations() {
+  SearchServer search_server("and in"s);
+  search_server.AddDocument(0, "black dog"s, DocumentStatus::ACTUAL, {1});
+  search_server.AddDocument(1, "white cat"s, DocumentStatus::ACTUAL, {1});
+  QueryResultCache cache(search_server);
+  ASSERT_EQUAL(GetIds(cache.FindTopDocuments("cat"s)), vector<int>{1});
+  ASSERT_EQUAL(GetIds(cache.FindTopDocuments("cat cat"s)), vector<int>{1});
+  ASSERT_EQUAL(cache.GetStats().hits, 1u);
+
+  const uint64_t generation = search_server.GetGeneration();
+  search_server.AddDocument(2, "cat"s, DocumentStatus::ACTUAL, {1});
+  ASSERT(search_server.GetGeneration() > generation);
+  ASSERT_EQUAL(GetIds(cache.FindTopDocuments("cat"s)), (vector<int>{2, 1}));
+  ASSERT_EQUAL(cache.GetStats().invalidations, 1u);
+
+  // Every writer change lands between the preparation and the search of some lookups.
+  // Whatever they got, later lookups must see the final documents
+  thread writer([&search_server] {
+    for (int id = 3; id < 1000; ++id) {
+      search_server.AddDocument(id, "cat"s, DocumentStatus::ACTUAL, {1});
+      search_server.RemoveDocument(id);
+    }
+  });
+  for (int i = 0; i < 10'000; ++i) {
+    cache.FindTopDocuments("cat"s);
+  }
+  writer.join();
+  ASSERT_EQUAL(GetIds(cache.FindTopDocuments("cat"s)), (vector<int>{2, 1}));
+  ASSERT_EQUAL(GetIds(cache.FindTopDocuments("cat"s)), (vector<int>{2, 1}));
+}
+
+void TestScoreAccumulatorRelease() {
+  ScoreAccumulator accumulator;
+  accumulator.Add(1, 1.0);
+  accumulator.Add(5 * ScoreAccumulator::PAGE_SIZE, 2.0);
+  ASSERT_EQUAL(accumulator.GetPageCount(), 2u);
+  // Cleared pages are kept for reuse, released ones are freed
+  accumulator.Clear();
+  ASSERT_EQUAL(accumulator.GetPageCount(), 2u);
+  accumulator.Add(1, 3.0);
+  accumulator.Release();
+  ASSERT_EQUAL(accumulator.GetPageCount(), 0u);
+  ASSERT_EQUAL(accumulator.size(), 0u);
+  accumulator.Add(2, 4.0);
+  accumulator.Add(2, 1.0);
+  vector<int> document_ids;
+  vector<double> scores;
+  accumulator.ForEach([&](int document_id, double score) {
+    document_ids.push_back(document_id);
+    scores.push_back(score);
+  });
+  ASSERT_EQUAL(document_ids, vector<int>{2});
+  ASSERT_EQUAL(scores, vector<double>{5.0});
+}
+
+// The pool of a thread keeps a bounded number of accumulators and of their pages
+void TestScoreAccumulatorPool() {
+  const auto touch_pages = [](ScoreAccumulator& accumulator, size_t page_count) {
+    for (size_t page = 0; page < page_count; ++page) {
+      accumulator.Add(static_cast<int>(page * ScoreAccumulator::PAGE_SIZE), 1.0);
+    }
+  };
+  {
+    // Pages of earlier queries on this thread would count against the budget
+    vector<PooledScoreAccumulator> accumulators(PooledScoreAccumulator::MAX_POOLED_COUNT);
+    for (auto& accumulator : accumulators) {
+      accumulator->Release();
+    }
+  }
+  {
+    PooledScoreAccumulator accumulator;
+    touch_pages(*accumulator, 2);
+  }
+  {
+    // Pages within the budget are kept, the scores are not
+    PooledScoreAccumulator accumulator;
+    ASSERT_EQUAL(accumulator->GetPageCount(), 2u);
+    ASSERT_EQUAL(accumulator->size(), 0u);
+    touch_pages(*accumulator, PooledScoreAccumulator::MAX_POOLED_PAGE_COUNT + 1);
+  }
+  {
+    PooledScoreAccumulator accumulator;
+    ASSERT_EQUAL(accumulator->GetPageCount(), 0u);
+  }
+
+  const size_t borrowed_count = 2 * PooledScoreAccumulator::MAX_POOLED_COUNT;
+  {
+    vector<PooledScoreAccumulator> accumulators(borrowed_count);
+    for (auto& accumulator : accumulators) {
+      touch_pages(*accumulator, 1);
+    }
+  }
+  vector<PooledScoreAccumulator> accumulators(borrowed_count);
+  size_t pooled_count = 0;
+  for (const auto& accumulator : accumulators) {
+    pooled_count += accumulator->GetPageCount();
+  }
+  ASSERT_EQUAL(pooled_count, PooledScoreAccumulator::MAX_POOLED_COUNT);
+}
+
+// Batches find what single queries find, also with the accumulators of earlier batches
+void TestProcessQueries() {
+  mt19937 generator;
+  SearchServer search_server("and in"s);
+  for (int id = 0; id < 5000; ++id) {
+    search_server.AddDocument(id, MakeText(generator, uniform_int_distribution(1, 10)(generator)),
+                              static_cast<DocumentStatus>(id % 4), {id % 7});
+  }
+  for (int round = 0; round < 2; ++round) {
+    vector<string> queries;
+    for (int i = 0; i < 100; ++i) {
+      queries.push_back(MakeText(generator, uniform_int_distribution(1, 4)(generator), 0.2));
+    }
+    const auto results = ProcessQueries(search_server, queries);
+    ASSERT_EQUAL(results.size(), queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+      const auto expected = search_server.FindTopDocuments(queries[i]);
+      ASSERT_EQUAL(GetIds(results[i]), GetIds(expected));
+      for (size_t j = 0; j < expected.size(); ++j) {
+        ASSERT(abs(results[i][j].relevance - expected[j].relevance) < 1e-9);
+      }
+    }
+  }
+}
+
+// Ids of the matched documents in increasing order, with many results allowed
+vector<int> FindSortedIds(const SearchServer& search_server, const string& query) {
+  auto ids = GetIds(search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, {100}));
+  sort(ids.begin(), ids.end());
+  return ids;
+}
+
+void TestPhraseQueries() {
+  SearchServer search_server("and in the"s);
+  search_server.EnablePhraseQueries();
+  search_server.AddDocument(1, "white cat and black dog"s, DocumentStatus::ACTUAL, {1});
+  search_server.AddDocument(2, "black cat white dog"s, DocumentStatus::ACTUAL, {1});
+  search_server.AddDocument(3, "cat cat dog dog"s, DocumentStatus::ACTUAL, {1});
+  search_server.AddDocument(4, "dog in the cat house"s, DocumentStatus::ACTUAL, {1});
+  search_server.AddDocument(5, "cat black dog"s, DocumentStatus::ACTUAL, {1});
+
+  // Adjacent words in the order of the phrase
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"black dog\""s), (vector<int>{1, 5}));
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"white dog\""s), vector<int>{2});
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"dog black\""s), vector<int>{});
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"white black\""s), vector<int>{});
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"cat\""s), (vector<int>{1, 2, 3, 4, 5}));
+  // Both phrases must be there, words outside of them only add relevance
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"black dog\" \"white cat\""s), vector<int>{1});
+  ASSERT_EQUAL(FindSortedIds(search_server, "house \"black dog\""s), (vector<int>{1, 5}));
+
+  // Repeated words need as many occurrences in a row
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"cat cat\""s), vector<int>{3});
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"cat cat dog dog\""s), vector<int>{3});
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"cat cat cat\""s), vector<int>{});
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"dog dog dog\""s), vector<int>{});
+
+  // Stop words are skipped in the phrase and in the documents alike
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"cat and black\""s), (vector<int>{1, 5}));
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"cat black\""s), (vector<int>{1, 5}));
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"dog cat\""s), vector<int>{4});
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"dog in the cat\""s), vector<int>{4});
+  // A phrase of stop words only restricts nothing
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"in the\" house"s), vector<int>{4});
+
+  // Minus words drop documents with the phrase, they can't be in one
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"black dog\" -white"s), vector<int>{5});
+  ASSERT_EQUAL(FindSortedIds(search_server, "-cat \"black dog\""s), vector<int>{});
+  ASSERT_EQUAL(FindSortedIds(search_server, "\"cat cat\" -house"s), vector<int>{3});
+  ASSERT_THROWS(search_server.FindTopDocuments("\"black -dog\""s), invalid_argument);
+  ASSERT_THROWS(search_server.FindTopDocuments("-\"black dog\""s), invalid_argument);
+
+  // Quotes must pair up at the edges of words
+  ASSERT_THROWS(search_server.FindTopDocuments("\"black dog"s), invalid_argument);
+  ASSERT_THROWS(search_server.FindTopDocuments("black dog\""s), invalid_argument);
+  ASSERT_THROWS(search_server.FindTopDocuments("\"black\" \"dog"s), invalid_argument);
+  ASSERT_THROWS(search_server.FindTopDocuments("bla\"ck dog"s), invalid_argument);
+  ASSERT_THROWS(search_server.PrepareQuery("\"cat"s), invalid_argument);
+  ASSERT_THROWS(search_server.MatchDocument("\"cat"s, 1), invalid_argument);
+
+  // Positions are kept only when asked for before the first document
+  SearchServer no_phrases("and"s);
+  no_phrases.AddDocument(1, "black dog"s, DocumentStatus::ACTUAL, {1});
+  ASSERT_THROWS(no_phrases.FindTopDocuments("\"black dog\""s), invalid_argument);
+  ASSERT_THROWS(no_phrases.EnablePhraseQueries(), logic_error);
+}
+
+void CheckPrefixQueries(const SearchServer& search_server) {
+  for (const string& query : {"*"s, "-*"s, "+*"s, "cat**"s}) {
+    ASSERT_THROWS(search_server.FindTopDocuments(query), invalid_argument);
+  }
+
+  // Prefixes before, after and between the terms of the dictionary
+  ASSERT_EQUAL(FindSortedIds(search_server, "xyz*"s), vector<int>{});
+  ASSERT_EQUAL(FindSortedIds(search_server, "xyz* bird"s), vector<int>{6});
+  ASSERT_EQUAL(FindSortedIds(search_server, "0*"s), vector<int>{});
+  ASSERT_EQUAL(FindSortedIds(search_server, "zz*"s), vector<int>{});
+  ASSERT_EQUAL(FindSortedIds(search_server, "catalogue*"s), vector<int>{});
+  // The first and the last terms
+  ASSERT_EQUAL(FindSortedIds(search_server, "a*"s), (vector<int>{3, 4}));
+  ASSERT_EQUAL(FindSortedIds(search_server, "aardvark*"s), vector<int>{4});
+  ASSERT_EQUAL(FindSortedIds(search_server, "z*"s), (vector<int>{2, 3, 6}));
+  ASSERT_EQUAL(FindSortedIds(search_server, "zeb*"s), (vector<int>{2, 3}));
+  ASSERT_EQUAL(FindSortedIds(search_server, "zebu*"s), vector<int>{3});
+  // Stop words aren't terms, but other words may start with them
+  ASSERT_EQUAL(FindSortedIds(search_server, "and*"s), vector<int>{});
+  ASSERT_EQUAL(FindSortedIds(search_server, "an*"s), vector<int>{3});
+
+  // A whole term also matches the longer terms it starts
+  ASSERT_EQUAL(FindSortedIds(search_server, "ca*"s), (vector<int>{1, 2, 4, 5}));
+  ASSERT_EQUAL(FindSortedIds(search_server, "cat*"s), (vector<int>{1, 2, 5}));
+  ASSERT_EQUAL(FindSortedIds(search_server, "category*"s), vector<int>{2});
+  // Several terms with the prefix count as one word
+  const auto documents = search_server.FindTopDocuments("cat*"s);
+  const auto document = find_if(documents.begin(), documents.end(),
+                                [](const Document& document) { return document.id == 1; });
+  ASSERT(document != documents.end());
+  ASSERT(abs(document->relevance - log(6.0 / 3) * 2 / 3) < 1e-9);
+
+  // With minus and required words and as them
+  ASSERT_EQUAL(FindSortedIds(search_server, "cat* -dog"s), vector<int>{2});
+  ASSERT_EQUAL(FindSortedIds(search_server, "dog -cat*"s), vector<int>{3});
+  ASSERT_EQUAL(FindSortedIds(search_server, "dog -xyz*"s), (vector<int>{1, 3, 5}));
+  ASSERT_EQUAL(FindSortedIds(search_server, "+cat* dog"s), (vector<int>{1, 2, 5}));
+  ASSERT_EQUAL(FindSortedIds(search_server, "+dog cat*"s), (vector<int>{1, 3, 5}));
+  ASSERT_EQUAL(FindSortedIds(search_server, "+dog -cat*"s), vector<int>{3});
+  ASSERT_EQUAL(FindSortedIds(search_server, "+cat* +zebra"s), vector<int>{2});
+  ASSERT_EQUAL(FindSortedIds(search_server, "+xyz* dog"s), vector<int>{});
+
+  // Pruned evaluations leave prefix queries to the exhaustive one
+  for (const auto evaluation : {QueryEvaluation::WAND, QueryEvaluation::BLOCK_MAX_WAND}) {
+    ASSERT_EQUAL(GetIds(search_server.FindTopDocuments("ca* dog"s, DocumentStatus::ACTUAL,
+                                                       {100, evaluation})),
+                 GetIds(search_server.FindTopDocuments("ca* dog"s, DocumentStatus::ACTUAL, {100})));
+  }
+}
+
+// Documents of a query in the given mode, the same for every evaluation
+vector<int> FindSortedIds(const SearchServer& search_server, const string& query,
+                          QueryMatch match) {
+  auto expected = GetIds(search_server.FindTopDocuments(query, DocumentStatus::ACTUAL,
+                                                        {100, QueryEvaluation::EXHAUSTIVE, match}));
+  sort(expected.begin(), expected.end());
+  for (const auto evaluation : {QueryEvaluation::EXHAUSTIVE, QueryEvaluation::WAND,
+                                QueryEvaluation::BLOCK_MAX_WAND}) {
+    const QueryOptions options{100, evaluation, match};
+    for (auto ids : {GetIds(search_server.FindTopDocuments(query, DocumentStatus::ACTUAL,
+                                                            options)),
+                     GetIds(search_server.FindTopDocuments(execution::par, query,
+                                                            DocumentStatus::ACTUAL, options))}) {
+      sort(ids.begin(), ids.end());
+      ASSERT_EQUAL(ids, expected);
+    }
+  }
+  return expected;
+}
+
+void TestRequiredWords() {
+  SearchServer search_server("and in"s);
+  search_server.AddDocument(1, "cat dog bird"s, DocumentStatus::ACTUAL, {1});
+  search_server.AddDocument(2, "cat fish"s, DocumentStatus::ACTUAL, {2});
+  search_server.AddDocument(3, "dog fish bird"s, DocumentStatus::ACTUAL, {3});
+  search_server.AddDocument(4, "cat and dog"s, DocumentStatus::ACTUAL, {4});
+  search_server.AddDocument(5, "bird mouse"s, DocumentStatus::ACTUAL, {5});
+  const auto any_word = [&](const string& query) {
+    return FindSortedIds(search_server, query, QueryMatch::ANY_WORD);
+  };
+  ASSERT_EQUAL(any_word("+cat dog"s), (vector<int>{1, 2, 4}));
+  ASSERT_EQUAL(any_word("+cat +dog"s), (vector<int>{1, 4}));
+  ASSERT_EQUAL(any_word("+zebra cat"s), vector<int>{});
+  // Minus words exclude documents with the required words too
+  ASSERT_EQUAL(any_word("+cat -dog"s), vector<int>{2});
+  ASSERT_EQUAL(any_word("+cat dog -bird"s), (vector<int>{2, 4}));
+  ASSERT_EQUAL(any_word("+dog -dog"s), vector<int>{});
+  // Required stop words are dropped like the other stop words
+  ASSERT_EQUAL(any_word("+and cat"s), (vector<int>{1, 2, 4}));
+  ASSERT_EQUAL(any_word("+and"s), vector<int>{});
+
+  // Documents of every plus word, required or not
+  const auto all_words = [&](const string& query) {
+    return FindSortedIds(search_server, query, QueryMatch::ALL_WORDS);
+  };
+  ASSERT_EQUAL(all_words("cat dog"s), (vector<int>{1, 4}));
+  ASSERT_EQUAL(all_words("+cat bird"s), vector<int>{1});
+  ASSERT_EQUAL(all_words("cat dog -bird"s), vector<int>{4});
+  ASSERT_EQUAL(all_words("cat and dog"s), (vector<int>{1, 4}));
+  // A word no document has leaves nothing to match
+  ASSERT_EQUAL(all_words("cat zebra"s), vector<int>{});
+  ASSERT_EQUAL(all_words("zebra"s), vector<int>{});
+}
+
+// Every document adds its new terms as a run of the dictionary, a loaded index has them in one
+void TestPrefixQueries() {
+  SearchServer search_server("and in"s);
+  int id = 0;
+  for (const string& text : {"cat catalog dog"s, "category zebra"s, "dog zebu ant"s,
+                             "ca aardvark"s, "cattle and dog"s, "ze bird"s}) {
+    search_server.AddDocument(++id, text, DocumentStatus::ACTUAL, {1});
+  }
+  CheckPrefixQueries(search_server);
+
+  const string path = GetTemporaryPath("search_server_prefixes.idx"s);
+  search_server.SaveIndex(path);
+  const auto loaded = SearchServer::LoadIndex(path);
+  filesystem::remove(path);
+  CheckPrefixQueries(loaded);
+}
+
+// Terms get dense ids once, their texts are interned and postings come sorted by document
+void TestTermDictionary() {
+  EpochManager epochs;
+  InvertedIndex index(epochs);
+  string word = "cat"s;
+  const auto cat = index.AddTerm(word);
+  word = "dog"s;
+  const auto dog = index.AddTerm(word);
+  ASSERT_EQUAL(index.AddTerm("cat"sv), cat);
+  ASSERT_EQUAL(dog, cat + 1);
+  // Views of the texts stay valid while the dictionary grows
+  const string_view cat_text = index.GetTerm(cat);
+  for (int i = 0; i < 10'000; ++i) {
+    ASSERT_EQUAL(index.AddTerm("w"s + to_string(i)), dog + 1 + i);
+  }
+  ASSERT_EQUAL(index.GetTermCount(), 10'002u);
+  ASSERT_EQUAL(cat_text, "cat"sv);
+  ASSERT(cat_text.data() == index.GetTerm(cat).data());
+  ASSERT_EQUAL(index.GetTerm(dog), "dog"sv);
+
+  index.AddDocument(0.5, {{dog, 1}, {cat, 1}});
+  index.AddDocument(1.0, {{dog, 1}});
+  index.AddDocument(0.25, {{cat, 3}, {dog, 1}});
+  const auto snapshot = index.GetSnapshot();
+  ASSERT_EQUAL(snapshot.FindTerm("cat"sv), cat);
+  // Terms of no document and unknown words aren't found
+  ASSERT_EQUAL(snapshot.FindTerm("w0"sv), InvertedIndex::NO_TERM);
+  ASSERT_EQUAL(snapshot.FindTerm("cow"sv), InvertedIndex::NO_TERM);
+  ASSERT_EQUAL(snapshot.GetDocumentFreq(cat), 2u);
+  ASSERT_EQUAL(snapshot.GetDocumentFreq(dog), 3u);
+  ASSERT_EQUAL(snapshot.GetWordCount(), 7u);
+  vector<int> document_ids;
+  vector<uint32_t> term_counts;
+  snapshot.ForEachPosting(cat, [&](int document_id, uint32_t term_count) {
+    document_ids.push_back(document_id);
+    term_counts.push_back(term_count);
+  });
+  ASSERT_EQUAL(document_ids, (vector<int>{0, 2}));
+  ASSERT_EQUAL(term_counts, (vector<uint32_t>{1, 3}));
+}
+
+// Word frequencies refer to the interned terms, not to the text given to AddDocument
+void TestWordFrequenciesOutliveText() {
+  SearchServer search_server("and"s);
+  {
+    string text = "cat and dog cat"s;
+    search_server.AddDocument(1, text, DocumentStatus::ACTUAL, {1});
+    text.assign(text.size(), 'x');
+  }
+  const auto& frequencies = search_server.GetWordFrequencies(1);
+  ASSERT_EQUAL(frequencies.size(), 2u);
+  ASSERT(abs(frequencies.at("cat"sv) - 2.0 / 3) < 1e-9);
+  ASSERT(abs(frequencies.at("dog"sv) - 1.0 / 3) < 1e-9);
+  ASSERT(search_server.GetWordFrequencies(2).empty());
+}
+
+void TestTopDocumentsSelection() {
+  const vector<Document> documents = {{1, 0.5, 1}, {2, 0.9, 1}, {3, 0.5, 7}, {4, 0.5 + eps / 2, 7},
+                                      {5, 0.1, 9}, {6, 0.9, 1}};
+  // Relevances within eps tie and go by rating, then by id
+  const vector<int> best_to_worst = {2, 6, 3, 4, 1, 5};
+  for (size_t max_count = 0; max_count <= documents.size() + 2; ++max_count) {
+    TopDocuments top_documents(max_count);
+    for (const auto& document : documents) {
+      top_documents.Add(document);
+    }
+    ASSERT_EQUAL(top_documents.IsFull(), max_count <= documents.size());
+    const size_t count = min(max_count, documents.size());
+    ASSERT_EQUAL(top_documents.size(), count);
+    ASSERT_EQUAL(GetIds(top_documents.Extract()),
+                 vector<int>(best_to_worst.begin(), best_to_worst.begin() + count));
+    ASSERT_EQUAL(top_documents.size(), 0u);
+  }
+
+  // Heaps of chunks merge into the heap of all the documents
+  mt19937 generator;
+  vector<Document> many;
+  for (int id = 0; id < 1000; ++id) {
+    many.push_back({id, uniform_int_distribution(0, 20)(generator) / 10.0,
+                    uniform_int_distribution(0, 3)(generator)});
+  }
+  for (const size_t max_count : {size_t{1}, size_t{5}, size_t{2000}}) {
+    TopDocuments all(max_count);
+    vector<TopDocuments> chunks(7, TopDocuments(max_count));
+    for (size_t i = 0; i < many.size(); ++i) {
+      all.Add(many[i]);
+      chunks[i % chunks.size()].Add(many[i]);
+    }
+    for (size_t i = 1; i < chunks.size(); ++i) {
+      chunks[0].Merge(chunks[i]);
+    }
+    vector<Document> output(max_count);
+    output.resize(chunks[0].ExtractTo(output.data()));
+    const auto expected = all.Extract();
+    ASSERT_EQUAL(GetIds(output), GetIds(expected));
+  }
+}
+
+// Results are cut at the requested count, equal relevances go by rating and then by id
+void TestResultCountAndOrder() {
+  SearchServer search_server("and"s);
+  search_server.AddDocument(5, "cat dog"s, DocumentStatus::ACTUAL, {1});
+  search_server.AddDocument(3, "dog cat"s, DocumentStatus::ACTUAL, {1});
+  search_server.AddDocument(4, "cat dog"s, DocumentStatus::ACTUAL, {2});
+  search_server.AddDocument(1, "fox"s, DocumentStatus::ACTUAL, {9});
+  search_server.AddDocument(2, "cat cat"s, DocumentStatus::ACTUAL, {0});
+  search_server.AddDocument(6, "cat dog"s, DocumentStatus::ACTUAL, {1});
+  search_server.AddDocument(7, "cat dog"s, DocumentStatus::ACTUAL, {1});
+
+  const vector<int> all = {2, 4, 3, 5, 6, 7};
+  for (size_t max_count = 0; max_count <= all.size() + 1; ++max_count) {
+    const vector<int> expected(all.begin(), all.begin() + min(max_count, all.size()));
+    for (const auto evaluation : {QueryEvaluation::EXHAUSTIVE, QueryEvaluation::WAND,
+                                  QueryEvaluation::BLOCK_MAX_WAND}) {
+      ASSERT_EQUAL(GetIds(search_server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL,
+                                                         {max_count, evaluation})),
+                   expected);
+    }
+    ASSERT_EQUAL(GetIds(search_server.FindTopDocuments(execution::par, "cat"s,
+                                                       DocumentStatus::ACTUAL, {max_count})),
+                 expected);
+  }
+  ASSERT_EQUAL(GetIds(search_server.FindTopDocuments("cat"s)), (vector<int>{2, 4, 3, 5, 6}));
+
+  // The heaps of the parallel chunks merge into the sequential result
+  mt19937 generator;
+  SearchServer large("and"s);
+  for (int id = 0; id < 3000; ++id) {
+    large.AddDocument(id, MakeText(generator, uniform_int_distribution(1, 4)(generator)),
+                      DocumentStatus::ACTUAL, {id % 3});
+  }
+  for (const size_t max_count : {size_t{1}, size_t{5}, size_t{100}, size_t{5000}}) {
+    for (const string& query : {"cat"s, "cat dog -fox"s, "wolf bear deer"s}) {
+      ASSERT_EQUAL(GetIds(large.FindTopDocuments(execution::par, query, DocumentStatus::ACTUAL,
+                                                 {max_count})),
+                   GetIds(large.FindTopDocuments(query, DocumentStatus::ACTUAL, {max_count})));
+    }
+  }
+}
+
+// Internal ids are dense in the order of addition, every column reads back what was added
+// and readers of older generations keep seeing the documents of their time
+void TestDocumentTable() {
+  EpochManager epochs;
+  DocumentTable table(epochs);
+  const int document_count = 10000;
+  const auto get_external_id = [](int i) {
+    return i * 7 + 3;
+  };
+  for (int i = 0; i < document_count; ++i) {
+    ASSERT_EQUAL(table.Add(get_external_id(i), i % 11 - 5, static_cast<DocumentStatus>(i % 4),
+                           1.0 / (i + 1)),
+                 i);
+  }
+  ASSERT_EQUAL(table.GetInternalIdLimit(), document_count);
+  ASSERT_EQUAL(table.size(), static_cast<size_t>(document_count));
+  {
+    const auto guard = epochs.Pin();
+    for (int i = 0; i < document_count; ++i) {
+      ASSERT_EQUAL(table.GetExternalId(i), get_external_id(i));
+      ASSERT_EQUAL(table.GetRating(i), i % 11 - 5);
+      ASSERT(table.GetStatus(i) == static_cast<DocumentStatus>(i % 4));
+      ASSERT_EQUAL(table.GetInvWordCount(i), 1.0 / (i + 1));
+      ASSERT_EQUAL(table.FindInternalId(get_external_id(i)), i);
+      ASSERT_EQUAL(table.FindInternalId(get_external_id(i), 0, document_count), i);
+      // Documents past the limit of a reader are not seen
+      ASSERT_EQUAL(table.FindInternalId(get_external_id(i), 0, i), DocumentTable::NO_DOCUMENT);
+      ASSERT(!table.IsRemoved(i, UINT64_MAX - 1));
+    }
+    ASSERT_EQUAL(table.FindInternalId(1), DocumentTable::NO_DOCUMENT);
+    ASSERT_EQUAL(table.FindInternalId(-1, 0, document_count), DocumentTable::NO_DOCUMENT);
+  }
+
+  const int removed_id = 5;
+  const DocumentStatus removed_status = static_cast<DocumentStatus>(removed_id % 4);
+  table.Remove(removed_id, 10);
+  ASSERT_EQUAL(table.size(), static_cast<size_t>(document_count - 1));
+  ASSERT(!table.IsRemoved(removed_id, 9));
+  ASSERT(table.IsRemoved(removed_id, 10));
+  ASSERT(table.IsRemoved(removed_id, 11));
+  ASSERT(table.HasStatus(removed_id, removed_status, 9));
+  ASSERT(!table.HasStatus(removed_id, removed_status, 10));
+  ASSERT(!table.HasStatus(removed_id + 1, removed_status, 9));
+  ASSERT_EQUAL(table.FindInternalId(get_external_id(removed_id)), DocumentTable::NO_DOCUMENT);
+
+  // A re-added document gets a new internal id, readers of older generations and limits
+  // still find the old one while it was live
+  ASSERT_EQUAL(table.Add(get_external_id(removed_id), 42, DocumentStatus::ACTUAL, 0.5),
+               document_count);
+  ASSERT_EQUAL(table.size(), static_cast<size_t>(document_count));
+  ASSERT_EQUAL(table.GetInternalIdLimit(), document_count + 1);
+  const auto guard = epochs.Pin();
+  ASSERT_EQUAL(table.FindInternalId(get_external_id(removed_id)), document_count);
+  ASSERT_EQUAL(table.FindInternalId(get_external_id(removed_id), 9, document_count), removed_id);
+  ASSERT_EQUAL(table.FindInternalId(get_external_id(removed_id), 11, document_count),
+               DocumentTable::NO_DOCUMENT);
+  ASSERT_EQUAL(table.FindInternalId(get_external_id(removed_id), 11, document_count + 1),
+               document_count);
+  ASSERT_EQUAL(table.GetExternalId(document_count), get_external_id(removed_id));
+  ASSERT_EQUAL(table.GetRating(document_count), 42);
+  ASSERT(table.HasStatus(document_count, DocumentStatus::ACTUAL, 11));
+}
+
+// Every document of a batch gets its own status, the valid ones are indexed as
+// AddDocument would index them and the others leave no trace
+void TestAddDocumentsErrors() {
+  SearchServer search_server("and"s);
+  search_server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, {1});
+  const vector<DocumentToAdd> documents = {
+      {2, "white cat"sv, DocumentStatus::ACTUAL, {1}},
+      {1, "dup"sv, DocumentStatus::ACTUAL, {1}},
+      {-3, "negative"sv, DocumentStatus::ACTUAL, {1}},
+      {4, "bad wo\x01rd"sv, DocumentStatus::ACTUAL, {1}},
+      {2, "again"sv, DocumentStatus::ACTUAL, {1}},
+      {5, "black and dog"sv, DocumentStatus::BANNED, {2, 4}},
+  };
+  const vector<AddDocumentResult> expected = {
+      AddDocumentResult::ADDED,       AddDocumentResult::DUPLICATE_ID,
+      AddDocumentResult::INVALID_ID,  AddDocumentResult::INVALID_WORD,
+      AddDocumentResult::DUPLICATE_ID, AddDocumentResult::ADDED,
+  };
+  ASSERT(search_server.AddDocuments(documents) == expected);
+  ASSERT_EQUAL(search_server.GetDocumentCount(), 3);
+  ASSERT_EQUAL(vector<int>(search_server.begin(), search_server.end()), (vector<int>{1, 2, 5}));
+  ASSERT_EQUAL(FindSortedIds(search_server, "cat dup negative bad again black"s),
+               (vector<int>{1, 2}));
+  ASSERT(FindSortedIds(search_server, "dup negative bad wo again"s).empty());
+  const auto banned = search_server.FindTopDocuments("dog"s, DocumentStatus::BANNED);
+  ASSERT_EQUAL(GetIds(banned), vector<int>{5});
+  ASSERT_EQUAL(banned[0].rating, 3);
+  ASSERT_EQUAL(search_server.GetWordFrequencies(1).count("dup"sv), 0u);
+
+  // Errors spread over a batch which is tokenized in several chunks
+  SearchServer batch_server("and"s);
+  SearchServer single_server("and"s);
+  vector<string> texts;
+  vector<DocumentToAdd> batch;
+  vector<AddDocumentResult> batch_expected;
+  for (int i = 0; i < 200; ++i) {
+    texts.push_back(i % 13 == 6 ? "cat d\x02og"s : "cat "s + to_string(i % 17));
+  }
+  for (int i = 0; i < 200; ++i) {
+    const int document_id = i % 7 == 3 ? -i : i % 11 == 5 ? 0 : i;
+    batch.push_back({document_id, texts[i], DocumentStatus::ACTUAL, {i}});
+    if (document_id < 0) {
+      batch_expected.push_back(AddDocumentResult::INVALID_ID);
+    } else if (document_id != i) {
+      batch_expected.push_back(AddDocumentResult::DUPLICATE_ID);
+    } else if (i % 13 == 6) {
+      batch_expected.push_back(AddDocumentResult::INVALID_WORD);
+    } else {
+      batch_expected.push_back(AddDocumentResult::ADDED);
+      single_server.AddDocument(i, texts[i], DocumentStatus::ACTUAL, {i});
+    }
+  }
+  ASSERT(batch_server.AddDocuments(batch) == batch_expected);
+  ASSERT_EQUAL(vector<int>(batch_server.begin(), batch_server.end()),
+               vector<int>(single_server.begin(), single_server.end()));
+  for (const string& query : {"cat"s, "3 -cat"s, "5 12 16"s, "dog"s}) {
+    const auto expected_documents =
+        single_server.FindTopDocuments(query, DocumentStatus::ACTUAL, {50});
+    const auto actual_documents =
+        batch_server.FindTopDocuments(query, DocumentStatus::ACTUAL, {50});
+    ASSERT_EQUAL(GetIds(actual_documents), GetIds(expected_documents));
+    for (size_t i = 0; i < expected_documents.size(); ++i) {
+      ASSERT(abs(actual_documents[i].relevance - expected_documents[i].relevance) < 1e-9);
+      ASSERT_EQUAL(actual_documents[i].rating, expected_documents[i].rating);
+    }
+  }
+}
+
+// Removed documents leave the results at once and the statistics of the other documents
+// are those of a server which never had them
+void TestRemoveDocuments() {
+  SearchServer search_server("and"s);
+  SearchServer expected_server("and"s);
+  const vector<pair<int, string>> documents = {
+      {1, "cat and dog"s}, {2, "cat bird"s}, {3, "cat fish fish"s}, {4, "dog"s}, {5, "bird dog"s}};
+  for (const auto& [id, text] : documents) {
+    search_server.AddDocument(id, text, DocumentStatus::ACTUAL, {id});
+    if (id != 2 && id != 3) {
+      expected_server.AddDocument(id, text, DocumentStatus::ACTUAL, {id});
+    }
+  }
+  // Unknown ids are ignored
+  search_server.RemoveDocuments({2, 3, 42});
+  ASSERT_EQUAL(search_server.GetDocumentCount(), 3);
+  ASSERT_EQUAL(vector<int>(search_server.begin(), search_server.end()), (vector<int>{1, 4, 5}));
+  ASSERT(search_server.GetWordFrequencies(2).empty());
+  ASSERT(FindSortedIds(search_server, "fish"s).empty());
+  ASSERT(FindSortedIds(search_server, "fi*"s).empty());
+  ASSERT_EQUAL(FindSortedIds(search_server, "cat bird fish"s), (vector<int>{1, 5}));
+  for (const string& query : {"cat"s, "bird dog"s, "cat -dog"s, "bi* ca*"s}) {
+    for (const auto evaluation : {QueryEvaluation::EXHAUSTIVE, QueryEvaluation::WAND}) {
+      const auto actual_documents =
+          search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, {10, evaluation});
+      const auto expected_documents =
+          expected_server.FindTopDocuments(query, DocumentStatus::ACTUAL, {10, evaluation});
+      ASSERT_EQUAL(GetIds(actual_documents), GetIds(expected_documents));
+      for (size_t i = 0; i < expected_documents.size(); ++i) {
+        ASSERT(abs(actual_documents[i].relevance - expected_documents[i].relevance) < 1e-9);
+      }
+    }
+  }
+  // cat is now in one document of three
+  const auto cat_documents = search_server.FindTopDocuments("cat"s);
+  ASSERT_EQUAL(GetIds(cat_documents), vector<int>{1});
+  ASSERT(abs(cat_documents[0].relevance - log(3.0) / 2) < 1e-9);
+}
+
+// Merges drop the postings of removed documents from the segments they rewrite, and the
+// posting lists of terms left without documents
+void TestRemovedPostingsCompaction() {
+  const int segment_size = static_cast<int>(InvertedIndex::SEGMENT_DOCUMENT_COUNT);
+  EpochManager epochs;
+  InvertedIndex index(epochs);
+  const auto common = index.AddTerm("common"sv);
+  const auto stale = index.AddTerm("stale"sv);
+  vector<vector<InvertedIndex::TermEntry>> entries;
+  for (int id = 0; id < 2 * segment_size; ++id) {
+    entries.push_back({{common, 1}});
+    if (id < segment_size && id % 4 == 2) {
+      entries.back().push_back({stale, 2});
+    }
+    index.AddDocument(1.0 / entries.back().size(), entries.back());
+  }
+  ASSERT_EQUAL(index.GetSegmentCount(), 2u);
+  // Most documents of the first segment and a few of the second one
+  vector<InvertedIndex::RemovedDocument> removed;
+  for (int id = 0; id < 2 * segment_size; ++id) {
+    if (id < segment_size ? id % 4 != 0 : id % 4 == 1) {
+      removed.push_back({id, {entries[id].data(), entries[id].data() + entries[id].size()}});
+    }
+  }
+  const size_t memory_usage = index.GetPostingsMemoryUsage();
+  index.RemoveDocuments(removed);
+  {
+    const auto snapshot = index.GetSnapshot();
+    ASSERT_EQUAL(snapshot.GetDocumentCount(), 2u * segment_size - removed.size());
+    ASSERT_EQUAL(snapshot.GetDocumentFreq(common), 2u * segment_size - removed.size());
+    ASSERT_EQUAL(snapshot.FindTerm("stale"sv), InvertedIndex::NO_TERM);
+  }
+
+  index.WaitForMerges();
+  ASSERT(index.GetPostingsMemoryUsage() < memory_usage);
+  const auto snapshot = index.GetSnapshot();
+  vector<int> expected_ids;
+  for (int id = 0; id < 2 * segment_size; ++id) {
+    // The second segment has too few removed documents to be rewritten
+    if (id % 4 == 0 || id >= segment_size) {
+      expected_ids.push_back(id);
+    }
+  }
+  vector<int> document_ids;
+  snapshot.ForEachPosting(common, [&](int document_id, uint32_t) {
+    document_ids.push_back(document_id);
+  });
+  ASSERT_EQUAL(document_ids, expected_ids);
+  for (const auto& segment : snapshot.GetSegments()) {
+    ASSERT(segment->FindPostings(stale) == nullptr);
+  }
+}
+
+// Every tokenizer kernel splits like the scalar one, which splits like SplitIntoWords
+void TestTokenizerKernelEquivalence() {
+  mt19937 generator;
+  vector<string> texts = {""s, " "s, "a"s, "    "s, "  cat   dog  "s, string(100, ' ')};
+  // Control bytes at and around the 16- and 32-byte chunk boundaries, with texts ending
+  // in tails shorter than a vector
+  for (const size_t length : {15u, 16u, 17u, 31u, 32u, 33u, 47u, 64u, 65u, 70u}) {
+    string text;
+    for (size_t i = 0; i < length; ++i) {
+      text.push_back(i % 5 == 4 ? ' ' : static_cast<char>('a' + i % 26));
+    }
+    texts.push_back(text);
+    for (const size_t position : {0u, 14u, 15u, 16u, 17u, 30u, 31u, 32u, 33u, 63u, 64u}) {
+      if (position < length) {
+        texts.push_back(text);
+        texts.back()[position] = position % 2 == 0 ? '\x01' : '\x1f';
+      }
+    }
+  }
+  // Random texts with runs of spaces, bytes above 127 and rare control bytes
+  const string alphabet = "ab  \xc3\xa9-"s;
+  for (int i = 0; i < 2000; ++i) {
+    string text;
+    const int length = uniform_int_distribution(0, 100)(generator);
+    for (int j = 0; j < length; ++j) {
+      text.push_back(uniform_int_distribution(0, 200)(generator) == 0
+                         ? '\t'
+                         : alphabet[uniform_int_distribution<size_t>(0, alphabet.size() - 1)(
+                               generator)]);
+    }
+    texts.push_back(text);
+  }
+
+  const auto is_special = [](char c) {
+    return static_cast<unsigned char>(c) < ' ';
+  };
+  const auto kernels = GetSupportedTokenizerKernelNames();
+  vector<string_view> expected;
+  vector<string_view> words;
+  for (const string& text : texts) {
+    SelectTokenizerKernel("scalar"sv);
+    const bool is_valid = SplitIntoValidWords(text, expected);
+    ASSERT_EQUAL(is_valid, none_of(text.begin(), text.end(), is_special));
+    if (is_valid) {
+      ASSERT_EQUAL(expected, SplitIntoWords(text));
+    } else {
+      ASSERT(any_of(expected.back().begin(), expected.back().end(), is_special));
+    }
+    for (const auto kernel : kernels) {
+      SelectTokenizerKernel(kernel);
+      ASSERT_EQUAL(SplitIntoValidWords(text, words), is_valid);
+      ASSERT_EQUAL(words, expected);
+    }
+  }
+  SelectTokenizerKernel(kernels.front());
+}
+
+// The perfect hash finds exactly the words it was built from, also when they share the
+// first-level buckets and when tokens pass the length and first byte checks
+void TestStopWordFilter() {
+  using WordSet = set<string, less<>>;
+  const StopWordFilter empty_filter(WordSet{});
+  ASSERT(empty_filter.empty());
+  ASSERT(!empty_filter.Contains(""sv));
+  ASSERT(!empty_filter.Contains("and"sv));
+  // Empty words are not stop words
+  ASSERT(StopWordFilter(WordSet{""s}).empty());
+
+  const StopWordFilter single_filter(WordSet{"and"s});
+  ASSERT(!single_filter.empty());
+  ASSERT(single_filter.Contains("and"sv));
+  for (const string_view word : {""sv, "an"sv, "ana"sv, "andd"sv, "And"sv, "bnd"sv}) {
+    ASSERT(!single_filter.Contains(word));
+  }
+
+  // Up to four words share the only bucket, tokens of the same lengths and first bytes
+  // get to the table
+  const WordSet bucket_words = {"cat"s, "cab"s, "car"s, "cow"s};
+  const StopWordFilter bucket_filter(bucket_words);
+  for (const string& word : bucket_words) {
+    ASSERT(bucket_filter.Contains(word));
+  }
+  for (const string_view word : {"cad"sv, "caw"sv, "cot"sv, "ca"sv, "cats"sv, "c"sv}) {
+    ASSERT(!bucket_filter.Contains(word));
+  }
+
+  // Lengths from 63 on share one bit
+  const StopWordFilter long_filter(WordSet{string(70, 'a')});
+  ASSERT(long_filter.Contains(string(70, 'a')));
+  ASSERT(!long_filter.Contains(string(63, 'a')));
+  ASSERT(!long_filter.Contains(string(71, 'a')));
+
+  // Many buckets, each word against its own variants
+  mt19937 generator;
+  WordSet words;
+  while (words.size() < 5000) {
+    string word;
+    const int length = uniform_int_distribution(1, 8)(generator);
+    for (int i = 0; i < length; ++i) {
+      word.push_back(uniform_int_distribution('a', 'f')(generator));
+    }
+    words.insert(word);
+  }
+  const StopWordFilter filter(words);
+  for (const string& word : words) {
+    ASSERT(filter.Contains(word));
+    string other = word;
+    for (const char c : {'a', 'g'}) {
+      other.back() = c;
+      ASSERT_EQUAL(filter.Contains(other), words.count(other) > 0);
+      ASSERT_EQUAL(filter.Contains(other + c), words.count(other + c) > 0);
+    }
+  }
+}
+
+// A query prepared once finds what its text finds, also after documents are added and
+// removed: words are resolved again in the current index
+void TestPreparedQueryReuse() {
+  mt19937 generator;
+  SearchServer search_server("and in"s);
+  search_server.EnablePhraseQueries();
+  for (int id = 0; id < 300; ++id) {
+    search_server.AddDocument(id, MakeText(generator, uniform_int_distribution(1, 10)(generator)),
+                              DocumentStatus::ACTUAL, {id % 7});
+  }
+  const vector<string> texts = {"cat dog -fox"s,      "zebra cat"s, "\"cat dog\" bird"s,
+                                "+zebra -wolf mouse"s, "ze* co*"s,   "cat cat and"s};
+  vector<PreparedQuery> queries;
+  for (const string& text : texts) {
+    queries.push_back(search_server.PrepareQuery(text));
+  }
+  // Storage of another query is reused
+  PreparedQuery reused = search_server.PrepareQuery("wolf bear deer frog"s);
+  search_server.PrepareQuery(texts[0], reused);
+
+  const auto check_queries = [&] {
+    for (size_t i = 0; i < texts.size(); ++i) {
+      for (const auto evaluation : {QueryEvaluation::EXHAUSTIVE, QueryEvaluation::WAND}) {
+        const QueryOptions options{20, evaluation};
+        const auto expected =
+            search_server.FindTopDocuments(texts[i], DocumentStatus::ACTUAL, options);
+        const auto actual =
+            search_server.FindTopDocuments(queries[i], DocumentStatus::ACTUAL, options);
+        ASSERT_EQUAL(GetIds(actual), GetIds(expected));
+        for (size_t j = 0; j < expected.size(); ++j) {
+          ASSERT(abs(actual[j].relevance - expected[j].relevance) < 1e-9);
+        }
+      }
+    }
+    ASSERT_EQUAL(GetIds(search_server.FindTopDocuments(reused)),
+                 GetIds(search_server.FindTopDocuments(texts[0])));
+  };
+  check_queries();
+  // zebra is unknown when the queries are prepared
+  for (int id = 300; id < 320; ++id) {
+    search_server.AddDocument(id, "zebra "s + MakeText(generator, 3), DocumentStatus::ACTUAL,
+                              {1});
+  }
+  ASSERT(!search_server.FindTopDocuments(queries[1]).empty());
+  check_queries();
+  vector<int> removed;
+  for (int id = 0; id < 320; id += 3) {
+    removed.push_back(id);
+  }
+  search_server.RemoveDocuments(removed);
+  check_queries();
+}
+
+// A SmallVector keeps its elements inline up to N, then on the heap, where they stay when
+// it is cleared, copied or moved
+void TestSmallVectorSpill() {
+  SmallVector<int, 4> values;
+  const auto is_inline = [](const SmallVector<int, 4>& vector) {
+    const auto* object = reinterpret_cast<const char*>(&vector);
+    const auto* data = reinterpret_cast<const char*>(vector.data());
+    return data >= object && data < object + sizeof(vector);
+  };
+  for (int i = 0; i < 4; ++i) {
+    values.push_back(i);
+  }
+  ASSERT(is_inline(values));
+  values.push_back(4);
+  ASSERT(!is_inline(values));
+  ASSERT_EQUAL(vector<int>(values.begin(), values.end()), (vector<int>{0, 1, 2, 3, 4}));
+
+  const int* heap_data = values.data();
+  values.clear();
+  ASSERT(values.empty());
+  values.push_back(7);
+  ASSERT(values.data() == heap_data);
+  ASSERT_EQUAL(vector<int>(values.begin(), values.end()), vector<int>{7});
+
+  values.resize(10);
+  ASSERT_EQUAL(values.size(), 10u);
+  ASSERT_EQUAL(values[0], 7);
+  ASSERT_EQUAL(values[9], 0);
+  const SmallVector<int, 4> copy = values;
+  ASSERT(!is_inline(copy));
+  ASSERT_EQUAL(vector<int>(copy.begin(), copy.end()), vector<int>(values.begin(), values.end()));
+
+  SmallVector<int, 4> moved = move(values);
+  ASSERT_EQUAL(moved.size(), 10u);
+  ASSERT_EQUAL(moved[0], 7);
+  ASSERT(values.empty());
+  values.push_back(1);
+  ASSERT(is_inline(values));
+  ASSERT_EQUAL(values[0], 1);
+
+  SmallVector<int, 4> small;
+  small.resize(3);
+  small[2] = 5;
+  SmallVector<int, 4> small_copy = small;
+  ASSERT(is_inline(small_copy));
+  ASSERT_EQUAL(vector<int>(small_copy.begin(), small_copy.end()), (vector<int>{0, 0, 5}));
+}
+
+// Every iteration runs exactly once, also for loops run from several threads at once and
+// for loops run by the tasks of other loops
+void TestWorkStealingPool() {
+  WorkStealingPool pool(4);
+  for (const size_t count : {0u, 1u, 3u, 1000u}) {
+    vector<atomic<int>> calls(count);
+    // Uneven iterations make the threads steal
+    pool.ParallelFor(count, [&calls](size_t i) {
+      if (i % 7 == 0) {
+        this_thread::sleep_for(chrono::microseconds(50));
+      }
+      ++calls[i];
+    });
+    ASSERT(all_of(calls.begin(), calls.end(), [](const atomic<int>& c) { return c == 1; }));
+  }
+
+  const size_t outer_count = 16;
+  const size_t inner_count = 200;
+  vector<atomic<int>> nested_calls(outer_count * inner_count);
+  pool.ParallelFor(outer_count, [&](size_t i) {
+    pool.ParallelFor(inner_count, [&](size_t j) { ++nested_calls[i * inner_count + j]; });
+  });
+  ASSERT(all_of(nested_calls.begin(), nested_calls.end(),
+                [](const atomic<int>& c) { return c == 1; }));
+
+  const size_t thread_count = 4;
+  const size_t loop_count = 20'000;
+  vector<atomic<int>> concurrent_calls(thread_count * loop_count);
+  vector<thread> threads;
+  for (size_t t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&, t] {
+      for (int round = 0; round < 5; ++round) {
+        pool.ParallelFor(loop_count / 5, [&](size_t i) {
+          ++concurrent_calls[t * loop_count + round * (loop_count / 5) + i];
+        });
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT(all_of(concurrent_calls.begin(), concurrent_calls.end(),
+                [](const atomic<int>& c) { return c == 1; }));
+
+  // The first error comes out of the loop and the pool keeps working
+  ASSERT_THROWS(pool.ParallelFor(100,
+                                 [](size_t i) {
+                                   if (i == 42) {
+                                     throw runtime_error("task"s);
+                                   }
+                                 }),
+                runtime_error);
+  atomic<size_t> sum = 0;
+  pool.ParallelFor(100, [&sum](size_t i) { sum += i; });
+  ASSERT_EQUAL(sum.load(), 4950u);
+}
+
+// Batches run from several threads at once find what single queries find, and the joined
+// results follow the order of the queries
+void TestProcessQueriesConcurrently() {
+  mt19937 generator;
+  SearchServer search_server("and in"s);
+  for (int id = 0; id < 2000; ++id) {
+    search_server.AddDocument(id, MakeText(generator, uniform_int_distribution(1, 10)(generator)),
+                              DocumentStatus::ACTUAL, {id % 7});
+  }
+  vector<string> queries;
+  for (int i = 0; i < 200; ++i) {
+    queries.push_back(MakeText(generator, uniform_int_distribution(1, 4)(generator), 0.2));
+  }
+  vector<vector<int>> expected;
+  for (const string& query : queries) {
+    expected.push_back(GetIds(search_server.FindTopDocuments(query)));
+  }
+
+  atomic<int> mismatch_count = 0;
+  vector<thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      for (int round = 0; round < 5; ++round) {
+        const auto results = ProcessQueries(search_server, queries);
+        for (size_t i = 0; i < queries.size(); ++i) {
+          mismatch_count += GetIds(results[i]) != expected[i];
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQUAL(mismatch_count.load(), 0);
+
+  const auto joined = ProcessQueriesJoined(search_server, queries);
+  ASSERT_EQUAL(joined.GetQueryCount(), queries.size());
+  vector<int> all_expected;
+  for (size_t i = 0; i < queries.size(); ++i) {
+    const auto query_results = joined.GetQueryResults(i);
+    ASSERT_EQUAL(GetIds({query_results.begin(), query_results.end()}), expected[i]);
+    all_expected.insert(all_expected.end(), expected[i].begin(), expected[i].end());
+  }
+  ASSERT_EQUAL(GetIds({joined.begin(), joined.end()}), all_expected);
+}
+
+// Every query of a batch finds what it finds alone with its status, options and scorer:
+// shared posting reads, conjunctive, prefix and pruned queries alike
+template <typename Scorer>
+void CheckBatchQueries(const SearchServer& search_server, mt19937& generator) {
+  const vector<DocumentStatus> statuses = {DocumentStatus::ACTUAL, DocumentStatus::BANNED};
+  const vector<QueryEvaluation> evaluations = {
+      QueryEvaluation::EXHAUSTIVE, QueryEvaluation::WAND, QueryEvaluation::BLOCK_MAX_WAND};
+  vector<PreparedQuery> queries;
+  vector<BatchQuery> batch;
+  for (int i = 0; i < 200; ++i) {
+    string text = MakeText(generator, uniform_int_distribution(1, 5)(generator), 0.2);
+    if (i % 7 == 0) {
+      text = MakePrefixes(generator, text, 0.3);
+    } else if (i % 5 == 0 && text[0] != '-') {
+      text = "+"s + text;
+    }
+    queries.push_back(search_server.PrepareQuery(text));
+    BatchQuery query;
+    query.status = statuses[i % 3 == 0 ? 1 : 0];
+    query.options.max_result_count = vector<size_t>{1, 5, 20}[i % 3];
+    query.options.match = i % 4 == 0 ? QueryMatch::ALL_WORDS : QueryMatch::ANY_WORD;
+    query.options.evaluation = i % 2 == 0 ? QueryEvaluation::EXHAUSTIVE : evaluations[i % 3];
+    batch.push_back(query);
+  }
+  vector<Document> results(batch.size() * 20);
+  for (size_t i = 0; i < batch.size(); ++i) {
+    batch[i].query = &queries[i];
+    batch[i].results = results.data() + i * 20;
+  }
+  search_server.FindTopDocumentsBatch<Scorer>(batch);
+  for (size_t i = 0; i < batch.size(); ++i) {
+    const auto expected =
+        search_server.FindTopDocuments<Scorer>(queries[i], batch[i].status, batch[i].options);
+    const vector<Document> actual(batch[i].results, batch[i].results + batch[i].result_count);
+    ASSERT_EQUAL(GetIds(actual), GetIds(expected));
+    for (size_t j = 0; j < expected.size(); ++j) {
+      ASSERT(abs(actual[j].relevance - expected[j].relevance) < 1e-9);
+    }
+  }
+}
+
+void TestFindTopDocumentsBatch() {
+  mt19937 generator;
+  SearchServer search_server("and in"s);
+  for (int id = 0; id < 3000; ++id) {
+    search_server.AddDocument(id, MakeText(generator, uniform_int_distribution(1, 10)(generator)),
+                              id % 4 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL,
+                              {id % 7});
+  }
+  CheckBatchQueries<TfIdfScorer>(search_server, generator);
+  CheckBatchQueries<Bm25Scorer>(search_server, generator);
+
+  // Impact scoring of sealed and mutable documents
+  search_server.EnableImpactScoring();
+  for (int id = 3000; id < 3100; ++id) {
+    search_server.AddDocument(id, MakeText(generator, uniform_int_distribution(1, 10)(generator)),
+                              DocumentStatus::ACTUAL, {id % 7});
+  }
+  CheckBatchQueries<TfIdfScorer>(search_server, generator);
+}
+
+// With impact scoring on, every evaluation finds the documents and relevances exhaustive
+// evaluation does, and the relevances overestimate the exact ones by less than 2^-7
+template <typename Scorer>
+void CheckImpactScoring(SearchServer& search_server, mt19937& generator) {
+  const auto by_id = [](const Document& lhs, const Document& rhs) { return lhs.id < rhs.id; };
+  for (int i = 0; i < 60; ++i) {
+    const string query = MakeText(generator, uniform_int_distribution(1, 6)(generator), 0.2);
+    search_server.DisableImpactScoring();
+    auto exact = search_server.FindTopDocuments<Scorer>(query, DocumentStatus::ACTUAL, {20000});
+    search_server.EnableImpactScoring();
+    auto impact = search_server.FindTopDocuments<Scorer>(query, DocumentStatus::ACTUAL, {20000});
+    sort(exact.begin(), exact.end(), by_id);
+    sort(impact.begin(), impact.end(), by_id);
+    ASSERT_EQUAL(GetIds(impact), GetIds(exact));
+    for (size_t j = 0; j < exact.size(); ++j) {
+      ASSERT(impact[j].relevance >= exact[j].relevance - 1e-12);
+      ASSERT(impact[j].relevance <= exact[j].relevance + abs(exact[j].relevance) / 128 + 1e-12);
+    }
+
+    for (const size_t max_count : {size_t{1}, size_t{5}, size_t{50}}) {
+      const auto expected = search_server.FindTopDocuments<Scorer>(
+          query, DocumentStatus::ACTUAL, {max_count, QueryEvaluation::EXHAUSTIVE});
+      vector<vector<Document>> results;
+      results.push_back(search_server.FindTopDocuments<Scorer>(
+          execution::par, query, DocumentStatus::ACTUAL, {max_count, QueryEvaluation::EXHAUSTIVE}));
+      for (const auto evaluation : {QueryEvaluation::WAND, QueryEvaluation::BLOCK_MAX_WAND}) {
+        results.push_back(search_server.FindTopDocuments<Scorer>(query, DocumentStatus::ACTUAL,
+                                                                 {max_count, evaluation}));
+      }
+      for (const auto& actual : results) {
+        ASSERT_EQUAL(GetIds(actual), GetIds(expected));
+        for (size_t j = 0; j < expected.size(); ++j) {
+          ASSERT(abs(actual[j].relevance - expected[j].relevance) < 1e-9);
+        }
+      }
+    }
+  }
+  CheckBatchQueries<Scorer>(search_server, generator);
+}
+
+void TestImpactScoring() {
+  mt19937 generator;
+  SearchServer search_server("and in"s);
+  // Sealed segments, removals from them and documents still in the mutable segment
+  for (int id = 0; id < 9000; ++id) {
+    search_server.AddDocument(id, MakeText(generator, uniform_int_distribution(1, 30)(generator)),
+                              DocumentStatus::ACTUAL, {id % 7});
+  }
+  for (int id = 0; id < 9000; id += 13) {
+    search_server.RemoveDocument(id);
+  }
+  CheckImpactScoring<TfIdfScorer>(search_server, generator);
+  CheckImpactScoring<Bm25Scorer>(search_server, generator);
+  search_server.DisableImpactScoring();
+}
+
+size_t SumBucketRequests(const RequestStats& stats) {
+  size_t count = 0;
+  for (const auto& bucket : stats.latency_buckets) {
+    count += bucket.request_count;
+  }
+  return count;
+}
+
+// Requests of many threads are all counted while the window holds them, and once it's
+// full every slot counts exactly once
+void TestRequestQueueProducers() {
+  SearchServer search_server("and in"s);
+  search_server.AddDocument(1, "white cat"s, DocumentStatus::ACTUAL, {1});
+  constexpr int THREAD_COUNT = 4;
+  constexpr int REQUEST_COUNT = 2000;
+  const auto add_requests = [](RequestQueue& request_queue) {
+    vector<thread> threads;
+    for (int t = 0; t < THREAD_COUNT; ++t) {
+      threads.emplace_back([&request_queue, t] {
+        for (int i = 0; i < REQUEST_COUNT; ++i) {
+          // Every third request of a thread finds nothing
+          request_queue.AddFindRequest(i % 3 == t % 3 ? "dog"s : "cat"s);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  };
+
+  RequestQueue whole_queue(search_server, {THREAD_COUNT * REQUEST_COUNT});
+  add_requests(whole_queue);
+  const auto whole_stats = whole_queue.GetStats();
+  ASSERT_EQUAL(whole_stats.request_count, size_t{THREAD_COUNT * REQUEST_COUNT});
+  ASSERT_EQUAL(SumBucketRequests(whole_stats), whole_stats.request_count);
+  size_t no_result_count = 0;
+  for (int t = 0; t < THREAD_COUNT; ++t) {
+    for (int i = 0; i < REQUEST_COUNT; ++i) {
+      no_result_count += i % 3 == t % 3 ? 1 : 0;
+    }
+  }
+  ASSERT_EQUAL(whole_stats.no_result_count, no_result_count);
+  ASSERT_EQUAL(whole_queue.GetNoResultRequests(), static_cast<int>(no_result_count));
+
+  RequestQueue window_queue(search_server, {1000});
+  add_requests(window_queue);
+  const auto window_stats = window_queue.GetStats();
+  ASSERT_EQUAL(window_stats.request_count, 1000u);
+  ASSERT_EQUAL(SumBucketRequests(window_stats), 1000u);
+  ASSERT(window_stats.no_result_count <= 1000u);
+}
+
+// Requests leave the statistics as they get older than the time window, the newer ones
+// stay. Producer threads expire the requests as well as readers
+void TestRequestQueueTimeWindow() {
+  SearchServer search_server("and in"s);
+  search_server.AddDocument(1, "white cat"s, DocumentStatus::ACTUAL, {1});
+  RequestQueueOptions options;
+  options.time_window = chrono::milliseconds(300);
+  RequestQueue request_queue(search_server, options);
+  for (int i = 0; i < 5; ++i) {
+    request_queue.AddFindRequest("dog"s);
+  }
+  ASSERT_EQUAL(request_queue.GetNoResultRequests(), 5);
+  this_thread::sleep_for(chrono::milliseconds(200));
+  for (int i = 0; i < 3; ++i) {
+    request_queue.AddFindRequest("cat"s);
+  }
+  ASSERT_EQUAL(request_queue.GetStats().request_count, 8u);
+
+  this_thread::sleep_for(chrono::milliseconds(200));
+  request_queue.AddFindRequest("dog"s);
+  const auto stats = request_queue.GetStats();
+  ASSERT_EQUAL(stats.request_count, 4u);
+  ASSERT_EQUAL(stats.no_result_count, 1u);
+  ASSERT_EQUAL(SumBucketRequests(stats), 4u);
+
+  this_thread::sleep_for(chrono::milliseconds(400));
+  ASSERT_EQUAL(request_queue.GetStats().request_count, 0u);
+  ASSERT_EQUAL(request_queue.GetNoResultRequests(), 0);
+
+  // Requests expire while other producers hold tickets of slots they haven't written yet,
+  // none of them is passed over and kept for good
+  options.time_window = chrono::microseconds(200);
+  options.request_window = 64;
+  RequestQueue short_queue(search_server, options);
+  vector<thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&short_queue] {
+      for (int i = 0; i < 5000; ++i) {
+        short_queue.AddFindRequest(i % 2 == 0 ? "dog"s : "cat"s);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  this_thread::sleep_for(chrono::milliseconds(10));
+  const auto short_stats = short_queue.GetStats();
+  ASSERT_EQUAL(short_stats.request_count, 0u);
+  ASSERT_EQUAL(short_stats.no_result_count, 0u);
+  ASSERT_EQUAL(SumBucketRequests(short_stats), 0u);
+}
+
+void AddDuplicateDocuments(SearchServer& search_server) {
+  search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+  search_server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+  // Same words
+  search_server.AddDocument(3, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+  // Only stop words differ
+  search_server.AddDocument(4, "funny pet and curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+  // Repeated words make no difference
+  search_server.AddDocument(5, "funny funny pet and nasty nasty rat"s, DocumentStatus::ACTUAL,
+                            {1, 2});
+  search_server.AddDocument(6, "funny pet and not very nasty rat"s, DocumentStatus::ACTUAL, {1});
+  // Same words in another order
+  search_server.AddDocument(7, "very nasty rat and not very funny pet"s, DocumentStatus::ACTUAL,
+                            {1, 2});
+  search_server.AddDocument(8, "pet with rat and rat and rat"s, DocumentStatus::ACTUAL, {1, 2});
+  search_server.AddDocument(9, "nasty rat with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+}
+
+// Text of the words from first to last of the common vocabulary and the extra words
+string MakeWordRange(int first, int last, const string& extra = {}) {
+  string text = extra;
+  for (int i = first; i < last; ++i) {
+    text += " w"s + to_string(i);
+  }
+  return text;
+}
+
+void TestFindDuplicates() {
+  SearchServer search_server("and with"s);
+  AddDuplicateDocuments(search_server);
+  ASSERT_EQUAL(FindDuplicates(search_server), (vector<int>{3, 4, 5, 7}));
+  ASSERT_EQUAL(FindDuplicates(execution::par, search_server), (vector<int>{3, 4, 5, 7}));
+
+  // The Jaccard threshold is exact for the candidate pairs, one band row per hash makes
+  // every pair with a common word a candidate almost surely
+  SearchServer near_server("and with"s);
+  near_server.AddDocument(10, MakeWordRange(0, 20), DocumentStatus::ACTUAL, {1});
+  // 19 common words of 21
+  near_server.AddDocument(11, MakeWordRange(0, 19, "x"s), DocumentStatus::ACTUAL, {1});
+  // 14 common words of 26
+  near_server.AddDocument(12, MakeWordRange(6, 20, "y z u v t s"s), DocumentStatus::ACTUAL, {1});
+  DuplicateOptions options;
+  options.band_count = 32;
+  options.band_size = 1;
+  options.jaccard_threshold = 19.0 / 21;
+  ASSERT_EQUAL(FindDuplicates(near_server, options), vector<int>{11});
+  options.jaccard_threshold = 19.0 / 21 + 1e-9;
+  ASSERT_EQUAL(FindDuplicates(near_server, options), vector<int>{});
+  options.jaccard_threshold = 0.5;
+  ASSERT_EQUAL(FindDuplicates(near_server, options), (vector<int>{11, 12}));
+  ASSERT_EQUAL(FindDuplicates(execution::par, near_server, options), (vector<int>{11, 12}));
+  // Exact duplicates are found in near mode as well
+  options.jaccard_threshold = 0.95;
+  ASSERT_EQUAL(FindDuplicates(search_server, options), (vector<int>{3, 4, 5, 7}));
+
+  // Hundreds of documents with equal bands: each is compared with the first one of its
+  // buckets, the first one is kept of the group
+  SearchServer group_server("and with"s);
+  for (int id = 0; id < 500; ++id) {
+    group_server.AddDocument(id, MakeWordRange(0, 20, "u"s + to_string(id)),
+                             DocumentStatus::ACTUAL, {1});
+  }
+  group_server.AddDocument(500, MakeWordRange(100, 120), DocumentStatus::ACTUAL, {1});
+  vector<int> expected(499);
+  iota(expected.begin(), expected.end(), 1);
+  ASSERT_EQUAL(FindDuplicates(group_server, {0.8}), expected);
+}
+
+// The duplicates are reported in increasing id order and removed, the kept documents stay
+// searchable
+void TestRemoveDuplicates() {
+  SearchServer search_server("and with"s);
+  AddDuplicateDocuments(search_server);
+  ostringstream output;
+  auto* const old_buffer = cout.rdbuf(output.rdbuf());
+  RemoveDuplicates(search_server);
+  cout.rdbuf(old_buffer);
+  ASSERT_EQUAL(output.str(), "Found duplicate document id 3\nFound duplicate document id 4\n"
+                             "Found duplicate document id 5\nFound duplicate document id 7\n"s);
+  ASSERT_EQUAL(vector<int>(search_server.begin(), search_server.end()),
+               (vector<int>{1, 2, 6, 8, 9}));
+  ASSERT_EQUAL(search_server.GetDocumentCount(), 5);
+  ASSERT_EQUAL(GetIds(search_server.FindTopDocuments("curly"s)), (vector<int>{2, 9}));
+  ASSERT(FindDuplicates(search_server).empty());
+}
+
+}  // namespace
+
+void TestSearchServer() {
+  TestRunner tr;
+  RUN_TEST(tr, TestPackRoundTrip);
+  RUN_TEST(tr, TestKernelEquivalence);
+  RUN_TEST(tr, TestPostingListBlocks);
+  RUN_TEST(tr, TestPrunedEvaluation);
+  RUN_TEST(tr, TestBm25Relevance);
+  RUN_TEST(tr, TestConcurrentHashMapChurn);
+  RUN_TEST(tr, TestConcurrentMapsContention);
+  RUN_TEST(tr, TestIndexFileRoundTrip);
+  RUN_TEST(tr, TestIndexFileRejectsDamagedFiles);
+  RUN_TEST(tr, TestQueriesDuringMerges);
+  RUN_TEST(tr, TestQueryResultCacheGenerations);
+  RUN_TEST(tr, TestScoreAccumulatorRelease);
+  RUN_TEST(tr, TestScoreAccumulatorPool);
+  RUN_TEST(tr, TestProcessQueries);
+  RUN_TEST(tr, TestPhraseQueries);
+  RUN_TEST(tr, TestPrefixQueries);
+  RUN_TEST(tr, TestRequiredWords);
+  RUN_TEST(tr, TestTermDictionary);
+  RUN_TEST(tr, TestWordFrequenciesOutliveText);
+  RUN_TEST(tr, TestTopDocumentsSelection);
+  RUN_TEST(tr, TestResultCountAndOrder);
+  RUN_TEST(tr, TestDocumentTable);
+  RUN_TEST(tr, TestAddDocumentsErrors);
+  RUN_TEST(tr, TestRemoveDocuments);
+  RUN_TEST(tr, TestRemovedPostingsCompaction);
+  RUN_TEST(tr, TestTokenizerKernelEquivalence);
+  RUN_TEST(tr, TestStopWordFilter);
+  RUN_TEST(tr, TestPreparedQueryReuse);
+  RUN_TEST(tr, TestSmallVectorSpill);
+  RUN_TEST(tr, TestWorkStealingPool);
+  RUN_TEST(tr, TestProcessQueriesConcurrently);
+  RUN_TEST(tr, TestFindTopDocumentsBatch);
+  RUN_TEST(tr, TestImpactScoring);
+  RUN_TEST(tr, TestRequestQueueProducers);
+  RUN_TEST(tr, TestRequestQueueTimeWindow);
+  RUN_TEST(tr, TestFindDuplicates);
+  RUN_TEST(tr, TestRemoveDuplicates);
+}
@@ -0,0 +1,4 @@
+﻿#pragma once
+
+// Unit tests of the index and the queries, a failed test terminates the program
+void TestSearchServer();
@@ -0,0 +1,61 @@
+﻿#include "top_documents.h"
+#include <algorithm>
+#include <cmath>
+
+TopDocuments::TopDocuments(size_t max_count) : max_count_(max_count) {
+  heap_.reserve(max_count_);
+}
+
+bool TopDocuments::IsBetter(const Document& lhs, const Document& rhs) {
+  if (std::abs(lhs.relevance - rhs.relevance) < eps) {
+    if (lhs.rating == rhs.rating) {
+      return lhs.id < rhs.id;
+    }
+    return lhs.rating > rhs.rating;
+  }
+  return lhs.relevance > rhs.relevance;
+}
+
+void TopDocuments::Add(const Document& document) {
+  if (heap_.size() < max_count_) {
+    heap_.push_back(document);
+    std::push_heap(heap_.begin(), heap_.end(), IsBetter);
+  } else if (max_count_ > 0 && IsBetter(document, heap_.front())) {
+    std::pop_heap(heap_.begin(), heap_.end(), IsBetter);
+    heap_.back() = document;
+    std::push_heap(heap_.begin(), heap_.end(), IsBetter);
+  }
+}
+
+void TopDocuments::Merge(const TopDocuments& other) {
+  for (const auto& document : other.heap_) {
+    Add(document);
+  }
+}
+
+size_t TopDocuments::size() const {
+  return heap_.size();
+}
+
+bool TopDocuments::IsFull() const {
+  return heap_.size() == max_count_;
+}
+
+const Document& TopDocuments::GetWorst() const {
+  return heap_.front();
+}
+
+std::vector<Document> TopDocuments::Extract() {
+  std::vector<Document> result = std::move(heap_);
+  heap_.clear();
+  std::sort(result.begin(), result.end(), IsBetter);
+  return result;
+}
+
+size_t TopDocuments::ExtractTo(Document* output) {
+  std::sort(heap_.begin(), heap_.end(), IsBetter);
+  std::copy(heap_.begin(), heap_.end(), output);
+  const size_t count = heap_.size();
+  heap_.clear();
+  return count;
+}
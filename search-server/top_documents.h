@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "document.h"
+
+constexpr double eps = 1e-6;
+
+// Keeps the best max_count documents seen so far in a bounded heap
+class TopDocuments {
+ public:
+  explicit TopDocuments(size_t max_count);
+
+  // Relevances closer than eps are ordered by rating, then by id
+  static bool IsBetter(const Document& lhs, const Document& rhs);
+
+  void Add(const Document& document);
+
+  void Merge(const TopDocuments& other);
+
+  size_t size() const;
+
+  bool IsFull() const;
+
+  // The worst document kept so far, valid only when the heap is not empty
+  const Document& GetWorst() const;
+
+  // Returns the documents from the best to the worst
+  std::vector<Document> Extract();
+
+  // Writes the documents from the best to the worst and returns their number,
+  // the storage of the heap is kept for reuse
+  size_t ExtractTo(Document* output);
+
+ private:
+  size_t max_count_;
+  std::vector<Document> heap_;
+};
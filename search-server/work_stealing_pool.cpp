@@ -0,0 +1,147 @@
+﻿#include "work_stealing_pool.h"
+#include <utility>
+
+WorkStealingPool::WorkStealingPool(size_t thread_count)
+    : thread_count_(std::max<size_t>(thread_count, 1)) {
+  threads_.reserve(thread_count_ - 1);
+  for (size_t worker = 1; worker < thread_count_; ++worker) {
+    threads_.emplace_back([this, worker] { RunWorker(worker); });
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard guard(mutex_);
+    is_stopping_ = true;
+  }
+  start_condition_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+size_t WorkStealingPool::GetThreadCount() const {
+  return thread_count_;
+}
+
+uint64_t WorkStealingPool::PackRange(size_t begin, size_t end) {
+  return static_cast<uint64_t>(end) << 32 | begin;
+}
+
+void WorkStealingPool::Run(size_t count, const LoopTask& task) {
+  for (size_t first = 0; first < count; first += MAX_LOOP_SIZE) {
+    RunLoop(first, std::min(count - first, MAX_LOOP_SIZE), task);
+  }
+}
+
+void WorkStealingPool::RunLoop(size_t first, size_t count, const LoopTask& task) {
+  Loop loop;
+  loop.task = &task;
+  loop.first = first;
+  loop.ranges = std::make_unique<Range[]>(thread_count_);
+  for (size_t range = 0; range < thread_count_; ++range) {
+    loop.ranges[range].bounds.store(PackRange(count * range / thread_count_,
+                                              count * (range + 1) / thread_count_),
+                                    std::memory_order_relaxed);
+  }
+  loop.has_joined.assign(thread_count_, false);
+  {
+    std::lock_guard guard(mutex_);
+    loops_.push_back(&loop);
+  }
+  start_condition_.notify_all();
+
+  Work(loop, 0);
+
+  std::unique_lock lock(mutex_);
+  done_condition_.wait(lock, [&loop] { return loop.busy_workers == 0; });
+  loops_.erase(std::find(loops_.begin(), loops_.end(), &loop));
+  if (loop.error) {
+    std::rethrow_exception(loop.error);
+  }
+}
+
+void WorkStealingPool::RunWorker(size_t worker) {
+  std::unique_lock lock(mutex_);
+  while (true) {
+    Loop* loop = nullptr;
+    start_condition_.wait(lock, [&] {
+      return is_stopping_ || (loop = FindLoop(worker)) != nullptr;
+    });
+    if (is_stopping_) {
+      return;
+    }
+    loop->has_joined[worker] = true;
+    ++loop->busy_workers;
+    lock.unlock();
+    Work(*loop, worker);
+    lock.lock();
+    if (--loop->busy_workers == 0) {
+      done_condition_.notify_all();
+    }
+  }
+}
+
+WorkStealingPool::Loop* WorkStealingPool::FindLoop(size_t worker) const {
+  for (Loop* loop : loops_) {
+    if (!loop->has_joined[worker]) {
+      return loop;
+    }
+  }
+  return nullptr;
+}
+
+void WorkStealingPool::Work(Loop& loop, size_t range) {
+  size_t index;
+  while (TakeOwn(loop.ranges[range], index) || Steal(loop, range, index)) {
+    if (loop.has_error.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    try {
+      (*loop.task)(loop.first + index);
+    } catch (...) {
+      std::lock_guard guard(mutex_);
+      if (!loop.error) {
+        loop.error = std::current_exception();
+      }
+      loop.has_error.store(true, std::memory_order_relaxed);
+    }
+  }
+}
+
+bool WorkStealingPool::TakeOwn(Range& range, size_t& index) {
+  uint64_t bounds = range.bounds.load(std::memory_order_relaxed);
+  do {
+    const auto begin = static_cast<uint32_t>(bounds);
+    const auto end = static_cast<uint32_t>(bounds >> 32);
+    if (begin == end) {
+      return false;
+    }
+    index = begin;
+  } while (!range.bounds.compare_exchange_weak(bounds, bounds + 1, std::memory_order_relaxed));
+  return true;
+}
+
+bool WorkStealingPool::Steal(Loop& loop, size_t range, size_t& index) const {
+  for (size_t offset = 1; offset < thread_count_; ++offset) {
+    Range& victim = loop.ranges[(range + offset) % thread_count_];
+    uint64_t bounds = victim.bounds.load(std::memory_order_relaxed);
+    while (true) {
+      const auto begin = static_cast<uint32_t>(bounds);
+      const auto end = static_cast<uint32_t>(bounds >> 32);
+      if (begin == end) {
+        break;
+      }
+      const size_t middle = begin + (end - begin) / 2;
+      if (victim.bounds.compare_exchange_weak(bounds, PackRange(begin, middle),
+                                              std::memory_order_relaxed)) {
+        // Nobody steals from an empty range, so the own one is written as is. Iterations
+        // never return to a range, so a thief can't mistake the new bounds for old ones
+        loop.ranges[range].bounds.store(PackRange(middle + 1, end), std::memory_order_relaxed);
+        index = middle;
+        return true;
+      }
+    }
+  }
+  return false;
+}
@@ -0,0 +1,98 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads for parallel loops. Every thread starts on its own share of the
+// iterations and, once it runs out, steals the upper half of what another thread has left,
+// so uneven iterations keep all threads busy without a shared queue. A share is one atomic
+// word, so taking and stealing iterations never locks
+class WorkStealingPool {
+ public:
+  // The calling thread of ParallelFor is one of the threads
+  explicit WorkStealingPool(size_t thread_count = std::max(1u,
+                                                           std::thread::hardware_concurrency()));
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  ~WorkStealingPool();
+
+  size_t GetThreadCount() const;
+
+  // Calls task(i) for every i below count and returns when all calls are done.
+  // The first exception of a task is rethrown after the loop, the iterations left are skipped.
+  // Any number of threads may run loops at once, tasks may run loops too: idle pool threads
+  // join the running loops and the calling thread always works on its own loop
+  template <typename Task>
+  void ParallelFor(size_t count, Task task);
+
+ private:
+  static constexpr size_t CACHE_LINE_SIZE = 64;
+  // Bounds of a share take half of a word each
+  static constexpr size_t MAX_LOOP_SIZE = UINT32_MAX;
+
+  using LoopTask = std::function<void(size_t)>;
+
+  // Iterations [begin, end) left to a thread, begin in the low half of the word
+  struct alignas(CACHE_LINE_SIZE) Range {
+    std::atomic<uint64_t> bounds{0};
+  };
+
+  struct Loop {
+    const LoopTask* task;
+    // Added to the iterations of the ranges
+    size_t first;
+    // Range 0 belongs to the calling thread, range i to pool thread i
+    std::unique_ptr<Range[]> ranges;
+    // Guarded by mutex_. Pool threads join a loop once, they leave when it has no
+    // iterations left
+    std::vector<bool> has_joined;
+    size_t busy_workers = 0;
+    std::exception_ptr error;
+    std::atomic<bool> has_error = false;
+  };
+
+  static uint64_t PackRange(size_t begin, size_t end);
+
+  void Run(size_t count, const LoopTask& task);
+
+  void RunLoop(size_t first, size_t count, const LoopTask& task);
+
+  void RunWorker(size_t worker);
+
+  // A running loop the worker hasn't joined, nullptr if there is none. Requires mutex_
+  Loop* FindLoop(size_t worker) const;
+
+  // Runs iterations of the loop until no thread has any left
+  void Work(Loop& loop, size_t range);
+
+  static bool TakeOwn(Range& range, size_t& index);
+
+  bool Steal(Loop& loop, size_t range, size_t& index) const;
+
+  const size_t thread_count_;
+  std::vector<std::thread> threads_;
+
+  // Guards the fields below and the bookkeeping of the loops
+  std::mutex mutex_;
+  std::condition_variable start_condition_;
+  std::condition_variable done_condition_;
+  std::vector<Loop*> loops_;
+  bool is_stopping_ = false;
+};
+
+template <typename Task>
+void WorkStealingPool::ParallelFor(size_t count, Task task) {
+  Run(count, LoopTask(std::ref(task)));
+}